@@ -19,7 +19,7 @@ void usage(std::ostream& out, std::string_view filename)
   out << "USAGE: " << filename << " [options]" << std::endl;
   out << std::endl;
   out << "OPTIONS:" << std::endl;
-  out << "    -f FORMAT      output format ('text', 'json')" << std::endl;
+  out << "    -f FORMAT      output format ('text', 'json', 'binary')" << std::endl;
   out << "    -o file        redirect bpftrace output to file" << std::endl;
   out << "    -q,            keep messages quiet" << std::endl;
   out << "    -v,            verbose messages" << std::endl;
@@ -51,9 +51,11 @@ std::unique_ptr<Output> prepare_output(const std::string& output_file,
     output = std::make_unique<TextOutput>(*os);
   } else if (output_format == "json") {
     output = std::make_unique<JsonOutput>(*os);
+  } else if (output_format == "binary") {
+    output = std::make_unique<BinaryOutput>(*os);
   } else {
     LOG(ERROR) << "Invalid output format \"" << output_format << "\"\n"
-               << "Valid formats: 'text', 'json'";
+               << "Valid formats: 'text', 'json', 'binary'";
     return nullptr;
   }
 
@@ -349,9 +349,10 @@ DIGlobalVariableExpression *DIBuilderBPF::createMapEntry(
     libbpf::bpf_map_type map_type,
     uint64_t max_entries,
     DIType *key_type,
-    const SizedType &value_type)
+    const SizedType &value_type,
+    uint32_t map_flags)
 {
-  SmallVector<Metadata *, 4> fields = {
+  SmallVector<Metadata *, 5> fields = {
     createPointerMemberType("type", 0, GetMapFieldInt(map_type)),
     createPointerMemberType("max_entries", 64, GetMapFieldInt(max_entries)),
   };
@@ -364,6 +365,11 @@ DIGlobalVariableExpression *DIBuilderBPF::createMapEntry(
         "value", size + 64, createPointerType(GetType(value_type), 64)));
     size += 128;
   }
+  if (map_flags) {
+    fields.push_back(
+        createPointerMemberType("map_flags", size, GetMapFieldInt(map_flags)));
+    size += 64;
+  }
 
   DIType *map_entry_type = createStructType(file,
                                             "",
@@ -48,7 +48,8 @@ public:
                                              libbpf::bpf_map_type map_type,
                                              uint64_t max_entries,
                                              DIType *key_type,
-                                             const SizedType &value_type);
+                                             const SizedType &value_type,
+                                             uint32_t map_flags = 0);
   DIGlobalVariableExpression *createGlobalVariable(std::string_view name,
                                                    const SizedType &stype);
 
@@ -2143,6 +2143,11 @@ void IRBuilderBPF::CreateRingbufOutput(Value *data,
                                        size_t size,
                                        const Location &loc)
 {
+  if (bpftrace_.config_->ringbuf_cpus_per_buffer > 0) {
+    CreateRingbufArrayOutput(data, size, loc);
+    return;
+  }
+
   Value *map_ptr = GetMapVar(to_string(MapType::Ringbuf));
 
   // long bpf_ringbuf_output(void *ringbuf, void *data, u64 size, u64 flags)
@@ -2153,7 +2158,10 @@ void IRBuilderBPF::CreateRingbufOutput(Value *data,
 
   Value *ret = CreateHelperCall(libbpf::BPF_FUNC_ringbuf_output,
                                 ringbuf_output_func_type,
-                                { map_ptr, data, getInt64(size), getInt64(0) },
+                                { map_ptr,
+                                  data,
+                                  getInt64(size),
+                                  CreateRingbufWakeupFlags(map_ptr, loc) },
                                 "ringbuf_output",
                                 loc);
 
@@ -2175,11 +2183,136 @@ void IRBuilderBPF::CreateRingbufOutput(Value *data,
   SetInsertPoint(merge_block);
 }
 
+// Ring buffers are looked up in an array of maps indexed by the current CPU
+// divided by the number of CPUs sharing a buffer. Losses are counted
+// per-buffer, using the same index in the event loss counter map.
+void IRBuilderBPF::CreateRingbufArrayOutput(Value *data,
+                                            size_t size,
+                                            const Location &loc)
+{
+  Value *cpu = CreateGetCpuId(loc);
+  Value *idx = CreateIntCast(
+      CreateUDiv(cpu, getInt64(bpftrace_.config_->ringbuf_cpus_per_buffer)),
+      getInt32Ty(),
+      false);
+
+  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "ringbuf_key");
+  CreateStore(idx, key);
+  CallInst *map_ptr = createMapLookup(to_string(MapType::RingbufArray), key);
+  CreateLifetimeEnd(key);
+
+  llvm::Function *parent = GetInsertBlock()->getParent();
+  BasicBlock *output_block = BasicBlock::Create(module_.getContext(),
+                                                "ringbuf_output",
+                                                parent);
+  BasicBlock *loss_block = BasicBlock::Create(module_.getContext(),
+                                              "event_loss_counter",
+                                              parent);
+  BasicBlock *merge_block = BasicBlock::Create(module_.getContext(),
+                                               "counter_merge",
+                                               parent);
+  Value *found = CreateICmpNE(CreateIntCast(map_ptr, getPtrTy(), true),
+                              GetNull(),
+                              "ringbuf_found");
+  CreateCondBr(found, output_block, loss_block);
+
+  SetInsertPoint(output_block);
+  // long bpf_ringbuf_output(void *ringbuf, void *data, u64 size, u64 flags)
+  FunctionType *ringbuf_output_func_type = FunctionType::get(
+      getInt64Ty(),
+      { map_ptr->getType(), data->getType(), getInt64Ty(), getInt64Ty() },
+      false);
+
+  Value *ret = CreateHelperCall(libbpf::BPF_FUNC_ringbuf_output,
+                                ringbuf_output_func_type,
+                                { map_ptr,
+                                  data,
+                                  getInt64(size),
+                                  CreateRingbufWakeupFlags(map_ptr, loc) },
+                                "ringbuf_output",
+                                loc);
+  Value *condition = CreateICmpSLT(ret, getInt64(0), "ringbuf_loss");
+  CreateCondBr(condition, loss_block, merge_block);
+
+  SetInsertPoint(loss_block);
+  CreateAtomicIncCounter(to_string(MapType::EventLossCounter), idx);
+  CreateBr(merge_block);
+
+  SetInsertPoint(merge_block);
+}
+
+// By default, every ring buffer output wakes up user space. With the
+// ringbuf_wakeup_batch config option, only every Nth event on each CPU (or an
+// event which finds the buffer at least half full) wakes it up and the rest
+// are picked up by the periodic poll in user space.
+Value *IRBuilderBPF::CreateRingbufWakeupFlags(Value *ringbuf,
+                                              const Location &loc)
+{
+  uint64_t batch = bpftrace_.config_->ringbuf_wakeup_batch;
+  if (batch == 0)
+    return getInt64(0);
+
+  AllocaInst *wakeup = CreateAllocaBPF(getInt64Ty(), "ringbuf_wakeup");
+  CreateStore(getInt64(1), wakeup);
+
+  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "key");
+  CreateStore(getInt32(0), key);
+  CallInst *counter = createMapLookup(to_string(MapType::RingbufWakeup), key);
+  CreateLifetimeEnd(key);
+
+  llvm::Function *parent = GetInsertBlock()->getParent();
+  BasicBlock *counter_block = BasicBlock::Create(module_.getContext(),
+                                                 "wakeup_counter",
+                                                 parent);
+  BasicBlock *merge_block = BasicBlock::Create(module_.getContext(),
+                                               "wakeup_merge",
+                                               parent);
+  Value *found = CreateICmpNE(CreateIntCast(counter, getPtrTy(), true),
+                              GetNull(),
+                              "wakeup_counter_found");
+  CreateCondBr(found, counter_block, merge_block);
+
+  // The counter map is per-CPU, no atomics needed
+  SetInsertPoint(counter_block);
+  Value *count = CreateAdd(CreateLoad(getInt64Ty(), counter), getInt64(1));
+  Value *batch_full = CreateICmpUGE(count, getInt64(batch), "batch_full");
+  CreateStore(CreateSelect(batch_full, getInt64(0), count), counter);
+  CreateStore(CreateIntCast(batch_full, getInt64Ty(), false), wakeup);
+  CreateBr(merge_block);
+
+  SetInsertPoint(merge_block);
+  // u64 bpf_ringbuf_query(void *ringbuf, u64 flags)
+  FunctionType *ringbuf_query_func_type = FunctionType::get(
+      getInt64Ty(), { ringbuf->getType(), getInt64Ty() }, false);
+  Value *avail = CreateHelperCall(libbpf::BPF_FUNC_ringbuf_query,
+                                  ringbuf_query_func_type,
+                                  { ringbuf, getInt64(BPF_RB_AVAIL_DATA) },
+                                  "ringbuf_query",
+                                  loc);
+  uint64_t watermark = bpftrace_.config_->perf_rb_pages * 4096 / 2;
+  Value *above_watermark = CreateICmpUGE(avail,
+                                         getInt64(watermark),
+                                         "above_watermark");
+  Value *force = CreateOr(
+      CreateICmpNE(CreateLoad(getInt64Ty(), wakeup), getInt64(0)),
+      above_watermark);
+  CreateLifetimeEnd(wakeup);
+  return CreateSelect(force,
+                      getInt64(BPF_RB_FORCE_WAKEUP),
+                      getInt64(BPF_RB_NO_WAKEUP));
+}
+
 void IRBuilderBPF::CreateAtomicIncCounter(const std::string &map_name,
                                           uint32_t idx)
+{
+  CreateAtomicIncCounter(map_name, getInt32(idx));
+}
+
+void IRBuilderBPF::CreateAtomicIncCounter(const std::string &map_name,
+                                          Value *idx)
 {
   AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "key");
-  CreateStore(getInt32(idx), key);
+  CreateStore(idx, key);
 
   CallInst *call = createMapLookup(map_name, key);
   llvm::Function *parent = GetInsertBlock()->getParent();
@@ -2269,6 +2402,62 @@ void IRBuilderBPF::CreatePerCpuMapElemAdd(Value *ctx,
   CreateLifetimeEnd(value);
 }
 
+void IRBuilderBPF::CreatePerCpuMapElemArrayAdd(Value *ctx,
+                                               Map &map,
+                                               Value *key,
+                                               Value *index,
+                                               const SizedType &value_type,
+                                               Value *val,
+                                               const Location &loc)
+{
+  assert(value_type.IsArrayTy());
+  llvm::Type *array_type = GetType(value_type);
+
+  llvm::Function *parent = GetInsertBlock()->getParent();
+  BasicBlock *in_bounds_block = BasicBlock::Create(module_.getContext(),
+                                                   "index_in_bounds",
+                                                   parent);
+  BasicBlock *lookup_success_block = BasicBlock::Create(module_.getContext(),
+                                                        "lookup_success",
+                                                        parent);
+  BasicBlock *lookup_failure_block = BasicBlock::Create(module_.getContext(),
+                                                        "lookup_failure",
+                                                        parent);
+  BasicBlock *lookup_merge_block = BasicBlock::Create(module_.getContext(),
+                                                      "lookup_merge",
+                                                      parent);
+
+  // The verifier only allows variable offsets into the value with known
+  // bounds
+  CreateCondBr(CreateICmpULT(index, getInt64(value_type.GetNumElements())),
+               in_bounds_block,
+               lookup_merge_block);
+
+  SetInsertPoint(in_bounds_block);
+  CallInst *call = CreateMapLookup(map, key);
+  Value *condition = CreateICmpNE(call, GetNull(), "map_lookup_cond");
+  CreateCondBr(condition, lookup_success_block, lookup_failure_block);
+
+  // Each CPU has its own copy of the value, so no atomic add is needed
+  SetInsertPoint(lookup_success_block);
+  Value *elem = CreateGEP(array_type, call, { getInt64(0), index });
+  CreateStore(CreateAdd(CreateLoad(getInt64Ty(), elem), val), elem);
+  CreateBr(lookup_merge_block);
+
+  SetInsertPoint(lookup_failure_block);
+  Value *init_value = CreateWriteMapValueAllocation(value_type,
+                                                    "initial_value",
+                                                    loc);
+  CreateMemsetBPF(init_value, getInt8(0), value_type.GetSize());
+  CreateStore(val, CreateGEP(array_type, init_value, { getInt64(0), index }));
+  CreateMapUpdateElem(ctx, map.ident, key, init_value, loc, BPF_ANY);
+  if (dyn_cast<AllocaInst>(init_value))
+    CreateLifetimeEnd(init_value);
+  CreateBr(lookup_merge_block);
+
+  SetInsertPoint(lookup_merge_block);
+}
+
 void IRBuilderBPF::CreatePerfEventOutput(Value *ctx,
                                          Value *data,
                                          size_t size,
@@ -182,6 +182,7 @@ public:
                             const Location &loc);
   void CreateOutput(Value *ctx, Value *data, size_t size, const Location &loc);
   void CreateAtomicIncCounter(const std::string &map_name, uint32_t idx);
+  void CreateAtomicIncCounter(const std::string &map_name, Value *idx);
   void CreatePerCpuMapElemInit(Value *ctx,
                                Map &map,
                                Value *key,
@@ -192,6 +193,15 @@ public:
                               Value *key,
                               Value *val,
                               const Location &loc);
+  // Adds `val` to element `index` of an array-valued map element, creating
+  // the element zeroed if it doesn't exist. Out of bounds indexes are ignored.
+  void CreatePerCpuMapElemArrayAdd(Value *ctx,
+                                   Map &map,
+                                   Value *key,
+                                   Value *index,
+                                   const SizedType &value_type,
+                                   Value *val,
+                                   const Location &loc);
   void CreateDebugOutput(std::string fmt_str,
                          const std::vector<Value *> &values,
                          const Location &loc);
@@ -332,6 +342,10 @@ private:
   llvm::Type *getKernelPointerStorageTy();
   llvm::Type *getUserPointerStorageTy();
   void CreateRingbufOutput(Value *data, size_t size, const Location &loc);
+  void CreateRingbufArrayOutput(Value *data,
+                                size_t size,
+                                const Location &loc);
+  Value *CreateRingbufWakeupFlags(Value *ringbuf, const Location &loc);
   void CreatePerfEventOutput(Value *ctx,
                              Value *data,
                              size_t size,
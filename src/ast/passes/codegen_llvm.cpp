@@ -234,7 +234,7 @@ private:
                               const std::string &call_name,
                               AsyncAction async_action);
 
-  void createPrintMapCall(Call &call);
+  void createPrintMapCall(Call &call, bool clear = false);
   void createPrintNonMapCall(Call &call, int id);
   void createJoinCall(Call &call, int id);
 
@@ -242,7 +242,8 @@ private:
                            libbpf::bpf_map_type map_type,
                            uint64_t max_entries,
                            const SizedType &key_type,
-                           const SizedType &value_type);
+                           const SizedType &value_type,
+                           uint32_t map_flags = 0);
   Value *createTuple(
       const SizedType &tuple_type,
       const std::vector<std::pair<llvm::Value *, Location>> &vals,
@@ -287,6 +288,11 @@ private:
 
   llvm::Function *createLog2Function();
   llvm::Function *createLinearFunction();
+  // Counts an occurrence of `bucket` for the key of a hist()/lhist() map
+  void createHistIncrement(Map &map,
+                           Expression &key_expr,
+                           Value *bucket,
+                           const Location &loc);
   MDNode *createLoopMetadata();
 
   std::pair<ScopedExpr, uint64_t> getString(Expression &expr);
@@ -1016,10 +1022,7 @@ ScopedExpr CodegenLLVM::visit(Call &call)
                                    b_.getInt64Ty(),
                                    call.vargs.at(2).type().IsSigned());
     Value *log2 = b_.CreateCall(log2_func_, { expr, k }, "log2");
-    ScopedExpr scoped_key = getMultiMapKey(
-        map, call.vargs.at(1), { log2 }, call.loc);
-    b_.CreatePerCpuMapElemAdd(
-        ctx_, map, scoped_key.value(), b_.getInt64(1), call.loc);
+    createHistIncrement(map, call.vargs.at(1), log2, call.loc);
 
     return ScopedExpr();
 
@@ -1057,10 +1060,7 @@ ScopedExpr CodegenLLVM::visit(Call &call)
                                   { value, min, max, step },
                                   "linear");
 
-    ScopedExpr scoped_key = getMultiMapKey(
-        map, call.vargs.at(1), { linear }, call.loc);
-    b_.CreatePerCpuMapElemAdd(
-        ctx_, map, scoped_key.value(), b_.getInt64(1), call.loc);
+    createHistIncrement(map, call.vargs.at(1), linear, call.loc);
 
     return ScopedExpr();
 
@@ -2976,10 +2976,40 @@ ScopedExpr CodegenLLVM::visit(Predicate &pred)
   return ScopedExpr(cmp_value);
 }
 
+// Returns the call if `stmt` is a call of `func` on a map, e.g. `clear(@x)`
+static Call *mapCallStatement(Statement &stmt, std::string_view func)
+{
+  auto *expr_stmt = stmt.as<ExprStatement>();
+  if (!expr_stmt)
+    return nullptr;
+  auto *call = expr_stmt->expr.as<Call>();
+  if (!call || call->func != func || call->vargs.empty() ||
+      !call->vargs.at(0).is<Map>())
+    return nullptr;
+  return call;
+}
+
 ScopedExpr CodegenLLVM::visit(Block &block)
 {
   scope_stack_.push_back(&block);
-  visit(block.stmts);
+  for (size_t i = 0; i < block.stmts.size(); i++) {
+    // With fuse_print_clear, `print(@x); clear(@x);` is sent as a single
+    // event, so that user space can delete each element as it reads it,
+    // instead of clearing the map after the print and losing the updates made
+    // in between
+    if (bpftrace_.config_->fuse_print_clear && i + 1 < block.stmts.size()) {
+      auto *print = mapCallStatement(block.stmts[i], "print");
+      auto *clear = mapCallStatement(block.stmts[i + 1], "clear");
+      if (print && clear &&
+          print->vargs.at(0).as<Map>()->ident ==
+              clear->vargs.at(0).as<Map>()->ident) {
+        createPrintMapCall(*print, true);
+        i++;
+        continue;
+      }
+    }
+    visit(block.stmts[i]);
+  }
   ScopedExpr value = visit(block.expr);
   scope_stack_.pop_back();
 
@@ -3656,6 +3686,28 @@ llvm::Function *CodegenLLVM::createLog2Function()
   return module_->getFunction("log2");
 }
 
+void CodegenLLVM::createHistIncrement(Map &map,
+                                      Expression &key_expr,
+                                      Value *bucket,
+                                      const Location &loc)
+{
+  const auto &map_info = bpftrace_.resources.maps_info.at(map.ident);
+  if (map_info.dense_hist) {
+    ScopedExpr scoped_key = getMultiMapKey(map, key_expr, {}, loc);
+    b_.CreatePerCpuMapElemArrayAdd(ctx_,
+                                   map,
+                                   scoped_key.value(),
+                                   bucket,
+                                   map_info.dense_hist_type(),
+                                   b_.getInt64(1),
+                                   loc);
+    return;
+  }
+
+  ScopedExpr scoped_key = getMultiMapKey(map, key_expr, { bucket }, loc);
+  b_.CreatePerCpuMapElemAdd(ctx_, map, scoped_key.value(), b_.getInt64(1), loc);
+}
+
 llvm::Function *CodegenLLVM::createLinearFunction()
 {
   auto ip = b_.saveIP();
@@ -3898,7 +3950,7 @@ void CodegenLLVM::generateWatchpointSetupProbe(
   createRet();
 }
 
-void CodegenLLVM::createPrintMapCall(Call &call)
+void CodegenLLVM::createPrintMapCall(Call &call, bool clear)
 {
   auto elements = AsyncEvent::Print().asLLVMType(b_);
   StructType *print_struct = b_.GetStructType(call.func + "_t", elements, true);
@@ -3911,7 +3963,8 @@ void CodegenLLVM::createPrintMapCall(Call &call)
 
   // store asyncactionid:
   b_.CreateStore(
-      b_.getInt64(asyncactionint(AsyncAction::print)),
+      b_.getInt64(asyncactionint(clear ? AsyncAction::print_clear
+                                       : AsyncAction::print)),
       b_.CreateGEP(print_struct, buf, { b_.getInt64(0), b_.getInt32(0) }));
 
   int id = bpftrace_.resources.maps_info.at(map.ident).id;
@@ -4066,21 +4119,24 @@ void CodegenLLVM::createMapDefinition(const std::string &name,
                                       libbpf::bpf_map_type map_type,
                                       uint64_t max_entries,
                                       const SizedType &key_type,
-                                      const SizedType &value_type)
+                                      const SizedType &value_type,
+                                      uint32_t map_flags)
 {
   DIType *di_key_type = debug_.GetMapKeyType(key_type, value_type, map_type);
   map_types_.emplace(name, map_type);
   auto var_name = bpf_map_name(name);
   auto *debuginfo = debug_.createMapEntry(
-      var_name, map_type, max_entries, di_key_type, value_type);
+      var_name, map_type, max_entries, di_key_type, value_type, map_flags);
 
   // It's sufficient that the global variable has the correct size (struct with
   // one pointer per field). The actual inner types are defined in debug info.
-  SmallVector<llvm::Type *, 4> elems = { b_.getPtrTy(), b_.getPtrTy() };
+  SmallVector<llvm::Type *, 5> elems = { b_.getPtrTy(), b_.getPtrTy() };
   if (!value_type.IsNoneTy()) {
     elems.push_back(b_.getPtrTy());
     elems.push_back(b_.getPtrTy());
   }
+  if (map_flags)
+    elems.push_back(b_.getPtrTy());
   auto *type = StructType::create(elems, "struct map_t", false);
 
   auto *var = llvm::dyn_cast<GlobalVariable>(
@@ -4121,10 +4177,15 @@ void CodegenLLVM::generate_maps(const RequiredResources &required_resources,
 {
   // User-defined maps
   for (const auto &[name, info] : required_resources.maps_info) {
-    const auto &val_type = info.value_type;
+    const auto val_type = info.dense_hist ? info.dense_hist_type()
+                                          : info.value_type;
     const auto &key_type = info.key_type;
-    createMapDefinition(
-        name, info.bpf_type, info.max_entries, key_type, val_type);
+    createMapDefinition(name,
+                        info.bpf_type,
+                        info.max_entries,
+                        key_type,
+                        val_type,
+                        info.map_flags);
   }
 
   // bpftrace internal maps
@@ -4183,7 +4244,18 @@ void CodegenLLVM::generate_maps(const RequiredResources &required_resources,
                         CreateInt32());
   }
 
-  if (bpftrace_.feature_->has_map_ringbuf()) {
+  // With per-CPU ring buffers, the buffers themselves are created by the
+  // runtime and stored in an array of maps. Losses are counted per buffer.
+  uint32_t loss_cnt_entries = 1;
+  if (bpftrace_.feature_->has_map_ringbuf() &&
+      bpftrace_.config_->ringbuf_cpus_per_buffer > 0) {
+    loss_cnt_entries = bpftrace_.ringbuf_count();
+    createMapDefinition(to_string(MapType::RingbufArray),
+                        libbpf::BPF_MAP_TYPE_ARRAY_OF_MAPS,
+                        loss_cnt_entries,
+                        CreateInt32(),
+                        CreateInt32());
+  } else if (bpftrace_.feature_->has_map_ringbuf()) {
     const auto entries = bpftrace_.config_->perf_rb_pages * 4096;
     createMapDefinition(to_string(MapType::Ringbuf),
                         libbpf::BPF_MAP_TYPE_RINGBUF,
@@ -4192,11 +4264,20 @@ void CodegenLLVM::generate_maps(const RequiredResources &required_resources,
                         CreateNone());
   }
 
+  if (bpftrace_.feature_->has_map_ringbuf() &&
+      bpftrace_.config_->ringbuf_wakeup_batch > 0) {
+    createMapDefinition(to_string(MapType::RingbufWakeup),
+                        libbpf::BPF_MAP_TYPE_PERCPU_ARRAY,
+                        1,
+                        CreateUInt32(),
+                        CreateUInt64());
+  }
+
   int loss_cnt_key_size = sizeof(bpftrace::BPFtrace::event_loss_cnt_key_) * 8;
   int loss_cnt_val_size = sizeof(bpftrace::BPFtrace::event_loss_cnt_val_) * 8;
   createMapDefinition(to_string(MapType::EventLossCounter),
                       libbpf::BPF_MAP_TYPE_ARRAY,
-                      1,
+                      loss_cnt_entries,
                       CreateInt(loss_cnt_key_size),
                       CreateInt(loss_cnt_val_size));
 }
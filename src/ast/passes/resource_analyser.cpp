@@ -361,6 +361,24 @@ void ResourceAnalyser::visit(Call &call)
       resources_.max_map_key_size = std::max(resources_.max_map_key_size,
                                              map_key_size);
     }
+
+    // Dense histograms need a zeroed value to insert a key's buckets
+    auto &map_info = resources_.maps_info[map.ident];
+    map_info.dense_hist = bpftrace_.config_->dense_hist;
+    if (map_info.dense_hist) {
+      const auto value_size = map_info.dense_hist_type().GetSize();
+      if (exceeds_stack_limit(value_size)) {
+        resources_.max_write_map_value_size = std::max(
+            resources_.max_write_map_value_size, value_size);
+      }
+      // The kernel would otherwise allocate a value of up to 15 KiB for
+      // every possible key and CPU when the map is created. Scalar maps have
+      // just the one key.
+      if (!map_info.is_scalar &&
+          (map_info.bpf_type == libbpf::BPF_MAP_TYPE_HASH ||
+           map_info.bpf_type == libbpf::BPF_MAP_TYPE_PERCPU_HASH))
+        map_info.map_flags = BPF_F_NO_PREALLOC;
+    }
   } else if (call.func == "has_key") {
     auto &map = *call.vargs.at(0).as<Map>();
     auto &key_expr = call.vargs.at(1);
@@ -555,8 +573,11 @@ void ResourceAnalyser::update_map_info(Map &map)
                                          map_info.is_scalar);
     // hist() and lhist() transparently create additional elements in whatever
     // map they are assigned to. So even if the map looks like it has no keys,
-    // multiple keys are necessary.
-    if (!map.type().IsMultiKeyMapTy() && map_info.is_scalar) {
+    // multiple keys are necessary. Unless the histogram is dense, then all
+    // buckets are in the one element.
+    bool multi_key = map.type().IsMultiKeyMapTy() &&
+                     !bpftrace_.config_->dense_hist;
+    if (!multi_key && map_info.is_scalar) {
       map_info.max_entries = 1;
     } else {
       map_info.max_entries = bpftrace_.config_->max_map_keys;
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace bpftrace::binary {
+
+// The binary output format (`-f binary`)
+//
+// A stream starts with the magic bytes "BPFTRACE" and the format version as a
+// u32. Records follow, each of them a u8 record type, a u32 payload size and
+// the payload. Integers are little endian, strings are a u32 length followed
+// by that many bytes.
+//
+// The elements of a map are laid out as described by the key and value type
+// descriptors of the map, which are sent in a schema record before the first
+// print of the map. Values only bpftrace can make sense of, such as stacks,
+// symbols or user names, are resolved to strings by the writer.
+//
+// Readers skip records of unknown types, so that new ones can be added without
+// bumping the version.
+
+inline constexpr std::string_view MAGIC = "BPFTRACE";
+inline constexpr uint32_t VERSION = 1;
+
+enum class RecordType : uint8_t {
+  // u32 schema id, string map name, string kind ("map", "hist" or "stats"),
+  // u8 is_scalar, key type, value type
+  schema = 1,
+  // u32 schema id, u32 element count, then the key and value of each element
+  map = 2,
+  // type, value
+  value = 3,
+  // string message type (e.g. "printf"), u8 newline, string message
+  message = 4,
+  // u64 count
+  lost_events = 5,
+  // u64 count
+  attached_probes = 6,
+  // i32 retcode, string helper, string message, string filename, u32 line,
+  // u32 column
+  helper_error = 7,
+};
+
+// A type descriptor is a u8 kind, followed by fields depending on the kind
+enum class TypeKind : uint8_t {
+  // No value, e.g. the key of a scalar map
+  none = 0,
+  // 64 bit integers
+  uint = 1,
+  sint = 2,
+  // 64 bit address
+  pointer = 3,
+  string = 4,
+  // u32 field count, then the type of each field
+  tuple = 5,
+  // u32 field count, then the name and type of each field
+  record = 6,
+  // u32 element count, then the element type
+  array = 7,
+  // u32 bucket count, then the i64 lower bound, i64 upper bound and u64 count
+  // of each bucket with a non-zero count. Bounds are inclusive, open bounds
+  // are INT64_MIN and INT64_MAX.
+  hist = 8,
+  // u8 signed. The value is the count, average and total as 64 bit integers.
+  stats = 9,
+};
+
+inline constexpr int64_t OPEN_LOWER_BOUND = INT64_MIN;
+inline constexpr int64_t OPEN_UPPER_BOUND = INT64_MAX;
+
+// Appends the fields of a record to a buffer
+class Encoder {
+public:
+  void u8(uint8_t v)
+  {
+    data_.push_back(static_cast<char>(v));
+  }
+  void u32(uint32_t v)
+  {
+    put(v, 4);
+  }
+  void u64(uint64_t v)
+  {
+    put(v, 8);
+  }
+  void i32(int32_t v)
+  {
+    put(static_cast<uint32_t>(v), 4);
+  }
+  void i64(int64_t v)
+  {
+    put(static_cast<uint64_t>(v), 8);
+  }
+  void string(std::string_view str)
+  {
+    u32(str.size());
+    data_.append(str);
+  }
+  void kind(TypeKind kind)
+  {
+    u8(static_cast<uint8_t>(kind));
+  }
+
+  const std::string &data() const
+  {
+    return data_;
+  }
+  void clear()
+  {
+    data_.clear();
+  }
+
+private:
+  void put(uint64_t v, int size)
+  {
+    for (int i = 0; i < size; i++)
+      data_.push_back(static_cast<char>(v >> (8 * i)));
+  }
+
+  std::string data_;
+};
+
+// Reads the fields of a record. Reading past the end of the record returns
+// zeros and empty strings and marks the decoder as failed.
+class Decoder {
+public:
+  explicit Decoder(std::span<const uint8_t> data) : data_(data)
+  {
+  }
+
+  uint8_t u8()
+  {
+    return get(1);
+  }
+  uint32_t u32()
+  {
+    return get(4);
+  }
+  uint64_t u64()
+  {
+    return get(8);
+  }
+  int32_t i32()
+  {
+    return static_cast<int32_t>(get(4));
+  }
+  int64_t i64()
+  {
+    return static_cast<int64_t>(get(8));
+  }
+  std::string string()
+  {
+    uint32_t size = u32();
+    if (size > data_.size() - pos_) {
+      failed_ = true;
+      return {};
+    }
+    std::string str(reinterpret_cast<const char *>(data_.data() + pos_), size);
+    pos_ += size;
+    return str;
+  }
+  TypeKind kind()
+  {
+    return static_cast<TypeKind>(u8());
+  }
+
+  // Checks that `count` more elements of at least `size` bytes each fit in
+  // the rest of the record, and marks it as invalid otherwise. Elements which
+  // take no bytes count as one, so that a bogus count can't make the reader
+  // spin either.
+  bool fits(uint64_t count, uint64_t size)
+  {
+    if (count > (data_.size() - pos_) / std::max<uint64_t>(size, 1))
+      failed_ = true;
+    return !failed_;
+  }
+
+  bool failed() const
+  {
+    return failed_;
+  }
+  // Marks the record as invalid
+  void fail()
+  {
+    failed_ = true;
+  }
+
+private:
+  uint64_t get(size_t size)
+  {
+    if (size > data_.size() - pos_) {
+      failed_ = true;
+      pos_ = data_.size();
+      return 0;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < size; i++)
+      v |= static_cast<uint64_t>(data_[pos_ + i]) << (8 * i);
+    pos_ += size;
+    return v;
+  }
+
+  std::span<const uint8_t> data_;
+  size_t pos_ = 0;
+  bool failed_ = false;
+};
+
+} // namespace bpftrace::binary
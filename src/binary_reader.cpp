@@ -0,0 +1,448 @@
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#include "binary_reader.h"
+#include "util/format.h"
+
+namespace bpftrace::binary {
+
+char DecodeError::ID;
+void DecodeError::log(llvm::raw_ostream &OS) const
+{
+  OS << "invalid binary output: " << msg_;
+}
+
+namespace {
+
+// Deeper types are rejected rather than risking to run out of stack
+constexpr int MAX_TYPE_DEPTH = 32;
+// Records are read in chunks of this size, so that a bogus record size can't
+// make the reader allocate more than the input holds
+constexpr size_t READ_CHUNK_SIZE = 1 << 20;
+// Encoded size of a bucket of a histogram
+constexpr uint64_t HIST_BUCKET_SIZE = 24;
+
+std::string json_string(const std::string &str)
+{
+  return "\"" + util::json_escape(str) + "\"";
+}
+
+std::string hist_bucket_label(int64_t low, int64_t high)
+{
+  std::ostringstream label;
+  if (low == OPEN_LOWER_BOUND)
+    label << "(..., " << high + 1 << ")";
+  else if (high == OPEN_UPPER_BOUND)
+    label << "[" << low << ", ...)";
+  else if (low == high)
+    label << "[" << low << "]";
+  else
+    label << "[" << low << ", " << high + 1 << ")";
+  return label.str();
+}
+
+} // namespace
+
+Result<> Reader::read_header()
+{
+  std::string magic(MAGIC.size(), '\0');
+  uint8_t version[4];
+  in_.read(magic.data(), magic.size());
+  in_.read(reinterpret_cast<char *>(version), sizeof(version));
+  if (!in_ || magic != MAGIC)
+    return make_error<DecodeError>("not a bpftrace binary output stream");
+
+  Decoder dec(version);
+  if (uint32_t v = dec.u32(); v != VERSION)
+    return make_error<DecodeError>("unsupported version " + std::to_string(v));
+  return OK();
+}
+
+Result<bool> Reader::convert_next()
+{
+  uint8_t header[5];
+  in_.read(reinterpret_cast<char *>(header), sizeof(header));
+  if (in_.gcount() == 0 && in_.eof())
+    return false;
+  if (!in_)
+    return make_error<DecodeError>("truncated record header");
+
+  Decoder header_dec(header);
+  auto type = static_cast<RecordType>(header_dec.u8());
+  uint32_t size = header_dec.u32();
+  std::vector<uint8_t> payload;
+  while (payload.size() < size) {
+    size_t offset = payload.size();
+    payload.resize(offset + std::min<size_t>(size - offset, READ_CHUNK_SIZE));
+    in_.read(reinterpret_cast<char *>(payload.data() + offset),
+             payload.size() - offset);
+    if (!in_)
+      return make_error<DecodeError>("truncated record");
+  }
+
+  Decoder dec(payload);
+  std::string converted;
+  switch (type) {
+    case RecordType::schema:
+      converted = convert_schema(dec);
+      break;
+    case RecordType::map: {
+      auto ok = convert_map(dec);
+      if (!ok)
+        return ok.takeError();
+      converted = std::move(*ok);
+      break;
+    }
+    case RecordType::value:
+      converted = convert_value(dec);
+      break;
+    case RecordType::message:
+      converted = convert_message(dec);
+      break;
+    case RecordType::lost_events:
+      converted = convert_count(dec, "lost_events", "events");
+      break;
+    case RecordType::attached_probes:
+      converted = convert_count(dec, "attached_probes", "probes");
+      break;
+    case RecordType::helper_error:
+      converted = convert_helper_error(dec);
+      break;
+    default:
+      // Records added by later versions of bpftrace
+      return true;
+  }
+  if (dec.failed())
+    return make_error<DecodeError>(
+        "malformed record of type " +
+        std::to_string(static_cast<uint32_t>(type)));
+
+  out_ << converted << std::flush;
+  return true;
+}
+
+Result<> Reader::convert()
+{
+  auto ok = read_header();
+  if (!ok)
+    return ok;
+
+  while (true) {
+    auto more = convert_next();
+    if (!more)
+      return more.takeError();
+    if (!*more)
+      return OK();
+  }
+}
+
+Reader::Type Reader::decode_type(Decoder &dec, int depth)
+{
+  Type type;
+  if (depth > MAX_TYPE_DEPTH) {
+    dec.fail();
+    return type;
+  }
+
+  type.kind = dec.kind();
+  switch (type.kind) {
+    case TypeKind::none:
+      break;
+    case TypeKind::uint:
+    case TypeKind::sint:
+    case TypeKind::pointer:
+      type.min_size = 8;
+      break;
+    case TypeKind::string:
+    case TypeKind::hist:
+      // The length or the bucket count
+      type.min_size = 4;
+      break;
+    case TypeKind::tuple:
+    case TypeKind::record:
+      type.count = dec.u32();
+      // Each field takes at least the byte of its kind
+      if (!dec.fits(type.count, 1))
+        break;
+      for (uint32_t i = 0; i < type.count && !dec.failed(); i++) {
+        std::string name;
+        if (type.kind == TypeKind::record)
+          name = dec.string();
+        auto field = decode_type(dec, depth + 1);
+        type.min_size += field.min_size;
+        type.fields.emplace_back(std::move(name), std::move(field));
+      }
+      break;
+    case TypeKind::array:
+      type.count = dec.u32();
+      type.fields.emplace_back("", decode_type(dec, depth + 1));
+      type.min_size = type.count * type.fields[0].second.min_size;
+      break;
+    case TypeKind::stats:
+      type.is_signed = dec.u8();
+      type.min_size = 24;
+      break;
+    default:
+      dec.fail();
+  }
+  // Values of larger types can't fit in a record. This also keeps the sizes
+  // above from overflowing.
+  if (type.min_size > std::numeric_limits<uint32_t>::max())
+    dec.fail();
+  return type;
+}
+
+std::string Reader::decode_value(Decoder &dec,
+                                 const Type &type,
+                                 bool is_key) const
+{
+  bool json = format_ == Format::json;
+  switch (type.kind) {
+    case TypeKind::none:
+      return "";
+    case TypeKind::uint:
+      return std::to_string(dec.u64());
+    case TypeKind::sint:
+      return std::to_string(dec.i64());
+    case TypeKind::pointer: {
+      if (json)
+        return std::to_string(dec.u64());
+      std::ostringstream res;
+      res << "0x" << std::hex << dec.u64();
+      return res.str();
+    }
+    case TypeKind::string: {
+      // In JSON, keys are quoted as a whole
+      auto str = dec.string();
+      return json && !is_key ? json_string(str) : str;
+    }
+    case TypeKind::tuple: {
+      std::vector<std::string> elems;
+      for (const auto &[name, field] : type.fields)
+        elems.push_back(decode_value(dec, field, is_key));
+      if (json)
+        return "[" + util::str_join(elems, ",") + "]";
+      return "(" + util::str_join(elems, ", ") + ")";
+    }
+    case TypeKind::record: {
+      std::vector<std::string> elems;
+      for (const auto &[name, field] : type.fields) {
+        auto value = decode_value(dec, field, is_key);
+        elems.push_back(json ? "\"" + name + "\": " + value
+                             : "." + name + " = " + value);
+      }
+      return "{ " + util::str_join(elems, ", ") + " }";
+    }
+    case TypeKind::array: {
+      std::vector<std::string> elems;
+      if (!dec.fits(type.count, type.fields[0].second.min_size))
+        return "";
+      for (uint32_t i = 0; i < type.count && !dec.failed(); i++)
+        elems.push_back(decode_value(dec, type.fields[0].second, is_key));
+      return "[" + util::str_join(elems, ",") + "]";
+    }
+    case TypeKind::hist:
+      return decode_hist(dec);
+    case TypeKind::stats:
+      return decode_stats(dec, type);
+  }
+  dec.fail();
+  return "";
+}
+
+std::string Reader::decode_key(Decoder &dec, const Type &type) const
+{
+  // Tuple keys are printed without parentheses
+  std::string key;
+  if (type.kind == TypeKind::tuple) {
+    std::vector<std::string> elems;
+    for (const auto &[name, field] : type.fields)
+      elems.push_back(decode_value(dec, field, true));
+    key = util::str_join(elems, format_ == Format::json ? "," : ", ");
+  } else {
+    key = decode_value(dec, type, true);
+  }
+  return format_ == Format::json ? json_string(key) : key;
+}
+
+std::string Reader::decode_hist(Decoder &dec) const
+{
+  struct Bucket {
+    int64_t low;
+    int64_t high;
+    uint64_t count;
+  };
+  std::vector<Bucket> buckets;
+  uint32_t nbuckets = dec.u32();
+  uint64_t max_count = 0;
+  if (!dec.fits(nbuckets, HIST_BUCKET_SIZE))
+    return "";
+  for (uint32_t i = 0; i < nbuckets && !dec.failed(); i++) {
+    auto &bucket = buckets.emplace_back(
+        Bucket{ .low = dec.i64(), .high = dec.i64(), .count = dec.u64() });
+    max_count = std::max(bucket.count, max_count);
+  }
+
+  std::ostringstream res;
+  if (format_ == Format::json) {
+    res << "[";
+    for (size_t i = 0; i < buckets.size(); i++) {
+      if (i > 0)
+        res << ", ";
+      res << "{";
+      if (buckets[i].low != OPEN_LOWER_BOUND)
+        res << "\"min\": " << buckets[i].low << ", ";
+      if (buckets[i].high != OPEN_UPPER_BOUND)
+        res << "\"max\": " << buckets[i].high << ", ";
+      res << "\"count\": " << buckets[i].count << "}";
+    }
+    res << "]";
+    return res.str();
+  }
+
+  for (const auto &bucket : buckets) {
+    int max_width = 52;
+    int bar_width = bucket.count / static_cast<float>(max_count) * max_width;
+    std::string bar(bar_width, '@');
+    res << std::setw(16) << std::left
+        << hist_bucket_label(bucket.low, bucket.high) << std::setw(8)
+        << std::right << bucket.count << " |" << std::setw(max_width)
+        << std::left << bar << "|" << std::endl;
+  }
+  return res.str();
+}
+
+std::string Reader::decode_stats(Decoder &dec, const Type &type) const
+{
+  Type value;
+  value.kind = type.is_signed ? TypeKind::sint : TypeKind::uint;
+  auto count = decode_value(dec, value, false);
+  auto avg = decode_value(dec, value, false);
+  auto total = decode_value(dec, value, false);
+  if (format_ == Format::json)
+    return R"({"count": )" + count + R"(, "average": )" + avg +
+           R"(, "total": )" + total + "}";
+  return "count " + count + ", average " + avg + ", total " + total;
+}
+
+std::string Reader::convert_schema(Decoder &dec)
+{
+  uint32_t id = dec.u32();
+  Schema schema;
+  schema.name = dec.string();
+  schema.kind = dec.string();
+  schema.is_scalar = dec.u8();
+  schema.key = decode_type(dec);
+  schema.value = decode_type(dec);
+  if (!dec.failed())
+    schemas_[id] = std::move(schema);
+  return "";
+}
+
+Result<std::string> Reader::convert_map(Decoder &dec) const
+{
+  uint32_t id = dec.u32();
+  auto it = schemas_.find(id);
+  if (it == schemas_.end())
+    return make_error<DecodeError>("map record for unknown schema " +
+                                   std::to_string(id));
+  const auto &schema = it->second;
+  bool json = format_ == Format::json;
+  bool is_hist = schema.value.kind == TypeKind::hist;
+
+  uint32_t count = dec.u32();
+  uint64_t elem_size = schema.value.min_size;
+  if (!schema.is_scalar)
+    elem_size += schema.key.min_size;
+  if (!dec.fits(count, elem_size))
+    return "";
+  std::vector<std::string> elems;
+  for (uint32_t i = 0; i < count && !dec.failed(); i++) {
+    std::string key;
+    if (!schema.is_scalar)
+      key = decode_key(dec, schema.key);
+    auto value = decode_value(dec, schema.value, false);
+
+    if (json)
+      elems.push_back(schema.is_scalar ? value : key + ": " + value);
+    else if (schema.is_scalar)
+      elems.push_back(schema.name + (is_hist ? ":\n" : ": ") + value);
+    else
+      elems.push_back(schema.name + "[" + key + "]" + (is_hist ? ":\n" : ": ") +
+                      value);
+  }
+
+  if (!json) {
+    auto res = util::str_join(elems, "\n") + "\n";
+    // Like TextOutput::map_stats()
+    if (schema.kind == "stats")
+      res += "\n";
+    return res;
+  }
+
+  // Like JsonOutput, empty maps are not printed
+  if (elems.empty())
+    return "";
+  std::string res = R"({"type": ")" + schema.kind + R"(", "data": {)" +
+                    json_string(schema.name) + ": ";
+  if (schema.is_scalar)
+    res += util::str_join(elems, ", ");
+  else
+    res += "{" + util::str_join(elems, ", ") + "}";
+  return res + "}}\n";
+}
+
+std::string Reader::convert_value(Decoder &dec) const
+{
+  auto type = decode_type(dec);
+  auto value = decode_value(dec, type, false);
+  if (format_ == Format::json)
+    return R"({"type": "value", "data": )" + value + "}\n";
+  return value + "\n";
+}
+
+std::string Reader::convert_message(Decoder &dec) const
+{
+  auto type = dec.string();
+  bool nl = dec.u8();
+  auto msg = dec.string();
+  if (format_ == Format::json)
+    return R"({"type": ")" + type + R"(", "data": )" + json_string(msg) + "}\n";
+  return nl ? msg + "\n" : msg;
+}
+
+std::string Reader::convert_count(Decoder &dec,
+                                  const std::string &type,
+                                  const std::string &field) const
+{
+  auto count = std::to_string(dec.u64());
+  if (format_ == Format::json)
+    return R"({"type": ")" + type + R"(", "data": {")" + field +
+           "\": " + count + "}}\n";
+  if (type == "lost_events")
+    return "Lost " + count + " events\n";
+  return "Attaching " + count + (count == "1" ? " probe...\n" : " probes...\n");
+}
+
+std::string Reader::convert_helper_error(Decoder &dec) const
+{
+  auto retcode = std::to_string(dec.i32());
+  auto helper = dec.string();
+  auto msg = dec.string();
+  auto filename = dec.string();
+  auto line = std::to_string(dec.u32());
+  auto col = std::to_string(dec.u32());
+  if (format_ == Format::json)
+    return R"({"type": "helper_error", "msg": )" + json_string(msg) +
+           R"(, "helper": )" + json_string(helper) +
+           R"(, "retcode": )" + retcode +
+           R"(, "filename": )" + json_string(filename) +
+           R"(, "line": )" + line + R"(, "col": )" + col + "}\n";
+  return filename + ":" + line + ":" + col + ": WARNING: " + msg +
+         "\nAdditional Info - helper: " + helper + ", retcode: " + retcode +
+         "\n";
+}
+
+} // namespace bpftrace::binary
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "binary_format.h"
+#include "util/result.h"
+
+namespace bpftrace::binary {
+
+class DecodeError : public ErrorInfo<DecodeError> {
+public:
+  DecodeError(std::string msg) : msg_(std::move(msg)) {};
+  static char ID;
+  void log(llvm::raw_ostream &OS) const override;
+
+private:
+  std::string msg_;
+};
+
+enum class Format {
+  text,
+  json,
+};
+
+// Converts the binary output of bpftrace (see binary_format.h) to the text or
+// JSON output it would have printed, record by record.
+//
+// The text output is a close approximation: values come already reduced and
+// resolved, but histograms are printed with plain bucket bounds.
+class Reader {
+public:
+  Reader(std::istream &in, std::ostream &out, Format format)
+      : in_(in), out_(out), format_(format)
+  {
+  }
+
+  // Checks the magic and the version at the start of the stream
+  Result<> read_header();
+  // Converts the next record. Returns false at the end of the stream.
+  Result<bool> convert_next();
+  // Reads the header and converts all records
+  Result<> convert();
+
+private:
+  struct Type {
+    TypeKind kind = TypeKind::none;
+    bool is_signed = false;
+    // Elements of tuples and records, or the single element type of arrays
+    std::vector<std::pair<std::string, Type>> fields;
+    uint32_t count = 0;
+    // The fewest bytes a value of this type is encoded in
+    uint64_t min_size = 0;
+  };
+
+  struct Schema {
+    std::string name;
+    std::string kind;
+    bool is_scalar;
+    Type key;
+    Type value;
+  };
+
+  static Type decode_type(Decoder &dec, int depth = 0);
+  std::string decode_value(Decoder &dec, const Type &type, bool is_key) const;
+  std::string decode_key(Decoder &dec, const Type &type) const;
+  std::string decode_hist(Decoder &dec) const;
+  std::string decode_stats(Decoder &dec, const Type &type) const;
+
+  std::string convert_schema(Decoder &dec);
+  Result<std::string> convert_map(Decoder &dec) const;
+  std::string convert_value(Decoder &dec) const;
+  std::string convert_message(Decoder &dec) const;
+  std::string convert_count(Decoder &dec,
+                            const std::string &type,
+                            const std::string &field) const;
+  std::string convert_helper_error(Decoder &dec) const;
+
+  std::istream &in_;
+  std::ostream &out_;
+  Format format_;
+  std::unordered_map<uint32_t, Schema> schemas_;
+};
+
+} // namespace bpftrace::binary
@@ -0,0 +1,124 @@
+#include <cstring>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+
+#include "binary_reader.h"
+#include "version.h"
+
+using namespace bpftrace;
+
+void usage(std::ostream& out, std::string_view filename)
+{
+  // clang-format off
+  out << "USAGE: " << filename << " [options] [FILE]" << std::endl;
+  out << std::endl;
+  out << "Converts the output of `bpftrace -f binary` read from FILE, or from" << std::endl;
+  out << "stdin, to text or JSON." << std::endl;
+  out << std::endl;
+  out << "OPTIONS:" << std::endl;
+  out << "    -f FORMAT      output format ('text', 'json')" << std::endl;
+  out << "    -o file        write the output to file" << std::endl;
+  out << "    -h, --help     show this help message" << std::endl;
+  out << "    -V, --version  bpftrace version" << std::endl;
+  out << std::endl;
+  // clang-format on
+}
+
+int main(int argc, char* argv[])
+{
+  std::string output_file, output_format;
+  int c;
+
+  const char* const short_opts = "f:ho:V";
+  option long_opts[] = {
+    option{
+        .name = "help",
+        .has_arg = no_argument,
+        .flag = nullptr,
+        .val = 'h',
+    },
+    option{
+        .name = "version",
+        .has_arg = no_argument,
+        .flag = nullptr,
+        .val = 'V',
+    },
+    // Must be last
+    option{
+        .name = nullptr,
+        .has_arg = 0,
+        .flag = nullptr,
+        .val = 0,
+    },
+  };
+
+  while ((c = getopt_long(argc, argv, short_opts, long_opts, nullptr)) != -1) {
+    switch (c) {
+      case 'f':
+        output_format = optarg;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'h':
+        usage(std::cout, argv[0]);
+        return 0;
+      case 'V':
+        std::cout << "bpftrace " << BPFTRACE_VERSION << std::endl;
+        return 0;
+      default:
+        usage(std::cerr, argv[0]);
+        return 1;
+    }
+  }
+
+  binary::Format format;
+  if (output_format.empty() || output_format == "text") {
+    format = binary::Format::text;
+  } else if (output_format == "json") {
+    format = binary::Format::json;
+  } else {
+    std::cerr << "Invalid output format \"" << output_format << "\"\n"
+              << "Valid formats: 'text', 'json'" << std::endl;
+    return 1;
+  }
+
+  if (optind + 1 < argc) {
+    usage(std::cerr, argv[0]);
+    return 1;
+  }
+
+  std::istream* is = &std::cin;
+  std::ifstream inputstream;
+  if (optind < argc) {
+    inputstream.open(argv[optind], std::ios::binary);
+    if (inputstream.fail()) {
+      std::cerr << "Failed to open input file: \"" << argv[optind]
+                << "\": " << strerror(errno) << std::endl;
+      return 1;
+    }
+    is = &inputstream;
+  }
+
+  std::ostream* os = &std::cout;
+  std::ofstream outputstream;
+  if (!output_file.empty()) {
+    outputstream.open(output_file);
+    if (outputstream.fail()) {
+      std::cerr << "Failed to open output file: \"" << output_file
+                << "\": " << strerror(errno) << std::endl;
+      return 1;
+    }
+    os = &outputstream;
+  }
+
+  binary::Reader reader(*is, *os, format);
+  auto ok = reader.convert();
+  if (!ok) {
+    std::cerr << ok.takeError() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -14,6 +14,7 @@
 #include <bpf/bpf.h>
 #include <bpf/btf.h>
 #include <elf.h>
+#include <unistd.h>
 
 namespace bpftrace {
 
@@ -196,7 +197,27 @@ void BpfBytecode::load_progs(const RequiredResources &resources,
   prepare_progs(resources.probes, btf, feature, config);
   prepare_progs(resources.watchpoint_probes, btf, feature, config);
 
+  // An array of maps must be created from a template of its inner map. The
+  // ring buffers actually stored in it are created by BPFtrace::setup_ringbuf.
+  int inner_map_fd = -1;
+  if (hasMap(MapType::RingbufArray)) {
+    inner_map_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF,
+                                  nullptr,
+                                  0,
+                                  0,
+                                  config.perf_rb_pages * 4096,
+                                  nullptr);
+    if (inner_map_fd < 0)
+      throw util::FatalUserException("Failed to create ring buffer: " +
+                                     std::string(strerror(-inner_map_fd)));
+    auto *ringbuf_array = bpf_object__find_map_by_name(
+        bpf_object_.get(), to_string(MapType::RingbufArray).c_str());
+    bpf_map__set_inner_map_fd(ringbuf_array, inner_map_fd);
+  }
+
   int res = bpf_object__load(bpf_object_.get());
+  if (inner_map_fd >= 0)
+    close(inner_map_fd);
 
   // If requested, print the entire verifier logs, even if loading succeeded.
   for (const auto &[name, prog] : programs_) {
@@ -324,6 +324,7 @@ bool BPFfeature::has_map_batch()
   int map_fd = 0;
   int keys[10];
   int values[10];
+  uint32_t batch = 0;
   uint32_t count = 0;
 
   if (has_map_batch_.has_value())
@@ -342,11 +343,13 @@ bool BPFfeature::has_map_batch()
   if (map_fd < 0)
     return false;
 
+  count = max_entries;
   int err = bpf_map_lookup_batch(
-      map_fd, nullptr, nullptr, keys, values, &count, nullptr);
+      map_fd, nullptr, &batch, keys, values, &count, nullptr);
   close(map_fd);
 
-  has_map_batch_ = err >= 0;
+  // The map is empty, so a kernel supporting batch ops reports ENOENT
+  has_map_batch_ = err >= 0 || err == -ENOENT;
   return *has_map_batch_;
 }
 
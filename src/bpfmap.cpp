@@ -1,10 +1,27 @@
+#include <algorithm>
+#include <bit>
+#include <bpf/bpf.h>
+#include <cerrno>
+#include <cstring>
 #include <sstream>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 
 #include "bpfmap.h"
 
 namespace bpftrace {
 
+// Upper bound on the number of elements moved by a single batch syscall.
+static constexpr uint32_t MAP_BATCH_SIZE = 4096;
+
+// Kernel-internal errno returned for map types that have no batch ops.
+static constexpr int KERNEL_ENOTSUPP = 524;
+
+// Hash maps are only read from several threads if each of them gets at least
+// this many hash buckets, smaller maps are not worth the thread startup.
+static constexpr uint32_t MIN_BUCKETS_PER_SHARD = 65536;
+
 const std::unordered_map<std::string, libbpf::bpf_map_type> BPF_MAP_TYPES = {
   { "hash", libbpf::BPF_MAP_TYPE_HASH },
   { "lruhash", libbpf::BPF_MAP_TYPE_LRU_HASH },
@@ -71,6 +88,393 @@ bool BpfMap::is_printable() const
   return bpf_name().starts_with("AT_");
 }
 
+void MapElements::append(const uint8_t *keys,
+                         const uint8_t *values,
+                         size_t count)
+{
+  size_t offset = data_.size();
+  data_.resize(offset + (count * stride()));
+  uint8_t *elem = data_.data() + offset;
+  for (size_t i = 0; i < count; i++) {
+    std::memcpy(elem, keys + (i * key_size_), key_size_);
+    std::memcpy(elem + key_size_, values + (i * value_size_), value_size_);
+    elem += stride();
+  }
+}
+
+void MapElements::push_back(std::span<const uint8_t> key,
+                            std::span<const uint8_t> value)
+{
+  data_.insert(data_.end(), key.begin(), key.end());
+  data_.insert(data_.end(), value.begin(), value.end());
+}
+
+void MapElements::reorder(const std::vector<size_t> &order)
+{
+  std::vector<uint8_t> data(order.size() * stride());
+  uint8_t *elem = data.data();
+  for (size_t i : order) {
+    std::memcpy(elem, data_.data() + (i * stride()), stride());
+    elem += stride();
+  }
+  data_ = std::move(data);
+}
+
+static bool is_batch_unsupported(int err)
+{
+  // Kernels predating batch ops reject the command with EINVAL
+  return err == -EINVAL || err == -EOPNOTSUPP || err == -KERNEL_ENOTSUPP;
+}
+
+static bool is_hash_map(libbpf::bpf_map_type type)
+{
+  return type == libbpf::BPF_MAP_TYPE_HASH ||
+         type == libbpf::BPF_MAP_TYPE_PERCPU_HASH ||
+         type == libbpf::BPF_MAP_TYPE_LRU_HASH ||
+         type == libbpf::BPF_MAP_TYPE_LRU_PERCPU_HASH;
+}
+
+// Walks the whole map with BPF_MAP_LOOKUP_BATCH (or
+// BPF_MAP_LOOKUP_AND_DELETE_BATCH if `del` is set) and calls `cb` with the
+// keys, values and number of elements of every batch.
+//
+// For hash maps, the walk can be limited to the hash buckets from
+// `first_bucket` up to `end_bucket`. The kernel only returns whole buckets
+// but as many as fit into a batch, so the last batch may hold elements from
+// buckets past `end_bucket`.
+template <typename F>
+static int for_each_batch(const BpfMap &map,
+                          size_t value_size,
+                          bool del,
+                          F &&cb,
+                          uint32_t first_bucket = 0,
+                          uint32_t end_bucket = UINT32_MAX)
+{
+  uint32_t batch_size = std::clamp(map.max_entries(), 1U, MAP_BATCH_SIZE);
+  // The batch token is opaque: hash maps store a bucket index in it, array
+  // maps a key.
+  size_t token_size = std::max<size_t>(map.key_size(), sizeof(uint64_t));
+  std::vector<uint8_t> in_batch(token_size);
+  std::vector<uint8_t> out_batch(token_size);
+  std::vector<uint8_t> keys;
+  std::vector<uint8_t> values;
+  bool first = true;
+  if (first_bucket != 0) {
+    std::memcpy(in_batch.data(), &first_bucket, sizeof(first_bucket));
+    first = false;
+  }
+
+  while (true) {
+    keys.resize(static_cast<size_t>(batch_size) * map.key_size());
+    values.resize(static_cast<size_t>(batch_size) * value_size);
+
+    uint32_t count = batch_size;
+    void *in = first ? nullptr : in_batch.data();
+    int err = del ? bpf_map_lookup_and_delete_batch(map.fd(),
+                                                    in,
+                                                    out_batch.data(),
+                                                    keys.data(),
+                                                    values.data(),
+                                                    &count,
+                                                    nullptr)
+                  : bpf_map_lookup_batch(map.fd(),
+                                         in,
+                                         out_batch.data(),
+                                         keys.data(),
+                                         values.data(),
+                                         &count,
+                                         nullptr);
+    if (err == -ENOSPC && count == 0) {
+      // A single hash bucket holds more elements than the batch can fit,
+      // retry the same bucket with a larger batch.
+      batch_size *= 2;
+      continue;
+    }
+    if (err && err != -ENOENT)
+      return err;
+
+    if (count > 0)
+      cb(keys.data(), values.data(), count);
+
+    // ENOENT signals that the last batch has been returned
+    if (err == -ENOENT)
+      return 0;
+
+    uint32_t next_bucket;
+    std::memcpy(&next_bucket, out_batch.data(), sizeof(next_bucket));
+    if (next_bucket >= end_bucket)
+      return 0;
+
+    in_batch.swap(out_batch);
+    first = false;
+  }
+}
+
+// The kernel sizes hash tables to the next power of two of max_entries.
+// Should that ever change, reading the table in shards still works, the
+// shards just end up unbalanced.
+static uint32_t hash_buckets(const BpfMap &map)
+{
+  return std::bit_ceil(std::clamp(map.max_entries(), 1U, 1U << 31));
+}
+
+// Reads a hash map from several threads, each of which walks its own range of
+// hash buckets with batch lookups. The elements end up in the same order as
+// with a single walk over the map.
+//
+// Shards may read elements of the next shards, so this can't be used to read
+// and delete elements: a shard could delete elements from the next one, which
+// would then miss them.
+static int collect_shards(const BpfMap &map,
+                          size_t value_size,
+                          uint32_t nshards,
+                          MapElements &elements)
+{
+  // The last shard reads up to the end of the table, whatever its size
+  uint32_t shard_size = (hash_buckets(map) + nshards - 1) / nshards;
+
+  struct Shard {
+    MapElements elements;
+    // Start of the last batch, which may overlap with the next shards
+    size_t tail = 0;
+    int err = 0;
+  };
+  std::vector<Shard> shards(nshards);
+  std::vector<std::thread> threads;
+  threads.reserve(nshards);
+  for (uint32_t i = 0; i < nshards; i++) {
+    threads.emplace_back([&, i]() {
+      auto &shard = shards[i];
+      shard.elements = MapElements(map.key_size(), value_size);
+      uint32_t first_bucket = i * shard_size;
+      uint32_t end_bucket = i + 1 == nshards ? UINT32_MAX
+                                             : first_bucket + shard_size;
+      auto append = [&](uint8_t *keys, uint8_t *values, uint32_t count) {
+        shard.tail = shard.elements.size();
+        shard.elements.append(keys, values, count);
+      };
+      shard.err = for_each_batch(
+          map, value_size, false, append, first_bucket, end_bucket);
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  for (const auto &shard : shards) {
+    if (shard.err)
+      return shard.err;
+  }
+
+  // An element read past the end of its shard is read again by the shard
+  // owning its bucket, unless it was deleted along the way. Each key lives in
+  // a single bucket, so when a key shows up more than once, the copy from the
+  // last shard is the one from the owner and the others are dropped.
+  auto as_string_view = [](std::span<const uint8_t> key) {
+    return std::string_view(reinterpret_cast<const char *>(key.data()),
+                            key.size());
+  };
+  // Shard and index of the last copy of each key
+  using Position = std::pair<uint32_t, size_t>;
+  std::unordered_map<std::string_view, std::optional<Position>> last_copy;
+  for (uint32_t i = 0; i + 1 < nshards; i++) {
+    const auto &shard = shards[i];
+    for (size_t j = shard.tail; j < shard.elements.size(); j++)
+      last_copy.emplace(as_string_view(shard.elements[j].key), std::nullopt);
+  }
+  std::vector<std::vector<bool>> dropped(nshards);
+  for (uint32_t i = 0; i < nshards; i++) {
+    dropped[i].resize(shards[i].elements.size());
+    if (last_copy.empty())
+      continue;
+    for (size_t j = 0; j < shards[i].elements.size(); j++) {
+      auto it = last_copy.find(as_string_view(shards[i].elements[j].key));
+      if (it == last_copy.end())
+        continue;
+      if (it->second)
+        dropped[it->second->first][it->second->second] = true;
+      it->second = { i, j };
+    }
+  }
+
+  size_t total = 0;
+  for (const auto &shard : shards)
+    total += shard.elements.size();
+  elements.reserve(elements.size() + total);
+  for (uint32_t i = 0; i < nshards; i++) {
+    for (size_t j = 0; j < shards[i].elements.size(); j++) {
+      if (!dropped[i][j]) {
+        auto elem = shards[i].elements[j];
+        elements.push_back(elem.key, elem.value);
+      }
+    }
+    shards[i].elements = {};
+  }
+  return 0;
+}
+
+int BpfMap::collect_elements(int nvalues,
+                             bool use_batch,
+                             MapElements &elements,
+                             bool del,
+                             uint32_t threads) const
+{
+  size_t value_size = static_cast<size_t>(value_size_) * nvalues;
+  elements = MapElements(key_size_, value_size);
+
+  if (use_batch) {
+    // Starting a walk in the middle of the map relies on the batch token being
+    // a bucket index, which only holds for hash maps. Lookups that delete
+    // the elements are done in a single walk, see collect_shards().
+    uint32_t nshards = 1;
+    if (is_hash_map(type_) && !del)
+      nshards = std::clamp(hash_buckets(*this) / MIN_BUCKETS_PER_SHARD,
+                           1U,
+                           std::max(threads, 1U));
+
+    int err;
+    if (nshards > 1) {
+      err = collect_shards(*this, value_size, nshards, elements);
+    } else {
+      auto append = [&](uint8_t *keys, uint8_t *values, uint32_t count) {
+        elements.append(keys, values, count);
+      };
+      err = for_each_batch(*this, value_size, del, append);
+    }
+    if (!is_batch_unsupported(err))
+      return err;
+    elements.clear();
+  }
+
+  uint8_t *old_key = nullptr;
+  auto key = std::vector<uint8_t>(key_size_);
+  auto value = std::vector<uint8_t>(value_size);
+  while (bpf_map_get_next_key(fd(), old_key, key.data()) == 0) {
+    int err = bpf_map_lookup_elem(fd(), key.data(), value.data());
+    if (err == -ENOENT) {
+      // key was removed by the eBPF program during bpf_map_get_next_key() and
+      // bpf_map_lookup_elem(), let's skip this key
+      continue;
+    } else if (err) {
+      return err;
+    }
+
+    elements.push_back(key, value);
+    old_key = key.data();
+  }
+
+  if (del) {
+    for (const auto &elem : elements) {
+      int err = bpf_map_delete_elem(fd(), elem.key.data());
+      if (err && err != -ENOENT)
+        return err;
+    }
+  }
+  return 0;
+}
+
+int BpfMap::collect_keys(int nvalues,
+                         bool use_batch,
+                         std::vector<std::vector<uint8_t>> &keys) const
+{
+  if (use_batch) {
+    size_t value_size = static_cast<size_t>(value_size_) * nvalues;
+    auto append = [&](uint8_t *batch_keys, uint8_t *, uint32_t count) {
+      keys.reserve(keys.size() + count);
+      for (uint32_t i = 0; i < count; i++) {
+        uint8_t *key = batch_keys + (static_cast<size_t>(i) * key_size_);
+        keys.emplace_back(key, key + key_size_);
+      }
+    };
+    int err = for_each_batch(*this, value_size, false, append);
+    if (!is_batch_unsupported(err))
+      return err;
+    keys.clear();
+  }
+
+  uint8_t *old_key = nullptr;
+  auto key = std::vector<uint8_t>(key_size_);
+  while (bpf_map_get_next_key(fd(), old_key, key.data()) == 0) {
+    keys.push_back(key);
+    old_key = key.data();
+  }
+  return 0;
+}
+
+int BpfMap::clear(int nvalues, bool use_batch) const
+{
+  if (use_batch) {
+    size_t value_size = static_cast<size_t>(value_size_) * nvalues;
+    auto discard = [](uint8_t *, uint8_t *, uint32_t) {};
+    int err = for_each_batch(*this, value_size, true, discard);
+    if (!is_batch_unsupported(err))
+      return err;
+  }
+
+  // snapshot keys, then operate on them
+  std::vector<std::vector<uint8_t>> keys;
+  int err = collect_keys(nvalues, false, keys);
+  if (err)
+    return err;
+
+  for (auto &k : keys) {
+    err = bpf_map_delete_elem(fd(), k.data());
+    if (err && err != -ENOENT)
+      return err;
+  }
+  return 0;
+}
+
+int BpfMap::zero_out(int nvalues, bool use_batch) const
+{
+  std::vector<std::vector<uint8_t>> keys;
+  int err = collect_keys(nvalues, use_batch, keys);
+  if (err)
+    return err;
+
+  size_t value_size = static_cast<size_t>(value_size_) * nvalues;
+
+  if (use_batch && !keys.empty()) {
+    std::vector<uint8_t> flat_keys;
+    flat_keys.reserve(keys.size() * key_size_);
+    for (const auto &k : keys)
+      flat_keys.insert(flat_keys.end(), k.begin(), k.end());
+    std::vector<uint8_t> zero(std::min<size_t>(keys.size(), MAP_BATCH_SIZE) *
+                                  value_size,
+                              0);
+
+    BPFTRACE_LIBBPF_OPTS(bpf_map_batch_opts, opts, .elem_flags = BPF_EXIST);
+    size_t done = 0;
+    while (done < keys.size()) {
+      uint32_t count = std::min<size_t>(keys.size() - done, MAP_BATCH_SIZE);
+      err = bpf_map_update_batch(fd(),
+                                 flat_keys.data() + (done * key_size_),
+                                 zero.data(),
+                                 &count,
+                                 &opts);
+      done += count;
+      if (err == -ENOENT) {
+        // The element at `count` was deleted by the eBPF program in the
+        // meantime, skip it and carry on with the rest
+        done++;
+      } else if (err && done == 0 && is_batch_unsupported(err)) {
+        break;
+      } else if (err) {
+        return err;
+      }
+    }
+    if (done >= keys.size())
+      return 0;
+  }
+
+  std::vector<uint8_t> zero(value_size, 0);
+  for (auto &k : keys) {
+    err = bpf_map_update_elem(fd(), k.data(), zero.data(), BPF_EXIST);
+    if (err && err != -ENOENT)
+      return err;
+  }
+  return 0;
+}
+
 std::string to_string(MapType t)
 {
   switch (t) {
@@ -82,6 +486,10 @@ std::string to_string(MapType t)
       return "elapsed";
     case MapType::Ringbuf:
       return "ringbuf";
+    case MapType::RingbufArray:
+      return "ringbuf_array";
+    case MapType::RingbufWakeup:
+      return "ringbuf_wakeup";
     case MapType::EventLossCounter:
       return "event_loss_counter";
     case MapType::RecursionPrevention:
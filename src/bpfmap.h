@@ -1,8 +1,13 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include <bpf/libbpf.h>
 #include <linux/bpf.h>
@@ -15,6 +20,123 @@ namespace libbpf {
 
 namespace bpftrace {
 
+// The elements of a map, read from the kernel for printing.
+//
+// All keys and values are stored back to back in a single buffer, as the
+// elements of a map all have the same size. Millions of elements then take
+// one allocation instead of two each, and a batch read from the kernel is
+// appended with a few copies.
+class MapElements {
+public:
+  struct Element {
+    std::span<const uint8_t> key;
+    std::span<const uint8_t> value;
+  };
+
+  class Iterator {
+  public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = Element;
+
+    Iterator() = default;
+    Iterator(const MapElements *elements, size_t index)
+        : elements_(elements), index_(index)
+    {
+    }
+
+    Element operator*() const
+    {
+      return (*elements_)[index_];
+    }
+    Iterator &operator++()
+    {
+      index_++;
+      return *this;
+    }
+    Iterator operator++(int)
+    {
+      auto it = *this;
+      index_++;
+      return it;
+    }
+    bool operator==(const Iterator &other) const
+    {
+      return index_ == other.index_;
+    }
+
+  private:
+    const MapElements *elements_ = nullptr;
+    size_t index_ = 0;
+  };
+
+  MapElements() = default;
+  MapElements(size_t key_size, size_t value_size)
+      : key_size_(key_size), value_size_(value_size)
+  {
+  }
+
+  // Appends `count` elements from separate arrays of keys and values, as
+  // returned by batch lookups
+  void append(const uint8_t *keys, const uint8_t *values, size_t count);
+  void push_back(std::span<const uint8_t> key, std::span<const uint8_t> value);
+  void reserve(size_t count)
+  {
+    data_.reserve(count * stride());
+  }
+  void clear()
+  {
+    data_.clear();
+  }
+
+  // Rearranges the elements so that the i-th one is the one which was at
+  // `order[i]`. Elements missing from `order` are dropped.
+  void reorder(const std::vector<size_t> &order);
+  template <typename F>
+  void erase_if(F pred)
+  {
+    std::vector<size_t> order;
+    for (size_t i = 0; i < size(); i++) {
+      if (!pred((*this)[i]))
+        order.push_back(i);
+    }
+    if (order.size() != size())
+      reorder(order);
+  }
+
+  Element operator[](size_t i) const
+  {
+    const uint8_t *elem = data_.data() + (i * stride());
+    return { .key = { elem, key_size_ },
+             .value = { elem + key_size_, value_size_ } };
+  }
+  size_t size() const
+  {
+    return stride() ? data_.size() / stride() : 0;
+  }
+  bool empty() const
+  {
+    return data_.empty();
+  }
+  Iterator begin() const
+  {
+    return { this, 0 };
+  }
+  Iterator end() const
+  {
+    return { this, size() };
+  }
+
+private:
+  size_t stride() const
+  {
+    return key_size_ + value_size_;
+  }
+
+  size_t key_size_ = 0;
+  size_t value_size_ = 0;
+  std::vector<uint8_t> data_;
+};
+
 class BpfMap {
 public:
   BpfMap(struct bpf_map *bpf_map)
@@ -53,6 +175,31 @@ public:
   bool is_clearable() const;
   bool is_printable() const;
 
+  // Bulk element access. When `use_batch` is set, the BPF_MAP_*_BATCH
+  // commands are used to move many elements per syscall. If the kernel does
+  // not support batch operations for this map, these transparently fall back
+  // to one syscall per element. Return 0 on success or a negative errno.
+  //
+  // collect_elements() replaces the contents of `elements`. With `del` set,
+  // it also deletes the elements it returns. Batches are then read and
+  // deleted by the same syscall, so that no update made in between is lost.
+  // Without batch support, the elements are only deleted after all of them
+  // have been read.
+  //
+  // Large hash maps are read from up to `threads` threads at once, each of
+  // them walking its own range of the hash table with batch lookups, unless
+  // `del` is set.
+  int collect_elements(int nvalues,
+                       bool use_batch,
+                       MapElements &elements,
+                       bool del = false,
+                       uint32_t threads = 1) const;
+  int collect_keys(int nvalues,
+                   bool use_batch,
+                   std::vector<std::vector<uint8_t>> &keys) const;
+  int clear(int nvalues, bool use_batch) const;
+  int zero_out(int nvalues, bool use_batch) const;
+
 private:
   struct bpf_map *bpf_map_;
   libbpf::bpf_map_type type_;
@@ -69,6 +216,8 @@ enum class MapType {
   Join,
   Elapsed,
   Ringbuf,
+  RingbufArray,
+  RingbufWakeup,
   EventLossCounter,
   RecursionPrevention,
 };
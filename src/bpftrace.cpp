@@ -7,6 +7,7 @@
 #include <bpf/libbpf.h>
 #include <cassert>
 #include <cerrno>
+#include <chrono>
 #include <cinttypes>
 #include <csignal>
 #include <cstdio>
@@ -17,8 +18,9 @@
 #include <fstream>
 #include <glob.h>
 #include <iostream>
+#include <numeric>
 #include <ranges>
-#include <regex>
+#include <span>
 #include <sstream>
 #include <sys/epoll.h>
 #include <sys/personality.h>
@@ -26,7 +28,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <tuple>
 #include <unistd.h>
+#include <unordered_set>
 #ifdef HAVE_LIBSYSTEMD
 #include <systemd/sd-daemon.h>
 #endif
@@ -37,6 +41,7 @@
 #include "bpfprogram.h"
 #include "bpftrace.h"
 #include "btf.h"
+#include "histograms.h"
 #include "log.h"
 #include "printf.h"
 #include "scopeguard.h"
@@ -45,9 +50,11 @@
 #include "util/cpus.h"
 #include "util/exceptions.h"
 #include "util/format.h"
+#include "util/hash.h"
 #include "util/int_parser.h"
 #include "util/io.h"
 #include "util/kernel.h"
+#include "util/math.h"
 #include "util/paths.h"
 #include "util/stats.h"
 #include "util/system.h"
@@ -65,6 +72,13 @@ volatile sig_atomic_t BPFtrace::sigusr1_recv = false;
 
 BPFtrace::~BPFtrace()
 {
+  if (stack_cache_.hits() || stack_cache_.misses())
+    LOG(V1) << "Stack cache: " << stack_cache_.hits() << " hits, "
+            << stack_cache_.misses() << " misses, " << stack_cache_.size()
+            << " entries";
+  if (usyms_.cache_size())
+    LOG(V1) << "User symbol caches: " << usyms_.cache_size() / 1024
+            << " KiB, " << usyms_.cache_evictions() << " evictions";
   close_pcaps();
 }
 
@@ -184,6 +198,11 @@ int BPFtrace::num_probes() const
 void BPFtrace::request_finalize()
 {
   finalize_ = true;
+  // The output thread only flags the request, the polling thread detaches
+  // the probes once it notices (see poll_output).
+  if (output_thread_.joinable() &&
+      std::this_thread::get_id() == output_thread_.get_id())
+    return;
   attached_probes_.clear();
   if (child_)
     child_->terminate();
@@ -191,18 +210,13 @@ void BPFtrace::request_finalize()
 
 void perf_event_printer(void *cb_cookie, void *data, int size)
 {
-  // The perf event data is not aligned, so we use memcpy to copy the data and
-  // avoid UBSAN errors. Using an std::vector guarantees that it will be aligned
-  // to the largest type. See:
-  // https://stackoverflow.com/questions/8456236/how-is-a-vectors-data-aligned.
-  std::vector<uint8_t> data_aligned;
-  data_aligned.resize(size);
-  memcpy(data_aligned.data(), data, size);
-
   auto *bpftrace = static_cast<BPFtrace *>(cb_cookie);
-  auto *arg_data = data_aligned.data();
+  // The perf event data is not aligned. Fields are read with memcpy (see
+  // get_arg_values) rather than copying the whole event to aligned storage.
+  auto *arg_data = static_cast<uint8_t *>(data);
 
-  auto printf_id = *reinterpret_cast<uint64_t *>(arg_data);
+  uint64_t printf_id;
+  memcpy(&printf_id, arg_data, sizeof(printf_id));
 
   int err;
 
@@ -221,17 +235,30 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
     auto *exit = static_cast<AsyncEvent::Exit *>(data);
     BPFtrace::exit_code = exit->exit_code;
     bpftrace->request_finalize();
+    bpftrace->flush_output();
     return;
   } else if (printf_id == asyncactionint(AsyncAction::print)) {
     auto *print = static_cast<AsyncEvent::Print *>(data);
     const auto &map = bpftrace->bytecode_.getMap(print->mapid);
 
     err = bpftrace->print_map(map, print->top, print->div);
+    bpftrace->flush_output();
 
     if (err)
       LOG(BUG) << "Could not print map with ident \"" << map.name()
                << "\", err=" << std::to_string(err);
     return;
+  } else if (printf_id == asyncactionint(AsyncAction::print_clear)) {
+    auto *print = static_cast<AsyncEvent::Print *>(data);
+    const auto &map = bpftrace->bytecode_.getMap(print->mapid);
+
+    err = bpftrace->print_map(map, print->top, print->div, true);
+    bpftrace->flush_output();
+
+    if (err)
+      LOG(BUG) << "Could not print and clear map with ident \"" << map.name()
+               << "\", err=" << std::to_string(err);
+    return;
   } else if (printf_id == asyncactionint(AsyncAction::print_non_map)) {
     auto *print = static_cast<AsyncEvent::PrintNonMap *>(data);
     const SizedType &ty = bpftrace->resources.non_map_print_args.at(
@@ -407,7 +434,7 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
     auto id = printf_id - asyncactionint(AsyncAction::syscall);
     auto &fmt = std::get<0>(bpftrace->resources.system_args[id]);
     auto &args = std::get<1>(bpftrace->resources.system_args[id]);
-    auto arg_values = bpftrace->get_arg_values(args, arg_data);
+    const auto &arg_values = bpftrace->get_arg_values(args, arg_data);
 
     bpftrace->out_->message(MessageType::syscall,
                             util::exec_system(
@@ -418,7 +445,7 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
     auto id = printf_id - asyncactionint(AsyncAction::cat);
     auto &fmt = std::get<0>(bpftrace->resources.cat_args[id]);
     auto &args = std::get<1>(bpftrace->resources.cat_args[id]);
-    auto arg_values = bpftrace->get_arg_values(args, arg_data);
+    const auto &arg_values = bpftrace->get_arg_values(args, arg_data);
 
     std::stringstream buf;
     util::cat_file(fmt.format_str(arg_values).c_str(),
@@ -432,7 +459,7 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
   // printf
   auto &fmt = std::get<0>(bpftrace->resources.printf_args[printf_id]);
   auto &args = std::get<1>(bpftrace->resources.printf_args[printf_id]);
-  auto arg_values = bpftrace->get_arg_values(args, arg_data);
+  const auto &arg_values = bpftrace->get_arg_values(args, arg_data);
 
   bpftrace->out_->message(MessageType::printf,
                           fmt.format_str(arg_values),
@@ -445,32 +472,61 @@ int ringbuf_printer(void *cb_cookie, void *data, size_t size)
   return 0;
 }
 
-std::vector<std::unique_ptr<IPrintable>> BPFtrace::get_arg_values(
+// Hands raw events over to the output thread instead of formatting them on
+// the polling thread.
+void perf_event_enqueuer(void *cb_cookie, void *data, int size)
+{
+  auto *bpftrace = static_cast<BPFtrace *>(cb_cookie);
+  if (!bpftrace->event_queue_->push(data, size))
+    bpftrace->events_lost_++;
+}
+
+int ringbuf_enqueuer(void *cb_cookie, void *data, size_t size)
+{
+  perf_event_enqueuer(cb_cookie, data, size);
+  return 0;
+}
+
+// Event data is not necessarily aligned, so fields are copied out of it
+template <typename T>
+static T read_field(const uint8_t *data, size_t offset)
+{
+  T value;
+  memcpy(&value, data + offset, sizeof(value));
+  return value;
+}
+
+const std::vector<PrintableValue> &BPFtrace::get_arg_values(
     const std::vector<Field> &args,
-    uint8_t *arg_data)
+    const uint8_t *arg_data)
 {
-  std::vector<std::unique_ptr<IPrintable>> arg_values;
+  // The values are reused by the next event, along with the storage of the
+  // strings in them
+  arg_values_.resize(args.size());
 
-  for (auto arg : args) {
+  for (size_t i = 0; i < args.size(); i++) {
+    const auto &arg = args[i];
+    const auto *field = arg_data + arg.offset;
+    auto &value = arg_values_[i];
     switch (arg.type.GetTy()) {
       case Type::integer:
         if (arg.type.IsSigned()) {
           int64_t val = 0;
           switch (arg.type.GetIntBitWidth()) {
             case 64:
-              val = *reinterpret_cast<int64_t *>(arg_data + arg.offset);
+              val = read_field<int64_t>(field, 0);
               break;
             case 32:
-              val = *reinterpret_cast<int32_t *>(arg_data + arg.offset);
+              val = read_field<int32_t>(field, 0);
               break;
             case 16:
-              val = *reinterpret_cast<int16_t *>(arg_data + arg.offset);
+              val = read_field<int16_t>(field, 0);
               break;
             case 8:
-              val = *reinterpret_cast<int8_t *>(arg_data + arg.offset);
+              val = read_field<int8_t>(field, 0);
               break;
             case 1:
-              val = *reinterpret_cast<int8_t *>(arg_data + arg.offset);
+              val = read_field<int8_t>(field, 0);
               break;
             default:
               throw util::FatalUserException(
@@ -478,24 +534,24 @@ std::vector<std::unique_ptr<IPrintable>> BPFtrace::get_arg_values(
                   "8, 4, 2 and byte supported. " +
                   std::to_string(arg.type.GetSize()) + "provided");
           }
-          arg_values.push_back(std::make_unique<PrintableSInt>(val));
+          value.set_sint(val);
         } else {
           uint64_t val = 0;
           switch (arg.type.GetIntBitWidth()) {
             case 64:
-              val = *reinterpret_cast<uint64_t *>(arg_data + arg.offset);
+              val = read_field<uint64_t>(field, 0);
               break;
             case 32:
-              val = *reinterpret_cast<uint32_t *>(arg_data + arg.offset);
+              val = read_field<uint32_t>(field, 0);
               break;
             case 16:
-              val = *reinterpret_cast<uint16_t *>(arg_data + arg.offset);
+              val = read_field<uint16_t>(field, 0);
               break;
             case 8:
-              val = *reinterpret_cast<uint8_t *>(arg_data + arg.offset);
+              val = read_field<uint8_t>(field, 0);
               break;
             case 1:
-              val = *reinterpret_cast<uint8_t *>(arg_data + arg.offset);
+              val = read_field<uint8_t>(field, 0);
               break;
             default:
               throw util::FatalUserException(
@@ -506,107 +562,85 @@ std::vector<std::unique_ptr<IPrintable>> BPFtrace::get_arg_values(
 
           // bpftrace represents enums as unsigned integers
           if (arg.type.IsEnumTy()) {
-            auto enum_name = arg.type.GetName();
+            const auto &enum_name = arg.type.GetName();
             if (enum_defs_.contains(enum_name) &&
                 enum_defs_[enum_name].contains(val)) {
-              arg_values.push_back(
-                  std::make_unique<PrintableEnum>(val,
-                                                  enum_defs_[enum_name][val]));
+              value.set_enum(val, enum_defs_[enum_name][val]);
             } else {
-              arg_values.push_back(
-                  std::make_unique<PrintableEnum>(val, std::to_string(val)));
+              value.set_enum(val, std::to_string(val));
             }
           } else {
-            arg_values.push_back(std::make_unique<PrintableInt>(val));
+            value.set_uint(val);
           }
         }
         break;
       case Type::string: {
-        auto *p = reinterpret_cast<char *>(arg_data + arg.offset);
-        arg_values.push_back(std::make_unique<PrintableString>(
-            std::string(p, strnlen(p, arg.type.GetSize())),
-            config_->max_strlen,
-            config_->str_trunc_trailer.c_str()));
+        const auto *p = reinterpret_cast<const char *>(field);
+        value.set_string(std::string_view(p, strnlen(p, arg.type.GetSize())),
+                         config_->max_strlen,
+                         config_->str_trunc_trailer);
         break;
       }
       case Type::buffer: {
-        auto length =
-            reinterpret_cast<AsyncEvent::Buf *>(arg_data + arg.offset)->length;
-        arg_values.push_back(std::make_unique<PrintableBuffer>(
-            reinterpret_cast<AsyncEvent::Buf *>(arg_data + arg.offset)->content,
-            length));
+        const auto *buf = reinterpret_cast<const AsyncEvent::Buf *>(field);
+        value.set_buffer(buf->content,
+                         read_field<uint32_t>(
+                             field, offsetof(AsyncEvent::Buf, length)));
         break;
       }
       case Type::ksym_t:
-        arg_values.push_back(std::make_unique<PrintableString>(resolve_ksym(
-            *reinterpret_cast<uint64_t *>(arg_data + arg.offset))));
+        value.set_string(resolve_ksym(read_field<uint64_t>(field, 0)));
         break;
       case Type::usym_t:
-        arg_values.push_back(std::make_unique<PrintableString>(resolve_usym(
-            *reinterpret_cast<uint64_t *>(arg_data + arg.offset),
-            *reinterpret_cast<int32_t *>(arg_data + arg.offset + 8),
-            *reinterpret_cast<int32_t *>(arg_data + arg.offset + 12))));
+        value.set_string(resolve_usym(read_field<uint64_t>(field, 0),
+                                      read_field<int32_t>(field, 8),
+                                      read_field<int32_t>(field, 12)));
         break;
       case Type::inet:
-        arg_values.push_back(std::make_unique<PrintableString>(resolve_inet(
-            *reinterpret_cast<int64_t *>(arg_data + arg.offset),
-            reinterpret_cast<uint8_t *>(arg_data + arg.offset + 8))));
+        value.set_string(resolve_inet(read_field<int64_t>(field, 0),
+                                      field + 8));
         break;
       case Type::username:
-        arg_values.push_back(std::make_unique<PrintableString>(
-            resolve_uid(*reinterpret_cast<uint64_t *>(arg_data + arg.offset))));
+        value.set_string(resolve_uid(read_field<uint64_t>(field, 0)));
         break;
       case Type::kstack_t:
-        arg_values.push_back(std::make_unique<PrintableString>(
-            get_stack(*reinterpret_cast<int64_t *>(arg_data + arg.offset),
-                      *reinterpret_cast<uint32_t *>(arg_data + arg.offset + 8),
-                      -1,
-                      -1,
-                      false,
-                      arg.type.stack_type,
-                      8)));
+        value.set_string(get_stack(read_field<int64_t>(field, 0),
+                                   read_field<uint32_t>(field, 8),
+                                   -1,
+                                   -1,
+                                   false,
+                                   arg.type.stack_type,
+                                   8));
         break;
       case Type::ustack_t:
-        arg_values.push_back(std::make_unique<PrintableString>(
-            get_stack(*reinterpret_cast<int64_t *>(arg_data + arg.offset),
-                      *reinterpret_cast<uint32_t *>(arg_data + arg.offset + 8),
-                      *reinterpret_cast<int32_t *>(arg_data + arg.offset + 16),
-                      *reinterpret_cast<int32_t *>(arg_data + arg.offset + 20),
-                      true,
-                      arg.type.stack_type,
-                      8)));
+        value.set_string(get_stack(read_field<int64_t>(field, 0),
+                                   read_field<uint32_t>(field, 8),
+                                   read_field<int32_t>(field, 16),
+                                   read_field<int32_t>(field, 20),
+                                   true,
+                                   arg.type.stack_type,
+                                   8));
         break;
-      case Type::timestamp:
-        arg_values.push_back(
-            std::make_unique<PrintableString>(resolve_timestamp(
-                reinterpret_cast<AsyncEvent::Strftime *>(arg_data + arg.offset)
-                    ->mode,
-                reinterpret_cast<AsyncEvent::Strftime *>(arg_data + arg.offset)
-                    ->strftime_id,
-                reinterpret_cast<AsyncEvent::Strftime *>(arg_data + arg.offset)
-                    ->nsecs)));
+      case Type::timestamp: {
+        auto ts = read_field<AsyncEvent::Strftime>(field, 0);
+        value.set_string(
+            resolve_timestamp(ts.mode, ts.strftime_id, ts.nsecs));
         break;
+      }
       case Type::pointer:
-        arg_values.push_back(std::make_unique<PrintableInt>(
-            *reinterpret_cast<uint64_t *>(arg_data + arg.offset)));
+        value.set_uint(read_field<uint64_t>(field, 0));
         break;
       case Type::mac_address:
-        arg_values.push_back(
-            std::make_unique<PrintableString>(resolve_mac_address(
-                reinterpret_cast<uint8_t *>(arg_data + arg.offset))));
+        value.set_string(resolve_mac_address(field));
         break;
-      case Type::cgroup_path_t:
-        arg_values.push_back(std::make_unique<PrintableString>(
-            resolve_cgroup_path(reinterpret_cast<AsyncEvent::CgroupPath *>(
-                                    arg_data + arg.offset)
-                                    ->cgroup_path_id,
-                                reinterpret_cast<AsyncEvent::CgroupPath *>(
-                                    arg_data + arg.offset)
-                                    ->cgroup_id)));
+      case Type::cgroup_path_t: {
+        auto cgroup_path = read_field<AsyncEvent::CgroupPath>(field, 0);
+        value.set_string(resolve_cgroup_path(cgroup_path.cgroup_path_id,
+                                             cgroup_path.cgroup_id));
         break;
+      }
       case Type::strerror_t:
-        arg_values.push_back(std::make_unique<PrintableString>(
-            strerror(*reinterpret_cast<uint64_t *>(arg_data + arg.offset))));
+        value.set_string(strerror(read_field<uint64_t>(field, 0)));
         break;
         // fall through
       default:
@@ -614,7 +648,7 @@ std::vector<std::unique_ptr<IPrintable>> BPFtrace::get_arg_values(
     }
   }
 
-  return arg_values;
+  return arg_values_;
 }
 
 void BPFtrace::add_param(const std::string &param)
@@ -638,7 +672,11 @@ size_t BPFtrace::num_params() const
 void perf_event_lost(void *cb_cookie, uint64_t lost)
 {
   auto *bpftrace = static_cast<BPFtrace *>(cb_cookie);
-  bpftrace->out_->lost_events(lost);
+  // Output must only be written from the output thread when there is one
+  if (bpftrace->event_queue_)
+    bpftrace->events_lost_ += lost;
+  else
+    bpftrace->out_->lost_events(lost);
 }
 
 std::vector<std::unique_ptr<AttachedProbe>> BPFtrace::attach_usdt_probe(
@@ -1044,8 +1082,16 @@ int BPFtrace::run(BpfBytecode bytecode)
 
 int BPFtrace::setup_output()
 {
+  if (output_buffer_)
+    output_buffer_->set_flush_policy(
+        config_->output_flush_bytes,
+        std::chrono::milliseconds(config_->output_flush_ms));
+  if (config_->output_queue_size > 0)
+    start_output_thread();
   if (is_ringbuf_enabled()) {
-    setup_ringbuf();
+    int err = setup_ringbuf();
+    if (err)
+      return err;
   }
   int err = setup_event_loss();
   if (err)
@@ -1067,7 +1113,8 @@ int BPFtrace::setup_perf_events()
   std::vector<int> cpus = util::get_online_cpus();
   online_cpus_ = cpus.size();
   for (int cpu : cpus) {
-    void *reader = bpf_open_perf_buffer(&perf_event_printer,
+    void *reader = bpf_open_perf_buffer(event_queue_ ? &perf_event_enqueuer
+                                                     : &perf_event_printer,
                                         &perf_event_lost,
                                         this,
                                         -1,
@@ -1097,10 +1144,49 @@ int BPFtrace::setup_perf_events()
   return 0;
 }
 
-void BPFtrace::setup_ringbuf()
+int BPFtrace::setup_ringbuf()
 {
-  ringbuf_ = ring_buffer__new(
-      bytecode_.getMap(MapType::Ringbuf).fd(), ringbuf_printer, this, nullptr);
+  auto *callback = event_queue_ ? ringbuf_enqueuer : ringbuf_printer;
+  if (!bytecode_.hasMap(MapType::RingbufArray)) {
+    ringbuf_ = ring_buffer__new(
+        bytecode_.getMap(MapType::Ringbuf).fd(), callback, this, nullptr);
+    return 0;
+  }
+
+  // Per-CPU ring buffers: create one buffer for each group of CPUs, store it
+  // in the array the BPF programs index by CPU and poll all of them through a
+  // single ring_buffer manager.
+  const auto &ringbuf_array = bytecode_.getMap(MapType::RingbufArray);
+  for (uint32_t i = 0; i < ringbuf_array.max_entries(); i++) {
+    int fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF,
+                            nullptr,
+                            0,
+                            0,
+                            config_->perf_rb_pages * 4096,
+                            nullptr);
+    if (fd < 0) {
+      LOG(ERROR) << "Failed to create ring buffer: " << strerror(-fd);
+      return -1;
+    }
+    ringbuf_fds_.push_back(fd);
+
+    if (bpf_update_elem(ringbuf_array.fd(), &i, &fd, 0)) {
+      LOG(ERROR) << "Failed to add ring buffer to " << ringbuf_array.name();
+      return -1;
+    }
+
+    if (!ringbuf_) {
+      ringbuf_ = ring_buffer__new(fd, callback, this, nullptr);
+      if (!ringbuf_) {
+        LOG(ERROR) << "Failed to open ring buffer";
+        return -1;
+      }
+    } else if (int err = ring_buffer__add(ringbuf_, fd, callback, this)) {
+      LOG(ERROR) << "Failed to open ring buffer: " << strerror(-err);
+      return -1;
+    }
+  }
+  return 0;
 }
 
 int BPFtrace::setup_event_loss()
@@ -1115,14 +1201,93 @@ int BPFtrace::setup_event_loss()
   return 0;
 }
 
+void BPFtrace::flush_output()
+{
+  if (output_buffer_)
+    output_buffer_->flush();
+}
+
 void BPFtrace::teardown_output()
 {
   if (is_ringbuf_enabled())
     ring_buffer__free(ringbuf_);
 
+  if (!ringbuf_fds_.empty()) {
+    const auto &loss_map = bytecode_.getMap(MapType::EventLossCounter);
+    auto cpus_per_buffer = config_->ringbuf_cpus_per_buffer;
+    for (uint32_t i = 0; i < ringbuf_fds_.size(); i++) {
+      uint64_t lost = 0;
+      bpf_lookup_elem(loss_map.fd(), &i, &lost);
+      // The last buffer may be shared by fewer CPUs than the others
+      uint64_t first_cpu = i * cpus_per_buffer;
+      uint64_t last_cpu = std::min<uint64_t>(first_cpu + cpus_per_buffer - 1,
+                                             max_cpu_id_);
+      LOG(V1) << "Ring buffer " << i << " (CPUs " << first_cpu << "-"
+              << last_cpu << "): lost " << lost << " events";
+      close(ringbuf_fds_[i]);
+    }
+    ringbuf_fds_.clear();
+  }
+
   if (is_perf_event_enabled())
     // Calls perf_reader_free() on all open perf buffers.
     open_perf_buffers_.clear();
+
+  stop_output_thread();
+}
+
+void BPFtrace::start_output_thread()
+{
+  event_queue_ = std::make_unique<EventQueue>(config_->output_queue_size);
+  output_thread_ = std::thread(&BPFtrace::output_thread_loop, this);
+}
+
+void BPFtrace::stop_output_thread()
+{
+  if (!event_queue_)
+    return;
+
+  // The output thread consumes whatever is still queued before exiting
+  event_queue_->close();
+  output_thread_.join();
+
+  LOG(V1) << "Output queue: depth " << event_queue_->depth()
+          << ", high-water mark " << event_queue_->high_water_mark()
+          << " events, full " << event_queue_->full_waits() << " times ("
+          << event_queue_->capacity() << " bytes)";
+
+  // Report the losses which happened after the last check of the thread
+  handle_event_loss();
+  event_queue_.reset();
+}
+
+void BPFtrace::output_thread_loop()
+{
+  auto last_loss_check = std::chrono::steady_clock::now();
+
+  try {
+    while (true) {
+      auto event = event_queue_->front(timeout_ms);
+      if (!event.empty()) {
+        perf_event_printer(this, event.data(), event.size());
+        event_queue_->pop();
+      } else if (event_queue_->closed()) {
+        break;
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      if (now - last_loss_check >= std::chrono::milliseconds(timeout_ms)) {
+        handle_event_loss();
+        last_loss_check = now;
+      }
+      if (output_buffer_)
+        output_buffer_->flush_if_due();
+    }
+  } catch (...) {
+    // Rethrown on the polling thread by poll_output()
+    output_thread_error_ = std::current_exception();
+    event_queue_->close();
+  }
 }
 
 void BPFtrace::poll_output(bool drain)
@@ -1152,6 +1317,7 @@ void BPFtrace::poll_output(bool drain)
     return;
   }
 
+  bool finalize_handled = false;
   while (true) {
     if (do_poll_perf_event) {
       ready = poll_perf_events();
@@ -1164,11 +1330,21 @@ void BPFtrace::poll_output(bool drain)
       }
     }
 
-    // print loss events
-    handle_event_loss();
+    // print loss events, and write out buffered output while idle
+    if (!event_queue_) {
+      handle_event_loss();
+      if (output_buffer_)
+        output_buffer_->flush_if_due();
+    }
 
     if (do_poll_ringbuf) {
-      ready = ring_buffer__poll(ringbuf_, timeout_ms);
+      // ringbuf_max_latency_ms is bounded by the config parser
+      ready = ring_buffer__poll(
+          ringbuf_, static_cast<int>(config_->ringbuf_max_latency_ms));
+      // With batched wakeups, there may be events pending which did not
+      // signal the poll
+      if (ready == 0 && config_->ringbuf_wakeup_batch > 0)
+        ready = ring_buffer__consume(ringbuf_);
       if (should_retry(ready)) {
         continue;
       }
@@ -1177,14 +1353,26 @@ void BPFtrace::poll_output(bool drain)
       }
     }
     if (!do_poll_perf_event && !do_poll_ringbuf) {
-      return;
+      break;
+    }
+
+    if (event_queue_) {
+      // The output thread has failed, poll no further
+      if (event_queue_->closed())
+        break;
+      // exit() is processed on the output thread, which only flags the
+      // request. Detach the probes from here so that the buffers drain.
+      if (finalize_ && !finalize_handled) {
+        request_finalize();
+        finalize_handled = true;
+      }
     }
 
     // If we are tracing a specific pid and it has exited, we should exit
     // as well b/c otherwise we'd be tracing nothing.
     if ((procmon_ && !procmon_->is_alive()) ||
         (child_ && !child_->is_alive())) {
-      return;
+      break;
     }
 
     if (BPFtrace::sigusr1_recv) {
@@ -1193,12 +1381,20 @@ void BPFtrace::poll_output(bool drain)
       if (sigusr1_prog_fd_.has_value()) {
         if (::bpf_prog_test_run_opts(*sigusr1_prog_fd_, nullptr)) {
           LOG(ERROR) << "Failed to run signal probe";
-          return;
+          break;
         }
         LOG(V1) << "Attaching self:signal";
       }
     }
   }
+
+  if (event_queue_) {
+    // Let the output thread catch up so that callers observe the output of
+    // every event polled so far.
+    event_queue_->wait_empty();
+    if (output_thread_error_)
+      std::rethrow_exception(output_thread_error_);
+  }
 }
 
 int BPFtrace::poll_perf_events()
@@ -1216,11 +1412,19 @@ int BPFtrace::poll_perf_events()
 
 void BPFtrace::handle_event_loss()
 {
+  if (uint64_t lost = events_lost_.exchange(0))
+    out_->lost_events(lost);
+
+  // With per-CPU ring buffers there is one counter per buffer
+  const auto &loss_map = bytecode_.getMap(MapType::EventLossCounter);
   uint64_t current_value = 0;
-  if (bpf_lookup_elem(bytecode_.getMap(MapType::EventLossCounter).fd(),
-                      const_cast<uint32_t *>(&event_loss_cnt_key_),
-                      &current_value)) {
-    LOG(ERROR) << "fail to get event loss counter";
+  for (uint32_t key = 0; key < loss_map.max_entries(); key++) {
+    uint64_t value = 0;
+    if (bpf_lookup_elem(loss_map.fd(), &key, &value)) {
+      LOG(ERROR) << "fail to get event loss counter";
+      continue;
+    }
+    current_value += value;
   }
   if (current_value) {
     if (current_value > event_loss_count_) {
@@ -1253,25 +1457,17 @@ int BPFtrace::print_maps()
 // clear a map
 int BPFtrace::clear_map(const BpfMap &map)
 {
+  // Print all keys again, even those which come back with the same value
+  map_deltas_.erase(map.name());
+
   if (!map.is_clearable())
     return zero_map(map);
 
-  uint8_t *old_key = nullptr;
-  auto key = std::vector<uint8_t>(map.key_size());
-
-  // snapshot keys, then operate on them
-  std::vector<std::vector<uint8_t>> keys;
-  while (bpf_get_next_key(map.fd(), old_key, key.data()) == 0) {
-    keys.push_back(key);
-    old_key = key.data();
-  }
-
-  for (auto &k : keys) {
-    int err = bpf_delete_elem(map.fd(), k.data());
-    if (err && err != -ENOENT) {
-      LOG(ERROR) << "failed to look up elem: " << err;
-      return -1;
-    }
+  uint64_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
+  int err = map.clear(nvalues, feature_->has_map_batch());
+  if (err) {
+    LOG(ERROR) << "failed to clear map: " << err;
+    return -1;
   }
 
   return 0;
@@ -1280,108 +1476,150 @@ int BPFtrace::clear_map(const BpfMap &map)
 // zero a map
 int BPFtrace::zero_map(const BpfMap &map)
 {
+  map_deltas_.erase(map.name());
+
   uint64_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
+  int err = map.zero_out(nvalues, feature_->has_map_batch());
+  if (err) {
+    LOG(ERROR) << "failed to zero map: " << err;
+    return -1;
+  }
 
-  uint8_t *old_key = nullptr;
-  auto key = std::vector<uint8_t>(map.key_size());
+  return 0;
+}
 
-  // snapshot keys, then operate on them
-  std::vector<std::vector<uint8_t>> keys;
-  while (bpf_get_next_key(map.fd(), old_key, key.data()) == 0) {
-    keys.push_back(key);
-    old_key = key.data();
-  }
+// Sorts map elements in ascending order of `sort_value(value)`, keeping the
+// original order of equal elements. The sort values are computed once per
+// element instead of on every comparison, which matters for per-CPU maps.
+// With `top` set, only the last `top` elements end up in order, the ones
+// before are smaller but left unsorted.
+template <typename T, typename F>
+static void sort_by(MapElements &values_by_key, uint32_t top, F sort_value)
+{
+  std::vector<std::pair<T, size_t>> order;
+  order.reserve(values_by_key.size());
+  for (size_t i = 0; i < values_by_key.size(); i++)
+    order.emplace_back(sort_value(values_by_key[i].value), i);
 
-  int value_size = map.value_size() * nvalues;
-  std::vector<uint8_t> zero(value_size, 0);
-  for (auto &k : keys) {
-    int err = bpf_update_elem(map.fd(), k.data(), zero.data(), BPF_EXIST);
+  // Ties are broken by the original position, which makes this stable
+  auto first = order.begin() + util::top_skip(order.size(), top);
+  if (first != order.begin())
+    std::ranges::nth_element(order, first);
+  std::sort(first, order.end());
 
-    if (err && err != -ENOENT) {
-      LOG(ERROR) << "failed to look up elem: " << err;
-      return -1;
-    }
+  std::vector<size_t> indices;
+  indices.reserve(order.size());
+  for (const auto &[_, i] : order)
+    indices.push_back(i);
+  values_by_key.reorder(indices);
+}
+
+bool BPFtrace::sort_by_value(const SizedType &value_type,
+                             uint32_t top,
+                             uint64_t nvalues,
+                             MapElements &values_by_key)
+{
+  if (value_type.IsCountTy() || value_type.IsSumTy() || value_type.IsIntTy()) {
+    if (value_type.IsSigned())
+      sort_by<int64_t>(values_by_key, top, [&](const auto &value) {
+        return util::reduce_value<int64_t>(value, nvalues);
+      });
+    else
+      sort_by<uint64_t>(values_by_key, top, [&](const auto &value) {
+        return util::reduce_value<uint64_t>(value, nvalues);
+      });
+  } else if (value_type.IsMinTy() || value_type.IsMaxTy()) {
+    sort_by<uint64_t>(values_by_key, top, [&](const auto &value) {
+      return util::min_max_value<uint64_t>(
+          value, nvalues, value_type.IsMaxTy());
+    });
+  } else if (value_type.IsAvgTy() || value_type.IsStatsTy()) {
+    if (value_type.IsSigned())
+      sort_by<int64_t>(values_by_key, top, [&](const auto &value) {
+        return util::avg_value<int64_t>(value, nvalues);
+      });
+    else
+      sort_by<uint64_t>(values_by_key, top, [&](const auto &value) {
+        return util::avg_value<uint64_t>(value, nvalues);
+      });
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Reads all elements of a map for printing. With `clear` set, clearable maps
+// are emptied by the same syscalls that read them, other maps are zeroed
+// afterwards.
+int BPFtrace::collect_map_elements(const BpfMap &map,
+                                   bool clear,
+                                   MapElements &elements)
+{
+  uint64_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
+  bool del = clear && map.is_clearable();
+  // map_read_threads is bounded by the config parser
+  uint32_t threads = config_->map_read_threads
+                         ? static_cast<uint32_t>(config_->map_read_threads)
+                         : std::thread::hardware_concurrency();
+  int err = map.collect_elements(
+      nvalues, feature_->has_map_batch(), elements, del, threads);
+  if (err) {
+    LOG(ERROR) << "failed to look up elem: " << err;
+    return -1;
   }
 
+  if (clear && !del)
+    return zero_map(map);
   return 0;
 }
 
-int BPFtrace::print_map(const BpfMap &map, uint32_t top, uint32_t div)
+int BPFtrace::print_map(const BpfMap &map,
+                        uint32_t top,
+                        uint32_t div,
+                        bool clear)
 {
   const auto &map_info = resources.maps_info.at(map.name());
   const auto &value_type = map_info.value_type;
   if (value_type.IsHistTy() || value_type.IsLhistTy())
-    return print_map_hist(map, top, div);
+    return print_map_hist(map, top, div, clear);
 
   uint64_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
 
-  uint8_t *old_key = nullptr;
-  auto key = std::vector<uint8_t>(map.key_size());
-
-  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-      values_by_key;
-
-  while (bpf_get_next_key(map.fd(), old_key, key.data()) == 0) {
-    auto value = std::vector<uint8_t>(map.value_size() * nvalues);
-    int err = bpf_lookup_elem(map.fd(), key.data(), value.data());
-    if (err == -ENOENT) {
-      // key was removed by the eBPF program during bpf_get_next_key() and
-      // bpf_lookup_elem(), let's skip this key
-      continue;
-    } else if (err) {
-      LOG(ERROR) << "failed to look up elem: " << err;
-      return -1;
-    }
-
-    values_by_key.emplace_back(key, value);
+  MapElements values_by_key;
+  int err = collect_map_elements(map, clear, values_by_key);
+  if (err)
+    return err;
 
-    old_key = key.data();
+  if (config_->print_delta) {
+    auto &delta = map_deltas_[map.name()];
+    delta.start();
+    values_by_key.erase_if([&](const MapElements::Element &elem) {
+      return !delta.update(elem.key, elem.value);
+    });
+    delta.finish();
   }
+  if (clear)
+    map_deltas_.erase(map.name());
 
-  if (value_type.IsCountTy() || value_type.IsSumTy() || value_type.IsIntTy()) {
-    bool is_signed = value_type.IsSigned();
-    std::ranges::sort(values_by_key,
-
-                      [&](auto &a, auto &b) {
-                        if (is_signed)
-                          return util::reduce_value<int64_t>(a.second,
-                                                             nvalues) <
-                                 util::reduce_value<int64_t>(b.second, nvalues);
-                        return util::reduce_value<uint64_t>(a.second, nvalues) <
-                               util::reduce_value<uint64_t>(b.second, nvalues);
-                      });
-  } else if (value_type.IsMinTy() || value_type.IsMaxTy()) {
-    std::ranges::sort(values_by_key,
-
-                      [&](auto &a, auto &b) {
-                        return util::min_max_value<uint64_t>(
-                                   a.second, nvalues, value_type.IsMaxTy()) <
-                               util::min_max_value<uint64_t>(
-                                   b.second, nvalues, value_type.IsMaxTy());
-                      });
-  } else if (value_type.IsAvgTy() || value_type.IsStatsTy()) {
-    if (value_type.IsSigned()) {
-      std::ranges::sort(values_by_key,
-
-                        [&](auto &a, auto &b) {
-                          return util::avg_value<int64_t>(a.second, nvalues) <
-                                 util::avg_value<int64_t>(b.second, nvalues);
-                        });
-    } else {
-      std::ranges::sort(values_by_key,
-
-                        [&](auto &a, auto &b) {
-                          return util::avg_value<uint64_t>(a.second, nvalues) <
-                                 util::avg_value<uint64_t>(b.second, nvalues);
-                        });
-    }
-  } else {
+  // Only the top elements are printed, so leave the rest unsorted. Stats
+  // maps are always printed in full.
+  uint32_t sort_top = value_type.IsStatsTy() ? 0 : top;
+  if (!sort_by_value(value_type, sort_top, nvalues, values_by_key))
     sort_by_key(map_info.key_type, values_by_key);
-  };
 
   if (div == 0)
     div = 1;
 
+  // Symbolicate the stacks of all printed elements in one go
+  size_t skip = util::top_skip(values_by_key.size(), sort_top);
+  std::vector<std::span<const uint8_t>> printed_keys, printed_values;
+  for (size_t i = skip; i < values_by_key.size(); i++) {
+    printed_keys.push_back(values_by_key[i].key);
+    printed_values.push_back(values_by_key[i].value);
+  }
+  cache_stacks(map_info.key_type, printed_keys);
+  cache_stacks(value_type, printed_values);
+
   if (value_type.IsAvgTy() || value_type.IsStatsTy()) {
     out_->map_stats(*this, map, top, div, values_by_key);
     return 0;
@@ -1391,69 +1629,86 @@ int BPFtrace::print_map(const BpfMap &map, uint32_t top, uint32_t div)
   return 0;
 }
 
-int BPFtrace::print_map_hist(const BpfMap &map, uint32_t top, uint32_t div)
+int BPFtrace::print_map_hist(const BpfMap &map,
+                             uint32_t top,
+                             uint32_t div,
+                             bool clear)
 {
   // A hist-map adds an extra 8 bytes onto the end of its key for storing
   // the bucket number.
   // e.g. A map defined as: @x[1, 2] = @hist(3);
   // would actually be stored with the key: [1, 2, 3]
+  // Unless it is dense, then the key is [1, 2] and the value holds an array
+  // of all buckets.
 
   uint64_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
 
-  uint8_t *old_key = nullptr;
-  auto key = std::vector<uint8_t>(map.key_size());
-
-  std::map<std::vector<uint8_t>, std::vector<uint64_t>> values_by_key;
+  MapElements elements;
+  int err = collect_map_elements(map, clear, elements);
+  if (err)
+    return err;
 
+  Histograms histograms;
   const auto &map_info = resources.maps_info.at(map.name());
-  while (bpf_get_next_key(map.fd(), old_key, key.data()) == 0) {
-    auto key_prefix = std::vector<uint8_t>(map_info.key_type.GetSize());
-    auto bucket = util::read_data<uint64_t>(key.data() +
-                                            map_info.key_type.GetSize());
-
-    for (size_t i = 0; i < map_info.key_type.GetSize(); i++)
-      key_prefix.at(i) = key.at(i);
-
-    auto value = std::vector<uint8_t>(map.value_size() * nvalues);
-    int err = bpf_lookup_elem(map.fd(), key.data(), value.data());
-    if (err == -ENOENT) {
-      // key was removed by the eBPF program during bpf_get_next_key() and
-      // bpf_lookup_elem(), let's skip this key
-      continue;
-    } else if (err) {
-      LOG(ERROR) << "failed to look up elem: " << err;
-      return -1;
+  if (map_info.dense_hist) {
+    const size_t num_buckets = map_info.dense_hist_type().GetNumElements();
+    std::vector<uint64_t> counts(num_buckets);
+    for (const auto &[key, value] : elements) {
+      // The value holds all buckets of the key, once for each CPU
+      std::ranges::fill(counts, 0);
+      size_t stride = value.size() / nvalues;
+      for (uint64_t cpu = 0; cpu < nvalues; cpu++) {
+        const uint8_t *cpu_value = value.data() + (cpu * stride);
+        for (size_t i = 0; i < num_buckets; i++)
+          counts[i] += util::read_data<uint64_t>(cpu_value + (i * 8));
+      }
+      auto &hist = histograms.get(key);
+      for (size_t i = 0; i < num_buckets; i++)
+        hist.add(i, counts[i]);
     }
-
-    if (!values_by_key.contains(key_prefix)) {
-      // New key - create a list of buckets for it
-      if (map_info.value_type.IsHistTy())
-        values_by_key[key_prefix] = std::vector<uint64_t>(65 * 32);
-      else
-        values_by_key[key_prefix] = std::vector<uint64_t>(1002);
+  } else {
+    const size_t key_size = map_info.key_type.GetSize();
+    for (const auto &[key, value] : elements) {
+      auto bucket = util::read_data<uint64_t>(key.data() + key_size);
+      histograms.get(key.first(key_size))
+          .add(bucket, util::reduce_value<uint64_t>(value, nvalues));
     }
-    values_by_key[key_prefix].at(
-        bucket) = util::reduce_value<uint64_t>(value, nvalues);
-
-    old_key = key.data();
   }
-
-  // Sort based on sum of counts in all buckets
-  std::vector<std::pair<std::vector<uint8_t>, uint64_t>> total_counts_by_key;
-  for (auto &map_elem : values_by_key) {
-    int64_t sum = 0;
-    for (unsigned long i : map_elem.second) {
-      sum += i;
-    }
-    total_counts_by_key.emplace_back(map_elem.first, sum);
+  // The histograms hold all that is needed
+  elements = {};
+
+  if (config_->print_delta) {
+    auto &delta = map_deltas_[map.name()];
+    delta.start();
+    std::vector<uint64_t> buckets;
+    histograms.erase_if([&](const Histograms::Histogram &hist) {
+      buckets.clear();
+      for (const auto &bucket : hist.buckets()) {
+        buckets.push_back(bucket.index);
+        buckets.push_back(bucket.count);
+      }
+      return !delta.update(
+          hist.key(),
+          { reinterpret_cast<const uint8_t *>(buckets.data()),
+            buckets.size() * sizeof(uint64_t) });
+    });
+    delta.finish();
   }
-  std::ranges::sort(total_counts_by_key,
+  if (clear)
+    map_deltas_.erase(map.name());
 
-                    [&](auto &a, auto &b) { return a.second < b.second; });
+  histograms.sort_by_total(top);
+
+  // Symbolicate the stacks of all printed elements in one go
+  size_t skip = util::top_skip(histograms.size(), top);
+  std::vector<std::span<const uint8_t>> printed_keys;
+  for (const auto &hist : histograms | std::views::drop(skip))
+    printed_keys.push_back(hist.key());
+  cache_stacks(map_info.key_type, printed_keys);
 
   if (div == 0)
     div = 1;
-  out_->map_hist(*this, map, top, div, values_by_key, total_counts_by_key);
+  out_->map_hist(*this, map, top, div, histograms);
   return 0;
 }
 
@@ -1472,17 +1727,46 @@ std::optional<std::string> BPFtrace::get_watchpoint_binary_path() const
   }
 }
 
-std::string BPFtrace::get_stack(int64_t stackid,
-                                uint32_t nr_stack_frames,
-                                int32_t pid,
-                                int32_t probe_id,
-                                bool ustack,
-                                StackType stack_type,
-                                int indent)
+BPFtrace::StackCacheKey BPFtrace::stack_cache_key(int64_t stackid,
+                                                  uint32_t nr_stack_frames,
+                                                  int32_t pid,
+                                                  int32_t probe_id,
+                                                  bool ustack,
+                                                  StackType stack_type,
+                                                  int indent)
+{
+  // Stack ids are hashes of the stack contents, so a rendered stack can be
+  // reused for as long as the process runs the same program. The process is
+  // re-checked at most once a second, also while its stacks keep hitting the
+  // cache.
+  if (stack_cache_.capacity() != config_->stack_cache_size)
+    stack_cache_.set_capacity(config_->stack_cache_size);
+  return { .stackid = stackid,
+           .nr_stack_frames = nr_stack_frames,
+           .stack_type = stack_type,
+           .ustack = ustack,
+           .pid = ustack ? pid : 0,
+           .probe_id = ustack ? probe_id : 0,
+           .process_generation = ustack ? process_cache_.get(pid).generation
+                                        : 0,
+           .indent = indent };
+}
+
+bool BPFtrace::is_stack_cacheable(bool ustack) const
+{
+  return !ustack ||
+         config_->user_symbol_cache_type != UserSymbolCacheType::none;
+}
+
+bool BPFtrace::lookup_stack(int64_t stackid,
+                            uint32_t nr_stack_frames,
+                            int32_t pid,
+                            StackType stack_type,
+                            std::vector<uint64_t> &stack_trace)
 {
   struct stack_key stack_key = { .stackid = stackid,
                                  .nr_stack_frames = nr_stack_frames };
-  auto stack_trace = std::vector<uint64_t>(stack_type.limit);
+  stack_trace.resize(stack_type.limit);
   int err = bpf_lookup_elem(bytecode_.getMap(stack_type.name()).fd(),
                             &stack_key,
                             stack_trace.data());
@@ -1491,37 +1775,35 @@ std::string BPFtrace::get_stack(int64_t stackid,
     LOG(ERROR) << "failed to look up stack id: " << stackid
                << " stack length: " << nr_stack_frames << " (pid " << pid
                << "): " << err;
-    return "";
+    return false;
   }
+  stack_trace.resize(std::min<size_t>(nr_stack_frames, stack_type.limit));
+  return true;
+}
 
+std::string BPFtrace::render_stack(
+    std::span<const uint64_t> stack_trace,
+    const std::vector<std::vector<std::string>> &syms,
+    StackType stack_type,
+    int indent)
+{
   std::ostringstream stack;
   std::string padding(indent, ' ');
 
   stack << "\n";
-  for (uint32_t i = 0; i < nr_stack_frames;) {
-    uint64_t addr = stack_trace.at(i);
+  for (uint32_t i = 0; i < stack_trace.size();) {
+    uint64_t addr = stack_trace[i];
     if (stack_type.mode == StackMode::raw) {
       stack << std::hex << addr << std::endl;
       ++i;
       continue;
     }
-    std::vector<std::string> syms;
-    if (!ustack)
-      syms = resolve_ksym_stack(addr,
-                                true,
-                                stack_type.mode == StackMode::perf,
-                                config_->show_debug_info);
-    else
-      syms = resolve_usym_stack(addr,
-                                pid,
-                                probe_id,
-                                true,
-                                stack_type.mode == StackMode::perf,
-                                config_->show_debug_info);
-
-    std::string sym;
-    for (size_t sym_idx = 0; i < nr_stack_frames && sym_idx < syms.size();) {
-      sym = syms.at(sym_idx);
+
+    // Inlined functions take up frames too
+    const auto &frame_syms = syms.at(i);
+    for (size_t sym_idx = 0;
+         i < stack_trace.size() && sym_idx < frame_syms.size();) {
+      const auto &sym = frame_syms.at(sym_idx);
       switch (stack_type.mode) {
         case StackMode::bpftrace:
           stack << padding << sym << std::endl;
@@ -1543,41 +1825,185 @@ std::string BPFtrace::get_stack(int64_t stackid,
   return stack.str();
 }
 
-std::string BPFtrace::resolve_uid(uint64_t addr) const
+std::vector<std::vector<std::string>> BPFtrace::resolve_stack_frames(
+    std::span<const uint64_t> addrs,
+    int32_t pid,
+    int32_t probe_id,
+    bool ustack,
+    StackType stack_type)
 {
-  std::string file_name = "/etc/passwd";
-  std::string uid = std::to_string(addr);
-  std::string username;
+  if (stack_type.mode == StackMode::raw)
+    return {};
+  bool perf_mode = stack_type.mode == StackMode::perf;
+  if (!ustack)
+    return resolve_ksym_stack(addrs, true, perf_mode, config_->show_debug_info);
+  return resolve_usym_stack(
+      addrs, pid, probe_id, true, perf_mode, config_->show_debug_info);
+}
 
-  std::ifstream file(file_name);
-  if (file.fail()) {
-    LOG(ERROR) << strerror(errno) << ": " << file_name;
-    return username;
+std::string BPFtrace::get_stack(int64_t stackid,
+                                uint32_t nr_stack_frames,
+                                int32_t pid,
+                                int32_t probe_id,
+                                bool ustack,
+                                StackType stack_type,
+                                int indent)
+{
+  bool cacheable = is_stack_cacheable(ustack);
+  auto cache_key = stack_cache_key(
+      stackid, nr_stack_frames, pid, probe_id, ustack, stack_type, indent);
+  if (cacheable) {
+    if (const auto *cached = stack_cache_.get(cache_key))
+      return *cached;
   }
 
-  std::string line;
-  bool found = false;
+  std::vector<uint64_t> stack_trace;
+  if (!lookup_stack(stackid, nr_stack_frames, pid, stack_type, stack_trace))
+    return "";
+
+  // All frames are symbolicated at once
+  auto syms = resolve_stack_frames(
+      stack_trace, pid, probe_id, ustack, stack_type);
+  auto result = render_stack(stack_trace, syms, stack_type, indent);
+  if (cacheable)
+    stack_cache_.put(cache_key, result);
+  return result;
+}
+
+void BPFtrace::collect_stack_offsets(const SizedType &type,
+                                     size_t offset,
+                                     std::vector<StackField> &fields)
+{
+  if (type.IsKstackTy() || type.IsUstackTy()) {
+    fields.push_back({ .offset = offset,
+                       .ustack = type.IsUstackTy(),
+                       .stack_type = type.stack_type });
+  } else if (type.IsTupleTy() || type.IsRecordTy()) {
+    for (const auto &field : type.GetFields())
+      collect_stack_offsets(field.type, offset + field.offset, fields);
+  }
+}
 
-  while (std::getline(file, line) && !found) {
-    auto fields = util::split_string(line, ':');
+void BPFtrace::cache_stacks(const SizedType &type,
+                            std::span<const std::span<const uint8_t>> elements)
+{
+  std::vector<StackField> fields;
+  collect_stack_offsets(type, 0, fields);
+  if (fields.empty() || config_->stack_cache_size == 0)
+    return;
 
-    if (fields.size() >= 3 && fields[2] == uid) {
-      found = true;
-      username = fields[0];
+  // Find the stacks which are going to be printed and are not rendered yet.
+  // Stacks printed from maps always have an indent of 8, see
+  // Output::resolved_value_to_str. They are grouped by how they are
+  // symbolicated: kernel or user (per process) and perf mode or not.
+  std::map<std::tuple<bool, int32_t, int32_t, bool>, std::vector<StackCacheKey>>
+      pending;
+  std::unordered_set<StackCacheKey, HashStackCacheKey> seen;
+  size_t cached = 0;
+  for (const auto &data : elements) {
+    for (const auto &field : fields) {
+      if (field.stack_type.mode == StackMode::raw ||
+          !is_stack_cacheable(field.ustack))
+        continue;
+      const uint8_t *stack = data.data() + field.offset;
+      int32_t pid = field.ustack ? util::read_data<int32_t>(stack + 16) : -1;
+      int32_t probe_id = field.ustack ? util::read_data<int32_t>(stack + 20)
+                                      : -1;
+      auto key = stack_cache_key(util::read_data<uint64_t>(stack),
+                                 util::read_data<uint64_t>(stack + 8),
+                                 pid,
+                                 probe_id,
+                                 field.ustack,
+                                 field.stack_type,
+                                 8);
+      if (!seen.insert(key).second)
+        continue;
+      if (stack_cache_.contains(key)) {
+        cached++;
+        continue;
+      }
+      bool perf_mode = key.stack_type.mode == StackMode::perf;
+      pending[{ key.ustack, key.pid, key.probe_id, perf_mode }].push_back(key);
     }
   }
 
-  file.close();
+  // Anything beyond the cache capacity would evict stacks before they are
+  // printed
+  size_t budget = config_->stack_cache_size > cached
+                      ? config_->stack_cache_size - cached
+                      : 0;
+  struct Lookup {
+    const StackCacheKey *key;
+    size_t first_frame;
+    std::vector<uint64_t> trace;
+  };
+  std::vector<Lookup> lookups;
+  std::vector<uint64_t> addrs;
+  for (const auto &[group, keys] : pending) {
+    lookups.clear();
+    addrs.clear();
+    for (const auto &key : keys) {
+      if (budget == 0)
+        break;
+      Lookup lookup = { .key = &key, .first_frame = addrs.size(), .trace = {} };
+      if (!lookup_stack(key.stackid,
+                        key.nr_stack_frames,
+                        key.pid,
+                        key.stack_type,
+                        lookup.trace))
+        continue;
+      budget--;
+      addrs.insert(addrs.end(), lookup.trace.begin(), lookup.trace.end());
+      lookups.push_back(std::move(lookup));
+    }
+    if (lookups.empty())
+      continue;
 
-  return username;
+    // All frames of all stacks in the group are symbolicated at once
+    const auto &first = *lookups.front().key;
+    auto syms = resolve_stack_frames(
+        addrs, first.pid, first.probe_id, first.ustack, first.stack_type);
+
+    for (const auto &lookup : lookups) {
+      auto frames = syms.begin() + lookup.first_frame;
+      std::vector<std::vector<std::string>> stack_syms(
+          std::make_move_iterator(frames),
+          std::make_move_iterator(frames + lookup.trace.size()));
+      stack_cache_.put(*lookup.key,
+                       render_stack(lookup.trace,
+                                    stack_syms,
+                                    lookup.key->stack_type,
+                                    lookup.key->indent));
+    }
+  }
+}
+
+size_t BPFtrace::HashStackCacheKey::operator()(const StackCacheKey &key) const
+{
+  std::size_t seed = 0;
+  util::hash_combine(seed, key.stackid);
+  util::hash_combine(seed, key.nr_stack_frames);
+  util::hash_combine(seed, key.stack_type.limit);
+  util::hash_combine(seed, static_cast<int>(key.stack_type.mode));
+  util::hash_combine(seed, key.ustack);
+  util::hash_combine(seed, key.pid);
+  util::hash_combine(seed, key.probe_id);
+  util::hash_combine(seed, key.process_generation);
+  util::hash_combine(seed, key.indent);
+  return seed;
+}
+
+const std::string &BPFtrace::resolve_uid(uint64_t addr) const
+{
+  return usernames_.resolve(addr);
 }
 
-std::string BPFtrace::resolve_timestamp(uint32_t mode,
-                                        uint32_t strftime_id,
-                                        uint64_t nsecs)
+const std::string &BPFtrace::resolve_timestamp(uint32_t mode,
+                                               uint32_t strftime_id,
+                                               uint64_t nsecs)
 {
-  static const auto usec_regex = std::regex("%f");
   static constexpr auto ns_in_sec = 1'000'000'000;
+  static const std::string unknown = "(?)";
   auto ts_mode = static_cast<TimestampMode>(mode);
   struct timespec zero = {};
   struct timespec *basetime = &zero;
@@ -1586,39 +2012,25 @@ std::string BPFtrace::resolve_timestamp(uint32_t mode,
     if (!boottime_) {
       LOG(ERROR)
           << "Cannot resolve timestamp due to failed boot time calculation";
-      return "(?)";
+      return unknown;
     } else {
       basetime = &boottime_.value();
     }
   }
 
-  // Calculate and localize timestamp
-  struct tm tmp;
-  time_t time = basetime->tv_sec + ((basetime->tv_nsec + nsecs) / ns_in_sec);
-  if (!localtime_r(&time, &tmp)) {
-    LOG(ERROR) << "localtime_r: " << strerror(errno);
-    return "(?)";
-  }
+  // Formats are parsed on first use, keeping their rendering caches around
+  while (strftime_formats_.size() <= strftime_id)
+    strftime_formats_.emplace_back(
+        resources.strftime_args[strftime_formats_.size()]);
 
-  // Process strftime() format string extensions
-  const auto &raw_fmt = resources.strftime_args[strftime_id];
+  time_t time = basetime->tv_sec + ((basetime->tv_nsec + nsecs) / ns_in_sec);
   uint64_t us = ((basetime->tv_nsec + nsecs) % ns_in_sec) / 1000;
-  char usecs_buf[7];
-  snprintf(usecs_buf, sizeof(usecs_buf), "%06" PRIu64, us);
-  auto fmt = std::regex_replace(raw_fmt, usec_regex, usecs_buf);
-
-  const auto timestr_size = config_->max_strlen;
-  std::string timestr(timestr_size, '\0');
-  size_t timestr_len = strftime(
-      timestr.data(), timestr_size, fmt.c_str(), &tmp);
-  if (timestr_len == 0) {
+  if (!strftime_formats_[strftime_id].format(
+          time, us, config_->max_strlen, timestamp_buf_)) {
     LOG(ERROR) << "strftime returned 0";
-    return "(?)";
+    return unknown;
   }
-
-  // Fit return value to formatted length
-  timestr.resize(timestr_len);
-  return timestr;
+  return timestamp_buf_;
 }
 
 std::string BPFtrace::resolve_buf(const char *buf, size_t size)
@@ -1628,17 +2040,19 @@ std::string BPFtrace::resolve_buf(const char *buf, size_t size)
 
 std::string BPFtrace::resolve_ksym(uint64_t addr)
 {
-  auto syms = resolve_ksym_stack(addr, false, false, false);
-  assert(syms.size() == 1);
-  return syms.front();
+  auto syms = resolve_ksym_stack(
+      std::span<const uint64_t>(&addr, 1), false, false, false);
+  assert(syms.size() == 1 && syms.front().size() == 1);
+  return syms.front().front();
 }
 
-std::vector<std::string> BPFtrace::resolve_ksym_stack(uint64_t addr,
-                                                      bool show_offset,
-                                                      bool perf_mode,
-                                                      bool show_debug_info)
+std::vector<std::vector<std::string>> BPFtrace::resolve_ksym_stack(
+    std::span<const uint64_t> addrs,
+    bool show_offset,
+    bool perf_mode,
+    bool show_debug_info)
 {
-  return ksyms_.resolve(addr, show_offset, perf_mode, show_debug_info);
+  return ksyms_.resolve_many(addrs, show_offset, perf_mode, show_debug_info);
 }
 
 uint64_t BPFtrace::resolve_kname(const std::string &name) const
@@ -1763,19 +2177,21 @@ std::string BPFtrace::resolve_inet(int af, const uint8_t *inet) const
 
 std::string BPFtrace::resolve_usym(uint64_t addr, int32_t pid, int32_t probe_id)
 {
-  auto syms = resolve_usym_stack(addr, pid, probe_id, false, false, false);
-  assert(syms.size() == 1);
-  return syms.front();
+  auto syms = resolve_usym_stack(
+      std::span<const uint64_t>(&addr, 1), pid, probe_id, false, false, false);
+  assert(syms.size() == 1 && syms.front().size() == 1);
+  return syms.front().front();
 }
 
-std::vector<std::string> BPFtrace::resolve_usym_stack(uint64_t addr,
-                                                      int32_t pid,
-                                                      int32_t probe_id,
-                                                      bool show_offset,
-                                                      bool perf_mode,
-                                                      bool show_debug_info)
+std::vector<std::vector<std::string>> BPFtrace::resolve_usym_stack(
+    std::span<const uint64_t> addrs,
+    int32_t pid,
+    int32_t probe_id,
+    bool show_offset,
+    bool perf_mode,
+    bool show_debug_info)
 {
-  std::string pid_exe = util::get_pid_exe(pid);
+  std::string pid_exe = process_cache_.get(pid).exe;
   if (pid_exe.empty() && probe_id != -1) {
     // sometimes program cannot be determined from PID, typically when the
     // process does not exist anymore; in that case, try to get program name
@@ -1792,8 +2208,8 @@ std::vector<std::string> BPFtrace::resolve_usym_stack(uint64_t addr,
       pid_exe = probe_full.substr(start, end - start);
     }
   }
-  return usyms_.resolve(
-      addr, pid, pid_exe, show_offset, perf_mode, show_debug_info);
+  return usyms_.resolve_many(
+      addrs, pid, pid_exe, show_offset, perf_mode, show_debug_info);
 }
 
 std::string BPFtrace::resolve_probe(uint64_t probe_id) const
@@ -1802,11 +2218,13 @@ std::string BPFtrace::resolve_probe(uint64_t probe_id) const
   return resources.probe_ids[probe_id];
 }
 
-void BPFtrace::sort_by_key(
-    const SizedType &key,
-    std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-        &values_by_key)
+void BPFtrace::sort_by_key(const SizedType &key, MapElements &values_by_key)
 {
+  // The elements are sorted by index, then moved into place once
+  std::vector<size_t> order(values_by_key.size());
+  std::iota(order.begin(), order.end(), 0);
+  auto key_data = [&](size_t i) { return values_by_key[i].key.data(); };
+
   if (key.IsTupleTy()) {
     // Sort the key arguments in reverse order so the results are sorted by
     // the first argument first, then the second, etc.
@@ -1815,23 +2233,23 @@ void BPFtrace::sort_by_key(
       const auto &field = fields.at(i);
       if (field.type.IsIntTy()) {
         if (field.type.GetSize() == 8) {
-          std::ranges::stable_sort(values_by_key,
+          std::ranges::stable_sort(order,
 
-                                   [&](auto &a, auto &b) {
+                                   [&](size_t a, size_t b) {
                                      auto va = util::read_data<uint64_t>(
-                                         a.first.data() + field.offset);
+                                         key_data(a) + field.offset);
                                      auto vb = util::read_data<uint64_t>(
-                                         b.first.data() + field.offset);
+                                         key_data(b) + field.offset);
                                      return va < vb;
                                    });
         } else if (field.type.GetSize() == 4) {
-          std::ranges::stable_sort(values_by_key,
+          std::ranges::stable_sort(order,
 
-                                   [&](auto &a, auto &b) {
+                                   [&](size_t a, size_t b) {
                                      auto va = util::read_data<uint32_t>(
-                                         a.first.data() + field.offset);
+                                         key_data(a) + field.offset);
                                      auto vb = util::read_data<uint32_t>(
-                                         b.first.data() + field.offset);
+                                         key_data(b) + field.offset);
                                      return va < vb;
                                    });
         } else {
@@ -1840,12 +2258,12 @@ void BPFtrace::sort_by_key(
         }
       } else if (field.type.IsStringTy()) {
         std::ranges::stable_sort(
-            values_by_key,
+            order,
 
-            [&](auto &a, auto &b) {
-              return strncmp(reinterpret_cast<const char *>(a.first.data() +
+            [&](size_t a, size_t b) {
+              return strncmp(reinterpret_cast<const char *>(key_data(a) +
                                                             field.offset),
-                             reinterpret_cast<const char *>(b.first.data() +
+                             reinterpret_cast<const char *>(key_data(b) +
                                                             field.offset),
                              field.type.GetSize()) < 0;
             });
@@ -1854,20 +2272,20 @@ void BPFtrace::sort_by_key(
   } else if (key.IsIntTy()) {
     if (key.GetSize() == 8) {
       std::ranges::stable_sort(
-          values_by_key,
+          order,
 
-          [&](auto &a, auto &b) {
-            auto va = util::read_data<uint64_t>(a.first.data());
-            auto vb = util::read_data<uint64_t>(b.first.data());
+          [&](size_t a, size_t b) {
+            auto va = util::read_data<uint64_t>(key_data(a));
+            auto vb = util::read_data<uint64_t>(key_data(b));
             return va < vb;
           });
     } else if (key.GetSize() == 4) {
       std::ranges::stable_sort(
-          values_by_key,
+          order,
 
-          [&](auto &a, auto &b) {
-            auto va = util::read_data<uint32_t>(a.first.data());
-            auto vb = util::read_data<uint32_t>(b.first.data());
+          [&](size_t a, size_t b) {
+            auto va = util::read_data<uint32_t>(key_data(a));
+            auto vb = util::read_data<uint32_t>(key_data(b));
             return va < vb;
           });
     } else {
@@ -1876,12 +2294,14 @@ void BPFtrace::sort_by_key(
     }
 
   } else if (key.IsStringTy()) {
-    std::ranges::stable_sort(values_by_key, [&](auto &a, auto &b) {
-      return strncmp(reinterpret_cast<const char *>(a.first.data()),
-                     reinterpret_cast<const char *>(b.first.data()),
+    std::ranges::stable_sort(order, [&](size_t a, size_t b) {
+      return strncmp(reinterpret_cast<const char *>(key_data(a)),
+                     reinterpret_cast<const char *>(key_data(b)),
                      key.GetSize()) < 0;
     });
   }
+
+  values_by_key.reorder(order);
 }
 
 const util::FuncsModulesMap &BPFtrace::get_traceable_funcs() const
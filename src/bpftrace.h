@@ -1,15 +1,19 @@
 #pragma once
 
+#include <atomic>
 #include <bcc/bcc_syms.h>
 #include <cstdint>
+#include <exception>
 #include <iostream>
 #include <limits>
 #include <map>
 #include <memory>
 #include <optional>
 #include <set>
+#include <span>
 #include <string_view>
 #include <sys/stat.h>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -24,19 +28,26 @@
 #include "child.h"
 #include "config.h"
 #include "dwarf_parser.h"
+#include "event_queue.h"
 #include "functions.h"
 #include "ksyms.h"
+#include "map_delta.h"
 #include "output.h"
+#include "output_buffer.h"
 #include "pcap_writer.h"
 #include "printf.h"
 #include "probe_matcher.h"
+#include "process_cache.h"
 #include "procmon.h"
 #include "required_resources.h"
 #include "struct.h"
 #include "types.h"
+#include "usernames.h"
 #include "usyms.h"
 #include "util/cpus.h"
 #include "util/kernel.h"
+#include "util/lru_cache.h"
+#include "util/strftime.h"
 
 namespace bpftrace {
 
@@ -109,8 +120,12 @@ public:
         max_cpu_id_(util::get_max_cpu_id()),
         config_(std::move(config)),
         ksyms_(*config_),
-        usyms_(*config_)
+        usyms_(*config_),
+        usernames_(*config_)
   {
+    // Symbols cached for a pid are stale once it runs a different program
+    process_cache_.on_new_generation(
+        [this](pid_t pid) { usyms_.invalidate(pid); });
   }
   ~BPFtrace() override;
   virtual int add_probe(ast::ASTContext &ctx,
@@ -129,7 +144,13 @@ public:
   int print_maps();
   int clear_map(const BpfMap &map);
   int zero_map(const BpfMap &map);
-  int print_map(const BpfMap &map, uint32_t top, uint32_t div);
+  // With `clear` set, the map is also cleared, as if by clear_map(). Unlike
+  // clearing after printing, this does not lose updates made to the map in
+  // between.
+  int print_map(const BpfMap &map,
+                uint32_t top,
+                uint32_t div,
+                bool clear = false);
   std::string get_stack(int64_t stackid,
                         uint32_t nr_stack_frames,
                         int32_t pid,
@@ -137,14 +158,30 @@ public:
                         bool ustack,
                         StackType stack_type,
                         int indent = 0);
+  // Renders all stacks in the given map keys or values into the stack cache
+  // ahead of printing them, symbolicating their frames in as few batches as
+  // possible.
+  void cache_stacks(const SizedType &type,
+                    std::span<const std::span<const uint8_t>> elements);
+  virtual bool lookup_stack(int64_t stackid,
+                            uint32_t nr_stack_frames,
+                            int32_t pid,
+                            StackType stack_type,
+                            std::vector<uint64_t> &stack_trace);
+  virtual std::vector<std::vector<std::string>> resolve_stack_frames(
+      std::span<const uint64_t> addrs,
+      int32_t pid,
+      int32_t probe_id,
+      bool ustack,
+      StackType stack_type);
   std::string resolve_buf(const char *buf, size_t size);
   std::string resolve_ksym(uint64_t addr);
   std::string resolve_usym(uint64_t addr, int32_t pid, int32_t probe_id);
   std::string resolve_inet(int af, const uint8_t *inet) const;
-  std::string resolve_uid(uint64_t addr) const;
-  std::string resolve_timestamp(uint32_t mode,
-                                uint32_t strftime_id,
-                                uint64_t nsecs);
+  const std::string &resolve_uid(uint64_t addr) const;
+  const std::string &resolve_timestamp(uint32_t mode,
+                                       uint32_t strftime_id,
+                                       uint64_t nsecs);
   uint64_t resolve_kname(const std::string &name) const;
   virtual int resolve_uname(const std::string &name,
                             struct symbol *sym,
@@ -153,13 +190,17 @@ public:
   std::string resolve_cgroup_path(uint64_t cgroup_path_id,
                                   uint64_t cgroup_id) const;
   std::string resolve_probe(uint64_t probe_id) const;
-  std::vector<std::unique_ptr<IPrintable>> get_arg_values(
+  // Decodes the printf-style arguments of an event. The returned values are
+  // only valid until the next call.
+  const std::vector<PrintableValue> &get_arg_values(
       const std::vector<Field> &args,
-      uint8_t *arg_data);
+      const uint8_t *arg_data);
   void add_param(const std::string &param);
   std::string get_param(size_t index) const;
   size_t num_params() const;
   void request_finalize();
+  // Writes out output held back by output_buffer_, if any
+  void flush_output();
   std::optional<std::string> get_watchpoint_binary_path() const;
   virtual bool is_traceable_func(const std::string &func_name) const;
   virtual std::unordered_set<std::string> get_func_modules(
@@ -177,7 +218,7 @@ public:
   std::set<std::string> list_modules(const ast::ASTContext &ctx);
 
   std::string cmd_;
-  bool finalize_ = false;
+  std::atomic<bool> finalize_ = false;
   static int exit_code;
   // Global variables checking if an exit/usr1 signal was received
   static volatile sig_atomic_t exitsig_recv;
@@ -203,6 +244,11 @@ public:
   unsigned int join_argnum_ = 16;
   unsigned int join_argsize_ = 1024;
   std::unique_ptr<Output> out_;
+  // Raw events waiting to be formatted by the output thread, only set when
+  // the output_queue_size config option is non-zero.
+  std::unique_ptr<EventQueue> event_queue_;
+  // Events dropped in user space, reported from the output thread
+  std::atomic<uint64_t> events_lost_ = 0;
   std::unique_ptr<BTF> btf_;
   std::unique_ptr<BPFfeature> feature_;
 
@@ -218,16 +264,23 @@ public:
   static constexpr uint64_t event_loss_cnt_val_ = 0;
   bool need_recursion_check_ = false;
 
-  static void sort_by_key(
-      const SizedType &key,
-      std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-          &values_by_key);
+  static void sort_by_key(const SizedType &key, MapElements &values_by_key);
+  // Sorts map elements by their value, in ascending order, if the values are
+  // numbers that can be sorted by. With `top` set, only the last `top`
+  // elements end up in order. Elements with equal values stay in their
+  // original order.
+  static bool sort_by_value(const SizedType &value_type,
+                            uint32_t top,
+                            uint64_t nvalues,
+                            MapElements &values_by_key);
 
   std::unique_ptr<ProbeMatcher> probe_matcher_;
 
   std::unordered_set<std::string> btf_set_;
   std::unique_ptr<ChildProcBase> child_;
   std::unique_ptr<ProcMonBase> procmon_;
+  // Set with `-B full`, output is held back in it until flushed
+  OutputBuffer *output_buffer_ = nullptr;
   std::optional<pid_t> pid() const
   {
     if (procmon_) {
@@ -240,10 +293,68 @@ public:
   int max_cpu_id_;
   std::unique_ptr<Config> config_;
 
+  // Number of ring buffers events are spread over. Each one is shared by
+  // `ringbuf_cpus_per_buffer` CPUs, or by all of them when that is unset.
+  uint32_t ringbuf_count() const
+  {
+    auto cpus_per_buffer = config_->ringbuf_cpus_per_buffer;
+    if (cpus_per_buffer == 0)
+      return 1;
+    return (max_cpu_id_ + cpus_per_buffer) / cpus_per_buffer;
+  }
+
 private:
   Ksyms ksyms_;
   Usyms usyms_;
+  ProcessCache process_cache_;
+  mutable Usernames usernames_;
   std::vector<std::string> params_;
+  std::vector<PrintableValue> arg_values_;
+  std::vector<util::StrftimeFormat> strftime_formats_;
+
+  // Rendered stacks, see get_stack()
+  struct StackCacheKey {
+    int64_t stackid;
+    uint32_t nr_stack_frames;
+    StackType stack_type;
+    bool ustack;
+    int32_t pid;
+    int32_t probe_id;
+    uint64_t process_generation;
+    int indent;
+
+    bool operator==(const StackCacheKey &other) const = default;
+  };
+  struct HashStackCacheKey {
+    size_t operator()(const StackCacheKey &key) const;
+  };
+  util::LruCache<StackCacheKey, std::string, HashStackCacheKey> stack_cache_;
+
+  // What was last printed of each map, by name, for print_delta
+  std::unordered_map<std::string, MapDelta> map_deltas_;
+
+  struct StackField {
+    size_t offset;
+    bool ustack;
+    StackType stack_type;
+  };
+
+  StackCacheKey stack_cache_key(int64_t stackid,
+                                uint32_t nr_stack_frames,
+                                int32_t pid,
+                                int32_t probe_id,
+                                bool ustack,
+                                StackType stack_type,
+                                int indent);
+  bool is_stack_cacheable(bool ustack) const;
+  std::string render_stack(std::span<const uint64_t> stack_trace,
+                           const std::vector<std::vector<std::string>> &syms,
+                           StackType stack_type,
+                           int indent);
+  void collect_stack_offsets(const SizedType &type,
+                             size_t offset,
+                             std::vector<StackField> &fields);
+  std::string timestamp_buf_;
 
   std::vector<std::unique_ptr<void, void (*)(void *)>> open_perf_buffers_;
   std::map<std::string, std::unique_ptr<PCAPwriter>> pcap_writers_;
@@ -257,7 +368,7 @@ private:
   void close_pcaps();
   int setup_output();
   int setup_perf_events();
-  void setup_ringbuf();
+  int setup_ringbuf();
   int setup_event_loss();
   // when the ringbuf feature is available, enable ringbuf for built-ins like
   // printf, cat.
@@ -271,21 +382,32 @@ private:
   {
     return !feature_->has_map_ringbuf() || resources.needs_perf_event_map;
   }
-  std::vector<std::string> resolve_ksym_stack(uint64_t addr,
-                                              bool show_offset,
-                                              bool perf_mode,
-                                              bool show_debug_info);
-  std::vector<std::string> resolve_usym_stack(uint64_t addr,
-                                              int32_t pid,
-                                              int32_t probe_id,
-                                              bool show_offset,
-                                              bool perf_mode,
-                                              bool show_debug_info);
+  std::vector<std::vector<std::string>> resolve_ksym_stack(
+      std::span<const uint64_t> addrs,
+      bool show_offset,
+      bool perf_mode,
+      bool show_debug_info);
+  std::vector<std::vector<std::string>> resolve_usym_stack(
+      std::span<const uint64_t> addrs,
+      int32_t pid,
+      int32_t probe_id,
+      bool show_offset,
+      bool perf_mode,
+      bool show_debug_info);
   void teardown_output();
+  void start_output_thread();
+  void stop_output_thread();
+  void output_thread_loop();
   void poll_output(bool drain = false);
   int poll_perf_events();
   void handle_event_loss();
-  int print_map_hist(const BpfMap &map, uint32_t top, uint32_t div);
+  int print_map_hist(const BpfMap &map,
+                     uint32_t top,
+                     uint32_t div,
+                     bool clear);
+  int collect_map_elements(const BpfMap &map,
+                           bool clear,
+                           MapElements &elements);
   static uint64_t read_address_from_output(std::string output);
   struct bcc_symbol_option &get_symbol_opts();
   Probe generate_probe(const ast::AttachPoint &ap,
@@ -294,7 +416,10 @@ private:
   bool has_iter_ = false;
   int epollfd_ = -1;
   struct ring_buffer *ringbuf_ = nullptr;
+  std::vector<int> ringbuf_fds_;
   uint64_t event_loss_count_ = 0;
+  std::thread output_thread_;
+  std::exception_ptr output_thread_error_;
 
   // Mapping traceable functions to modules (or "vmlinux") they appear in.
   // Needs to be mutable to allow lazy loading of the mapping from const lookup
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <climits>
 #include <cstring>
 #include <fstream>
 #include <unordered_set>
@@ -231,24 +232,70 @@ AnyParser parser(T fn)
   };
 }
 
+// Like parser(), for integer fields that must be within [min, max].
+template <typename T>
+AnyParser bounded_parser(T fn, uint64_t min, uint64_t max)
+{
+  auto parse = [fn, min, max](const std::string &k,
+                              Config *c,
+                              const auto &value) -> Result<OK> {
+    uint64_t v;
+    ConfigParser<uint64_t> parser;
+    auto ok = parser.parse(k, &v, value);
+    if (!ok)
+      return ok;
+    if (v < min || v > max)
+      return make_error<ParseError>(k,
+                                    "expecting a number between " +
+                                        std::to_string(min) + " and " +
+                                        std::to_string(max) + ", got " +
+                                        std::to_string(v));
+    *fn(c) = v;
+    return OK();
+  };
+  return AnyParser{ .integer = parse, .string = parse };
+}
+
+// Reading a map from more threads than this doesn't pay off
+static constexpr uint64_t MAX_MAP_READ_THREADS = 1024;
+// The ring buffers are polled with an int timeout, and 0 would busy-poll
+static constexpr uint64_t MAX_RINGBUF_LATENCY_MS = INT_MAX;
+
 // This map construsts all the different parsers.
 #define CONFIG_FIELD_PARSER(x) parser([](Config *config) { return &config->x; })
+#define CONFIG_BOUNDED_PARSER(x, min, max)                                     \
+  bounded_parser([](Config *config) { return &config->x; }, min, max)
 const std::map<std::string, AnyParser> CONFIG_KEY_MAP = {
   { "cache_user_symbols", CONFIG_FIELD_PARSER(user_symbol_cache_type) },
   { "cpp_demangle", CONFIG_FIELD_PARSER(cpp_demangle) },
+  { "dense_hist", CONFIG_FIELD_PARSER(dense_hist) },
+  { "fuse_print_clear", CONFIG_FIELD_PARSER(fuse_print_clear) },
   { "lazy_symbolication", CONFIG_FIELD_PARSER(lazy_symbolication) },
   { "license", CONFIG_FIELD_PARSER(license) },
   { "log_size", CONFIG_FIELD_PARSER(log_size) },
+  { "map_read_threads",
+    CONFIG_BOUNDED_PARSER(map_read_threads, 0, MAX_MAP_READ_THREADS) },
   { "max_bpf_progs", CONFIG_FIELD_PARSER(max_bpf_progs) },
   { "max_cat_bytes", CONFIG_FIELD_PARSER(max_cat_bytes) },
   { "max_map_keys", CONFIG_FIELD_PARSER(max_map_keys) },
   { "max_probes", CONFIG_FIELD_PARSER(max_probes) },
   { "max_strlen", CONFIG_FIELD_PARSER(max_strlen) },
+  { "nss_usernames", CONFIG_FIELD_PARSER(nss_usernames) },
   { "on_stack_limit", CONFIG_FIELD_PARSER(on_stack_limit) },
+  { "output_flush_bytes", CONFIG_FIELD_PARSER(output_flush_bytes) },
+  { "output_flush_ms", CONFIG_FIELD_PARSER(output_flush_ms) },
+  { "output_queue_size", CONFIG_FIELD_PARSER(output_queue_size) },
   { "perf_rb_pages", CONFIG_FIELD_PARSER(perf_rb_pages) },
+  { "ringbuf_cpus_per_buffer", CONFIG_FIELD_PARSER(ringbuf_cpus_per_buffer) },
+  { "ringbuf_max_latency_ms",
+    CONFIG_BOUNDED_PARSER(ringbuf_max_latency_ms, 1, MAX_RINGBUF_LATENCY_MS) },
+  { "ringbuf_wakeup_batch", CONFIG_FIELD_PARSER(ringbuf_wakeup_batch) },
+  { "stack_cache_size", CONFIG_FIELD_PARSER(stack_cache_size) },
   { "stack_mode", CONFIG_FIELD_PARSER(stack_mode) },
   { "str_trunc_trailer", CONFIG_FIELD_PARSER(str_trunc_trailer) },
+  { "user_symbol_cache_bytes", CONFIG_FIELD_PARSER(user_symbol_cache_bytes) },
   { "missing_probes", CONFIG_FIELD_PARSER(missing_probes) },
+  { "print_delta", CONFIG_FIELD_PARSER(print_delta) },
   { "print_maps_on_exit", CONFIG_FIELD_PARSER(print_maps_on_exit) },
   { "use_blazesym", CONFIG_FIELD_PARSER(use_blazesym) },
   { "show_debug_info", CONFIG_FIELD_PARSER(show_debug_info) },
@@ -30,7 +30,11 @@ public:
 
   // All configuration options.
   bool cpp_demangle = true;
+  bool dense_hist = false;
+  bool fuse_print_clear = false;
   bool lazy_symbolication = true;
+  bool nss_usernames = false;
+  bool print_delta = false;
   bool print_maps_on_exit = true;
   bool unstable_macro = false;
   bool unstable_map_decl = false;
@@ -43,13 +47,22 @@ public:
   bool show_debug_info = false;
 #endif
   uint64_t log_size = 1000000;
+  uint64_t map_read_threads = 0;
   uint64_t max_bpf_progs = 1024;
   uint64_t max_cat_bytes = 10240;
   uint64_t max_map_keys = 4096;
   uint64_t max_probes = 1024;
   uint64_t max_strlen = 1024;
   uint64_t on_stack_limit = 32;
+  uint64_t output_flush_bytes = 1024 * 1024;
+  uint64_t output_flush_ms = 100;
+  uint64_t output_queue_size = 0;
   uint64_t perf_rb_pages = 64;
+  uint64_t ringbuf_cpus_per_buffer = 0;
+  uint64_t ringbuf_max_latency_ms = 100;
+  uint64_t ringbuf_wakeup_batch = 0;
+  uint64_t stack_cache_size = 4096;
+  uint64_t user_symbol_cache_bytes = 256 * 1024 * 1024;
   std::string license = "GPL";
   std::string str_trunc_trailer = "..";
   ConfigMissingProbes missing_probes = ConfigMissingProbes::warn;
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "event_queue.h"
+
+namespace bpftrace {
+
+static constexpr size_t record_align = sizeof(uint64_t);
+
+EventQueue::EventQueue(size_t capacity)
+    : buf_(std::max(capacity, record_align) & ~(record_align - 1))
+{
+}
+
+size_t EventQueue::record_size(size_t size)
+{
+  // Size header followed by the record padded to keep the next one aligned
+  return sizeof(uint64_t) + ((size + record_align - 1) & ~(record_align - 1));
+}
+
+void EventQueue::wake(const std::atomic<bool> &waiting)
+{
+  // Pairs with the store to the waiting flag done by a side before it parks:
+  // either we see the flag here or the parking side sees our update.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_all();
+  }
+}
+
+bool EventQueue::wait_for_space(uint64_t head, size_t required)
+{
+  const size_t cap = capacity();
+  if (cap - (head - tail_.load(std::memory_order_acquire)) >= required)
+    return !closed();
+
+  full_waits_.fetch_add(1, std::memory_order_relaxed);
+  std::unique_lock<std::mutex> lock(mutex_);
+  producer_waiting_.store(true, std::memory_order_seq_cst);
+  while (cap - (head - tail_.load(std::memory_order_seq_cst)) < required &&
+         !closed()) {
+    cv_.wait_for(lock, std::chrono::milliseconds(10));
+  }
+  producer_waiting_.store(false, std::memory_order_relaxed);
+  return !closed();
+}
+
+bool EventQueue::push(const void *data, size_t size)
+{
+  const size_t cap = capacity();
+  const size_t needed = record_size(size);
+  if (needed > cap || closed())
+    return false;
+
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  size_t offset = head % cap;
+  size_t contiguous = cap - offset;
+
+  // A record never wraps around, skip the end of the ring if it doesn't fit.
+  // The marker is published on its own: the consumer has to skip it before
+  // the start of the ring can hold a record larger than what precedes it.
+  if (needed > contiguous) {
+    if (!wait_for_space(head, contiguous))
+      return false;
+    std::memcpy(buf_.data() + offset, &wrap_marker_, sizeof(wrap_marker_));
+    head += contiguous;
+    offset = 0;
+    head_.store(head, std::memory_order_release);
+    wake(consumer_waiting_);
+  }
+
+  if (!wait_for_space(head, needed))
+    return false;
+
+  uint64_t header = size;
+  std::memcpy(buf_.data() + offset, &header, sizeof(header));
+  std::memcpy(buf_.data() + offset + sizeof(header), data, size);
+
+  // Account for the record before publishing it so that the depth never
+  // underflows when the consumer pops it right away.
+  size_t depth = depth_.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (depth > high_water_mark_.load(std::memory_order_relaxed))
+    high_water_mark_.store(depth, std::memory_order_relaxed);
+
+  head_.store(head + needed, std::memory_order_release);
+  wake(consumer_waiting_);
+  return true;
+}
+
+std::span<uint8_t> EventQueue::front(int timeout_ms)
+{
+  const size_t cap = capacity();
+  uint64_t tail = tail_.load(std::memory_order_relaxed);
+  while (true) {
+    if (head_.load(std::memory_order_acquire) == tail) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      consumer_waiting_.store(true, std::memory_order_seq_cst);
+      if (head_.load(std::memory_order_seq_cst) == tail && !closed())
+        cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms));
+      consumer_waiting_.store(false, std::memory_order_relaxed);
+      if (head_.load(std::memory_order_acquire) == tail)
+        return {};
+    }
+
+    size_t offset = tail % cap;
+    uint64_t header;
+    std::memcpy(&header, buf_.data() + offset, sizeof(header));
+    if (header != wrap_marker_) {
+      front_size_ = record_size(header);
+      return { buf_.data() + offset + sizeof(header),
+               static_cast<size_t>(header) };
+    }
+
+    // Skipping the end of the ring may be what the producer waits for before
+    // it can write the next record
+    tail += cap - offset;
+    tail_.store(tail, std::memory_order_release);
+    wake(producer_waiting_);
+  }
+}
+
+void EventQueue::pop()
+{
+  // Unaccount for the record before freeing its space, otherwise a producer
+  // filling that space can briefly count one record too many.
+  depth_.fetch_sub(1, std::memory_order_relaxed);
+  tail_.store(tail_.load(std::memory_order_relaxed) + front_size_,
+              std::memory_order_release);
+  front_size_ = 0;
+  wake(producer_waiting_);
+}
+
+void EventQueue::close()
+{
+  closed_.store(true);
+  std::lock_guard<std::mutex> lock(mutex_);
+  cv_.notify_all();
+}
+
+bool EventQueue::closed() const
+{
+  return closed_.load(std::memory_order_acquire);
+}
+
+void EventQueue::wait_empty()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  producer_waiting_.store(true, std::memory_order_seq_cst);
+  while (depth_.load(std::memory_order_seq_cst) != 0 && !closed())
+    cv_.wait_for(lock, std::chrono::milliseconds(10));
+  producer_waiting_.store(false, std::memory_order_relaxed);
+}
+
+size_t EventQueue::depth() const
+{
+  return depth_.load(std::memory_order_relaxed);
+}
+
+size_t EventQueue::high_water_mark() const
+{
+  return high_water_mark_.load(std::memory_order_relaxed);
+}
+
+uint64_t EventQueue::full_waits() const
+{
+  return full_waits_.load(std::memory_order_relaxed);
+}
+
+} // namespace bpftrace
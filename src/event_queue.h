@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace bpftrace {
+
+// Lock-free single-producer single-consumer queue of variable-sized event
+// records, used to hand raw events from the thread draining the kernel
+// buffers over to the thread formatting them.
+//
+// Records are copied into a byte ring, each one prefixed with its size and
+// padded so that it starts 8-byte aligned. The two sides only synchronise
+// through the head and tail positions; the mutex and condition variable are
+// used solely to park a side which has nothing to do.
+class EventQueue {
+public:
+  explicit EventQueue(size_t capacity);
+
+  EventQueue(const EventQueue &) = delete;
+  EventQueue &operator=(const EventQueue &) = delete;
+
+  // Producer side. Copies a record into the queue, waiting while the queue is
+  // full. Returns false if the record can never fit or the queue is closed.
+  bool push(const void *data, size_t size);
+
+  // Consumer side. Returns the oldest record, waiting up to `timeout_ms` for
+  // one to arrive. An empty span means that no record is available. The
+  // record stays valid until it is released with pop().
+  std::span<uint8_t> front(int timeout_ms);
+  void pop();
+
+  // Makes subsequent pushes fail and wakes up both sides. Records which are
+  // already queued can still be consumed.
+  void close();
+  bool closed() const;
+
+  // Waits until all pushed records have been popped or the queue is closed.
+  void wait_empty();
+
+  size_t capacity() const
+  {
+    return buf_.size();
+  }
+  // Number of records pushed but not yet popped.
+  size_t depth() const;
+  // Largest depth observed so far.
+  size_t high_water_mark() const;
+  // Number of times the producer had to wait for the consumer.
+  uint64_t full_waits() const;
+
+private:
+  static constexpr uint64_t wrap_marker_ = UINT64_MAX;
+
+  static size_t record_size(size_t size);
+  // Waits until `required` bytes from `head` on are free. Returns false if
+  // the queue is closed.
+  bool wait_for_space(uint64_t head, size_t required);
+  void wake(const std::atomic<bool> &waiting);
+
+  std::vector<uint8_t> buf_;
+  // Monotonic byte positions, the ring offset is `pos % capacity()`
+  std::atomic<uint64_t> head_ = 0;
+  std::atomic<uint64_t> tail_ = 0;
+  std::atomic<size_t> depth_ = 0;
+  std::atomic<size_t> high_water_mark_ = 0;
+  std::atomic<uint64_t> full_waits_ = 0;
+  std::atomic<bool> closed_ = false;
+  // Ring space taken by the record returned by front(), consumer only
+  size_t front_size_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<bool> producer_waiting_ = false;
+  std::atomic<bool> consumer_waiting_ = false;
+};
+
+} // namespace bpftrace
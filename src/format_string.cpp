@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <unordered_map>
 #include <unordered_set>
@@ -149,104 +151,104 @@ std::string validate_format_string(const std::string &fmt,
   return "";
 }
 
-void FormatString::split()
+void FormatString::compile()
 {
+  segments_.clear();
+  trailer_.clear();
+
+  // Note we're passing in the superset `printf_format_types` regardless
+  // of what the calling context was. This is ok b/c the format string
+  // was already validated for correctness during compilation.
+  auto tokens = get_token_types(fmt_, printf_format_types);
+
   auto tokens_begin = std::sregex_iterator(fmt_.begin(),
                                            fmt_.end(),
                                            format_specifier_re);
   auto tokens_end = std::sregex_iterator();
 
   size_t last_pos = 0;
-  for (std::regex_iterator i = tokens_begin; i != tokens_end; i++) {
-    int end = i->position() + i->length();
-    parts_.push_back(fmt_.substr(last_pos, end - last_pos));
+  size_t idx = 0;
+  for (auto i = tokens_begin; i != tokens_end; i++, idx++) {
+    size_t end = i->position() + i->length();
+    const auto &[token, token_type] = tokens[idx];
+
+    Segment segment;
+    segment.fmt = fmt_.substr(last_pos, end - last_pos);
+    segment.token_type = token_type;
+    segment.expected_type = get_expected_argument_type(segment.fmt);
+    if (token == "r" || token == "rx" || token == "rh") {
+      segment.raw_buffer = true;
+      segment.keep_ascii = token == "r";
+      segment.escape_hex = token != "rh";
+      segment.fmt.replace(segment.fmt.size() - token.size(), token.size(), "s");
+    }
+    segments_.push_back(std::move(segment));
     last_pos = end;
   }
 
-  if (last_pos != fmt_.length()) {
-    parts_.push_back(fmt_.substr(last_pos));
-  }
+  trailer_ = fmt_.substr(last_pos);
 }
 
 void FormatString::format(std::ostream &out,
-                          std::vector<std::unique_ptr<IPrintable>> &args)
+                          const std::vector<PrintableValue> &args)
 {
-  if (parts_.empty()) {
-    split();
-
-    // figure out the argument type for each format specifier
-    expected_types_.resize(parts_.size());
-    for (size_t i = 0; i < parts_.size(); i++)
-      expected_types_[i] = get_expected_argument_type(parts_[i]);
-
-    // Note we're passing in the superset `printf_format_types` regardless
-    // of what the calling context was. This is ok b/c the format string
-    // was already validated for correctness during compilation.
-    tokens_ = get_token_types(fmt_, printf_format_types);
-  }
-  auto buffer = std::vector<char>(FMT_BUF_SZ);
-  auto check_snprintf_ret = [](int r) {
-    if (r < 0) {
-      char *e = std::strerror(errno);
-      throw util::FatalUserException("format() error occurred: " +
-                                     std::string(e ? e : ""));
-    }
-  };
+  out << format_str(args);
+}
 
+const std::string &FormatString::format_str(
+    const std::vector<PrintableValue> &args)
+{
+  // Conversions are printed straight into the output string, which keeps its
+  // capacity from one call to the next. snprintf may use the terminating NUL
+  // slot as well, hence the `+ 1`s.
+  output_.clear();
   size_t i = 0;
   for (; i < args.size(); i++) {
-    for (int try_ = 0; try_ < 2; try_++) {
-      // find format specified in the string
-      auto last_percent_sign = parts_[i].find_last_of('%');
-      std::string fmt_string = last_percent_sign != std::string::npos
-                                   ? parts_[i].substr(last_percent_sign)
-                                   : "";
-      std::string printf_fmt;
-      if (fmt_string == "%r" || fmt_string == "%rx" || fmt_string == "%rh") {
-        if (fmt_string == "%rx" || fmt_string == "%rh") {
-          auto *printable_buffer = dynamic_cast<PrintableBuffer *>(
-              &*args.at(i));
-          // this is checked by semantic analyzer
-          assert(printable_buffer);
-          printable_buffer->keep_ascii(false);
-          if (fmt_string == "%rh")
-            printable_buffer->escape_hex(false);
-        }
-        // replace nonstandard format specifier with %s
-        printf_fmt = std::regex_replace(parts_[i],
-                                        std::regex("%r[x|h]?"),
-                                        "%s");
+    const auto &segment = segments_[i];
+    const auto &arg = args[i];
+    auto print = [&](char *buf, size_t size) {
+      int r;
+      if (segment.raw_buffer) {
+        // this is checked by semantic analyzer
+        assert(arg.kind() == PrintableValue::Kind::buffer);
+        auto buffer = arg.buffer();
+        util::hex_format_buffer(buffer.data(),
+                                buffer.size(),
+                                segment.keep_ascii,
+                                segment.escape_hex,
+                                hex_buffer_);
+        r = snprintf(buf, size, segment.fmt.c_str(), hex_buffer_.c_str());
       } else {
-        printf_fmt = parts_[i];
+        r = arg.print(buf,
+                      size,
+                      segment.fmt.c_str(),
+                      segment.token_type,
+                      segment.expected_type);
+      }
+      if (r < 0) {
+        char *e = std::strerror(errno);
+        throw util::FatalUserException("format() error occurred: " +
+                                       std::string(e ? e : ""));
       }
-      int r = args.at(i)->print(buffer.data(),
-                                buffer.capacity(),
-                                printf_fmt.c_str(),
-                                std::get<1>(tokens_[i]),
-                                expected_types_[i]);
-      check_snprintf_ret(r);
-      if (static_cast<size_t>(r) < buffer.capacity())
-        // string fits into buffer, we are done
-        break;
-      else
-        // the buffer is not big enough to hold the string, resize it
-        // and try again
-        buffer.resize(r + 1);
+      return static_cast<size_t>(r);
+    };
+
+    size_t pos = output_.size();
+    size_t avail = std::max(output_.capacity() - pos,
+                            static_cast<size_t>(FMT_BUF_SZ));
+    output_.resize(pos + avail);
+    size_t len = print(output_.data() + pos, avail + 1);
+    if (len > avail) {
+      // the string did not fit, make room for it and print again
+      output_.resize(pos + len);
+      print(output_.data() + pos, len + 1);
     }
-
-    out << buffer.data();
+    output_.resize(pos + len);
   }
-  if (i < parts_.size()) {
-    out << parts_[i];
+  if (i == segments_.size()) {
+    output_ += trailer_;
   }
-}
-
-std::string FormatString::format_str(
-    std::vector<std::unique_ptr<IPrintable>> &args)
-{
-  std::stringstream buf;
-  format(buf, args);
-  return buf.str();
+  return output_;
 }
 
 } // namespace bpftrace
@@ -19,9 +19,10 @@ struct Field;
 
 class FormatString {
 private:
-  // Split the format string on format specifiers, e.g.
-  // 'foo %s bar' -> [ 'foo %s', 'bar' ]
-  void split();
+  // Compile the format string into a list of segments, each made of literal
+  // text followed by one conversion, and a trailing literal, e.g.
+  // 'foo %s bar %d!' -> [ 'foo %s', ' bar %d' ] + '!'
+  void compile();
 
 public:
   // NOTE: As format strings are used as a vector of tuples the cereal
@@ -30,19 +31,20 @@ public:
 
   FormatString(const char *s) : fmt_(s)
   {
+    compile();
   }
   FormatString(std::string &s) : fmt_(s)
   {
+    compile();
   }
 
   // format formats the format string with the given args. Its up to the caller
   // to ensure that the argument types match those of the call to validate_types
-  void format(std::ostream &out,
-              std::vector<std::unique_ptr<IPrintable>> &args);
+  void format(std::ostream &out, const std::vector<PrintableValue> &args);
 
   // format_str is similar to format but returns a string instead of writing to
-  // an ostream
-  std::string format_str(std::vector<std::unique_ptr<IPrintable>> &args);
+  // an ostream. The string is reused by the next call.
+  const std::string &format_str(const std::vector<PrintableValue> &args);
 
   // length returns the length of the format string
   size_t length() const noexcept
@@ -67,19 +69,39 @@ public:
   };
 
 private:
+  // Literal text followed by one conversion specifier, ready to be passed to
+  // PrintableValue::print. Nonstandard specifiers (%r, %rx, %rh) are rewritten
+  // to %s and the buffer rendering options recorded instead.
+  struct Segment {
+    std::string fmt;
+    Type token_type;
+    ArgumentType expected_type;
+    bool raw_buffer = false;
+    bool keep_ascii = true;
+    bool escape_hex = true;
+  };
+
   std::string fmt_;
-  std::vector<std::string> parts_;
-  std::vector<ArgumentType> expected_types_;
-  std::vector<std::tuple<std::string, Type>> tokens_;
+  std::vector<Segment> segments_;
+  std::string trailer_;
+  std::string output_;
+  std::string hex_buffer_;
 
   friend class cereal::access;
 
   template <typename Archive>
-  void serialize(Archive &ar)
+  void save(Archive &ar) const
+  {
+    // NOTE: the compiled segments are cheap to rebuild, so only the format
+    // string itself is serialized
+    ar(fmt_);
+  }
+
+  template <typename Archive>
+  void load(Archive &ar)
   {
-    // NOTE: parts_, expected_types_, and tokens_ are not constructed until
-    // first use, so no point in serializing them
     ar(fmt_);
+    compile();
   }
 };
 
@@ -0,0 +1,77 @@
+#include <algorithm>
+
+#include "histograms.h"
+#include "util/math.h"
+
+namespace bpftrace {
+
+static std::string_view as_string_view(std::span<const uint8_t> bytes)
+{
+  return { reinterpret_cast<const char *>(bytes.data()), bytes.size() };
+}
+
+void Histograms::Histogram::add(uint32_t index, uint64_t count)
+{
+  if (count == 0)
+    return;
+  total_ += count;
+
+  // Buckets usually come in order, either all of them from a dense map value
+  // or the few populated ones of a key from the map, so this is mostly an
+  // append
+  if (buckets_.empty() || buckets_.back().index < index) {
+    buckets_.push_back({ .index = index, .count = count });
+    return;
+  }
+  auto it = std::ranges::lower_bound(buckets_, index, {}, &Bucket::index);
+  if (it != buckets_.end() && it->index == index)
+    it->count += count;
+  else
+    buckets_.insert(it, { .index = index, .count = count });
+}
+
+void Histograms::Histogram::expand(std::vector<uint64_t> &values,
+                                   size_t size) const
+{
+  if (values.size() < size)
+    values.resize(size);
+  std::ranges::fill(values, 0);
+  for (const auto &bucket : buckets_) {
+    if (bucket.index < values.size())
+      values[bucket.index] = bucket.count;
+  }
+}
+
+Histograms::Histogram &Histograms::get(std::span<const uint8_t> key)
+{
+  auto it = index_.find(as_string_view(key));
+  if (it != index_.end())
+    return histograms_[it->second];
+
+  auto &hist = histograms_.emplace_back(key);
+  index_.emplace(as_string_view(hist.key()), histograms_.size() - 1);
+  return hist;
+}
+
+void Histograms::sort_by_total(uint32_t top)
+{
+  auto by_total = [](const Histogram &a, const Histogram &b) {
+    if (a.total() != b.total())
+      return a.total() < b.total();
+    return a.key() < b.key();
+  };
+  auto first = histograms_.begin() + util::top_skip(histograms_.size(), top);
+  if (first != histograms_.begin())
+    std::ranges::nth_element(histograms_, first, by_total);
+  std::sort(first, histograms_.end(), by_total);
+  reindex();
+}
+
+void Histograms::reindex()
+{
+  index_.clear();
+  for (size_t i = 0; i < histograms_.size(); i++)
+    index_.emplace(as_string_view(histograms_[i].key()), i);
+}
+
+} // namespace bpftrace
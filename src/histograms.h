@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace bpftrace {
+
+// The histograms of all keys of a hist() or lhist() map, for printing.
+//
+// Only the populated buckets of a histogram are stored. Out of the 2080
+// possible log2 or 1002 linear buckets, most histograms only use a few dozen,
+// so allocating all of them for every key would take several times the memory
+// of the map itself. Histograms are found by key through a hash table and keep
+// their total count up to date as buckets are added.
+class Histograms {
+public:
+  struct Bucket {
+    uint32_t index;
+    uint64_t count;
+  };
+
+  class Histogram {
+  public:
+    explicit Histogram(std::span<const uint8_t> key)
+        : key_(key.begin(), key.end())
+    {
+    }
+
+    // Adds `count` to the bucket
+    void add(uint32_t index, uint64_t count);
+    // Writes the counts of all buckets to `values`, which is resized to
+    // `size` if smaller
+    void expand(std::vector<uint64_t> &values, size_t size) const;
+
+    const std::vector<uint8_t> &key() const
+    {
+      return key_;
+    }
+    uint64_t total() const
+    {
+      return total_;
+    }
+    // Sorted by index, without empty buckets
+    const std::vector<Bucket> &buckets() const
+    {
+      return buckets_;
+    }
+
+  private:
+    std::vector<uint8_t> key_;
+    uint64_t total_ = 0;
+    std::vector<Bucket> buckets_;
+  };
+
+  // Returns the histogram for `key`, adding an empty one if there is none
+  Histogram &get(std::span<const uint8_t> key);
+
+  // Sorts the histograms in ascending order of their total count, then of
+  // their key. With `top` set, only the last `top` of them end up in order,
+  // the ones before are smaller but left unsorted.
+  void sort_by_total(uint32_t top = 0);
+
+  template <typename F>
+  void erase_if(F pred)
+  {
+    std::erase_if(histograms_, pred);
+    reindex();
+  }
+
+  auto begin() const
+  {
+    return histograms_.begin();
+  }
+  auto end() const
+  {
+    return histograms_.end();
+  }
+  size_t size() const
+  {
+    return histograms_.size();
+  }
+  bool empty() const
+  {
+    return histograms_.empty();
+  }
+
+private:
+  void reindex();
+
+  std::vector<Histogram> histograms_;
+  // Views into the keys of histograms_, which don't move along with the
+  // histograms
+  std::unordered_map<std::string_view, size_t> index_;
+};
+
+} // namespace bpftrace
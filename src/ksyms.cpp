@@ -1,4 +1,5 @@
 #include <bcc/bcc_syms.h>
+#include <fstream>
 #include <sstream>
 
 #ifdef HAVE_BLAZESYM
@@ -9,6 +10,10 @@
 #include "scopeguard.h"
 
 namespace {
+
+// How often to check whether modules were loaded or unloaded
+constexpr auto MODULES_RECHECK_INTERVAL = std::chrono::seconds(1);
+
 std::string stringify_addr(uint64_t addr)
 {
   std::ostringstream symbol;
@@ -57,6 +62,23 @@ std::string stringify_ksym(const char *name,
 }
 #endif
 
+// Lists the loaded modules and their addresses, leaving out reference counts
+// and such which change all the time
+std::string read_modules()
+{
+  std::ifstream file("/proc/modules");
+  std::string modules;
+  std::string line;
+  while (std::getline(file, line)) {
+    // <name> <size> <refcount> <deps> <state> <address> ...
+    std::istringstream fields(line);
+    std::string name, size, refs, deps, state, address;
+    fields >> name >> size >> refs >> deps >> state >> address;
+    modules += name + " " + address + "\n";
+  }
+  return modules;
+}
+
 } // namespace
 
 namespace bpftrace {
@@ -93,14 +115,41 @@ std::string Ksyms::resolve_bcc(uint64_t addr, bool show_offset)
   return stringify_addr(addr);
 }
 
-#ifdef HAVE_BLAZESYM
-std::vector<std::string> Ksyms::resolve_blazesym_impl(uint64_t addr,
-                                                      bool show_offset,
-                                                      bool perf_mode,
-                                                      bool show_debug_info)
+bool Ksyms::update_kallsyms()
+{
+  auto now = std::chrono::steady_clock::now();
+  if (kallsyms_loaded_ && now - modules_checked_ < MODULES_RECHECK_INTERVAL)
+    return !kallsyms_.empty();
+  modules_checked_ = now;
+
+  // Modules bring their own symbols, so reload when they change
+  auto modules = read_modules();
+  if (kallsyms_loaded_ && modules == kallsyms_modules_)
+    return !kallsyms_.empty();
+  kallsyms_modules_ = std::move(modules);
+  kallsyms_loaded_ = true;
+  return kallsyms_.load();
+}
+
+std::string Ksyms::resolve_kallsyms(uint64_t addr, bool show_offset) const
 {
-  std::vector<std::string> str_syms;
+  auto sym = kallsyms_.lookup(addr);
+  if (!sym)
+    return stringify_addr(addr);
+
+  std::string symbol(sym->name);
+  if (show_offset)
+    symbol += "+" + std::to_string(sym->offset);
+  return symbol;
+}
 
+#ifdef HAVE_BLAZESYM
+void Ksyms::resolve_blazesym(std::span<const uint64_t> addrs,
+                             bool show_offset,
+                             bool perf_mode,
+                             bool show_debug_info,
+                             std::vector<std::vector<std::string>> &str_syms)
+{
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
   if (symbolizer_ == nullptr) {
@@ -112,7 +161,7 @@ std::vector<std::string> Ksyms::resolve_blazesym_impl(uint64_t addr,
     };
     symbolizer_ = blaze_symbolizer_new_opts(&opts);
     if (symbolizer_ == nullptr)
-      return str_syms;
+      return;
   }
 
   blaze_symbolize_src_kernel src = {
@@ -128,62 +177,84 @@ std::vector<std::string> Ksyms::resolve_blazesym_impl(uint64_t addr,
 #pragma GCC diagnostic pop
 
   const blaze_syms *syms = blaze_symbolize_kernel_abs_addrs(
-      symbolizer_, &src, &addr, 1);
+      symbolizer_, &src, addrs.data(), addrs.size());
   if (syms == nullptr)
-    return str_syms;
+    return;
   SCOPE_EXIT
   {
     blaze_syms_free(syms);
   };
 
-  const blaze_sym *sym = &syms->syms[0];
-  const struct blaze_symbolize_inlined_fn *inlined;
-
-  if (sym == nullptr || sym->name == nullptr) {
-    return str_syms;
-  }
-
-  // bpftrace prints stacks leaf first so the inlined functions
-  // need to come first in the list (and in reverse order)
-  for (int j = static_cast<int>(sym->inlined_cnt) - 1; j >= 0; j--) {
-    inlined = &sym->inlined[j];
-    if (inlined != nullptr) {
-      str_syms.push_back(stringify_ksym(
-          inlined->name, &inlined->code_info, 0, false, perf_mode, true));
+  for (size_t i = 0; i < syms->cnt && i < addrs.size(); i++) {
+    const blaze_sym *sym = &syms->syms[i];
+    const struct blaze_symbolize_inlined_fn *inlined;
+
+    if (sym->name == nullptr)
+      continue;
+
+    // bpftrace prints stacks leaf first so the inlined functions
+    // need to come first in the list (and in reverse order)
+    for (int j = static_cast<int>(sym->inlined_cnt) - 1; j >= 0; j--) {
+      inlined = &sym->inlined[j];
+      if (inlined != nullptr) {
+        str_syms[i].push_back(stringify_ksym(
+            inlined->name, &inlined->code_info, 0, false, perf_mode, true));
+      }
     }
-  }
-
-  str_syms.push_back(stringify_ksym(
-      sym->name, &sym->code_info, sym->offset, show_offset, perf_mode, false));
-
-  return str_syms;
-}
 
-std::vector<std::string> Ksyms::resolve_blazesym(uint64_t addr,
-                                                 bool show_offset,
-                                                 bool perf_mode,
-                                                 bool show_debug_info)
-{
-  auto syms = resolve_blazesym_impl(
-      addr, show_offset, perf_mode, show_debug_info);
-  if (syms.empty()) {
-    syms.push_back(stringify_addr(addr));
+    str_syms[i].push_back(stringify_ksym(sym->name,
+                                         &sym->code_info,
+                                         sym->offset,
+                                         show_offset,
+                                         perf_mode,
+                                         false));
   }
-
-  return syms;
 }
 #endif
 
 std::vector<std::string> Ksyms::resolve(uint64_t addr,
                                         bool show_offset,
-                                        [[maybe_unused]] bool perf_mode,
-                                        [[maybe_unused]] bool show_debug_info)
+                                        bool perf_mode,
+                                        bool show_debug_info)
 {
+  return std::move(resolve_many(std::span<const uint64_t>(&addr, 1),
+                                show_offset,
+                                perf_mode,
+                                show_debug_info)
+                       .front());
+}
+
+std::vector<std::vector<std::string>> Ksyms::resolve_many(
+    std::span<const uint64_t> addrs,
+    bool show_offset,
+    [[maybe_unused]] bool perf_mode,
+    [[maybe_unused]] bool show_debug_info)
+{
+  std::vector<std::vector<std::string>> syms;
+  syms.reserve(addrs.size());
+
+  // Without a vmlinux, blazesym also only has kallsyms to go by for the
+  // kernel, so this gives the same results at a fraction of the cost
+  if (update_kallsyms()) {
+    for (uint64_t addr : addrs)
+      syms.push_back({ resolve_kallsyms(addr, show_offset) });
+    return syms;
+  }
+
 #ifdef HAVE_BLAZESYM
-  if (config_.use_blazesym)
-    return resolve_blazesym(addr, show_offset, perf_mode, show_debug_info);
+  if (config_.use_blazesym) {
+    syms.resize(addrs.size());
+    resolve_blazesym(addrs, show_offset, perf_mode, show_debug_info, syms);
+    for (size_t i = 0; i < addrs.size(); i++) {
+      if (syms[i].empty())
+        syms[i].push_back(stringify_addr(addrs[i]));
+    }
+    return syms;
+  }
 #endif
-  return std::vector<std::string>{ resolve_bcc(addr, show_offset) };
+  for (uint64_t addr : addrs)
+    syms.push_back({ resolve_bcc(addr, show_offset) });
+  return syms;
 }
 
 } // namespace bpftrace
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <optional>
+#include <span>
 #include <string>
+#include <vector>
 
 #include "config.h"
+#include "util/kallsyms.h"
 
 namespace bpftrace {
 class Config;
@@ -20,22 +24,35 @@ public:
                                    bool show_offset,
                                    bool perf_mode,
                                    bool show_debug_info);
+  // Resolves all addresses (e.g. of a stack) in one go, which is cheaper than
+  // resolving them one by one. Returns the symbols of each address, in order.
+  std::vector<std::vector<std::string>> resolve_many(
+      std::span<const uint64_t> addrs,
+      bool show_offset,
+      bool perf_mode,
+      bool show_debug_info);
 
 private:
   const Config &config_;
   void *ksyms_{ nullptr };
 
+  util::KallsymsTable kallsyms_;
+  bool kallsyms_loaded_ = false;
+  // Loaded modules at the time kallsyms_ was loaded
+  std::string kallsyms_modules_;
+  std::chrono::steady_clock::time_point modules_checked_;
+
+  bool update_kallsyms();
+  std::string resolve_kallsyms(uint64_t addr, bool show_offset) const;
+
 #ifdef HAVE_BLAZESYM
   struct blaze_symbolizer *symbolizer_{ nullptr };
 
-  std::vector<std::string> resolve_blazesym_impl(uint64_t addr,
-                                                 bool show_offset,
-                                                 bool perf_mode,
-                                                 bool show_debug_info);
-  std::vector<std::string> resolve_blazesym(uint64_t addr,
-                                            bool show_offset,
-                                            bool perf_mode,
-                                            bool show_debug_info);
+  void resolve_blazesym(std::span<const uint64_t> addrs,
+                        bool show_offset,
+                        bool perf_mode,
+                        bool show_debug_info,
+                        std::vector<std::vector<std::string>> &str_syms);
 #endif
 
   std::string resolve_bcc(uint64_t addr, bool show_offset);
@@ -16,6 +16,10 @@
 #define BPF_F_UPROBE_MULTI_RETURN (1U << 0)
 #endif
 
+#ifndef BPF_F_NO_PREALLOC
+#define BPF_F_NO_PREALLOC (1U << 0)
+#endif
+
 // clang-format off
 enum bpf_map_type {
 	BPF_MAP_TYPE_UNSPEC,
@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <getopt.h>
@@ -42,6 +43,7 @@
 #include "lockdown.h"
 #include "log.h"
 #include "output.h"
+#include "output_buffer.h"
 #include "probe_matcher.h"
 #include "procmon.h"
 #include "run_bpftrace.h"
@@ -105,7 +107,7 @@ void usage(std::ostream& out)
   out << std::endl;
   out << "OPTIONS:" << std::endl;
   out << "    -B MODE        output buffering mode ('line', 'full', 'none')" << std::endl;
-  out << "    -f FORMAT      output format ('text', 'json')" << std::endl;
+  out << "    -f FORMAT      output format ('text', 'json', 'binary')" << std::endl;
   out << "    -o file        redirect bpftrace output to file" << std::endl;
   out << "    -e 'program'   execute this program" << std::endl;
   out << "    -h, --help     show this help message" << std::endl;
@@ -677,7 +679,28 @@ int main(int argc, char* argv[])
   const Args args = parse_args(argc, argv);
   std::ostream* os = &std::cout;
   std::ofstream outputstream;
-  if (!args.output_file.empty()) {
+  // With full buffering, output goes through an OutputBuffer instead, which
+  // is flushed by BPFtrace as needed
+  std::unique_ptr<OutputBuffer> output_buffer;
+  std::unique_ptr<std::ostream> bufferedstream;
+  if (args.obc == OutputBufferConfig::FULL) {
+    int fd = STDOUT_FILENO;
+    bool owns_fd = false;
+    if (!args.output_file.empty()) {
+      fd = open(args.output_file.c_str(),
+                O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+      if (fd < 0) {
+        LOG(ERROR) << "Failed to open output file: \"" << args.output_file
+                   << "\": " << strerror(errno);
+        exit(1);
+      }
+      owns_fd = true;
+    }
+    output_buffer = std::make_unique<OutputBuffer>(fd, owns_fd);
+    bufferedstream = std::make_unique<std::ostream>(output_buffer.get());
+    os = bufferedstream.get();
+  } else if (!args.output_file.empty()) {
     outputstream.open(args.output_file);
     if (outputstream.fail()) {
       LOG(ERROR) << "Failed to open output file: \"" << args.output_file
@@ -692,9 +715,11 @@ int main(int argc, char* argv[])
     output = std::make_unique<TextOutput>(*os);
   } else if (args.output_format == "json") {
     output = std::make_unique<JsonOutput>(*os);
+  } else if (args.output_format == "binary") {
+    output = std::make_unique<BinaryOutput>(*os);
   } else {
     LOG(ERROR) << "Invalid output format \"" << args.output_format << "\"\n"
-               << "Valid formats: 'text', 'json'";
+               << "Valid formats: 'text', 'json', 'binary'";
     exit(1);
   }
 
@@ -715,6 +740,7 @@ int main(int argc, char* argv[])
 
   auto config = std::make_unique<Config>(!args.cmd_str.empty());
   BPFtrace bpftrace(std::move(output), args.no_feature, std::move(config));
+  bpftrace.output_buffer_ = output_buffer.get();
 
   // Most configuration can be applied during the configuration pass, however
   // we need to extract a few bits of configuration up front, because they may
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string_view>
+
+#include "map_delta.h"
+
+namespace bpftrace {
+
+static std::string_view as_string_view(std::span<const uint8_t> bytes)
+{
+  return { reinterpret_cast<const char *>(bytes.data()), bytes.size() };
+}
+
+// Multiplies and folds the 128-bit product, as wyhash does
+static uint64_t mix(uint64_t a, uint64_t b)
+{
+  auto product = static_cast<unsigned __int128>(a) * b;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+static const std::array<uint64_t, 4> &hash_keys()
+{
+  static const std::array<uint64_t, 4> keys = [] {
+    std::random_device rd;
+    std::array<uint64_t, 4> keys;
+    for (auto &key : keys)
+      key = (static_cast<uint64_t>(rd()) << 32) | rd();
+    return keys;
+  }();
+  return keys;
+}
+
+MapDelta::Fingerprint MapDelta::fingerprint(std::span<const uint8_t> value)
+{
+  Fingerprint fp = {};
+  if (value.size() <= sizeof(fp)) {
+    std::ranges::copy(value, reinterpret_cast<uint8_t *>(fp.data()));
+    return fp;
+  }
+
+  // Two independently keyed 64-bit lanes
+  const auto &keys = hash_keys();
+  fp = { keys[0] ^ value.size(), keys[2] ^ value.size() };
+  for (size_t i = 0; i < value.size(); i += 8) {
+    uint64_t word = 0;
+    size_t size = std::min<size_t>(sizeof(word), value.size() - i);
+    std::memcpy(&word, value.data() + i, size);
+    fp[0] = mix(word ^ keys[0], fp[0] ^ keys[1]);
+    fp[1] = mix(word ^ keys[2], fp[1] ^ keys[3]);
+  }
+  fp[0] = mix(fp[0], keys[1]);
+  fp[1] = mix(fp[1], keys[3]);
+  return fp;
+}
+
+void MapDelta::start()
+{
+  generation_++;
+}
+
+bool MapDelta::update(std::span<const uint8_t> key,
+                      std::span<const uint8_t> value)
+{
+  auto fp = fingerprint(value);
+  auto [it, inserted] = fingerprints_.try_emplace(
+      std::string(as_string_view(key)),
+      Entry{ .fingerprint = fp, .generation = generation_ });
+  if (inserted)
+    return true;
+
+  auto &entry = it->second;
+  bool changed = entry.fingerprint != fp;
+  entry.fingerprint = fp;
+  entry.generation = generation_;
+  return changed;
+}
+
+void MapDelta::finish()
+{
+  std::erase_if(fingerprints_, [this](const auto &item) {
+    return item.second.generation != generation_;
+  });
+}
+
+} // namespace bpftrace
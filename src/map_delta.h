@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+namespace bpftrace {
+
+// Tracks which keys of a map changed between two prints of it, so that only
+// those are printed (see the print_delta config option).
+//
+// A print goes through all elements of the map, between start() and
+// finish(). Each key's value is remembered as a fingerprint of 16 bytes,
+// which is the value itself if it fits. Longer values, e.g. those of per-CPU
+// maps, are hashed with a 128-bit hash keyed randomly for each bpftrace run,
+// so a change is only missed if the old and new value collide, which is
+// too unlikely to matter for output.
+//
+// Keys which are not seen during a print, because they were deleted from the
+// map, are forgotten, so that they count as changed if they come back.
+class MapDelta {
+public:
+  using Fingerprint = std::array<uint64_t, 2>;
+
+  void start();
+  // Returns true if the key is new or its value differs from the last print.
+  // Must be called at most once per key between start() and finish(). Values
+  // shorter than a fingerprint are padded with zeros, so a value must not
+  // change in its size alone.
+  bool update(std::span<const uint8_t> key, std::span<const uint8_t> value);
+  void finish();
+
+  size_t size() const
+  {
+    return fingerprints_.size();
+  }
+
+  static Fingerprint fingerprint(std::span<const uint8_t> value);
+
+private:
+  struct Entry {
+    Fingerprint fingerprint;
+    uint64_t generation;
+  };
+
+  uint64_t generation_ = 0;
+  std::unordered_map<std::string, Entry> fingerprints_;
+};
+
+} // namespace bpftrace
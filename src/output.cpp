@@ -1,7 +1,10 @@
 #include <algorithm>
 #include <bpf/libbpf.h>
 #include <iomanip>
+#include <ranges>
+#include <sstream>
 #include <string>
+#include <type_traits>
 
 #include "ast/async_event_types.h"
 #include "bpftrace.h"
@@ -9,6 +12,7 @@
 #include "output.h"
 #include "required_resources.h"
 #include "util/format.h"
+#include "util/math.h"
 #include "util/stats.h"
 
 namespace libbpf {
@@ -57,6 +61,55 @@ bool is_quoted_type(const SizedType &ty)
   }
   return false;
 }
+
+std::string type_name(MessageType type)
+{
+  std::ostringstream name;
+  name << type;
+  return name.str();
+}
+
+// Writes integers of any size as 64 bits
+template <typename T>
+void encode_int(binary::Encoder &enc, T value)
+{
+  if constexpr (std::is_signed_v<T>)
+    enc.i64(value);
+  else
+    enc.u64(value);
+}
+
+// The inclusive bounds of a histogram bucket, as in JsonOutput::hist_to_str()
+// and JsonOutput::lhist_to_str()
+std::pair<int64_t, int64_t> hist_bucket_bounds(const MapInfo &map_info,
+                                               uint32_t index)
+{
+  if (map_info.value_type.IsHistTy()) {
+    const uint32_t k = std::get<HistogramArgs>(map_info.detail).bits;
+    if (index == 0)
+      return { binary::OPEN_LOWER_BOUND, -1 };
+    if (index <= (2U << k))
+      return { index - 1, index - 1 };
+
+    const uint32_t n = 1 << k;
+    uint32_t power = ((index - 1) >> k) - 1;
+    uint32_t bucket = (index - 1) & (n - 1);
+    const int64_t low = (1ULL << power) * (n + bucket);
+    power = (index >> k) - 1;
+    bucket = index & (n - 1);
+    const int64_t high = ((1ULL << power) * (n + bucket)) - 1;
+    return { low, high };
+  }
+
+  const auto &args = std::get<LinearHistogramArgs>(map_info.detail);
+  const uint32_t buckets = (args.max - args.min) / args.step;
+  if (index == 0)
+    return { binary::OPEN_LOWER_BOUND, args.min - 1 };
+  if (index == buckets + 1)
+    return { args.max, binary::OPEN_UPPER_BOUND };
+  return { ((index - 1) * args.step) + args.min,
+           (index * args.step) + args.min - 1 };
+}
 } // namespace
 
 std::ostream &operator<<(std::ostream &out, MessageType type)
@@ -154,10 +207,10 @@ std::string TextOutput::lhist_index_label(int number, int step)
   return label.str();
 }
 
-void Output::hist_prepare(const std::vector<uint64_t> &values,
-                          int &min_index,
-                          int &max_index,
-                          int &max_value) const
+void FormattedOutput::hist_prepare(const std::vector<uint64_t> &values,
+                                   int &min_index,
+                                   int &max_index,
+                                   int &max_value) const
 {
   min_index = -1;
   max_index = -1;
@@ -174,15 +227,15 @@ void Output::hist_prepare(const std::vector<uint64_t> &values,
   }
 }
 
-void Output::lhist_prepare(const std::vector<uint64_t> &values,
-                           int min,
-                           int max,
-                           int step,
-                           int &max_index,
-                           int &max_value,
-                           int &buckets,
-                           int &start_value,
-                           int &end_value) const
+void FormattedOutput::lhist_prepare(const std::vector<uint64_t> &values,
+                                    int min,
+                                    int max,
+                                    int step,
+                                    int &max_index,
+                                    int &max_value,
+                                    int &buckets,
+                                    int &start_value,
+                                    int &end_value) const
 {
   max_index = -1;
   max_value = 0;
@@ -237,14 +290,10 @@ std::string Output::get_helper_error_msg(int func_id, int retcode) const
   return msg;
 }
 
-std::string Output::value_to_str(BPFtrace &bpftrace,
-                                 const SizedType &type,
-                                 const std::vector<uint8_t> &value,
-                                 bool is_per_cpu,
-                                 uint32_t div,
-                                 bool is_map_key) const
+std::string Output::resolved_value_to_str(BPFtrace &bpftrace,
+                                          const SizedType &type,
+                                          std::span<const uint8_t> value) const
 {
-  uint32_t nvalues = is_per_cpu ? bpftrace.ncpus_ : 1;
   switch (type.GetTy()) {
     case Type::kstack_t: {
       return bpftrace.get_stack(util::read_data<uint64_t>(value.data()),
@@ -290,12 +339,75 @@ std::string Output::value_to_str(BPFtrace &bpftrace,
       const auto *p = reinterpret_cast<const char *>(value.data());
       return { p, strnlen(p, type.GetSize()) };
     }
+    case Type::timestamp: {
+      return bpftrace.resolve_timestamp(
+          reinterpret_cast<const AsyncEvent::Strftime *>(value.data())->mode,
+          reinterpret_cast<const AsyncEvent::Strftime *>(value.data())
+              ->strftime_id,
+          reinterpret_cast<const AsyncEvent::Strftime *>(value.data())->nsecs);
+    }
+    case Type::mac_address: {
+      return bpftrace.resolve_mac_address(value.data());
+    }
+    case Type::cgroup_path_t: {
+      return bpftrace.resolve_cgroup_path(
+          reinterpret_cast<const AsyncEvent::CgroupPath *>(value.data())
+              ->cgroup_path_id,
+          reinterpret_cast<const AsyncEvent::CgroupPath *>(value.data())
+              ->cgroup_id);
+    }
+    case Type::strerror_t: {
+      return strerror(util::read_data<uint64_t>(value.data()));
+    }
+    case Type::none:
+    case Type::voidtype:
+    case Type::integer:
+    case Type::pointer:
+    case Type::record:
+    case Type::hist_t:
+    case Type::lhist_t:
+    case Type::count_t:
+    case Type::sum_t:
+    case Type::min_t:
+    case Type::max_t:
+    case Type::avg_t:
+    case Type::stats_t:
+    case Type::stack_mode:
+    case Type::array:
+    case Type::tuple:
+    case Type::timestamp_mode:
+      LOG(BUG) << "Invalid resolved value type: " << type;
+  }
+  return "";
+}
+
+std::string FormattedOutput::value_to_str(BPFtrace &bpftrace,
+                                          const SizedType &type,
+                                          std::span<const uint8_t> value,
+                                          bool is_per_cpu,
+                                          uint32_t div,
+                                          bool is_map_key) const
+{
+  uint32_t nvalues = is_per_cpu ? bpftrace.ncpus_ : 1;
+  switch (type.GetTy()) {
+    case Type::kstack_t:
+    case Type::ustack_t:
+    case Type::ksym_t:
+    case Type::usym_t:
+    case Type::inet:
+    case Type::username:
+    case Type::buffer:
+    case Type::string:
+    case Type::timestamp:
+    case Type::mac_address:
+    case Type::cgroup_path_t:
+    case Type::strerror_t:
+      return resolved_value_to_str(bpftrace, type, value);
     case Type::array: {
       size_t elem_size = type.GetElementTy()->GetSize();
       std::vector<std::string> elems;
       for (size_t i = 0; i < type.GetNumElements(); i++) {
-        std::vector<uint8_t> elem_data(value.begin() + i * elem_size,
-                                       value.begin() + (i + 1) * elem_size);
+        auto elem_data = value.subspan(i * elem_size, elem_size);
         elems.push_back(value_to_str(bpftrace,
                                      *type.GetElementTy(),
                                      elem_data,
@@ -308,9 +420,7 @@ std::string Output::value_to_str(BPFtrace &bpftrace,
     case Type::record: {
       std::vector<std::string> elems;
       for (auto &field : type.GetFields()) {
-        std::vector<uint8_t> elem_data(value.begin() + field.offset,
-                                       value.begin() + field.offset +
-                                           field.type.GetSize());
+        auto elem_data = value.subspan(field.offset, field.type.GetSize());
         elems.push_back(field_to_str(
             field.name,
             value_to_str(
@@ -321,9 +431,7 @@ std::string Output::value_to_str(BPFtrace &bpftrace,
     case Type::tuple: {
       std::vector<std::string> elems;
       for (auto &field : type.GetFields()) {
-        std::vector<uint8_t> elem_data(value.begin() + field.offset,
-                                       value.begin() + field.offset +
-                                           field.type.GetSize());
+        auto elem_data = value.subspan(field.offset, field.type.GetSize());
         elems.push_back(value_to_str(
             bpftrace, field.type, elem_data, is_per_cpu, div, false));
       }
@@ -396,26 +504,6 @@ std::string Output::value_to_str(BPFtrace &bpftrace,
       }
       return std::to_string(util::read_data<uint64_t>(value.data()) / div);
     }
-    case Type::timestamp: {
-      return bpftrace.resolve_timestamp(
-          reinterpret_cast<const AsyncEvent::Strftime *>(value.data())->mode,
-          reinterpret_cast<const AsyncEvent::Strftime *>(value.data())
-              ->strftime_id,
-          reinterpret_cast<const AsyncEvent::Strftime *>(value.data())->nsecs);
-    }
-    case Type::mac_address: {
-      return bpftrace.resolve_mac_address(value.data());
-    }
-    case Type::cgroup_path_t: {
-      return bpftrace.resolve_cgroup_path(
-          reinterpret_cast<const AsyncEvent::CgroupPath *>(value.data())
-              ->cgroup_path_id,
-          reinterpret_cast<const AsyncEvent::CgroupPath *>(value.data())
-              ->cgroup_id);
-    }
-    case Type::strerror_t: {
-      return strerror(util::read_data<uint64_t>(value.data()));
-    }
     case Type::none: {
       return "";
     }
@@ -432,9 +520,9 @@ std::string Output::value_to_str(BPFtrace &bpftrace,
   return "";
 }
 
-std::string Output::map_key_str(BPFtrace &bpftrace,
-                                const SizedType &arg,
-                                const std::vector<uint8_t> &data) const
+std::string FormattedOutput::map_key_str(BPFtrace &bpftrace,
+                                         const SizedType &arg,
+                                         std::span<const uint8_t> data) const
 {
   std::ostringstream ptr;
   switch (arg.GetTy()) {
@@ -461,9 +549,7 @@ std::string Output::map_key_str(BPFtrace &bpftrace,
     case Type::tuple: {
       std::vector<std::string> elems;
       for (auto &field : arg.GetFields()) {
-        std::vector<uint8_t> elem_data(data.begin() + field.offset,
-                                       data.begin() + field.offset +
-                                           field.type.GetSize());
+        auto elem_data = data.subspan(field.offset, field.type.GetSize());
         elems.push_back(
             value_to_str(bpftrace, field.type, elem_data, false, 1, true));
       }
@@ -483,37 +569,33 @@ std::string Output::map_key_str(BPFtrace &bpftrace,
   return "";
 }
 
-std::string Output::array_to_str(const std::vector<std::string> &elems) const
+std::string FormattedOutput::array_to_str(
+    const std::vector<std::string> &elems) const
 {
   return "[" + util::str_join(elems, ",") + "]";
 }
 
-std::string Output::struct_to_str(const std::vector<std::string> &elems) const
+std::string FormattedOutput::struct_to_str(
+    const std::vector<std::string> &elems) const
 {
   return "{ " + util::str_join(elems, ", ") + " }";
 }
 
-void Output::map_contents(
+void FormattedOutput::map_contents(
     BPFtrace &bpftrace,
     const BpfMap &map,
     uint32_t top,
     uint32_t div,
-    const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-        &values_by_key) const
+    const MapElements &values_by_key) const
 {
-  uint32_t i = 0;
-  size_t total = values_by_key.size();
   const auto &map_type = bpftrace.resources.maps_info.at(map.name()).value_type;
+  size_t skip = util::top_skip(values_by_key.size(), top);
+  size_t i = 0;
 
   bool first = true;
-  for (const auto &pair : values_by_key) {
-    auto key = pair.first;
-    auto value = pair.second;
-
-    if (top) {
-      if (total > top && i++ < (total - top))
-        continue;
-    }
+  for (const auto &[key, value] : values_by_key) {
+    if (i++ < skip)
+      continue;
 
     if (first)
       first = false;
@@ -527,25 +609,21 @@ void Output::map_contents(
   }
 }
 
-void Output::map_hist_contents(
-    BPFtrace &bpftrace,
-    const BpfMap &map,
-    uint32_t top,
-    uint32_t div,
-    const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
-    const std::vector<std::pair<std::vector<uint8_t>, uint64_t>>
-        &total_counts_by_key) const
+void FormattedOutput::map_hist_contents(BPFtrace &bpftrace,
+                                        const BpfMap &map,
+                                        uint32_t top,
+                                        uint32_t div,
+                                        const Histograms &histograms) const
 {
-  uint32_t i = 0;
   const auto &map_info = bpftrace.resources.maps_info.at(map.name());
   const auto &map_type = map_info.value_type;
+  size_t skip = util::top_skip(histograms.size(), top);
   bool first = true;
-  for (const auto &key_count : total_counts_by_key) {
-    const auto &key = key_count.first;
-    const auto &value = values_by_key.at(key);
-
-    if (top && values_by_key.size() > top && i++ < (values_by_key.size() - top))
-      continue;
+  // Only the printed histograms are expanded to all of their buckets
+  std::vector<uint64_t> value;
+  for (const auto &hist : histograms | std::views::drop(skip)) {
+    const auto &key = hist.key();
+    hist.expand(value, map_type.IsHistTy() ? 65 * 32 : 1002);
 
     if (first)
       first = false;
@@ -570,24 +648,23 @@ void Output::map_hist_contents(
   }
 }
 
-void Output::map_stats_contents(
+void FormattedOutput::map_stats_contents(
     BPFtrace &bpftrace,
     const BpfMap &map,
     uint32_t top,
     uint32_t div,
-    const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-        &values_by_key) const
+    const MapElements &values_by_key) const
 {
   const auto &map_type = bpftrace.resources.maps_info.at(map.name()).value_type;
-  uint32_t i = 0;
-  size_t total = values_by_key.size();
+  // Stats maps are always printed in full
+  size_t skip = map_type.IsAvgTy() ? util::top_skip(values_by_key.size(), top)
+                                   : 0;
+  size_t i = 0;
   bool first = true;
 
   for (const auto &[key, value] : values_by_key) {
-    if (top && map_type.IsAvgTy()) {
-      if (total > top && i++ < (total - top))
-        continue;
-    }
+    if (i++ < skip)
+      continue;
 
     if (first)
       first = false;
@@ -633,8 +710,7 @@ void TextOutput::map(
     const BpfMap &map,
     uint32_t top,
     uint32_t div,
-    const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-        &values_by_key) const
+    const MapElements &values_by_key) const
 {
   map_contents(bpftrace, map, top, div, values_by_key);
   out_ << std::endl;
@@ -728,17 +804,13 @@ std::string TextOutput::lhist_to_str(const std::vector<uint64_t> &values,
   return res.str();
 }
 
-void TextOutput::map_hist(
-    BPFtrace &bpftrace,
-    const BpfMap &map,
-    uint32_t top,
-    uint32_t div,
-    const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
-    const std::vector<std::pair<std::vector<uint8_t>, uint64_t>>
-        &total_counts_by_key) const
+void TextOutput::map_hist(BPFtrace &bpftrace,
+                          const BpfMap &map,
+                          uint32_t top,
+                          uint32_t div,
+                          const Histograms &histograms) const
 {
-  map_hist_contents(
-      bpftrace, map, top, div, values_by_key, total_counts_by_key);
+  map_hist_contents(bpftrace, map, top, div, histograms);
   out_ << std::endl;
 }
 
@@ -747,8 +819,7 @@ void TextOutput::map_stats(
     const BpfMap &map,
     uint32_t top,
     uint32_t div,
-    const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-        &values_by_key) const
+    const MapElements &values_by_key) const
 {
   map_stats_contents(bpftrace, map, top, div, values_by_key);
   out_ << std::endl << std::endl;
@@ -763,7 +834,7 @@ void TextOutput::value(BPFtrace &bpftrace,
 
 std::string TextOutput::value_to_str(BPFtrace &bpftrace,
                                      const SizedType &type,
-                                     const std::vector<uint8_t> &value,
+                                     std::span<const uint8_t> value,
                                      bool is_per_cpu,
                                      uint32_t div,
                                      bool is_map_key) const
@@ -812,7 +883,7 @@ std::string TextOutput::value_to_str(BPFtrace &bpftrace,
       [[fallthrough]];
     }
     default: {
-      return Output::value_to_str(
+      return FormattedOutput::value_to_str(
           bpftrace, type, value, is_per_cpu, div, is_map_key);
     }
   };
@@ -868,7 +939,7 @@ std::string TextOutput::tuple_to_str(const std::vector<std::string> &elems,
 
 std::string TextOutput::map_key_to_str(BPFtrace &bpftrace,
                                        const BpfMap &map,
-                                       const std::vector<uint8_t> &key) const
+                                       std::span<const uint8_t> key) const
 {
   const auto &map_info = bpftrace.resources.maps_info.at(map.name());
   const auto &key_type = map_info.key_type;
@@ -906,51 +977,12 @@ std::string TextOutput::key_value_pairs_to_str(
   return util::str_join(elems, ", ");
 }
 
-std::string JsonOutput::json_escape(const std::string &str) const
-{
-  std::ostringstream escaped;
-  for (const char &c : str) {
-    switch (c) {
-      case '"':
-        escaped << "\\\"";
-        break;
-
-      case '\\':
-        escaped << "\\\\";
-        break;
-
-      case '\n':
-        escaped << "\\n";
-        break;
-
-      case '\r':
-        escaped << "\\r";
-        break;
-
-      case '\t':
-        escaped << "\\t";
-        break;
-
-      default:
-        // c always >= '\x00'
-        if (c <= '\x1f') {
-          escaped << "\\u" << std::hex << std::setw(4) << std::setfill('0')
-                  << static_cast<int>(c);
-        } else {
-          escaped << c;
-        }
-    }
-  }
-  return escaped.str();
-}
-
 void JsonOutput::map(
     BPFtrace &bpftrace,
     const BpfMap &map,
     uint32_t top,
     uint32_t div,
-    const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-        &values_by_key) const
+    const MapElements &values_by_key) const
 {
   if (values_by_key.empty())
     return;
@@ -958,7 +990,7 @@ void JsonOutput::map(
   const auto &map_info = bpftrace.resources.maps_info.at(map.name());
 
   out_ << R"({"type": ")" << MessageType::map << R"(", "data": {)";
-  out_ << "\"" << json_escape(map.name()) << "\": ";
+  out_ << "\"" << util::json_escape(map.name()) << "\": ";
   if (!map_info.is_scalar)
     out_ << "{";
 
@@ -1054,27 +1086,23 @@ std::string JsonOutput::lhist_to_str(const std::vector<uint64_t> &values,
   return res.str();
 }
 
-void JsonOutput::map_hist(
-    BPFtrace &bpftrace,
-    const BpfMap &map,
-    uint32_t top,
-    uint32_t div,
-    const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
-    const std::vector<std::pair<std::vector<uint8_t>, uint64_t>>
-        &total_counts_by_key) const
+void JsonOutput::map_hist(BPFtrace &bpftrace,
+                          const BpfMap &map,
+                          uint32_t top,
+                          uint32_t div,
+                          const Histograms &histograms) const
 {
-  if (total_counts_by_key.empty())
+  if (histograms.empty())
     return;
 
   const auto &map_info = bpftrace.resources.maps_info.at(map.name());
 
   out_ << R"({"type": ")" << MessageType::hist << R"(", "data": {)";
-  out_ << "\"" << json_escape(map.name()) << "\": ";
+  out_ << "\"" << util::json_escape(map.name()) << "\": ";
   if (!map_info.is_scalar)
     out_ << "{";
 
-  map_hist_contents(
-      bpftrace, map, top, div, values_by_key, total_counts_by_key);
+  map_hist_contents(bpftrace, map, top, div, histograms);
 
   if (!map_info.is_scalar)
     out_ << "}";
@@ -1086,8 +1114,7 @@ void JsonOutput::map_stats(
     const BpfMap &map,
     uint32_t top,
     uint32_t div,
-    const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-        &values_by_key) const
+    const MapElements &values_by_key) const
 {
   if (values_by_key.empty())
     return;
@@ -1095,7 +1122,7 @@ void JsonOutput::map_stats(
   const auto &map_info = bpftrace.resources.maps_info.at(map.name());
 
   out_ << R"({"type": ")" << MessageType::stats << R"(", "data": {)";
-  out_ << "\"" << json_escape(map.name()) << "\": ";
+  out_ << "\"" << util::json_escape(map.name()) << "\": ";
   if (!map_info.is_scalar)
     out_ << "{";
 
@@ -1119,7 +1146,7 @@ void JsonOutput::message(MessageType type,
                          const std::string &msg,
                          bool nl __attribute__((unused))) const
 {
-  out_ << R"({"type": ")" << type << R"(", "data": ")" << json_escape(msg)
+  out_ << R"({"type": ")" << type << R"(", "data": ")" << util::json_escape(msg)
        << "\"}" << std::endl;
 }
 
@@ -1167,7 +1194,7 @@ std::string JsonOutput::tuple_to_str(const std::vector<std::string> &elems,
 
 std::string JsonOutput::value_to_str(BPFtrace &bpftrace,
                                      const SizedType &type,
-                                     const std::vector<uint8_t> &value,
+                                     std::span<const uint8_t> value,
                                      bool is_per_cpu,
                                      uint32_t div,
                                      bool is_map_key) const
@@ -1179,15 +1206,15 @@ std::string JsonOutput::value_to_str(BPFtrace &bpftrace,
       str = std::to_string(util::read_data<uint64_t>(value.data()));
       break;
     default:
-      str = Output::value_to_str(
+      str = FormattedOutput::value_to_str(
           bpftrace, type, value, is_per_cpu, div, is_map_key);
   };
 
   if (is_quoted_type(type)) {
     if (is_map_key) {
-      return json_escape(str);
+      return util::json_escape(str);
     } else {
-      return "\"" + json_escape(str) + "\"";
+      return "\"" + util::json_escape(str) + "\"";
     }
   }
 
@@ -1196,13 +1223,14 @@ std::string JsonOutput::value_to_str(BPFtrace &bpftrace,
 
 std::string JsonOutput::map_key_to_str(BPFtrace &bpftrace,
                                        const BpfMap &map,
-                                       const std::vector<uint8_t> &key) const
+                                       std::span<const uint8_t> key) const
 {
   const auto &map_info = bpftrace.resources.maps_info.at(map.name());
   if (map_info.is_scalar)
     return "";
 
-  return "\"" + json_escape(map_key_str(bpftrace, map_info.key_type, key)) +
+  return "\"" +
+         util::json_escape(map_key_str(bpftrace, map_info.key_type, key)) +
          "\"";
 }
 
@@ -1228,4 +1256,374 @@ std::string JsonOutput::key_value_pairs_to_str(
   return "{" + util::str_join(elems, ", ") + "}";
 }
 
+BinaryOutput::BinaryOutput(std::ostream &out, std::ostream &err)
+    : Output(out, err)
+{
+  binary::Encoder header;
+  header.u32(binary::VERSION);
+  out_ << binary::MAGIC << header.data() << std::flush;
+}
+
+void BinaryOutput::write_record(binary::RecordType type,
+                                const binary::Encoder &record) const
+{
+  binary::Encoder header;
+  header.u8(static_cast<uint8_t>(type));
+  header.u32(record.data().size());
+  // Flushed like the lines of the other outputs, so that the records can be
+  // read as they come
+  out_ << header.data() << record.data() << std::flush;
+}
+
+void BinaryOutput::begin_map(BPFtrace &bpftrace,
+                             const BpfMap &map,
+                             MessageType kind,
+                             binary::Encoder &record) const
+{
+  auto [it, inserted] = schemas_.try_emplace(map.name(), schemas_.size());
+  if (inserted) {
+    const auto &map_info = bpftrace.resources.maps_info.at(map.name());
+    binary::Encoder schema;
+    schema.u32(it->second);
+    schema.string(map.name());
+    schema.string(type_name(kind));
+    schema.u8(map_info.is_scalar);
+    if (map_info.is_scalar)
+      schema.kind(binary::TypeKind::none);
+    else
+      encode_type(schema, map_info.key_type);
+    encode_type(schema, map_info.value_type);
+    write_record(binary::RecordType::schema, schema);
+  }
+  record.u32(it->second);
+}
+
+void BinaryOutput::encode_type(binary::Encoder &enc, const SizedType &type)
+{
+  switch (type.GetTy()) {
+    case Type::integer:
+    case Type::count_t:
+    case Type::sum_t:
+    case Type::max_t:
+    case Type::min_t:
+    case Type::avg_t:
+      enc.kind(type.IsSigned() ? binary::TypeKind::sint
+                               : binary::TypeKind::uint);
+      return;
+    case Type::pointer:
+      enc.kind(binary::TypeKind::pointer);
+      return;
+    case Type::none:
+      enc.kind(binary::TypeKind::none);
+      return;
+    case Type::tuple:
+      enc.kind(binary::TypeKind::tuple);
+      enc.u32(type.GetFields().size());
+      for (auto &field : type.GetFields())
+        encode_type(enc, field.type);
+      return;
+    case Type::record:
+      enc.kind(binary::TypeKind::record);
+      enc.u32(type.GetFields().size());
+      for (auto &field : type.GetFields()) {
+        enc.string(field.name);
+        encode_type(enc, field.type);
+      }
+      return;
+    case Type::array:
+      enc.kind(binary::TypeKind::array);
+      enc.u32(type.GetNumElements());
+      encode_type(enc, *type.GetElementTy());
+      return;
+    case Type::hist_t:
+    case Type::lhist_t:
+      enc.kind(binary::TypeKind::hist);
+      return;
+    case Type::stats_t:
+      enc.kind(binary::TypeKind::stats);
+      enc.u8(type.IsSigned());
+      return;
+    // Resolved to strings by resolved_value_to_str()
+    case Type::buffer:
+    case Type::cgroup_path_t:
+    case Type::inet:
+    case Type::kstack_t:
+    case Type::ksym_t:
+    case Type::mac_address:
+    case Type::strerror_t:
+    case Type::string:
+    case Type::timestamp:
+    case Type::username:
+    case Type::ustack_t:
+    case Type::usym_t:
+      enc.kind(binary::TypeKind::string);
+      return;
+    case Type::voidtype:
+    case Type::stack_mode:
+    case Type::timestamp_mode:
+      LOG(BUG) << "Invalid value type: " << type;
+  }
+}
+
+void BinaryOutput::encode_value(binary::Encoder &enc,
+                                BPFtrace &bpftrace,
+                                const SizedType &type,
+                                std::span<const uint8_t> value,
+                                bool is_per_cpu,
+                                uint32_t div) const
+{
+  uint32_t nvalues = is_per_cpu ? bpftrace.ncpus_ : 1;
+  auto sdiv = static_cast<int64_t>(div);
+  switch (type.GetTy()) {
+    case Type::integer: {
+      auto sign = type.IsSigned();
+      switch (type.GetIntBitWidth()) {
+        case 64:
+          if (sign)
+            return encode_int(
+                enc, util::reduce_value<int64_t>(value, nvalues) / sdiv);
+          return encode_int(enc,
+                            util::reduce_value<uint64_t>(value, nvalues) / div);
+        case 32:
+          if (sign)
+            return encode_int(
+                enc, util::reduce_value<int32_t>(value, nvalues) / sdiv);
+          return encode_int(enc,
+                            util::reduce_value<uint32_t>(value, nvalues) / div);
+        case 16:
+          if (sign)
+            return encode_int(
+                enc, util::reduce_value<int16_t>(value, nvalues) / sdiv);
+          return encode_int(enc,
+                            util::reduce_value<uint16_t>(value, nvalues) / div);
+        case 8:
+          if (sign)
+            return encode_int(
+                enc, util::reduce_value<int8_t>(value, nvalues) / sdiv);
+          return encode_int(enc,
+                            util::reduce_value<uint8_t>(value, nvalues) / div);
+        default:
+          LOG(BUG) << "encode_value: Invalid int bitwidth: "
+                   << type.GetIntBitWidth() << "provided";
+          return;
+      }
+    }
+    case Type::count_t:
+      return enc.u64(util::reduce_value<uint64_t>(value, nvalues) / div);
+    case Type::sum_t:
+      if (type.IsSigned())
+        return enc.i64(util::reduce_value<int64_t>(value, nvalues) / sdiv);
+      return enc.u64(util::reduce_value<uint64_t>(value, nvalues) / div);
+    case Type::max_t:
+    case Type::min_t:
+      if (is_per_cpu) {
+        if (type.IsSigned())
+          return enc.i64(
+              util::min_max_value<int64_t>(value, nvalues, type.IsMaxTy()) /
+              sdiv);
+        return enc.u64(
+            util::min_max_value<uint64_t>(value, nvalues, type.IsMaxTy()) /
+            div);
+      }
+      [[fallthrough]];
+    case Type::avg_t:
+      if (type.IsSigned())
+        return enc.i64(util::read_data<int64_t>(value.data()) / sdiv);
+      return enc.u64(util::read_data<uint64_t>(value.data()) / div);
+    case Type::pointer:
+      return enc.u64(util::read_data<uint64_t>(value.data()));
+    case Type::none:
+      return;
+    case Type::tuple:
+    case Type::record:
+      for (auto &field : type.GetFields())
+        encode_value(enc,
+                     bpftrace,
+                     field.type,
+                     value.subspan(field.offset, field.type.GetSize()),
+                     is_per_cpu,
+                     div);
+      return;
+    case Type::array: {
+      size_t elem_size = type.GetElementTy()->GetSize();
+      for (size_t i = 0; i < type.GetNumElements(); i++)
+        encode_value(enc,
+                     bpftrace,
+                     *type.GetElementTy(),
+                     value.subspan(i * elem_size, elem_size),
+                     is_per_cpu,
+                     div);
+      return;
+    }
+    case Type::buffer:
+    case Type::cgroup_path_t:
+    case Type::inet:
+    case Type::kstack_t:
+    case Type::ksym_t:
+    case Type::mac_address:
+    case Type::strerror_t:
+    case Type::string:
+    case Type::timestamp:
+    case Type::username:
+    case Type::ustack_t:
+    case Type::usym_t:
+      return enc.string(resolved_value_to_str(bpftrace, type, value));
+    case Type::hist_t:
+    case Type::lhist_t:
+    case Type::stats_t:
+    case Type::voidtype:
+    case Type::stack_mode:
+    case Type::timestamp_mode:
+      LOG(BUG) << "Invalid value type: " << type;
+  }
+}
+
+void BinaryOutput::encode_key(binary::Encoder &enc,
+                              BPFtrace &bpftrace,
+                              const BpfMap &map,
+                              std::span<const uint8_t> key) const
+{
+  const auto &map_info = bpftrace.resources.maps_info.at(map.name());
+  if (!map_info.is_scalar)
+    encode_value(enc, bpftrace, map_info.key_type, key, false, 1);
+}
+
+void BinaryOutput::map(
+    BPFtrace &bpftrace,
+    const BpfMap &map,
+    uint32_t top,
+    uint32_t div,
+    const MapElements &values_by_key) const
+{
+  const auto &map_type = bpftrace.resources.maps_info.at(map.name()).value_type;
+  size_t total = values_by_key.size();
+  size_t skip = util::top_skip(total, top);
+
+  binary::Encoder record;
+  begin_map(bpftrace, map, MessageType::map, record);
+  record.u32(total - skip);
+  size_t i = 0;
+  for (const auto &[key, value] : values_by_key) {
+    if (i++ < skip)
+      continue;
+    encode_key(record, bpftrace, map, key);
+    encode_value(record, bpftrace, map_type, value, map.is_per_cpu_type(), div);
+  }
+  write_record(binary::RecordType::map, record);
+}
+
+void BinaryOutput::map_hist(BPFtrace &bpftrace,
+                            const BpfMap &map,
+                            uint32_t top,
+                            uint32_t div,
+                            const Histograms &histograms) const
+{
+  const auto &map_info = bpftrace.resources.maps_info.at(map.name());
+  size_t total = histograms.size();
+  size_t skip = util::top_skip(total, top);
+  // Like in the other outputs, only log2 histogram counts are divided
+  if (!map_info.value_type.IsHistTy())
+    div = 1;
+
+  binary::Encoder record;
+  begin_map(bpftrace, map, MessageType::hist, record);
+  record.u32(total - skip);
+  for (const auto &hist : histograms | std::views::drop(skip)) {
+    encode_key(record, bpftrace, map, hist.key());
+    record.u32(hist.buckets().size());
+    for (const auto &bucket : hist.buckets()) {
+      auto [low, high] = hist_bucket_bounds(map_info, bucket.index);
+      record.i64(low);
+      record.i64(high);
+      record.u64(bucket.count / div);
+    }
+  }
+  write_record(binary::RecordType::map, record);
+}
+
+void BinaryOutput::map_stats(
+    BPFtrace &bpftrace,
+    const BpfMap &map,
+    uint32_t top,
+    uint32_t div,
+    const MapElements &values_by_key) const
+{
+  const auto &map_type = bpftrace.resources.maps_info.at(map.name()).value_type;
+  size_t total = values_by_key.size();
+  size_t skip = map_type.IsAvgTy() ? util::top_skip(total, top) : 0;
+
+  binary::Encoder record;
+  begin_map(bpftrace, map, MessageType::stats, record);
+  record.u32(total - skip);
+  size_t i = 0;
+  for (const auto &[key, value] : values_by_key) {
+    if (i++ < skip)
+      continue;
+    encode_key(record, bpftrace, map, key);
+    if (map_type.IsSigned()) {
+      auto stats = util::stats_value<int64_t>(value, bpftrace.ncpus_);
+      if (map_type.IsStatsTy())
+        record.i64(stats.count);
+      record.i64(stats.avg / static_cast<int64_t>(div));
+      if (map_type.IsStatsTy())
+        record.i64(stats.total);
+    } else {
+      auto stats = util::stats_value<uint64_t>(value, bpftrace.ncpus_);
+      if (map_type.IsStatsTy())
+        record.u64(stats.count);
+      record.u64(stats.avg / div);
+      if (map_type.IsStatsTy())
+        record.u64(stats.total);
+    }
+  }
+  write_record(binary::RecordType::map, record);
+}
+
+void BinaryOutput::value(BPFtrace &bpftrace,
+                         const SizedType &ty,
+                         std::vector<uint8_t> &value) const
+{
+  binary::Encoder record;
+  encode_type(record, ty);
+  encode_value(record, bpftrace, ty, value, false, 1);
+  write_record(binary::RecordType::value, record);
+}
+
+void BinaryOutput::message(MessageType type,
+                           const std::string &msg,
+                           bool nl) const
+{
+  binary::Encoder record;
+  record.string(type_name(type));
+  record.u8(nl);
+  record.string(msg);
+  write_record(binary::RecordType::message, record);
+}
+
+void BinaryOutput::lost_events(uint64_t lost) const
+{
+  binary::Encoder record;
+  record.u64(lost);
+  write_record(binary::RecordType::lost_events, record);
+}
+
+void BinaryOutput::attached_probes(uint64_t num_probes) const
+{
+  binary::Encoder record;
+  record.u64(num_probes);
+  write_record(binary::RecordType::attached_probes, record);
+}
+
+void BinaryOutput::helper_error(int retcode, const HelperErrorInfo &info) const
+{
+  binary::Encoder record;
+  record.i32(retcode);
+  record.string(libbpf::bpf_func_name[info.func_id]);
+  record.string(get_helper_error_msg(info.func_id, retcode));
+  record.string(info.filename);
+  record.u32(info.line);
+  record.u32(info.column);
+  write_record(binary::RecordType::helper_error, record);
+}
+
 } // namespace bpftrace
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <iostream>
-#include <map>
+#include <span>
+#include <unordered_map>
 #include <vector>
 
+#include "binary_format.h"
 #include "bpfmap.h"
+#include "histograms.h"
 #include "required_resources.h"
 #include "types.h"
 
@@ -32,10 +35,8 @@ enum class MessageType {
 std::ostream &operator<<(std::ostream &out, MessageType type);
 
 // Abstract class (interface) for output
-// Provides default implementation of some methods for formatting map and
-// non-map values into strings.
-// All output formatters should extend this class and override (at least) pure
-// virtual methods.
+// All outputs should extend this class and override its pure virtual methods.
+// Outputs which print values as text should extend FormattedOutput instead.
 class Output {
 public:
   explicit Output(std::ostream &out = std::cout, std::ostream &err = std::cerr)
@@ -57,29 +58,24 @@ public:
       const BpfMap &map,
       uint32_t top,
       uint32_t div,
-      const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-          &values_by_key) const = 0;
+      const MapElements &values_by_key) const = 0;
   // Write map histogram to output
-  virtual void map_hist(
-      BPFtrace &bpftrace,
-      const BpfMap &map,
-      uint32_t top,
-      uint32_t div,
-      const std::map<std::vector<uint8_t>, std::vector<uint64_t>>
-          &values_by_key,
-      const std::vector<std::pair<std::vector<uint8_t>, uint64_t>>
-          &total_counts_by_key) const = 0;
+  // The histograms must be sorted by total count.
+  virtual void map_hist(BPFtrace &bpftrace,
+                        const BpfMap &map,
+                        uint32_t top,
+                        uint32_t div,
+                        const Histograms &histograms) const = 0;
   // Write map statistics to output
   virtual void map_stats(
       BPFtrace &bpftrace,
       const BpfMap &map,
       uint32_t top,
       uint32_t div,
-      const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-          &values_by_key) const = 0;
+      const MapElements &values_by_key) const = 0;
   // Write non-map value to output
-  // Ideally, the implementation should use value_to_str to convert a value into
-  // a string, format it properly, and print it to out_.
+  // Ideally, text outputs should use FormattedOutput::value_to_str to convert a
+  // value into a string, format it properly, and print it to out_.
   virtual void value(BPFtrace &bpftrace,
                      const SizedType &ty,
                      std::vector<uint8_t> &value) const = 0;
@@ -94,6 +90,24 @@ public:
 protected:
   std::ostream &out_;
   std::ostream &err_;
+  std::string get_helper_error_msg(int func_id, int retcode) const;
+  // Convert a value which only bpftrace can make sense of (e.g. a stack, a
+  // symbol or a user name) into string. Strings are returned as they are.
+  std::string resolved_value_to_str(BPFtrace &bpftrace,
+                                    const SizedType &type,
+                                    std::span<const uint8_t> value) const;
+};
+
+// Base class for outputs which print values as text
+// Provides default implementation of some methods for formatting map and
+// non-map values into strings.
+// All text output formatters should extend this class and override (at least)
+// pure virtual methods.
+class FormattedOutput : public Output {
+public:
+  using Output::Output;
+
+protected:
   void hist_prepare(const std::vector<uint64_t> &values,
                     int &min_index,
                     int &max_index,
@@ -107,7 +121,6 @@ protected:
                      int &buckets,
                      int &start_value,
                      int &end_value) const;
-  std::string get_helper_error_msg(int func_id, int retcode) const;
   // Convert a log2 histogram into string
   virtual std::string hist_to_str(const std::vector<uint64_t> &values,
                                   uint32_t div,
@@ -126,20 +139,15 @@ protected:
       const BpfMap &map,
       uint32_t top,
       uint32_t div,
-      const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-          &values_by_key) const;
+      const MapElements &values_by_key) const;
   // Convert map histogram into string
   // Default behaviour: format each (key, hist) pair using output-specific
   // methods and join them into a single string
-  virtual void map_hist_contents(
-      BPFtrace &bpftrace,
-      const BpfMap &map,
-      uint32_t top,
-      uint32_t div,
-      const std::map<std::vector<uint8_t>, std::vector<uint64_t>>
-          &values_by_key,
-      const std::vector<std::pair<std::vector<uint8_t>, uint64_t>>
-          &total_counts_by_key) const;
+  virtual void map_hist_contents(BPFtrace &bpftrace,
+                                 const BpfMap &map,
+                                 uint32_t top,
+                                 uint32_t div,
+                                 const Histograms &histograms) const;
   // Convert map statistics into string
   // Default behaviour: format each (key, stats) pair using output-specific
   // methods and join them into a single string
@@ -148,12 +156,11 @@ protected:
       const BpfMap &map,
       uint32_t top,
       uint32_t div,
-      const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-          &values_by_key) const;
+      const MapElements &values_by_key) const;
   // Convert map key to string
   virtual std::string map_key_to_str(BPFtrace &bpftrace,
                                      const BpfMap &map,
-                                     const std::vector<uint8_t> &key) const = 0;
+                                     std::span<const uint8_t> key) const = 0;
   // Properly join map key and value strings
   virtual void map_key_val(const SizedType &map_type,
                            const std::string &key,
@@ -166,13 +173,13 @@ protected:
   // methods.
   virtual std::string value_to_str(BPFtrace &bpftrace,
                                    const SizedType &type,
-                                   const std::vector<uint8_t> &value,
+                                   std::span<const uint8_t> value,
                                    bool is_per_cpu = false,
                                    uint32_t div = 1,
                                    bool is_map_key = false) const;
   virtual std::string map_key_str(BPFtrace &bpftrace,
                                   const SizedType &arg,
-                                  const std::vector<uint8_t> &data) const;
+                                  std::span<const uint8_t> data) const;
   // Convert an array to string
   // Default behaviour: [elem1, elem2, ...]
   virtual std::string array_to_str(const std::vector<std::string> &elems) const;
@@ -193,11 +200,11 @@ protected:
       std::vector<std::pair<std::string, std::string>> &keyvals) const = 0;
 };
 
-class TextOutput : public Output {
+class TextOutput : public FormattedOutput {
 public:
   explicit TextOutput(std::ostream &out = std::cout,
                       std::ostream &err = std::cerr)
-      : Output(out, err)
+      : FormattedOutput(out, err)
   {
   }
 
@@ -206,23 +213,18 @@ public:
       const BpfMap &map,
       uint32_t top,
       uint32_t div,
-      const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-          &values_by_key) const override;
+      const MapElements &values_by_key) const override;
   void map_hist(BPFtrace &bpftrace,
                 const BpfMap &map,
                 uint32_t top,
                 uint32_t div,
-                const std::map<std::vector<uint8_t>, std::vector<uint64_t>>
-                    &values_by_key,
-                const std::vector<std::pair<std::vector<uint8_t>, uint64_t>>
-                    &total_counts_by_key) const override;
+                const Histograms &histograms) const override;
   void map_stats(
       BPFtrace &bpftrace,
       const BpfMap &map,
       uint32_t top,
       uint32_t div,
-      const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-          &values_by_key) const override;
+      const MapElements &values_by_key) const override;
   void value(BPFtrace &bpftrace,
              const SizedType &ty,
              std::vector<uint8_t> &value) const override;
@@ -237,7 +239,7 @@ public:
 protected:
   std::string value_to_str(BPFtrace &bpftrace,
                            const SizedType &type,
-                           const std::vector<uint8_t> &value,
+                           std::span<const uint8_t> value,
                            bool is_per_cpu,
                            uint32_t div,
                            bool is_map_key = false) const override;
@@ -253,7 +255,7 @@ protected:
 
   std::string map_key_to_str(BPFtrace &bpftrace,
                              const BpfMap &map,
-                             const std::vector<uint8_t> &key) const override;
+                             std::span<const uint8_t> key) const override;
   void map_key_val(const SizedType &map_type,
                    const std::string &key,
                    const std::string &val) const override;
@@ -266,11 +268,11 @@ protected:
       std::vector<std::pair<std::string, std::string>> &keyvals) const override;
 };
 
-class JsonOutput : public Output {
+class JsonOutput : public FormattedOutput {
 public:
   explicit JsonOutput(std::ostream &out = std::cout,
                       std::ostream &err = std::cerr)
-      : Output(out, err)
+      : FormattedOutput(out, err)
   {
   }
 
@@ -279,23 +281,18 @@ public:
       const BpfMap &map,
       uint32_t top,
       uint32_t div,
-      const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-          &values_by_key) const override;
+      const MapElements &values_by_key) const override;
   void map_hist(BPFtrace &bpftrace,
                 const BpfMap &map,
                 uint32_t top,
                 uint32_t div,
-                const std::map<std::vector<uint8_t>, std::vector<uint64_t>>
-                    &values_by_key,
-                const std::vector<std::pair<std::vector<uint8_t>, uint64_t>>
-                    &total_counts_by_key) const override;
+                const Histograms &histograms) const override;
   void map_stats(
       BPFtrace &bpftrace,
       const BpfMap &map,
       uint32_t top,
       uint32_t div,
-      const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-          &values_by_key) const override;
+      const MapElements &values_by_key) const override;
   void value(BPFtrace &bpftrace,
              const SizedType &ty,
              std::vector<uint8_t> &value) const override;
@@ -310,13 +307,10 @@ public:
   void attached_probes(uint64_t num_probes) const override;
   void helper_error(int retcode, const HelperErrorInfo &info) const override;
 
-private:
-  std::string json_escape(const std::string &str) const;
-
 protected:
   std::string value_to_str(BPFtrace &bpftrace,
                            const SizedType &type,
-                           const std::vector<uint8_t> &value,
+                           std::span<const uint8_t> value,
                            bool is_per_cpu,
                            uint32_t div,
                            bool is_map_key) const override;
@@ -330,7 +324,7 @@ protected:
 
   std::string map_key_to_str(BPFtrace &bpftrace,
                              const BpfMap &map,
-                             const std::vector<uint8_t> &key) const override;
+                             std::span<const uint8_t> key) const override;
   void map_key_val(const SizedType &map_type,
                    const std::string &key,
                    const std::string &val) const override;
@@ -343,4 +337,65 @@ protected:
       std::vector<std::pair<std::string, std::string>> &keyvals) const override;
 };
 
+// Compact binary output, see binary_format.h for the format. It is meant to be
+// converted to text or JSON later by bpftrace-decode, so that printing large
+// maps doesn't have to format every element while tracing.
+class BinaryOutput : public Output {
+public:
+  explicit BinaryOutput(std::ostream &out = std::cout,
+                        std::ostream &err = std::cerr);
+
+  void map(
+      BPFtrace &bpftrace,
+      const BpfMap &map,
+      uint32_t top,
+      uint32_t div,
+      const MapElements &values_by_key) const override;
+  void map_hist(BPFtrace &bpftrace,
+                const BpfMap &map,
+                uint32_t top,
+                uint32_t div,
+                const Histograms &histograms) const override;
+  void map_stats(
+      BPFtrace &bpftrace,
+      const BpfMap &map,
+      uint32_t top,
+      uint32_t div,
+      const MapElements &values_by_key) const override;
+  void value(BPFtrace &bpftrace,
+             const SizedType &ty,
+             std::vector<uint8_t> &value) const override;
+
+  void message(MessageType type,
+               const std::string &msg,
+               bool nl = true) const override;
+  void lost_events(uint64_t lost) const override;
+  void attached_probes(uint64_t num_probes) const override;
+  void helper_error(int retcode, const HelperErrorInfo &info) const override;
+
+private:
+  void write_record(binary::RecordType type,
+                    const binary::Encoder &record) const;
+  // Writes the schema of the map if it hasn't been written yet and starts a
+  // map record with its id
+  void begin_map(BPFtrace &bpftrace,
+                 const BpfMap &map,
+                 MessageType kind,
+                 binary::Encoder &record) const;
+  static void encode_type(binary::Encoder &enc, const SizedType &type);
+  void encode_value(binary::Encoder &enc,
+                    BPFtrace &bpftrace,
+                    const SizedType &type,
+                    std::span<const uint8_t> value,
+                    bool is_per_cpu,
+                    uint32_t div) const;
+  void encode_key(binary::Encoder &enc,
+                  BPFtrace &bpftrace,
+                  const BpfMap &map,
+                  std::span<const uint8_t> key) const;
+
+  // Ids of the maps whose schema has been written, by name
+  mutable std::unordered_map<std::string, uint32_t> schemas_;
+};
+
 } // namespace bpftrace
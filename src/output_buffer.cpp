@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "output_buffer.h"
+
+namespace bpftrace {
+
+OutputBuffer::OutputBuffer(int fd, bool owns_fd)
+    : fd_(fd), owns_fd_(owns_fd), last_flush_(std::chrono::steady_clock::now())
+{
+  chunks_.push_back(std::make_unique<char[]>(chunk_size_));
+}
+
+OutputBuffer::~OutputBuffer()
+{
+  flush();
+  if (owns_fd_)
+    ::close(fd_);
+}
+
+void OutputBuffer::set_flush_policy(size_t flush_bytes,
+                                    std::chrono::milliseconds flush_interval)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  flush_bytes_ = flush_bytes;
+  flush_interval_ = flush_interval;
+}
+
+size_t OutputBuffer::buffered() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return buffered_locked();
+}
+
+size_t OutputBuffer::buffered_locked() const
+{
+  return (current_ * chunk_size_) + used_;
+}
+
+bool OutputBuffer::is_due() const
+{
+  return std::chrono::steady_clock::now() - last_flush_ >= flush_interval_;
+}
+
+int OutputBuffer::flush()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return flush_locked();
+}
+
+int OutputBuffer::flush_locked()
+{
+  last_flush_ = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < current_; i++)
+    iov_.push_back({ .iov_base = chunks_[i].get(), .iov_len = chunk_size_ });
+  if (used_ > 0)
+    iov_.push_back({ .iov_base = chunks_[current_].get(), .iov_len = used_ });
+
+  int err = 0;
+  size_t idx = 0;
+  while (idx < iov_.size()) {
+    int iovcnt = std::min(iov_.size() - idx, static_cast<size_t>(IOV_MAX));
+    ssize_t written = ::writev(fd_, &iov_[idx], iovcnt);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      // The data is dropped, there is no point in holding on to it
+      err = -errno;
+      break;
+    }
+
+    // Skip over what was written, which may end in the middle of a chunk
+    auto remaining = static_cast<size_t>(written);
+    while (idx < iov_.size() && remaining >= iov_[idx].iov_len) {
+      remaining -= iov_[idx].iov_len;
+      idx++;
+    }
+    if (remaining > 0) {
+      iov_[idx].iov_base = static_cast<char *>(iov_[idx].iov_base) + remaining;
+      iov_[idx].iov_len -= remaining;
+    }
+  }
+
+  iov_.clear();
+  current_ = 0;
+  used_ = 0;
+  return err;
+}
+
+void OutputBuffer::flush_if_due()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (buffered_locked() > 0 && is_due())
+    flush_locked();
+}
+
+std::streamsize OutputBuffer::xsputn(const char *s, std::streamsize count)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::streamsize done = 0;
+  while (done < count) {
+    if (used_ == chunk_size_) {
+      // The current chunk is full
+      if (buffered_locked() >= flush_bytes_) {
+        if (flush_locked())
+          return done;
+      } else {
+        current_++;
+        if (current_ == chunks_.size())
+          chunks_.push_back(std::make_unique<char[]>(chunk_size_));
+        used_ = 0;
+      }
+    }
+
+    size_t n = std::min(static_cast<size_t>(count - done), chunk_size_ - used_);
+    std::memcpy(chunks_[current_].get() + used_, s + done, n);
+    used_ += n;
+    done += n;
+  }
+  return done;
+}
+
+OutputBuffer::int_type OutputBuffer::overflow(int_type ch)
+{
+  if (traits_type::eq_int_type(ch, traits_type::eof()))
+    return traits_type::not_eof(ch);
+
+  char c = traits_type::to_char_type(ch);
+  if (xsputn(&c, 1) != 1)
+    return traits_type::eof();
+  return ch;
+}
+
+int OutputBuffer::sync()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (buffered_locked() >= flush_bytes_ || is_due())
+    return flush_locked() ? -1 : 0;
+  return 0;
+}
+
+} // namespace bpftrace
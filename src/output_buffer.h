@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <vector>
+
+#include <sys/uio.h>
+
+namespace bpftrace {
+
+// Stream buffer which holds output back and writes it to a file descriptor in
+// large batches, used for `-B full`.
+//
+// Data is accumulated in fixed-size chunks and written out with a single
+// writev(2) once `flush_bytes` are buffered, or when the stream is flushed
+// (e.g. by std::endl) at least `flush_interval` after the last write out.
+// Callers write out everything immediately with flush().
+//
+// Output may be written and flushed from different threads (e.g. the output
+// thread flushing while idle), so all accesses to the buffered data are
+// serialized by a mutex. To that end, the buffer doesn't expose a put area and
+// every write goes through xsputn().
+class OutputBuffer : public std::streambuf {
+public:
+  // With `owns_fd` set, `fd` is closed on destruction
+  explicit OutputBuffer(int fd, bool owns_fd = false);
+  ~OutputBuffer() override;
+
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  void set_flush_policy(size_t flush_bytes,
+                        std::chrono::milliseconds flush_interval);
+
+  // Writes out all buffered data. Returns 0 or a negative errno.
+  int flush();
+  // Writes out buffered data if `flush_interval` has elapsed since the last
+  // write out, for callers which want output to show up while idle.
+  void flush_if_due();
+
+  size_t buffered() const;
+
+protected:
+  std::streamsize xsputn(const char *s, std::streamsize count) override;
+  int_type overflow(int_type ch) override;
+  int sync() override;
+
+private:
+  static constexpr size_t chunk_size_ = 64 * 1024;
+
+  // These expect mutex_ to be held
+  size_t buffered_locked() const;
+  int flush_locked();
+  bool is_due() const;
+
+  int fd_;
+  bool owns_fd_;
+  mutable std::mutex mutex_;
+  size_t flush_bytes_ = 1024 * 1024;
+  std::chrono::milliseconds flush_interval_{ 100 };
+  std::chrono::steady_clock::time_point last_flush_;
+
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  // Chunk currently being filled, all chunks before it are full
+  size_t current_ = 0;
+  // Bytes used in the current chunk
+  size_t used_ = 0;
+  std::vector<struct iovec> iov_;
+};
+
+} // namespace bpftrace
@@ -1,24 +1,71 @@
 #include "pcap_writer.h"
 
 #ifdef HAVE_LIBPCAP
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <pcap/pcap.h>
 
 namespace bpftrace {
 
+namespace {
+// Packets are handed to the flush thread once this many bytes are buffered,
+// or after FLUSH_INTERVAL
+constexpr size_t FLUSH_SIZE = 4 << 20;
+constexpr auto FLUSH_INTERVAL = std::chrono::seconds(1);
+// write() waits for the flush thread beyond this
+constexpr size_t MAX_BUFFERED = 16 * FLUSH_SIZE;
+// Size of the stdio buffer of the file, so that a flush takes a few large
+// writes rather than one per few packets
+constexpr size_t FILE_BUFFER_SIZE = 1 << 20;
+
+struct PacketHeader {
+  uint64_t ns;
+  uint32_t size;
+} __attribute__((packed));
+} // namespace
+
 bool PCAPwriter::open(std::string file)
 {
   pd_ = pcap_open_dead(DLT_RAW, 65535);
   if (!pd_)
     return false;
 
-  pdumper_ = pcap_dump_open(pd_, file.c_str());
+  FILE *fp = fopen(file.c_str(), "w");
+  if (!fp)
+    return false;
+  setvbuf(fp, nullptr, _IOFBF, FILE_BUFFER_SIZE);
+
+  pdumper_ = pcap_dump_fopen(pd_, fp);
+  if (!pdumper_) {
+    fclose(fp);
+    return false;
+  }
+
+  buffer_.reserve(FLUSH_SIZE);
+  flusher_ = std::thread(&PCAPwriter::flush_loop, this);
   return true;
 }
 
 void PCAPwriter::close()
 {
-  pcap_close(pd_);
-  pcap_dump_close(pdumper_);
+  if (flusher_.joinable()) {
+    {
+      std::lock_guard lock(mutex_);
+      closing_ = true;
+    }
+    flush_cv_.notify_one();
+    flusher_.join();
+  }
+
+  if (pdumper_) {
+    pcap_dump_close(pdumper_);
+    pdumper_ = nullptr;
+  }
+  if (pd_) {
+    pcap_close(pd_);
+    pd_ = nullptr;
+  }
 }
 
 #define NSEC_PER_SEC 1000000000L
@@ -26,27 +73,80 @@ void PCAPwriter::close()
 
 bool PCAPwriter::write(uint64_t ns, void *pkt, unsigned int size)
 {
-  time_t secs, usecs, nsecs = ns;
-
-  secs = nsecs / NSEC_PER_SEC;
-  nsecs -= secs * NSEC_PER_SEC;
-  usecs = nsecs / NSEC_PER_USEC;
-
-  struct pcap_pkthdr hdr = {
-    .ts     = {
-      .tv_sec  = secs,
-      .tv_usec = usecs,
-    },
-    .caplen = size,
-    .len    = size,
-  };
-
-  pcap_dump(reinterpret_cast<u_char *>(pdumper_),
-            &hdr,
-            static_cast<const u_char *>(pkt));
+  if (!pdumper_)
+    return false;
+
+  PacketHeader hdr = { .ns = ns, .size = size };
+  std::unique_lock lock(mutex_);
+  space_cv_.wait(lock, [this] { return buffer_.size() < MAX_BUFFERED; });
+
+  auto *data = static_cast<const uint8_t *>(pkt);
+  auto *hdr_data = reinterpret_cast<const uint8_t *>(&hdr);
+  buffer_.insert(buffer_.end(), hdr_data, hdr_data + sizeof(hdr));
+  buffer_.insert(buffer_.end(), data, data + size);
+
+  if (buffer_.size() >= FLUSH_SIZE)
+    flush_cv_.notify_one();
   return true;
 }
 
+void PCAPwriter::flush_loop()
+{
+  std::vector<uint8_t> packets;
+  packets.reserve(FLUSH_SIZE);
+
+  std::unique_lock lock(mutex_);
+  while (true) {
+    flush_cv_.wait_for(lock, FLUSH_INTERVAL, [this] {
+      return closing_ || buffer_.size() >= FLUSH_SIZE;
+    });
+    // write() isn't called anymore once closing, so this is the last batch
+    bool done = closing_;
+    packets.swap(buffer_);
+    lock.unlock();
+    space_cv_.notify_all();
+
+    dump(packets);
+    packets.clear();
+    if (done)
+      return;
+    lock.lock();
+  }
+}
+
+void PCAPwriter::dump(const std::vector<uint8_t> &packets)
+{
+  if (packets.empty())
+    return;
+
+  for (size_t offset = 0; offset < packets.size();) {
+    PacketHeader pkt;
+    std::memcpy(&pkt, packets.data() + offset, sizeof(pkt));
+    offset += sizeof(pkt);
+
+    time_t secs, usecs, nsecs = pkt.ns;
+
+    secs = nsecs / NSEC_PER_SEC;
+    nsecs -= secs * NSEC_PER_SEC;
+    usecs = nsecs / NSEC_PER_USEC;
+
+    struct pcap_pkthdr hdr = {
+      .ts     = {
+        .tv_sec  = secs,
+        .tv_usec = usecs,
+      },
+      .caplen = pkt.size,
+      .len    = pkt.size,
+    };
+
+    pcap_dump(reinterpret_cast<u_char *>(pdumper_),
+              &hdr,
+              static_cast<const u_char *>(packets.data() + offset));
+    offset += pkt.size;
+  }
+  pcap_dump_flush(pdumper_);
+}
+
 }; // namespace bpftrace
 
 #else
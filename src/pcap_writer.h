@@ -1,7 +1,11 @@
 #pragma once
 
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 struct pcap;
 using pcap_t = struct pcap;
@@ -11,10 +15,20 @@ using pcap_dumper_t = struct pcap_dumper;
 
 namespace bpftrace {
 
+// Writes packets to a pcap file.
+//
+// write() is called from the event loop for every packet, so it only copies
+// the packet into a buffer. A background thread takes the buffered packets
+// about every second, or as soon as there are enough of them, and dumps them
+// to the file in one go. If it can't keep up, write() waits for it rather than
+// buffering without bound.
 class PCAPwriter {
 public:
   PCAPwriter() = default;
-  ~PCAPwriter() = default;
+  ~PCAPwriter()
+  {
+    close();
+  }
 
   bool open(std::string file);
   void close();
@@ -22,8 +36,21 @@ public:
   bool write(uint64_t ns, void *pkt, unsigned int size);
 
 private:
-  pcap_t *pd_;
-  pcap_dumper_t *pdumper_;
+  void flush_loop();
+  void dump(const std::vector<uint8_t> &packets);
+
+  pcap_t *pd_ = nullptr;
+  pcap_dumper_t *pdumper_ = nullptr;
+
+  // Each packet is its timestamp, size and data
+  std::vector<uint8_t> buffer_;
+  bool closing_ = false;
+  std::mutex mutex_;
+  // Signals the flush thread that the buffer is full or the file is closing
+  std::condition_variable flush_cv_;
+  // Signals write() that the buffer has been taken by the flush thread
+  std::condition_variable space_cv_;
+  std::thread flusher_;
 };
 
 }; // namespace bpftrace
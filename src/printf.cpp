@@ -6,148 +6,156 @@
 
 namespace bpftrace {
 
-PrintableString::PrintableString(std::string value,
-                                 std::optional<size_t> buffer_size,
-                                 const char *trunc_trailer)
-    : value_(std::move(value))
+void PrintableValue::set_sint(int64_t value)
 {
-  // Add a trailer if string is truncated
-  //
-  // The heuristic we use is to check if the string exactly fits inside
-  // the buffer (NUL included). If it does, we assume it was truncated.
-  // This is obviously not a perfect heuristic, but it solves the majority
-  // case well enough and is simple to implement.
-  if (buffer_size && (value_.size() + 1 == *buffer_size))
-    value_ += trunc_trailer;
+  kind_ = Kind::sint;
+  value_ = static_cast<uint64_t>(value);
 }
 
-int PrintableString::print(char *buf,
-                           size_t size,
-                           const char *fmt,
-                           Type /*token*/,
-                           ArgumentType /*expected_type*/)
+void PrintableValue::set_uint(uint64_t value)
 {
-  return snprintf(buf, size, fmt, value_.c_str());
+  kind_ = Kind::uint;
+  value_ = value;
 }
 
-int PrintableBuffer::print(char *buf,
-                           size_t size,
-                           const char *fmt,
-                           Type /*token*/,
-                           ArgumentType /*expected_type*/)
+void PrintableValue::set_enum(uint64_t value, std::string_view name)
 {
-  return snprintf(buf,
-                  size,
-                  fmt,
-                  util::hex_format_buffer(
-                      value_.data(), value_.size(), keep_ascii_, escape_hex_)
-                      .c_str());
+  kind_ = Kind::enumeration;
+  value_ = value;
+  text_.assign(name);
 }
 
-void PrintableBuffer::keep_ascii(bool value)
+void PrintableValue::set_string(std::string_view value)
 {
-  keep_ascii_ = value;
+  kind_ = Kind::string;
+  text_.assign(value);
 }
 
-void PrintableBuffer::escape_hex(bool value)
+void PrintableValue::set_string(std::string_view value,
+                                size_t buffer_size,
+                                std::string_view trunc_trailer)
 {
-  escape_hex_ = value;
+  set_string(value);
+
+  // Add a trailer if string is truncated
+  //
+  // The heuristic we use is to check if the string exactly fits inside
+  // the buffer (NUL included). If it does, we assume it was truncated.
+  // This is obviously not a perfect heuristic, but it solves the majority
+  // case well enough and is simple to implement.
+  if (value.size() + 1 == buffer_size)
+    text_ += trunc_trailer;
 }
 
-int PrintableCString::print(char *buf,
-                            size_t size,
-                            const char *fmt,
-                            Type /*token*/,
-                            ArgumentType /*expected_type*/)
+void PrintableValue::set_buffer(const char *data, size_t size)
 {
-  return snprintf(buf, size, fmt, value_);
+  kind_ = Kind::buffer;
+  text_.assign(data, size);
 }
 
-int PrintableInt::print(char *buf,
-                        size_t size,
-                        const char *fmt,
-                        Type /*token*/,
-                        ArgumentType expected_type)
+static int print_uint(char *buf,
+                      size_t size,
+                      const char *fmt,
+                      uint64_t value,
+                      ArgumentType expected_type)
 {
   // Since the value is internally always stored as a 64-bit integer, a cast is
   // needed to ensure that the type of the argument passed to snprintf matches
   // the format specifier.
   // For example, an int64_t argument may be pushed onto the stack while an int
   // is stored in a register, in which case "%d" would print the wrong value if
-  // we used value_ without an explicit cast.
+  // we used value without an explicit cast.
   switch (expected_type) {
     case ArgumentType::CHAR:
-      return snprintf(buf, size, fmt, static_cast<unsigned char>(value_));
+      return snprintf(buf, size, fmt, static_cast<unsigned char>(value));
     case ArgumentType::SHORT:
-      return snprintf(buf, size, fmt, static_cast<unsigned short>(value_));
+      return snprintf(buf, size, fmt, static_cast<unsigned short>(value));
     case ArgumentType::INT:
-      return snprintf(buf, size, fmt, static_cast<unsigned int>(value_));
+      return snprintf(buf, size, fmt, static_cast<unsigned int>(value));
     case ArgumentType::LONG:
-      return snprintf(buf, size, fmt, static_cast<unsigned long>(value_));
+      return snprintf(buf, size, fmt, static_cast<unsigned long>(value));
     case ArgumentType::LONG_LONG:
-      return snprintf(buf, size, fmt, static_cast<unsigned long long>(value_));
+      return snprintf(buf, size, fmt, static_cast<unsigned long long>(value));
     case ArgumentType::INTMAX_T:
-      return snprintf(buf, size, fmt, static_cast<uintmax_t>(value_));
+      return snprintf(buf, size, fmt, static_cast<uintmax_t>(value));
     case ArgumentType::SIZE_T:
-      return snprintf(buf, size, fmt, static_cast<size_t>(value_));
+      return snprintf(buf, size, fmt, static_cast<size_t>(value));
     case ArgumentType::PTRDIFF_T:
-      return snprintf(buf, size, fmt, static_cast<ptrdiff_t>(value_));
+      return snprintf(buf, size, fmt, static_cast<ptrdiff_t>(value));
     case ArgumentType::POINTER:
-      return snprintf(buf, size, fmt, reinterpret_cast<void *>(value_));
+      return snprintf(buf, size, fmt, reinterpret_cast<void *>(value));
     case ArgumentType::UNKNOWN:
-      return snprintf(buf, size, fmt, value_);
+      return snprintf(buf, size, fmt, value);
   }
 
   __builtin_unreachable();
 }
 
-int PrintableSInt::print(char *buf,
-                         size_t size,
-                         const char *fmt,
-                         Type /*token*/,
-                         ArgumentType expected_type)
+static int print_sint(char *buf,
+                      size_t size,
+                      const char *fmt,
+                      int64_t value,
+                      ArgumentType expected_type)
 {
   switch (expected_type) {
     case ArgumentType::CHAR:
-      return snprintf(buf, size, fmt, static_cast<char>(value_));
+      return snprintf(buf, size, fmt, static_cast<char>(value));
     case ArgumentType::SHORT:
-      return snprintf(buf, size, fmt, static_cast<short>(value_));
+      return snprintf(buf, size, fmt, static_cast<short>(value));
     case ArgumentType::INT:
-      return snprintf(buf, size, fmt, static_cast<int>(value_));
+      return snprintf(buf, size, fmt, static_cast<int>(value));
     case ArgumentType::LONG:
-      return snprintf(buf, size, fmt, static_cast<long>(value_));
+      return snprintf(buf, size, fmt, static_cast<long>(value));
     case ArgumentType::LONG_LONG:
-      return snprintf(buf, size, fmt, static_cast<long long>(value_));
+      return snprintf(buf, size, fmt, static_cast<long long>(value));
     case ArgumentType::INTMAX_T:
-      return snprintf(buf, size, fmt, static_cast<intmax_t>(value_));
+      return snprintf(buf, size, fmt, static_cast<intmax_t>(value));
     case ArgumentType::SIZE_T:
-      return snprintf(buf, size, fmt, static_cast<ssize_t>(value_));
+      return snprintf(buf, size, fmt, static_cast<ssize_t>(value));
     case ArgumentType::PTRDIFF_T:
-      return snprintf(buf, size, fmt, static_cast<ptrdiff_t>(value_));
+      return snprintf(buf, size, fmt, static_cast<ptrdiff_t>(value));
     case ArgumentType::POINTER:
-      return snprintf(buf, size, fmt, reinterpret_cast<void *>(value_));
+      return snprintf(buf, size, fmt, reinterpret_cast<void *>(value));
     case ArgumentType::UNKNOWN:
-      return snprintf(buf, size, fmt, value_);
+      return snprintf(buf, size, fmt, value);
   }
 
   __builtin_unreachable();
 }
 
-int PrintableEnum::print(char *buf,
-                         size_t size,
-                         const char *fmt,
-                         Type token,
-                         ArgumentType expected_type)
+int PrintableValue::print(char *buf,
+                          size_t size,
+                          const char *fmt,
+                          Type token,
+                          ArgumentType expected_type) const
 {
-  switch (token) {
-    case Type::integer:
-      return PrintableInt(value_).print(buf, size, fmt, token, expected_type);
-    case Type::string:
-      return snprintf(buf, size, fmt, name_.c_str());
-    default:
-      LOG(BUG) << "Invalid token type for enum";
-      __builtin_unreachable();
+  switch (kind_) {
+    case Kind::sint:
+      return print_sint(
+          buf, size, fmt, static_cast<int64_t>(value_), expected_type);
+    case Kind::uint:
+      return print_uint(buf, size, fmt, value_, expected_type);
+    case Kind::enumeration:
+      switch (token) {
+        case Type::integer:
+          return print_uint(buf, size, fmt, value_, expected_type);
+        case Type::string:
+          return snprintf(buf, size, fmt, text_.c_str());
+        default:
+          LOG(BUG) << "Invalid token type for enum";
+          __builtin_unreachable();
+      }
+    case Kind::string:
+      return snprintf(buf, size, fmt, text_.c_str());
+    case Kind::buffer:
+      return snprintf(
+          buf,
+          size,
+          fmt,
+          util::hex_format_buffer(text_.data(), text_.size()).c_str());
   }
+
+  __builtin_unreachable();
 }
 
 } // namespace bpftrace
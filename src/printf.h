@@ -1,8 +1,9 @@
 #pragma once
 
-#include <optional>
+#include <cstdint>
 #include <regex>
-#include <utility>
+#include <string>
+#include <string_view>
 
 #include "printf_format_types.h"
 #include "types.h"
@@ -37,111 +38,51 @@ enum class ArgumentType {
   POINTER,
 };
 
-class IPrintable {
+// A printf argument decoded from an async event. Integers are stored by
+// value, strings, enum names and buffers are copied into storage which keeps
+// its capacity. A vector of these can thus be reused from one event to the
+// next without allocating.
+class PrintableValue {
 public:
-  virtual ~IPrintable() = default;
-  virtual int print(char* buf,
-                    size_t size,
-                    const char* fmt,
-                    Type token,
-                    ArgumentType expected_type = ArgumentType::UNKNOWN) = 0;
-};
-
-class PrintableString : public virtual IPrintable {
-public:
-  PrintableString(std::string value,
-                  std::optional<size_t> buffer_size = std::nullopt,
-                  const char* trunc_trailer = nullptr);
-  int print(char* buf,
-            size_t size,
-            const char* fmt,
-            Type /*token*/,
-            ArgumentType /*expected_type*/) override;
-
-private:
-  std::string value_;
-};
-
-class PrintableBuffer : public virtual IPrintable {
-public:
-  PrintableBuffer(char* buffer, size_t size)
-      : value_(std::vector<char>(buffer, buffer + size))
-  {
-  }
-  int print(char* buf,
-            size_t size,
-            const char* fmt,
-            Type /*token*/,
-            ArgumentType /*expected_type*/) override;
-  void keep_ascii(bool value);
-  void escape_hex(bool value);
-
-private:
-  std::vector<char> value_;
-  bool keep_ascii_ = true;
-  bool escape_hex_ = true;
-};
-
-class PrintableCString : public virtual IPrintable {
-public:
-  PrintableCString(char* value) : value_(value)
-  {
-  }
-  int print(char* buf,
-            size_t size,
-            const char* fmt,
-            Type /*token*/,
-            ArgumentType /*expected_type*/) override;
-
-private:
-  char* value_;
-};
-
-class PrintableInt : public virtual IPrintable {
-public:
-  PrintableInt(uint64_t value) : value_(value)
+  enum class Kind {
+    sint,
+    uint,
+    enumeration,
+    string,
+    buffer,
+  };
+
+  void set_sint(int64_t value);
+  void set_uint(uint64_t value);
+  void set_enum(uint64_t value, std::string_view name);
+  void set_string(std::string_view value);
+  // Strings which exactly fill their buffer (NUL included) are assumed to
+  // have been truncated and get `trunc_trailer` appended.
+  void set_string(std::string_view value,
+                  size_t buffer_size,
+                  std::string_view trunc_trailer);
+  void set_buffer(const char* data, size_t size);
+
+  Kind kind() const
   {
+    return kind_;
   }
-  int print(char* buf,
-            size_t size,
-            const char* fmt,
-            Type token,
-            ArgumentType expected_type) override;
-
-private:
-  uint64_t value_;
-};
-
-class PrintableSInt : public virtual IPrintable {
-public:
-  PrintableSInt(int64_t value) : value_(value)
+  // Raw bytes of a buffer, see FormatString for how they are printed
+  std::string_view buffer() const
   {
+    return text_;
   }
-  int print(char* buf,
-            size_t size,
-            const char* fmt,
-            Type token,
-            ArgumentType expected_type) override;
 
-private:
-  int64_t value_;
-};
-
-class PrintableEnum : public virtual IPrintable {
-public:
-  PrintableEnum(uint64_t value, std::string name)
-      : name_(std::move(name)), value_(value)
-  {
-  }
   int print(char* buf,
             size_t size,
             const char* fmt,
             Type token,
-            ArgumentType expected_type) override;
+            ArgumentType expected_type = ArgumentType::UNKNOWN) const;
 
 private:
-  std::string name_;
-  uint64_t value_;
+  Kind kind_ = Kind::uint;
+  uint64_t value_ = 0;
+  std::string text_;
 };
 
 } // namespace bpftrace
@@ -0,0 +1,71 @@
+#include <algorithm>
+
+#include "process_cache.h"
+#include "util/system.h"
+
+namespace bpftrace {
+
+ProcessCache::ProcessCache(size_t max_processes,
+                           std::chrono::milliseconds recheck_interval)
+    : recheck_interval_(recheck_interval),
+      entries_(std::max<size_t>(max_processes, 1))
+{
+}
+
+const ProcessCache::Process &ProcessCache::get(pid_t pid)
+{
+  Entry *entry = entries_.get(pid);
+  if (!entry) {
+    entries_.put(pid, Entry{});
+    entry = entries_.get(pid);
+    refresh(pid, *entry);
+  } else if (std::chrono::steady_clock::now() - entry->checked >=
+             recheck_interval_) {
+    refresh(pid, *entry);
+  }
+  return entry->process;
+}
+
+uint64_t ProcessCache::generation(pid_t pid)
+{
+  if (const Entry *entry = entries_.get(pid))
+    return entry->process.generation;
+  return get(pid).generation;
+}
+
+void ProcessCache::refresh(pid_t pid, Entry &entry)
+{
+  entry.checked = std::chrono::steady_clock::now();
+
+  auto start_time = util::get_pid_start_time(pid);
+  if (!start_time) {
+    entry.start_time.reset();
+    return;
+  }
+  // A different start time means that the pid was reused
+  bool new_process = start_time != entry.start_time;
+  entry.start_time = start_time;
+
+  // Zombies have no executable anymore but are gone for our purposes
+  auto exe = util::get_pid_exe(pid);
+  if (exe.empty())
+    return;
+  set_exe(pid, entry, std::move(exe), new_process);
+}
+
+void ProcessCache::set_exe(pid_t pid,
+                           Entry &entry,
+                           std::string exe,
+                           bool new_process)
+{
+  if (!new_process && exe == entry.process.exe)
+    return;
+
+  bool seen_before = entry.process.generation != 0;
+  entry.process.exe = std::move(exe);
+  entry.process.generation = next_generation_++;
+  if (seen_before && on_new_generation_)
+    on_new_generation_(pid);
+}
+
+} // namespace bpftrace
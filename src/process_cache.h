@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+
+#include "util/lru_cache.h"
+
+namespace bpftrace {
+
+// Caches the executables of the processes whose user stacks and symbols are
+// resolved, so that resolving them doesn't need to read /proc/<pid>/exe every
+// time.
+//
+// Each process also has a generation, which changes whenever the pid is seen
+// to belong to a different program: after an exec of another executable, or
+// when the pid is reused after the process exited. Anything derived from the
+// address space of a process (e.g. its symbols) is only valid for the
+// generation it was derived for.
+//
+// Processes are re-checked at most once per `recheck_interval`, so changes are
+// picked up with at most that delay. A process is told apart from an earlier
+// one with the same pid by its start time in /proc/<pid>/stat, so no file
+// descriptor is kept open per process. Processes which exited keep their last
+// executable, so that their stacks can still be resolved.
+class ProcessCache {
+public:
+  struct Process {
+    std::string exe;
+    uint64_t generation = 0;
+  };
+
+  explicit ProcessCache(
+      size_t max_processes = 4096,
+      std::chrono::milliseconds recheck_interval = std::chrono::seconds(1));
+
+  ProcessCache(const ProcessCache &) = delete;
+  ProcessCache &operator=(const ProcessCache &) = delete;
+
+  const Process &get(pid_t pid);
+
+  // The generation of a process as of the last check, without re-checking it.
+  // Only looks at /proc for pids which aren't cached yet.
+  uint64_t generation(pid_t pid);
+
+  // Called with the pid whenever the generation of a process changes
+  void on_new_generation(std::function<void(pid_t)> callback)
+  {
+    on_new_generation_ = std::move(callback);
+  }
+
+private:
+  struct Entry {
+    Process process;
+    // Unset while no live process is known for the pid
+    std::optional<uint64_t> start_time;
+    std::chrono::steady_clock::time_point checked;
+  };
+
+  void refresh(pid_t pid, Entry &entry);
+  void set_exe(pid_t pid, Entry &entry, std::string exe, bool new_process);
+
+  std::chrono::milliseconds recheck_interval_;
+  uint64_t next_generation_ = 1;
+  util::LruCache<pid_t, Entry> entries_;
+  std::function<void(pid_t)> on_new_generation_;
+};
+
+} // namespace bpftrace
@@ -12,6 +12,16 @@
 
 namespace bpftrace {
 
+SizedType MapInfo::dense_hist_type() const
+{
+  uint64_t num_buckets = 0;
+  if (const auto *args = std::get_if<HistogramArgs>(&detail))
+    num_buckets = args->num_buckets();
+  else if (const auto *args = std::get_if<LinearHistogramArgs>(&detail))
+    num_buckets = args->num_buckets();
+  return CreateArray(num_buckets, CreateUInt64());
+}
+
 void RequiredResources::save_state(std::ostream &out) const
 {
   cereal::BinaryOutputArchive archive(out);
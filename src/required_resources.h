@@ -73,6 +73,13 @@ struct HistogramArgs {
     return !(*this == other);
   }
 
+  // Number of bucket indexes log2() can return, the highest one is for
+  // values of 2^62 and above
+  uint64_t num_buckets() const
+  {
+    return ((64 - bits) << bits) + 1;
+  }
+
 private:
   friend class cereal::access;
   template <typename Archive>
@@ -98,6 +105,12 @@ struct LinearHistogramArgs {
     return !(*this == other);
   }
 
+  // The buckets in the range plus the one for values below it
+  uint64_t num_buckets() const
+  {
+    return ((max - min) / step) + 2;
+  }
+
 private:
   friend class cereal::access;
   template <typename Archive>
@@ -114,14 +127,31 @@ struct MapInfo {
   int id = -1;
   int max_entries = -1;
   libbpf::bpf_map_type bpf_type = libbpf::BPF_MAP_TYPE_HASH;
+  // Flags the map is created with, e.g. BPF_F_NO_PREALLOC
+  uint32_t map_flags = 0;
   bool is_scalar = false;
+  // hist() and lhist() buckets are stored as an array in a single map value
+  // per key, instead of as one element per bucket with the bucket index
+  // appended to the key
+  bool dense_hist = false;
+
+  // The actual type of the map value of dense histograms
+  SizedType dense_hist_type() const;
 
 private:
   friend class cereal::access;
   template <typename Archive>
   void serialize(Archive &archive)
   {
-    archive(key_type, value_type, detail, id, max_entries, bpf_type, is_scalar);
+    archive(key_type,
+            value_type,
+            detail,
+            id,
+            max_entries,
+            bpf_type,
+            map_flags,
+            is_scalar,
+            dense_hist);
   }
 };
 
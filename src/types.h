@@ -736,6 +736,7 @@ enum class AsyncAction {
   watchpoint_attach,
   watchpoint_detach,
   skboutput,
+  print_clear,
   // clang-format on
 };
 
@@ -0,0 +1,138 @@
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "log.h"
+#include "usernames.h"
+
+namespace bpftrace {
+
+Usernames::Usernames(const Config &config,
+                     std::string passwd_path,
+                     std::chrono::milliseconds recheck_interval)
+    : config_(config),
+      passwd_path_(std::move(passwd_path)),
+      recheck_interval_(recheck_interval)
+{
+}
+
+bool Usernames::FileId::operator==(const FileId &other) const
+{
+  return dev == other.dev && ino == other.ino && size == other.size &&
+         mtime.tv_sec == other.mtime.tv_sec &&
+         mtime.tv_nsec == other.mtime.tv_nsec;
+}
+
+const std::string &Usernames::resolve(uint64_t uid)
+{
+  maybe_reload();
+
+  if (uid > std::numeric_limits<uint32_t>::max())
+    return empty_;
+
+  auto it = names_.find(static_cast<uint32_t>(uid));
+  if (it != names_.end())
+    return it->second;
+
+  // NSS modules may block on the network, which would stall the output
+  if (!config_.nss_usernames)
+    return empty_;
+  return lookup_nss(static_cast<uint32_t>(uid));
+}
+
+void Usernames::maybe_reload()
+{
+  auto now = std::chrono::steady_clock::now();
+  bool first_check = !checked_;
+  if (!first_check && now - last_check_ < recheck_interval_)
+    return;
+  checked_ = true;
+  last_check_ = now;
+
+  // The file is usually replaced with a rename rather than modified in place,
+  // so compare the inode as well as the modification time and size.
+  struct stat st;
+  if (::stat(passwd_path_.c_str(), &st) != 0) {
+    // Only report when the file goes missing, not on every check
+    if (loaded_ || first_check)
+      LOG(ERROR) << strerror(errno) << ": " << passwd_path_;
+    loaded_ = false;
+    names_.clear();
+    return;
+  }
+
+  FileId id{ .dev = st.st_dev,
+             .ino = st.st_ino,
+             .size = st.st_size,
+             .mtime = st.st_mtim };
+  if (loaded_ && id == loaded_id_)
+    return;
+  load(id);
+}
+
+void Usernames::load(const FileId &id)
+{
+  names_.clear();
+  loaded_ = false;
+
+  std::ifstream file(passwd_path_);
+  if (file.fail()) {
+    LOG(ERROR) << strerror(errno) << ": " << passwd_path_;
+    return;
+  }
+
+  // Each line is "name:password:uid:gid:gecos:home:shell"
+  std::string line;
+  while (std::getline(file, line)) {
+    auto name_end = line.find(':');
+    if (name_end == std::string::npos)
+      continue;
+    auto uid_start = line.find(':', name_end + 1);
+    if (uid_start == std::string::npos)
+      continue;
+    uid_start++;
+    auto uid_end = line.find(':', uid_start);
+    if (uid_end == std::string::npos)
+      uid_end = line.size();
+
+    uint32_t uid;
+    const char *first = line.data() + uid_start;
+    const char *last = line.data() + uid_end;
+    auto [ptr, ec] = std::from_chars(first, last, uid);
+    if (ec != std::errc() || ptr != last)
+      continue;
+
+    // Like getpwuid(3), the first entry for a uid wins
+    names_.emplace(uid, line.substr(0, name_end));
+  }
+
+  loaded_ = true;
+  loaded_id_ = id;
+}
+
+const std::string &Usernames::lookup_nss(uint32_t uid)
+{
+  long size = sysconf(_SC_GETPW_R_SIZE_MAX);
+  std::vector<char> buf(size > 0 ? size : 1024);
+
+  struct passwd pwd;
+  struct passwd *result = nullptr;
+  int err;
+  while ((err = getpwuid_r(uid, &pwd, buf.data(), buf.size(), &result)) ==
+         ERANGE)
+    buf.resize(buf.size() * 2);
+
+  // Remember misses too, so unknown uids don't hit NSS on every event
+  std::string name;
+  if (err == 0 && result)
+    name = result->pw_name;
+  return names_.emplace(uid, std::move(name)).first->second;
+}
+
+} // namespace bpftrace
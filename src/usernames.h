@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+#include "config.h"
+
+namespace bpftrace {
+
+// Resolves uids to user names.
+//
+// The passwd file is parsed once into a table and only re-read when it is
+// seen to have changed, which is checked at most once per `recheck_interval`
+// so that lookups stay O(1) without any syscalls. Uids which are not in the
+// file (e.g. LDAP or other NSS users) are looked up with getpwuid_r(3) if the
+// `nss_usernames` config option is set, and the result (including a miss) is
+// remembered until the next reload.
+class Usernames {
+public:
+  explicit Usernames(
+      const Config &config,
+      std::string passwd_path = "/etc/passwd",
+      std::chrono::milliseconds recheck_interval = std::chrono::seconds(1));
+
+  Usernames(const Usernames &) = delete;
+  Usernames &operator=(const Usernames &) = delete;
+
+  // Returns an empty string for unknown uids
+  const std::string &resolve(uint64_t uid);
+
+private:
+  struct FileId {
+    dev_t dev = 0;
+    ino_t ino = 0;
+    off_t size = 0;
+    struct timespec mtime = {};
+
+    bool operator==(const FileId &other) const;
+  };
+
+  void maybe_reload();
+  void load(const FileId &id);
+  const std::string &lookup_nss(uint32_t uid);
+
+  const Config &config_;
+  std::string passwd_path_;
+  std::chrono::milliseconds recheck_interval_;
+
+  bool checked_ = false;
+  std::chrono::steady_clock::time_point last_check_;
+  // Identity of the loaded file, unset if it could not be read
+  bool loaded_ = false;
+  FileId loaded_id_;
+
+  std::unordered_map<uint32_t, std::string> names_;
+  std::string empty_;
+};
+
+} // namespace bpftrace
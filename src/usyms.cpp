@@ -1,7 +1,9 @@
 #include "types.h"
 #include <bcc/bcc_elf.h>
 #include <bcc/bcc_syms.h>
+#include <limits>
 #include <sstream>
+#include <unordered_set>
 
 #ifdef HAVE_BLAZESYM
 #include <blazesym.h>
@@ -111,28 +113,184 @@ void add_symbols(const blaze_sym *sym,
 
 namespace bpftrace {
 
-Usyms::Usyms(const Config &config) : config_(config)
+// Accounted for each cache entry on top of the symbols it holds, so that
+// entries of exited processes don't pile up for free
+static constexpr size_t CACHE_ENTRY_OVERHEAD = 128;
+static constexpr size_t ELF_INFO_CACHE_SIZE = 4096;
+
+Usyms::Usyms(const Config &config)
+    : config_(config),
+      exe_sym_(std::numeric_limits<size_t>::max()),
+      pid_sym_(std::numeric_limits<size_t>::max()),
+      symbol_table_cache_(std::numeric_limits<size_t>::max()),
+      elf_info_cache_(ELF_INFO_CACHE_SIZE)
 {
 }
 
 Usyms::~Usyms()
 {
-  for (const auto &pair : exe_sym_) {
-    if (pair.second.second)
-      bcc_free_symcache(pair.second.second, pair.second.first);
-  }
-
-  for (const auto &pair : pid_sym_) {
-    if (pair.second)
-      bcc_free_symcache(pair.second, pair.first);
-  }
-
 #ifdef HAVE_BLAZESYM
   if (symbolizer_)
     blaze_symbolizer_free(symbolizer_);
 #endif
 }
 
+size_t Usyms::cache_size() const
+{
+  return cache_bytes_ + (exe_sym_.size() + pid_sym_.size() +
+                         symbol_table_cache_.size()) *
+                            CACHE_ENTRY_OVERHEAD;
+}
+
+void Usyms::trim_caches()
+{
+  auto used = [](const auto *entry) {
+    return entry ? entry->second.used : std::numeric_limits<uint64_t>::max();
+  };
+
+  while (cache_size() > config_.user_symbol_cache_bytes) {
+    const auto *exe = exe_sym_.lru();
+    const auto *pid = pid_sym_.lru();
+    const auto *table = symbol_table_cache_.lru();
+    if (!exe && !pid && !table)
+      break;
+
+    // Evict the least recently used entry of all caches. Symbol caches shared
+    // with other processes are only freed once none of them use it anymore.
+    if (pid && used(pid) <= used(exe) && used(pid) <= used(table))
+      pid_sym_.pop_lru();
+    else if (exe && used(exe) <= used(table))
+      exe_sym_.pop_lru();
+    else
+      symbol_table_cache_.pop_lru();
+    evictions_++;
+  }
+}
+
+Usyms::Layout Usyms::get_layout(int32_t pid)
+{
+  Layout layout;
+  std::unordered_set<std::string> seen;
+  std::ostringstream key;
+  bool shareable = true;
+  for (const auto &mapping : util::get_exec_mappings_for_pid(pid)) {
+    if (mapping.inode == 0) {
+      // Anonymous code, e.g. from a JIT, is symbolized through the process'
+      // own perf map, so its symbols can't be shared
+      if (!mapping.path.starts_with("["))
+        shareable = false;
+      key << mapping.path << "@" << std::hex << mapping.start << std::dec
+          << ";";
+      continue;
+    }
+
+    auto file_id = mapping.dev + ":" + std::to_string(mapping.inode);
+    auto *info = elf_info_cache_.get(file_id);
+    if (!info) {
+      // Go through the process' root, it may be in another mount namespace
+      auto path = "/proc/" + std::to_string(pid) + "/root" + mapping.path;
+      elf_info_cache_.put(file_id,
+                          util::get_elf_info(path).value_or(util::elf_info{}));
+      info = elf_info_cache_.get(file_id);
+    }
+
+    // The same binary can have different inodes, e.g. in different
+    // containers, so prefer the build id to identify it
+    key << (info->build_id.empty() ? file_id : info->build_id) << "@"
+        << std::hex << mapping.start - mapping.offset << std::dec << ";";
+    if (seen.insert(file_id).second)
+      layout.size += info->symbols_size;
+  }
+  if (shareable)
+    layout.key = key.str();
+  return layout;
+}
+
+std::shared_ptr<void> Usyms::new_symcache(int32_t pid,
+                                          size_t size,
+                                          std::string layout_key)
+{
+  void *psyms = bcc_symcache_new(pid, &get_symbol_opts());
+  if (psyms == nullptr)
+    return nullptr;
+
+  cache_bytes_ += size;
+  return std::shared_ptr<void>(
+      psyms, [this, pid, size, layout_key = std::move(layout_key)](void *p) {
+        bcc_free_symcache(p, pid);
+        cache_bytes_ -= size;
+        if (!layout_key.empty())
+          layout_sym_.erase(layout_key);
+      });
+}
+
+std::shared_ptr<void> Usyms::get_symcache(int32_t pid,
+                                          const std::string &pid_exe)
+{
+  const auto cache_type = config_.user_symbol_cache_type;
+  std::shared_ptr<void> psyms;
+
+  if (cache_type == UserSymbolCacheType::per_program) {
+    if (auto *cached = exe_sym_.get(pid_exe)) {
+      cached->used = ++use_counter_;
+      return cached->value;
+    }
+    psyms = new_symcache(pid, get_layout(pid).size, "");
+    if (psyms) {
+      exe_sym_.put(pid_exe, { psyms, ++use_counter_ });
+      trim_caches();
+    }
+  } else if (cache_type == UserSymbolCacheType::per_pid) {
+    if (auto *cached = pid_sym_.get(pid)) {
+      cached->used = ++use_counter_;
+      return cached->value;
+    }
+    auto layout = get_layout(pid);
+    if (!layout.key.empty()) {
+      auto it = layout_sym_.find(layout.key);
+      if (it != layout_sym_.end())
+        psyms = it->second.lock();
+    }
+    if (!psyms) {
+      psyms = new_symcache(pid, layout.size, layout.key);
+      if (psyms && !layout.key.empty())
+        layout_sym_[layout.key] = psyms;
+    }
+    if (psyms) {
+      pid_sym_.put(pid, { psyms, ++use_counter_ });
+      trim_caches();
+    }
+  } else {
+    // no user symbol caching, the bcc cache is freed once the caller is done
+    psyms = new_symcache(pid, 0, "");
+  }
+  return psyms;
+}
+
+std::shared_ptr<const Usyms::SymbolTable> Usyms::get_symbol_table(
+    const std::string &elf_file)
+{
+  if (auto *cached = symbol_table_cache_.get(elf_file)) {
+    cached->used = ++use_counter_;
+    return cached->value;
+  }
+
+  auto *table = new SymbolTable(util::get_symbol_table_for_elf(elf_file));
+  size_t size = 0;
+  for (const auto &[_, sym] : *table)
+    size += sizeof(SymbolTable::value_type) + 4 * sizeof(void *) +
+            sym.name.capacity();
+  cache_bytes_ += size;
+  std::shared_ptr<const SymbolTable> symbol_table(
+      table, [this, size](const SymbolTable *p) {
+        delete p;
+        cache_bytes_ -= size;
+      });
+  symbol_table_cache_.put(elf_file, { symbol_table, ++use_counter_ });
+  trim_caches();
+  return symbol_table;
+}
+
 void Usyms::cache_bcc(const std::string &elf_file)
 {
   const auto cache_type = config_.user_symbol_cache_type;
@@ -140,9 +298,8 @@ void Usyms::cache_bcc(const std::string &elf_file)
   // binary is not present at symbol resolution time
   // note: this only makes sense with ASLR disabled, since with ASLR offsets
   // might be different
-  if (cache_type == UserSymbolCacheType::per_program &&
-      !symbol_table_cache_.contains(elf_file))
-    symbol_table_cache_[elf_file] = util::get_symbol_table_for_elf(elf_file);
+  if (cache_type == UserSymbolCacheType::per_program)
+    get_symbol_table(elf_file);
 
   if (cache_type == UserSymbolCacheType::per_pid)
     // preload symbol tables from running processes
@@ -150,7 +307,7 @@ void Usyms::cache_bcc(const std::string &elf_file)
     // attach time, but not at symbol resolution time, even with ASLR
     // enabled, since BCC symcache records the offsets
     for (int pid : util::get_pids_for_program(elf_file))
-      pid_sym_[pid] = bcc_symcache_new(pid, &get_symbol_opts());
+      get_symcache(pid, elf_file);
 }
 
 #ifdef HAVE_BLAZESYM
@@ -215,31 +372,50 @@ void Usyms::cache(const std::string &elf_file)
   cache_bcc(elf_file);
 }
 
-std::string Usyms::resolve_bcc(uint64_t addr,
-                               int32_t pid,
-                               const std::string &pid_exe,
-                               bool show_offset,
-                               bool perf_mode)
+void Usyms::invalidate(int32_t pid)
+{
+  pid_sym_.erase(pid);
+}
+
+void Usyms::resolve_bcc(std::span<const uint64_t> addrs,
+                        int32_t pid,
+                        const std::string &pid_exe,
+                        bool show_offset,
+                        bool perf_mode,
+                        std::vector<std::vector<std::string>> &str_syms)
 {
   const auto cache_type = config_.user_symbol_cache_type;
-  struct bcc_symbol usym;
-  std::ostringstream symbol;
-  void *psyms = nullptr;
+  std::shared_ptr<const SymbolTable> symbol_table;
+  std::shared_ptr<void> psyms;
+  bool have_psyms = false;
+
+  if (cache_type == UserSymbolCacheType::per_program && !pid_exe.empty()) {
+    // try to resolve symbol directly from program file
+    // this might work when the process does not exist anymore, but cannot
+    // resolve all symbols, e.g. those in a dynamically linked library
+    symbol_table = get_symbol_table(pid_exe);
+  }
 
-  if (cache_type == UserSymbolCacheType::per_program) {
-    if (!pid_exe.empty()) {
-      // try to resolve symbol directly from program file
-      // this might work when the process does not exist anymore, but cannot
-      // resolve all symbols, e.g. those in a dynamically linked library
-      std::map<uintptr_t, elf_symbol, std::greater<>> &symbol_table =
-          symbol_table_cache_.contains(pid_exe)
-              ? symbol_table_cache_[pid_exe]
-              : (symbol_table_cache_[pid_exe] = util::get_symbol_table_for_elf(
-                     pid_exe));
-      auto sym = symbol_table.lower_bound(addr);
+  // The process symbol cache is only set up once it is needed, and shared by
+  // all addresses. Holding on to it keeps it alive even if it gets evicted
+  // meanwhile.
+  auto get_psyms = [&]() {
+    if (!have_psyms) {
+      have_psyms = true;
+      psyms = get_symcache(pid, pid_exe);
+    }
+    return psyms.get();
+  };
+
+  for (size_t i = 0; i < addrs.size(); i++) {
+    uint64_t addr = addrs[i];
+    std::ostringstream symbol;
+
+    if (symbol_table) {
+      auto sym = symbol_table->lower_bound(addr);
       // address has to be either the start of the symbol (for symbols of
       // length 0) or in [start, end)
-      if (sym != symbol_table.end() &&
+      if (sym != symbol_table->end() &&
           (addr == sym->second.start ||
            (addr >= sym->second.start && addr < sym->second.end))) {
         symbol << sym->second.name;
@@ -247,80 +423,57 @@ std::string Usyms::resolve_bcc(uint64_t addr,
           symbol << "+" << addr - sym->second.start;
         if (perf_mode)
           symbol << " (" << pid_exe << ")";
-        return symbol.str();
+        str_syms[i].push_back(symbol.str());
+        continue;
       }
     }
-    if (!exe_sym_.contains(pid_exe)) {
-      // not cached, create new ProcSyms cache
-      psyms = bcc_symcache_new(pid, &get_symbol_opts());
-      exe_sym_[pid_exe] = std::make_pair(pid, psyms);
-    } else {
-      psyms = exe_sym_[pid_exe].second;
-    }
-  } else if (cache_type == UserSymbolCacheType::per_pid) {
-    // cache user symbols per pid
-    if (!pid_sym_.contains(pid)) {
-      // not cached, create new ProcSyms cache
-      psyms = bcc_symcache_new(pid, &get_symbol_opts());
-      pid_sym_[pid] = psyms;
+
+    struct bcc_symbol usym;
+    void *syms = get_psyms();
+    if (syms && bcc_symcache_resolve(syms, addr, &usym) == 0) {
+      SCOPE_EXIT
+      {
+        // This is a horrible hack to work around the fact that
+        // bcc does not tell if you if demangling succeeded.
+        // B/c if demangling failed, it returns a string that
+        // you cannot free.
+        //
+        // This relies on the fact that bcc will not change the
+        // `demangle_name = name` fallback. Since blazesym is
+        // coming (written 2/4/25), this should be fine for now.
+        if (usym.demangle_name != usym.name)
+          ::free(const_cast<char *>(usym.demangle_name));
+      };
+      if (config_.cpp_demangle)
+        symbol << usym.demangle_name;
+      else
+        symbol << usym.name;
+      if (show_offset)
+        symbol << "+" << usym.offset;
+      if (perf_mode)
+        symbol << " (" << usym.module << ")";
     } else {
-      psyms = pid_sym_[pid];
+      symbol << reinterpret_cast<void *>(addr);
+      if (perf_mode)
+        symbol << " ([unknown])";
     }
-  } else {
-    // no user symbol caching, create new bcc cache
-    psyms = bcc_symcache_new(pid, &get_symbol_opts());
+    str_syms[i].push_back(symbol.str());
   }
-
-  if (psyms && bcc_symcache_resolve(psyms, addr, &usym) == 0) {
-    SCOPE_EXIT
-    {
-      // This is a horrible hack to work around the fact that
-      // bcc does not tell if you if demangling succeeded.
-      // B/c if demangling failed, it returns a string that
-      // you cannot free.
-      //
-      // This relies on the fact that bcc will not change the
-      // `demangle_name = name` fallback. Since blazesym is
-      // coming (written 2/4/25), this should be fine for now.
-      if (usym.demangle_name != usym.name)
-        ::free(const_cast<char *>(usym.demangle_name));
-    };
-    if (config_.cpp_demangle)
-      symbol << usym.demangle_name;
-    else
-      symbol << usym.name;
-    if (show_offset)
-      symbol << "+" << usym.offset;
-    if (perf_mode)
-      symbol << " (" << usym.module << ")";
-  } else {
-    symbol << reinterpret_cast<void *>(addr);
-    if (perf_mode)
-      symbol << " ([unknown])";
-  }
-
-  if (cache_type == UserSymbolCacheType::none)
-    bcc_free_symcache(psyms, pid);
-
-  return symbol.str();
 }
 
 #ifdef HAVE_BLAZESYM
-std::vector<std::string> Usyms::resolve_blazesym_impl(
-    uint64_t addr,
-    int32_t pid,
-    const std::string &pid_exe,
-    bool show_offset,
-    bool perf_mode,
-    bool show_debug_info)
+void Usyms::resolve_blazesym(std::span<const uint64_t> addrs,
+                             int32_t pid,
+                             const std::string &pid_exe,
+                             bool show_offset,
+                             bool perf_mode,
+                             bool show_debug_info,
+                             std::vector<std::vector<std::string>> &str_syms)
 {
-  std::vector<std::string> str_syms;
-  const blaze_sym *sym;
-
   if (symbolizer_ == nullptr) {
     symbolizer_ = create_symbolizer();
     if (symbolizer_ == nullptr)
-      return str_syms;
+      return;
   }
 
   auto cache_type = config_.user_symbol_cache_type;
@@ -332,66 +485,36 @@ std::vector<std::string> Usyms::resolve_blazesym_impl(
     }
   };
 
+  const blaze_syms *syms = nullptr;
   if (cache_type == UserSymbolCacheType::per_program) {
-    if (!pid_exe.empty()) {
-      blaze_symbolize_src_elf src = {
-        .type_size = sizeof(src),
-        .path = pid_exe.c_str(),
-        .debug_syms = show_debug_info,
-      };
-      const blaze_syms *syms = blaze_symbolize_elf_virt_offsets(
-          symbolizer_, &src, &addr, 1);
-      if (syms == nullptr) {
-        return str_syms;
-      }
-
-      SCOPE_EXIT
-      {
-        blaze_syms_free(syms);
-      };
-
-      sym = &syms->syms[0];
-
-      add_symbols(sym, show_offset, perf_mode, str_syms);
-    }
-    return str_syms;
+    if (pid_exe.empty())
+      return;
+    blaze_symbolize_src_elf src = {
+      .type_size = sizeof(src),
+      .path = pid_exe.c_str(),
+      .debug_syms = show_debug_info,
+    };
+    syms = blaze_symbolize_elf_virt_offsets(
+        symbolizer_, &src, addrs.data(), addrs.size());
+  } else {
+    blaze_symbolize_src_process src = {
+      .type_size = sizeof(src),
+      .pid = static_cast<uint32_t>(pid),
+      .debug_syms = show_debug_info,
+      .perf_map = true,
+    };
+    syms = blaze_symbolize_process_abs_addrs(
+        symbolizer_, &src, addrs.data(), addrs.size());
   }
-
-  blaze_symbolize_src_process src = {
-    .type_size = sizeof(src),
-    .pid = static_cast<uint32_t>(pid),
-    .debug_syms = show_debug_info,
-    .perf_map = true,
-  };
-
-  const blaze_syms *syms = blaze_symbolize_process_abs_addrs(
-      symbolizer_, &src, &addr, 1);
   if (syms == nullptr)
-    return str_syms;
+    return;
   SCOPE_EXIT
   {
     blaze_syms_free(syms);
   };
 
-  sym = &syms->syms[0];
-  add_symbols(sym, show_offset, perf_mode, str_syms);
-
-  return str_syms;
-}
-
-std::vector<std::string> Usyms::resolve_blazesym(uint64_t addr,
-                                                 int32_t pid,
-                                                 const std::string &pid_exe,
-                                                 bool show_offset,
-                                                 bool perf_mode,
-                                                 bool show_debug_info)
-{
-  auto syms = resolve_blazesym_impl(
-      addr, pid, pid_exe, show_offset, perf_mode, show_debug_info);
-  if (syms.empty()) {
-    syms.push_back(stringify_addr(addr, perf_mode));
-  }
-  return syms;
+  for (size_t i = 0; i < syms->cnt && i < addrs.size(); i++)
+    add_symbols(&syms->syms[i], show_offset, perf_mode, str_syms[i]);
 }
 #endif
 
@@ -400,16 +523,39 @@ std::vector<std::string> Usyms::resolve(uint64_t addr,
                                         const std::string &pid_exe,
                                         bool show_offset,
                                         bool perf_mode,
-                                        [[maybe_unused]] bool show_debug_info)
+                                        bool show_debug_info)
+{
+  return std::move(resolve_many(std::span<const uint64_t>(&addr, 1),
+                                pid,
+                                pid_exe,
+                                show_offset,
+                                perf_mode,
+                                show_debug_info)
+                       .front());
+}
+
+std::vector<std::vector<std::string>> Usyms::resolve_many(
+    std::span<const uint64_t> addrs,
+    int32_t pid,
+    const std::string &pid_exe,
+    bool show_offset,
+    bool perf_mode,
+    [[maybe_unused]] bool show_debug_info)
 {
+  std::vector<std::vector<std::string>> syms(addrs.size());
 #ifdef HAVE_BLAZESYM
-  if (config_.use_blazesym)
-    return resolve_blazesym(
-        addr, pid, pid_exe, show_offset, perf_mode, show_debug_info);
+  if (config_.use_blazesym) {
+    resolve_blazesym(
+        addrs, pid, pid_exe, show_offset, perf_mode, show_debug_info, syms);
+    for (size_t i = 0; i < addrs.size(); i++) {
+      if (syms[i].empty())
+        syms[i].push_back(stringify_addr(addrs[i], perf_mode));
+    }
+    return syms;
+  }
 #endif
-  return std::vector<std::string>{
-    resolve_bcc(addr, pid, pid_exe, show_offset, perf_mode)
-  };
+  resolve_bcc(addrs, pid, pid_exe, show_offset, perf_mode, syms);
+  return syms;
 }
 
 struct bcc_symbol_option &Usyms::get_symbol_opts()
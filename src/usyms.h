@@ -4,8 +4,13 @@
 #include <bcc/bcc_syms.h>
 #include <cstdint>
 #include <map>
+#include <memory>
+#include <span>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "util/lru_cache.h"
 #include "util/symbols.h"
 
 namespace bpftrace {
@@ -23,27 +28,83 @@ public:
   Usyms& operator=(const Usyms&) = delete;
 
   void cache(const std::string& elf_file);
+  // Drops the symbols cached for a process, e.g. after it exec'd
+  void invalidate(int32_t pid);
   std::vector<std::string> resolve(uint64_t addr,
                                    int32_t pid,
                                    const std::string& pid_exe,
                                    bool show_offset,
                                    bool perf_mode,
                                    bool show_debug_info);
+  // Resolves all addresses (e.g. of a stack) of a process in one go, which is
+  // cheaper than resolving them one by one. Returns the symbols of each
+  // address, in order.
+  std::vector<std::vector<std::string>> resolve_many(
+      std::span<const uint64_t> addrs,
+      int32_t pid,
+      const std::string& pid_exe,
+      bool show_offset,
+      bool perf_mode,
+      bool show_debug_info);
+
+  // Estimated memory held by the bcc symbol caches, in bytes
+  size_t cache_size() const;
+  size_t cache_evictions() const
+  {
+    return evictions_;
+  }
 
 private:
+  using SymbolTable = std::map<uintptr_t, elf_symbol, std::greater<>>;
+
+  // Cached entries remember when they were last used, so that the least
+  // recently used entry across all caches is evicted first
+  template <typename T>
+  struct Cached {
+    std::shared_ptr<T> value;
+    uint64_t used;
+  };
+
+  // The executable mappings of a process. Processes with the same layout
+  // (e.g. forked workers) can share one symbol cache.
+  struct Layout {
+    // Empty if the process' symbols can't be shared
+    std::string key;
+    // Estimated size of the symbols of all mapped binaries
+    size_t size = 0;
+  };
+
   const Config& config_;
+  uint64_t use_counter_ = 0;
+  size_t cache_bytes_ = 0;
+  size_t evictions_ = 0;
+
+  // Must outlive the caches below, which unregister themselves from it
+  std::unordered_map<std::string, std::weak_ptr<void>> layout_sym_;
   // note: exe_sym_ is used when layout is same for all instances of program
-  std::map<std::string, std::pair<int, void*>> exe_sym_; // exe -> (pid, cache)
-  std::map<int, void*> pid_sym_;                         // pid -> cache
-  std::map<std::string, std::map<uintptr_t, elf_symbol, std::greater<>>>
-      symbol_table_cache_;
+  util::LruCache<std::string, Cached<void>> exe_sym_;
+  util::LruCache<int32_t, Cached<void>> pid_sym_;
+  util::LruCache<std::string, Cached<const SymbolTable>> symbol_table_cache_;
+  // "dev:inode" -> build id and symbol size, so that shared libraries are
+  // only read once
+  util::LruCache<std::string, util::elf_info> elf_info_cache_;
+
+  std::shared_ptr<void> get_symcache(int32_t pid, const std::string& pid_exe);
+  std::shared_ptr<void> new_symcache(int32_t pid,
+                                     size_t size,
+                                     std::string layout_key);
+  std::shared_ptr<const SymbolTable> get_symbol_table(
+      const std::string& elf_file);
+  Layout get_layout(int32_t pid);
+  void trim_caches();
 
   void cache_bcc(const std::string& elf_file);
-  std::string resolve_bcc(uint64_t addr,
-                          int32_t pid,
-                          const std::string& pid_exe,
-                          bool show_offset,
-                          bool perf_mode);
+  void resolve_bcc(std::span<const uint64_t> addrs,
+                   int32_t pid,
+                   const std::string& pid_exe,
+                   bool show_offset,
+                   bool perf_mode,
+                   std::vector<std::vector<std::string>>& str_syms);
   struct bcc_symbol_option& get_symbol_opts();
 
 #ifdef HAVE_BLAZESYM
@@ -51,18 +112,13 @@ private:
 
   struct blaze_symbolizer* create_symbolizer() const;
   void cache_blazesym(const std::string& elf_file);
-  std::vector<std::string> resolve_blazesym_impl(uint64_t addr,
-                                                 int32_t pid,
-                                                 const std::string& pid_exe,
-                                                 bool show_offset,
-                                                 bool perf_mode,
-                                                 bool show_debug_info);
-  std::vector<std::string> resolve_blazesym(uint64_t addr,
-                                            int32_t pid,
-                                            const std::string& pid_exe,
-                                            bool show_offset,
-                                            bool perf_mode,
-                                            bool show_debug_info);
+  void resolve_blazesym(std::span<const uint64_t> addrs,
+                        int32_t pid,
+                        const std::string& pid_exe,
+                        bool show_offset,
+                        bool perf_mode,
+                        bool show_debug_info,
+                        std::vector<std::vector<std::string>>& str_syms);
 #endif
 };
 
@@ -17,10 +17,12 @@
 #include <fcntl.h>
 #include <filesystem>
 #include <fstream>
-#include <map>
+#include <memory>
 #include <ranges>
 #include <regex>
+#include <sys/inotify.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "util/cgroup.h"
 #include "util/exceptions.h"
@@ -28,40 +30,172 @@
 
 namespace bpftrace::util {
 
-std::string get_cgroup_path_in_hierarchy(uint64_t cgroupid,
-                                         std::string base_path)
+CgroupPathIndex::CgroupPathIndex(std::string base_path,
+                                 size_t max_entries,
+                                 std::chrono::milliseconds recheck_interval)
+    : base_path_(std::move(base_path)),
+      max_entries_(max_entries),
+      recheck_interval_(recheck_interval)
+{
+}
+
+CgroupPathIndex::~CgroupPathIndex()
 {
-  static std::map<std::pair<uint64_t, std::string>, std::string> path_cache;
+  if (inotify_fd_ >= 0)
+    close(inotify_fd_);
+}
+
+std::string CgroupPathIndex::find(uint64_t cgroupid)
+{
+  auto now = std::chrono::steady_clock::now();
+  bool refreshed = stale_ || now - last_check_ >= recheck_interval_;
+  if (refreshed)
+    refresh(now);
+
+  auto path = paths_.find(cgroupid);
+  // The cgroup may have been created since the events were last read
+  if (path == paths_.end() && !refreshed) {
+    refresh(now);
+    path = paths_.find(cgroupid);
+  }
+  if (path != paths_.end())
+    return path->second;
+  if (complete_)
+    return "";
+
+  auto walked = walk(cgroupid);
+  if (!walked.empty() && paths_.size() < max_entries_)
+    paths_.emplace(cgroupid, walked);
+  return walked;
+}
+
+void CgroupPathIndex::refresh(std::chrono::steady_clock::time_point now)
+{
+  if (!stale_)
+    process_events();
+  if (stale_)
+    build();
+  last_check_ = now;
+}
+
+void CgroupPathIndex::build()
+{
+  if (inotify_fd_ >= 0)
+    close(inotify_fd_);
+  paths_.clear();
+  watches_.clear();
+
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  complete_ = inotify_fd_ >= 0;
+  stale_ = false;
+  add_tree("/");
+}
+
+void CgroupPathIndex::add_tree(const std::string &path)
+{
+  auto full_path = path == "/" ? base_path_ : base_path_ + path;
   struct stat path_st;
+  // The cgroup may already be gone again
+  if (stat(full_path.c_str(), &path_st) < 0)
+    return;
+  if (paths_.size() >= max_entries_) {
+    complete_ = false;
+    return;
+  }
+  paths_[path_st.st_ino] = path;
+
+  // Watch before listing the children, so that none created in between are
+  // missed. Children created in between may be seen twice, which is harmless.
+  if (inotify_fd_ >= 0) {
+    int wd = inotify_add_watch(inotify_fd_,
+                               full_path.c_str(),
+                               IN_CREATE | IN_DELETE_SELF | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_ONLYDIR);
+    if (wd >= 0)
+      watches_[wd] = { path_st.st_ino, path };
+    else
+      complete_ = false;
+  }
 
-  auto cached_path = path_cache.find({ cgroupid, base_path });
-  if (cached_path != path_cache.end() &&
-      stat(cached_path->second.c_str(), &path_st) >= 0 &&
-      path_st.st_ino == cgroupid)
-    return cached_path->second;
+  std::error_code ec;
+  auto it = std::filesystem::directory_iterator(full_path, ec);
+  for (; !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    if (!it->is_directory(ec) || it->is_symlink(ec))
+      continue;
+    add_tree((path == "/" ? "" : path) + "/" + it->path().filename().string());
+  }
+}
+
+void CgroupPathIndex::process_events()
+{
+  if (inotify_fd_ < 0)
+    return;
+
+  alignas(struct inotify_event) char buf[4096];
+  ssize_t len;
+  while ((len = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+    const struct inotify_event *event;
+    for (char *ptr = buf; ptr < buf + len;
+         ptr += sizeof(struct inotify_event) + event->len) {
+      event = reinterpret_cast<const struct inotify_event *>(ptr);
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        stale_ = true;
+        continue;
+      }
+      auto watch = watches_.find(event->wd);
+      if (watch == watches_.end())
+        continue;
+      auto [cgroupid, path] = watch->second;
+
+      if (event->mask & IN_IGNORED) {
+        watches_.erase(watch);
+      } else if (event->mask & IN_DELETE_SELF) {
+        paths_.erase(cgroupid);
+      } else if (event->mask & IN_ISDIR) {
+        // A rename changes the paths of the whole subtree, start over
+        if (event->mask & (IN_MOVED_FROM | IN_MOVED_TO))
+          stale_ = true;
+        else if (event->mask & IN_CREATE)
+          add_tree((path == "/" ? "" : path) + "/" + event->name);
+      }
+    }
+  }
+}
+
+std::string CgroupPathIndex::walk(uint64_t cgroupid) const
+{
+  struct stat path_st;
 
   // Check for root cgroup path separately, since recursive_directory_iterator
   // does not iterate over base directory
-  if (stat(base_path.c_str(), &path_st) >= 0 && path_st.st_ino == cgroupid) {
-    path_cache[{ cgroupid, base_path }] = "/";
+  if (stat(base_path_.c_str(), &path_st) >= 0 && path_st.st_ino == cgroupid)
     return "/";
-  }
 
   for (const auto &path_iter :
-       std::filesystem::recursive_directory_iterator(base_path)) {
+       std::filesystem::recursive_directory_iterator(base_path_)) {
     if (stat(path_iter.path().c_str(), &path_st) < 0)
       return "";
-    if (path_st.st_ino == cgroupid) {
-      // Base directory is not a part of cgroup path
-      path_cache[{ cgroupid, base_path }] = path_iter.path().string().substr(
-          base_path.length());
-      return path_cache[{ cgroupid, base_path }];
-    }
+    // Base directory is not a part of cgroup path
+    if (path_st.st_ino == cgroupid)
+      return path_iter.path().string().substr(base_path_.length());
   }
 
   return "";
 }
 
+std::string get_cgroup_path_in_hierarchy(uint64_t cgroupid,
+                                         std::string base_path)
+{
+  static std::unordered_map<std::string, std::unique_ptr<CgroupPathIndex>>
+      indexes;
+
+  auto &index = indexes[base_path];
+  if (!index)
+    index = std::make_unique<CgroupPathIndex>(base_path);
+  return index->find(cgroupid);
+}
+
 std::array<std::vector<std::string>, 2> get_cgroup_hierarchy_roots()
 {
   // Get all cgroup mounts and their type (cgroup/cgroup2) from /proc/mounts
@@ -1,12 +1,67 @@
 #pragma once
 
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace bpftrace::util {
 
+// Index of the cgroups (directories) in a cgroup hierarchy by their id, which
+// is the inode number of the cgroup directory.
+//
+// The hierarchy is walked once and then kept up to date with inotify, which
+// reports mkdir and rmdir of cgroups, so that lookups are a hash lookup. If
+// the index can't be kept complete (more than `max_entries` cgroups, no more
+// inotify watches available), lookups which miss fall back to walking the
+// hierarchy.
+//
+// Reading the inotify events takes a syscall, so lookups only do it when they
+// miss, or at most once per `recheck_interval`. Until then, a lookup may still
+// return the path of a cgroup which was just removed or renamed.
+class CgroupPathIndex {
+public:
+  explicit CgroupPathIndex(
+      std::string base_path,
+      size_t max_entries = 1 << 20,
+      std::chrono::milliseconds recheck_interval = std::chrono::seconds(1));
+  ~CgroupPathIndex();
+
+  CgroupPathIndex(const CgroupPathIndex &) = delete;
+  CgroupPathIndex &operator=(const CgroupPathIndex &) = delete;
+
+  // Returns the path of the cgroup relative to the hierarchy root, or an empty
+  // string if there is no such cgroup.
+  std::string find(uint64_t cgroupid);
+
+  size_t size() const
+  {
+    return paths_.size();
+  }
+
+private:
+  void refresh(std::chrono::steady_clock::time_point now);
+  void build();
+  void add_tree(const std::string &path);
+  void process_events();
+  std::string walk(uint64_t cgroupid) const;
+
+  std::string base_path_;
+  size_t max_entries_;
+  std::chrono::milliseconds recheck_interval_;
+  std::chrono::steady_clock::time_point last_check_;
+  int inotify_fd_ = -1;
+  bool complete_ = false;
+  bool stale_ = true;
+
+  // cgroup id -> path relative to base_path_
+  std::unordered_map<uint64_t, std::string> paths_;
+  // inotify watch -> (cgroup id, path) of the watched directory
+  std::unordered_map<int, std::pair<uint64_t, std::string>> watches_;
+};
+
 std::string get_cgroup_path_in_hierarchy(uint64_t cgroupid,
                                          std::string base_path);
 
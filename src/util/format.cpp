@@ -1,4 +1,5 @@
 #include <cstdint>
+#include <iomanip>
 #include <sstream>
 
 #include "util/format.h"
@@ -21,6 +22,44 @@ std::vector<std::string> split_string(const std::string &str,
   return elems;
 }
 
+std::string json_escape(const std::string &str)
+{
+  std::ostringstream escaped;
+  for (const char &c : str) {
+    switch (c) {
+      case '"':
+        escaped << "\\\"";
+        break;
+
+      case '\\':
+        escaped << "\\\\";
+        break;
+
+      case '\n':
+        escaped << "\\n";
+        break;
+
+      case '\r':
+        escaped << "\\r";
+        break;
+
+      case '\t':
+        escaped << "\\t";
+        break;
+
+      default:
+        // c always >= '\x00'
+        if (c <= '\x1f') {
+          escaped << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                  << static_cast<int>(c);
+        } else {
+          escaped << c;
+        }
+    }
+  }
+  return escaped.str();
+}
+
 /// Erase prefix up to the first colon (:) from str and return the prefix
 std::string erase_prefix(std::string &str)
 {
@@ -72,10 +111,21 @@ std::string hex_format_buffer(const char *buf,
                               size_t size,
                               bool keep_ascii,
                               bool escape_hex)
+{
+  std::string str;
+  hex_format_buffer(buf, size, keep_ascii, escape_hex, str);
+  return str;
+}
+
+void hex_format_buffer(const char *buf,
+                       size_t size,
+                       bool keep_ascii,
+                       bool escape_hex,
+                       std::string &out)
 {
   // Allow enough space for every byte to be sanitized in the form "\x00"
-  std::string str((size * 4) + 1, '\0');
-  char *s = str.data();
+  out.resize((size * 4) + 1);
+  char *s = out.data();
 
   size_t offset = 0;
   for (size_t i = 0; i < size; i++)
@@ -92,9 +142,8 @@ std::string hex_format_buffer(const char *buf,
                         i == size - 1 ? "%02x" : "%02x ",
                         (reinterpret_cast<const uint8_t *>(buf))[i]);
 
-  // Fit return value to actual length
-  str.resize(offset);
-  return str;
+  // Fit to actual length
+  out.resize(offset);
 }
 
 } // namespace bpftrace::util
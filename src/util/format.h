@@ -32,6 +32,9 @@ std::vector<std::string> split_string(const std::string &str,
 std::string str_join(const std::vector<std::string> &list,
                      const std::string &delim);
 
+// Escapes the string for use in a JSON string literal
+std::string json_escape(const std::string &str);
+
 std::string erase_prefix(std::string &str);
 void erase_parameter_list(std::string &demangled_name);
 
@@ -39,5 +42,11 @@ std::string hex_format_buffer(const char *buf,
                               size_t size,
                               bool keep_ascii = true,
                               bool escape_hex = true);
+// Same as above, but formats into `out`, reusing its storage
+void hex_format_buffer(const char *buf,
+                       size_t size,
+                       bool keep_ascii,
+                       bool escape_hex,
+                       std::string &out);
 
 } // namespace bpftrace::util
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+
+#include "util/kallsyms.h"
+
+namespace bpftrace::util {
+
+bool KallsymsTable::load(const std::string &path)
+{
+  std::ifstream file(path);
+  if (file.fail()) {
+    addrs_.clear();
+    name_offsets_.clear();
+    names_.clear();
+    return false;
+  }
+  return load(file);
+}
+
+bool KallsymsTable::load(std::istream &in)
+{
+  struct Entry {
+    uint64_t addr;
+    uint32_t name_start;
+    uint32_t name_size;
+  };
+  std::vector<Entry> entries;
+  std::string blob;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    const char *end = line.data() + line.size();
+    uint64_t addr;
+    auto [ptr, ec] = std::from_chars(line.data(), end, addr, 16);
+    if (ec != std::errc() || end - ptr < 4 || ptr[0] != ' ' || ptr[2] != ' ')
+      continue;
+
+    // Absolute symbols are not in the kernel's address space
+    char type = ptr[1];
+    if (addr == 0 || type == 'a' || type == 'A' || type == 'U')
+      continue;
+
+    const char *name = ptr + 3;
+    const char *name_end = std::find_if(
+        name, end, [](char c) { return c == '\t' || c == ' '; });
+    if (name_end == name)
+      continue;
+
+    entries.push_back({ .addr = addr,
+                        .name_start = static_cast<uint32_t>(blob.size()),
+                        .name_size = static_cast<uint32_t>(name_end - name) });
+    blob.append(name, name_end);
+  }
+
+  // Module symbols are not necessarily in order. Of several symbols at the
+  // same address, the first one listed wins.
+  std::ranges::stable_sort(entries, {}, &Entry::addr);
+
+  addrs_.clear();
+  name_offsets_.clear();
+  names_.clear();
+  addrs_.reserve(entries.size());
+  name_offsets_.reserve(entries.size() + 1);
+  names_.reserve(blob.size());
+  for (const auto &entry : entries) {
+    if (!addrs_.empty() && addrs_.back() == entry.addr)
+      continue;
+    addrs_.push_back(entry.addr);
+    name_offsets_.push_back(names_.size());
+    names_.append(blob, entry.name_start, entry.name_size);
+  }
+  if (addrs_.empty()) {
+    name_offsets_.clear();
+    return false;
+  }
+  name_offsets_.push_back(names_.size());
+  return true;
+}
+
+std::optional<KallsymsTable::Symbol> KallsymsTable::lookup(uint64_t addr) const
+{
+  if (addrs_.empty() || addr < addrs_.front())
+    return std::nullopt;
+
+  // Binary search for the last address <= addr. The loop runs a fixed number
+  // of times for a given size and the comparison compiles to a conditional
+  // move, so there are no mispredicted branches.
+  const uint64_t *base = addrs_.data();
+  size_t n = addrs_.size();
+  while (n > 1) {
+    size_t half = n / 2;
+    base = base[half] <= addr ? base + half : base;
+    n -= half;
+  }
+
+  size_t i = base - addrs_.data();
+  return Symbol{
+    .name = std::string_view(names_).substr(
+        name_offsets_[i], name_offsets_[i + 1] - name_offsets_[i]),
+    .offset = addr - addrs_[i],
+  };
+}
+
+} // namespace bpftrace::util
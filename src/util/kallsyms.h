@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bpftrace::util {
+
+// Kernel symbols from /proc/kallsyms, for resolving addresses to names.
+//
+// The symbols are kept sorted by address in flat arrays: one of addresses,
+// which is all that a lookup has to search, and one of offsets into a single
+// blob holding all names. This is a fraction of the size of a table of
+// strings and keeps the search within a few cache lines.
+class KallsymsTable {
+public:
+  struct Symbol {
+    std::string_view name;
+    uint64_t offset;
+  };
+
+  // Replaces the table with the symbols from `path`. Returns false if the
+  // file can't be read, or if it has no usable addresses (e.g. because they
+  // are hidden by kptr_restrict).
+  bool load(const std::string &path = "/proc/kallsyms");
+  // Same, for lines in the format of /proc/kallsyms:
+  //   <address> <type> <name>[\t[<module>]]
+  bool load(std::istream &in);
+
+  // Finds the symbol `addr` belongs to, i.e. the closest one at or below it
+  std::optional<Symbol> lookup(uint64_t addr) const;
+
+  size_t size() const
+  {
+    return addrs_.size();
+  }
+  bool empty() const
+  {
+    return addrs_.empty();
+  }
+
+private:
+  std::vector<uint64_t> addrs_;
+  // Symbol i is names_[name_offsets_[i], name_offsets_[i + 1])
+  std::vector<uint32_t> name_offsets_;
+  std::string names_;
+};
+
+} // namespace bpftrace::util
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace bpftrace::util {
+
+// Fixed-capacity map which evicts the least recently used entry when full.
+//
+// Lookups and insertions are O(1). A capacity of 0 disables caching. Hits
+// and misses are counted so that callers can report how effective the cache
+// is.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache {
+public:
+  explicit LruCache(size_t capacity = 0) : capacity_(capacity)
+  {
+  }
+
+  // Returns the cached value and marks it as most recently used, or nullptr.
+  // The pointer is valid until the next insertion.
+  Value *get(const Key &key)
+  {
+    if (capacity_ == 0)
+      return nullptr;
+
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      misses_++;
+      return nullptr;
+    }
+    hits_++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+  }
+
+  // Unlike get(), doesn't count as a use of the entry
+  bool contains(const Key &key) const
+  {
+    return index_.contains(key);
+  }
+
+  void put(const Key &key, Value value)
+  {
+    if (capacity_ == 0)
+      return;
+
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      it->second->second = std::move(value);
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return;
+    }
+
+    if (entries_.size() >= capacity_) {
+      // Reuse the evicted node rather than allocating a new one
+      auto last = std::prev(entries_.end());
+      index_.erase(last->first);
+      last->first = key;
+      last->second = std::move(value);
+      entries_.splice(entries_.begin(), entries_, last);
+    } else {
+      entries_.emplace_front(key, std::move(value));
+    }
+    index_.emplace(key, entries_.begin());
+  }
+
+  void erase(const Key &key)
+  {
+    auto it = index_.find(key);
+    if (it == index_.end())
+      return;
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  // The least recently used entry, i.e. the next one to be evicted, or
+  // nullptr if empty
+  const std::pair<Key, Value> *lru() const
+  {
+    return entries_.empty() ? nullptr : &entries_.back();
+  }
+
+  void pop_lru()
+  {
+    if (entries_.empty())
+      return;
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+
+  void clear()
+  {
+    entries_.clear();
+    index_.clear();
+  }
+
+  void set_capacity(size_t capacity)
+  {
+    capacity_ = capacity;
+    while (entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+  size_t capacity() const
+  {
+    return capacity_;
+  }
+  size_t size() const
+  {
+    return entries_.size();
+  }
+  size_t hits() const
+  {
+    return hits_;
+  }
+  size_t misses() const
+  {
+    return misses_;
+  }
+
+private:
+  size_t capacity_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+
+  // Most recently used first
+  std::list<std::pair<Key, Value>> entries_;
+  std::unordered_map<Key,
+                     typename std::list<std::pair<Key, Value>>::iterator,
+                     Hash>
+      index_;
+};
+
+} // namespace bpftrace::util
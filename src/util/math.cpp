@@ -23,4 +23,9 @@ uint32_t round_up_to_next_power_of_two(uint32_t n)
   return n + 1;
 }
 
+size_t top_skip(size_t total, uint32_t top)
+{
+  return top && total > top ? total - top : 0;
+}
+
 } // namespace bpftrace::util
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 namespace bpftrace::util {
 
 uint32_t round_up_to_next_power_of_two(uint32_t n);
 
+// Number of leading elements to skip when only the last `top` of `total`
+// sorted elements are printed, as print(@map, top) does. A `top` of 0 prints
+// all of them.
+size_t top_skip(size_t total, uint32_t top);
+
 } // namespace bpftrace::util
@@ -0,0 +1,439 @@
+#include <cstring>
+#include <limits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "util/stats.h"
+
+// Per-CPU values are reduced with hand-written AVX2 and AVX-512 kernels when
+// the CPU supports them, selected once at runtime. Other architectures use
+// kernels written with the compiler's generic 128-bit vectors, which become
+// NEON code on aarch64. Unlike the portable loops, they also vectorize
+// min/max, which has to skip the CPUs that never set a value. The x86-64
+// baseline keeps the portable loops, see best_isa().
+
+namespace bpftrace::util::detail {
+
+namespace {
+
+// Min/max values are compared as signed integers. Unsigned ones get their
+// sign bit flipped, which keeps their order.
+constexpr uint64_t SIGN_BIT = 1ULL << 63;
+
+uint64_t load64(const uint8_t *src)
+{
+  uint64_t v;
+  std::memcpy(&v, src, sizeof(v));
+  return v;
+}
+
+template <bool is_max>
+int64_t pick(int64_t a, int64_t b)
+{
+  if constexpr (is_max)
+    return a > b ? a : b;
+  else
+    return a < b ? a : b;
+}
+
+uint64_t sum64_scalar(const uint8_t *data, size_t nvalues)
+{
+  uint64_t sum = 0;
+  for (size_t i = 0; i < nvalues; i++)
+    sum += load64(data + (i * 8));
+  return sum;
+}
+
+void sum_pairs64_scalar(const uint8_t *data,
+                        size_t nvalues,
+                        uint64_t &first,
+                        uint64_t &second)
+{
+  uint64_t a = 0;
+  uint64_t b = 0;
+  for (size_t i = 0; i < nvalues; i++) {
+    a += load64(data + (i * 16));
+    b += load64(data + (i * 16) + 8);
+  }
+  first = a;
+  second = b;
+}
+
+// Reduces the (value, is_set) pairs from index `i` on, continuing from `acc`
+// and `any_set`. CPUs which never set a value are skipped.
+template <bool is_signed, bool is_max>
+uint64_t min_max_tail(const uint8_t *data,
+                      size_t i,
+                      size_t nvalues,
+                      int64_t acc,
+                      bool any_set)
+{
+  constexpr uint64_t bias = is_signed ? 0 : SIGN_BIT;
+  for (; i < nvalues; i++) {
+    auto is_set = static_cast<uint32_t>(load64(data + (i * 16) + 8));
+    if (!is_set)
+      continue;
+    auto val = static_cast<int64_t>(load64(data + (i * 16)) ^ bias);
+    acc = pick<is_max>(acc, val);
+    any_set = true;
+  }
+  return any_set ? static_cast<uint64_t>(acc) ^ bias : 0;
+}
+
+template <bool is_signed, bool is_max>
+uint64_t min_max_scalar(const uint8_t *data, size_t nvalues)
+{
+  constexpr int64_t init = is_max ? std::numeric_limits<int64_t>::min()
+                                  : std::numeric_limits<int64_t>::max();
+  return min_max_tail<is_signed, is_max>(data, 0, nvalues, init, false);
+}
+
+using u64x2 = uint64_t __attribute__((vector_size(16)));
+using i64x2 = int64_t __attribute__((vector_size(16)));
+
+u64x2 load_u64x2(const uint8_t *src)
+{
+  u64x2 v;
+  std::memcpy(&v, src, sizeof(v));
+  return v;
+}
+
+uint64_t sum64_vec128(const uint8_t *data, size_t nvalues)
+{
+  u64x2 acc0 = {};
+  u64x2 acc1 = {};
+  size_t i = 0;
+  for (; i + 4 <= nvalues; i += 4) {
+    acc0 += load_u64x2(data + (i * 8));
+    acc1 += load_u64x2(data + (i * 8) + 16);
+  }
+  acc0 += acc1;
+  return acc0[0] + acc0[1] + sum64_scalar(data + (i * 8), nvalues - i);
+}
+
+void sum_pairs64_vec128(const uint8_t *data,
+                        size_t nvalues,
+                        uint64_t &first,
+                        uint64_t &second)
+{
+  // Each vector is one pair, so the lanes are the two sums
+  u64x2 acc0 = {};
+  u64x2 acc1 = {};
+  size_t i = 0;
+  for (; i + 2 <= nvalues; i += 2) {
+    acc0 += load_u64x2(data + (i * 16));
+    acc1 += load_u64x2(data + (i * 16) + 16);
+  }
+  acc0 += acc1;
+  sum_pairs64_scalar(data + (i * 16), nvalues - i, first, second);
+  first += acc0[0];
+  second += acc0[1];
+}
+
+template <bool is_signed, bool is_max>
+uint64_t min_max_vec128(const uint8_t *data, size_t nvalues)
+{
+  constexpr int64_t init = is_max ? std::numeric_limits<int64_t>::min()
+                                  : std::numeric_limits<int64_t>::max();
+  constexpr int64_t bias = is_signed ? 0 : SIGN_BIT;
+  const i64x2 inits = { init, init };
+
+  i64x2 acc = inits;
+  i64x2 any_set = {};
+  size_t i = 0;
+  for (; i + 2 <= nvalues; i += 2) {
+    const uint8_t *p = data + (i * 16);
+    // Split two (value, is_set) pairs into values and flags
+    i64x2 vals = { static_cast<int64_t>(load64(p)),
+                   static_cast<int64_t>(load64(p + 16)) };
+    i64x2 flags = { static_cast<int64_t>(load64(p + 8)),
+                    static_cast<int64_t>(load64(p + 24)) };
+    vals ^= bias;
+    flags &= 0xffffffff;
+    auto unset = reinterpret_cast<i64x2>(flags == 0);
+    vals = (vals & ~unset) | (inits & unset);
+    any_set |= flags;
+
+    auto greater = reinterpret_cast<i64x2>(vals > acc);
+    if constexpr (is_max)
+      acc = (vals & greater) | (acc & ~greater);
+    else
+      acc = (acc & greater) | (vals & ~greater);
+  }
+
+  return min_max_tail<is_signed, is_max>(data,
+                                         i,
+                                         nvalues,
+                                         pick<is_max>(acc[0], acc[1]),
+                                         (any_set[0] | any_set[1]) != 0);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) uint64_t sum64_avx2(const uint8_t *data,
+                                                    size_t nvalues)
+{
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= nvalues; i += 8) {
+    const auto *p = reinterpret_cast<const __m256i *>(data + (i * 8));
+    acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256(p));
+    acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256(p + 1));
+  }
+  acc0 = _mm256_add_epi64(acc0, acc1);
+
+  alignas(32) uint64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc0);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         sum64_scalar(data + (i * 8), nvalues - i);
+}
+
+__attribute__((target("avx2"))) void sum_pairs64_avx2(const uint8_t *data,
+                                                      size_t nvalues,
+                                                      uint64_t &first,
+                                                      uint64_t &second)
+{
+  // Each vector holds two pairs, so even lanes sum up the first halves and
+  // odd lanes the second ones
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 2 <= nvalues; i += 2) {
+    const auto *p = reinterpret_cast<const __m256i *>(data + (i * 16));
+    acc = _mm256_add_epi64(acc, _mm256_loadu_si256(p));
+  }
+
+  alignas(32) uint64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+  sum_pairs64_scalar(data + (i * 16), nvalues - i, first, second);
+  first += lanes[0] + lanes[2];
+  second += lanes[1] + lanes[3];
+}
+
+template <bool is_signed, bool is_max>
+__attribute__((target("avx2"))) uint64_t min_max_avx2(const uint8_t *data,
+                                                      size_t nvalues)
+{
+  constexpr int64_t init = is_max ? std::numeric_limits<int64_t>::min()
+                                  : std::numeric_limits<int64_t>::max();
+  const __m256i bias = _mm256_set1_epi64x(is_signed ? 0 : SIGN_BIT);
+  const __m256i inits = _mm256_set1_epi64x(init);
+  const __m256i flag_mask = _mm256_set1_epi64x(0xffffffff);
+  const __m256i zero = _mm256_setzero_si256();
+
+  __m256i acc = inits;
+  __m256i any_set = zero;
+  size_t i = 0;
+  for (; i + 4 <= nvalues; i += 4) {
+    const auto *p = reinterpret_cast<const __m256i *>(data + (i * 16));
+    __m256i a = _mm256_loadu_si256(p);
+    __m256i b = _mm256_loadu_si256(p + 1);
+    // Split four (value, is_set) pairs into values and flags
+    __m256i vals = _mm256_xor_si256(_mm256_unpacklo_epi64(a, b), bias);
+    __m256i flags = _mm256_and_si256(_mm256_unpackhi_epi64(a, b), flag_mask);
+    __m256i unset = _mm256_cmpeq_epi64(flags, zero);
+    vals = _mm256_blendv_epi8(vals, inits, unset);
+    any_set = _mm256_or_si256(any_set, flags);
+
+    __m256i greater = _mm256_cmpgt_epi64(vals, acc);
+    if constexpr (is_max)
+      acc = _mm256_blendv_epi8(acc, vals, greater);
+    else
+      acc = _mm256_blendv_epi8(vals, acc, greater);
+  }
+
+  alignas(32) int64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+  int64_t best = init;
+  for (int64_t lane : lanes)
+    best = pick<is_max>(best, lane);
+  return min_max_tail<is_signed, is_max>(
+      data, i, nvalues, best, !_mm256_testz_si256(any_set, any_set));
+}
+
+__attribute__((target("avx512f"))) uint64_t sum64_avx512(const uint8_t *data,
+                                                         size_t nvalues)
+{
+  __m512i acc0 = _mm512_setzero_si512();
+  __m512i acc1 = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 16 <= nvalues; i += 16) {
+    const uint8_t *p = data + (i * 8);
+    acc0 = _mm512_add_epi64(acc0, _mm512_loadu_si512(p));
+    acc1 = _mm512_add_epi64(acc1, _mm512_loadu_si512(p + 64));
+  }
+  alignas(64) uint64_t lanes[8];
+  _mm512_store_si512(lanes, _mm512_add_epi64(acc0, acc1));
+  uint64_t sum = 0;
+  for (uint64_t lane : lanes)
+    sum += lane;
+  return sum + sum64_avx2(data + (i * 8), nvalues - i);
+}
+
+__attribute__((target("avx512f"))) void sum_pairs64_avx512(
+    const uint8_t *data,
+    size_t nvalues,
+    uint64_t &first,
+    uint64_t &second)
+{
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 4 <= nvalues; i += 4)
+    acc = _mm512_add_epi64(acc, _mm512_loadu_si512(data + (i * 16)));
+
+  alignas(64) uint64_t lanes[8];
+  _mm512_store_si512(lanes, acc);
+  sum_pairs64_avx2(data + (i * 16), nvalues - i, first, second);
+  for (int lane = 0; lane < 8; lane += 2) {
+    first += lanes[lane];
+    second += lanes[lane + 1];
+  }
+}
+
+template <bool is_signed, bool is_max>
+__attribute__((target("avx512f"))) uint64_t min_max_avx512(
+    const uint8_t *data,
+    size_t nvalues)
+{
+  constexpr int64_t init = is_max ? std::numeric_limits<int64_t>::min()
+                                  : std::numeric_limits<int64_t>::max();
+  const __m512i bias = _mm512_set1_epi64(is_signed ? 0 : SIGN_BIT);
+  const __m512i flag_mask = _mm512_set1_epi64(0xffffffff);
+
+  __m512i acc = _mm512_set1_epi64(init);
+  __mmask8 any_set = 0;
+  size_t i = 0;
+  for (; i + 8 <= nvalues; i += 8) {
+    const uint8_t *p = data + (i * 16);
+    __m512i a = _mm512_loadu_si512(p);
+    __m512i b = _mm512_loadu_si512(p + 64);
+    // The zero-masking variants avoid a bogus -Wmaybe-uninitialized in
+    // some GCC versions' headers
+    __m512i vals = _mm512_xor_si512(_mm512_maskz_unpacklo_epi64(0xff, a, b),
+                                    bias);
+    __mmask8 set = _mm512_test_epi64_mask(
+        _mm512_maskz_unpackhi_epi64(0xff, a, b), flag_mask);
+    if constexpr (is_max)
+      acc = _mm512_mask_max_epi64(acc, set, acc, vals);
+    else
+      acc = _mm512_mask_min_epi64(acc, set, acc, vals);
+    any_set |= set;
+  }
+
+  alignas(64) int64_t lanes[8];
+  _mm512_store_si512(lanes, acc);
+  int64_t best = init;
+  for (int64_t lane : lanes)
+    best = pick<is_max>(best, lane);
+  return min_max_tail<is_signed, is_max>(
+      data, i, nvalues, best, any_set != 0);
+}
+
+#endif
+
+struct Kernels {
+  uint64_t (*sum64)(const uint8_t *, size_t);
+  void (*sum_pairs64)(const uint8_t *, size_t, uint64_t &, uint64_t &);
+  // Indexed by [is_signed][is_max]
+  uint64_t (*min_max[2][2])(const uint8_t *, size_t);
+};
+
+Kernels kernels_for(Isa isa)
+{
+  switch (isa) {
+#if defined(__x86_64__)
+    case Isa::avx512:
+      return {
+        .sum64 = sum64_avx512,
+        .sum_pairs64 = sum_pairs64_avx512,
+        .min_max = { { min_max_avx512<false, false>,
+                       min_max_avx512<false, true> },
+                     { min_max_avx512<true, false>,
+                       min_max_avx512<true, true> } },
+      };
+    case Isa::avx2:
+      return {
+        .sum64 = sum64_avx2,
+        .sum_pairs64 = sum_pairs64_avx2,
+        .min_max = { { min_max_avx2<false, false>, min_max_avx2<false, true> },
+                     { min_max_avx2<true, false>, min_max_avx2<true, true> } },
+      };
+#endif
+    case Isa::vec128:
+      return {
+        .sum64 = sum64_vec128,
+        .sum_pairs64 = sum_pairs64_vec128,
+        .min_max = { { min_max_vec128<false, false>,
+                       min_max_vec128<false, true> },
+                     { min_max_vec128<true, false>,
+                       min_max_vec128<true, true> } },
+      };
+    default:
+      return {
+        .sum64 = sum64_scalar,
+        .sum_pairs64 = sum_pairs64_scalar,
+        .min_max = { { min_max_scalar<false, false>,
+                       min_max_scalar<false, true> },
+                     { min_max_scalar<true, false>,
+                       min_max_scalar<true, true> } },
+      };
+  }
+}
+
+Kernels &kernels()
+{
+  static Kernels kernels = kernels_for(best_isa());
+  return kernels;
+}
+
+} // namespace
+
+Isa best_isa()
+{
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx512f"))
+    return Isa::avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return Isa::avx2;
+  // SSE2 has no 64-bit compare, which makes the min/max of the 128-bit
+  // kernels slower than the portable loop
+  return Isa::portable;
+#else
+  return Isa::vec128;
+#endif
+}
+
+bool use_isa(Isa isa)
+{
+  if (isa > Isa::vec128 && isa > best_isa())
+    return false;
+  kernels() = kernels_for(isa);
+  return true;
+}
+
+uint64_t sum64(const uint8_t *data, size_t nvalues)
+{
+  return kernels().sum64(data, nvalues);
+}
+
+uint64_t min_max_u64(const uint8_t *data, size_t nvalues, bool is_max)
+{
+  return kernels().min_max[0][is_max](data, nvalues);
+}
+
+int64_t min_max_s64(const uint8_t *data, size_t nvalues, bool is_max)
+{
+  return static_cast<int64_t>(kernels().min_max[1][is_max](data, nvalues));
+}
+
+void sum_pairs64(const uint8_t *data,
+                 size_t nvalues,
+                 uint64_t &first,
+                 uint64_t &second)
+{
+  kernels().sum_pairs64(data, nvalues, first, second);
+}
+
+} // namespace bpftrace::util::detail
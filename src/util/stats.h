@@ -2,7 +2,8 @@
 
 #include <cstdint>
 #include <cstring>
-#include <vector>
+#include <span>
+#include <type_traits>
 
 namespace bpftrace::util {
 
@@ -16,38 +17,73 @@ T read_data(const void *src)
 }
 } // namespace
 
+// Vectorized kernels for the common case of 64-bit values, see stats.cpp
+namespace detail {
+enum class Isa {
+  portable,
+  // Generic 128-bit vectors, NEON on aarch64. Available everywhere.
+  vec128,
+  avx2,
+  avx512,
+};
+// The best kernels the CPU supports, which are used by default
+Isa best_isa();
+// Switches to other kernels, e.g. to test all of them. Returns false if the
+// CPU doesn't support them.
+bool use_isa(Isa isa);
+
+uint64_t sum64(const uint8_t *data, size_t nvalues);
+uint64_t min_max_u64(const uint8_t *data, size_t nvalues, bool is_max);
+int64_t min_max_s64(const uint8_t *data, size_t nvalues, bool is_max);
+// Sums the first and second halves of 128-bit pairs separately
+void sum_pairs64(const uint8_t *data,
+                 size_t nvalues,
+                 uint64_t &first,
+                 uint64_t &second);
+} // namespace detail
+
 template <typename T>
-T reduce_value(const std::vector<uint8_t> &value, int nvalues)
+T reduce_value(std::span<const uint8_t> value, int nvalues)
 {
-  T sum = 0;
-  for (int i = 0; i < nvalues; i++) {
-    sum += read_data<T>(value.data() + (i * sizeof(T)));
+  if constexpr (sizeof(T) == 8) {
+    return static_cast<T>(detail::sum64(value.data(), nvalues));
+  } else {
+    T sum = 0;
+    for (int i = 0; i < nvalues; i++) {
+      sum += read_data<T>(value.data() + (i * sizeof(T)));
+    }
+    return sum;
   }
-  return sum;
 }
 
 template <typename T>
-T min_max_value(const std::vector<uint8_t> &value, int nvalues, bool is_max)
+T min_max_value(std::span<const uint8_t> value, int nvalues, bool is_max)
 {
-  T mm_val = 0;
-  bool mm_set = false;
-  for (int i = 0; i < nvalues; i++) {
-    T val = read_data<T>(value.data() + (i * (sizeof(T) * 2)));
-    auto is_set = read_data<uint32_t>(value.data() + sizeof(T) +
-                                      (i * (sizeof(T) * 2)));
-    if (!is_set) {
-      continue;
-    }
-    if (!mm_set) {
-      mm_val = val;
-      mm_set = true;
-    } else if (is_max && val > mm_val) {
-      mm_val = val;
-    } else if (!is_max && val < mm_val) {
-      mm_val = val;
+  if constexpr (std::is_same_v<T, uint64_t>) {
+    return detail::min_max_u64(value.data(), nvalues, is_max);
+  } else if constexpr (std::is_same_v<T, int64_t>) {
+    return detail::min_max_s64(value.data(), nvalues, is_max);
+  } else {
+    T mm_val = 0;
+    bool mm_set = false;
+    for (int i = 0; i < nvalues; i++) {
+      T val = read_data<T>(value.data() + (i * (sizeof(T) * 2)));
+      auto is_set = read_data<uint32_t>(value.data() + sizeof(T) +
+                                        (i * (sizeof(T) * 2)));
+      if (!is_set) {
+        continue;
+      }
+      if (!mm_set) {
+        mm_val = val;
+        mm_set = true;
+      } else if (is_max && val > mm_val) {
+        mm_val = val;
+      } else if (!is_max && val < mm_val) {
+        mm_val = val;
+      }
     }
+    return mm_val;
   }
-  return mm_val;
 }
 
 template <typename T>
@@ -58,22 +94,29 @@ struct stats {
 };
 
 template <typename T>
-stats<T> stats_value(const std::vector<uint8_t> &value, int nvalues)
+stats<T> stats_value(std::span<const uint8_t> value, int nvalues)
 {
   stats<T> ret = { 0, 0, 0 };
-  for (int i = 0; i < nvalues; i++) {
-    T val = read_data<T>(value.data() + (i * (sizeof(T) * 2)));
-    T cpu_count = read_data<T>(value.data() + sizeof(T) +
-                               (i * (sizeof(T) * 2)));
-    ret.count += cpu_count;
-    ret.total += val;
+  if constexpr (sizeof(T) == 8) {
+    uint64_t total, count;
+    detail::sum_pairs64(value.data(), nvalues, total, count);
+    ret.total = static_cast<T>(total);
+    ret.count = static_cast<T>(count);
+  } else {
+    for (int i = 0; i < nvalues; i++) {
+      T val = read_data<T>(value.data() + (i * (sizeof(T) * 2)));
+      T cpu_count = read_data<T>(value.data() + sizeof(T) +
+                                 (i * (sizeof(T) * 2)));
+      ret.count += cpu_count;
+      ret.total += val;
+    }
   }
   ret.avg = static_cast<T>(ret.total / ret.count);
   return ret;
 }
 
 template <typename T>
-T avg_value(const std::vector<uint8_t> &value, int nvalues)
+T avg_value(std::span<const uint8_t> value, int nvalues)
 {
   return stats_value<T>(value, nvalues).avg;
 }
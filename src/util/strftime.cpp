@@ -0,0 +1,85 @@
+#include <cinttypes>
+#include <cstdio>
+
+#include "util/strftime.h"
+
+namespace bpftrace::util {
+
+StrftimeFormat::StrftimeFormat(std::string_view fmt)
+{
+  std::string part;
+  for (size_t i = 0; i < fmt.size(); i++) {
+    if (fmt[i] == '%' && i + 1 < fmt.size()) {
+      if (fmt[i + 1] == 'f') {
+        parts_.push_back(std::move(part));
+        part.clear();
+        i++;
+        continue;
+      }
+      // Keep other conversions (including "%%") whole, so that the 'f' in
+      // "%%f" is not taken for a conversion
+      part += fmt[i++];
+    }
+    part += fmt[i];
+  }
+  parts_.push_back(std::move(part));
+}
+
+bool StrftimeFormat::render(time_t secs, size_t max_size)
+{
+  cached_ = false;
+  rendered_.clear();
+  rendered_ends_.clear();
+
+  struct tm tm;
+  if (!localtime_r(&secs, &tm))
+    return false;
+
+  scratch_.resize(max_size);
+  for (const auto &part : parts_) {
+    size_t len = 0;
+    if (!part.empty()) {
+      len = strftime(scratch_.data(), scratch_.size(), part.c_str(), &tm);
+      if (len == 0)
+        return false;
+    }
+    rendered_.append(scratch_.data(), len);
+    rendered_ends_.push_back(rendered_.size());
+  }
+
+  cached_ = true;
+  cached_secs_ = secs;
+  cached_max_size_ = max_size;
+  return true;
+}
+
+bool StrftimeFormat::format(time_t secs,
+                            uint32_t usecs,
+                            size_t max_size,
+                            std::string &out)
+{
+  out.clear();
+  if (!cached_ || cached_secs_ != secs || cached_max_size_ != max_size) {
+    if (!render(secs, max_size))
+      return false;
+  }
+
+  char usecs_buf[7];
+  snprintf(usecs_buf, sizeof(usecs_buf), "%06" PRIu32, usecs % 1000000);
+
+  size_t start = 0;
+  for (size_t i = 0; i < rendered_ends_.size(); i++) {
+    if (i > 0)
+      out.append(usecs_buf, 6);
+    out.append(rendered_, start, rendered_ends_[i] - start);
+    start = rendered_ends_[i];
+  }
+
+  if (out.empty() || out.size() >= max_size) {
+    out.clear();
+    return false;
+  }
+  return true;
+}
+
+} // namespace bpftrace::util
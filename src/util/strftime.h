@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bpftrace::util {
+
+// strftime(3) format string with bpftrace's `%f` (microseconds) extension,
+// used to render timestamp values.
+//
+// The format is split around `%f` once, and the parts are only rendered again
+// when the timestamp moves to a new second. Timestamps within the same second
+// just have their microseconds filled in.
+class StrftimeFormat {
+public:
+  explicit StrftimeFormat(std::string_view fmt);
+
+  // Renders `secs` (since the epoch, in local time) and `usecs` into `out`,
+  // replacing its contents. Fails if the result would not fit into `max_size`
+  // bytes including a terminating NUL, like strftime itself.
+  bool format(time_t secs, uint32_t usecs, size_t max_size, std::string &out);
+
+private:
+  bool render(time_t secs, size_t max_size);
+
+  // Parts of the format around each `%f`
+  std::vector<std::string> parts_;
+
+  // Parts rendered for `cached_secs_`, back to back
+  bool cached_ = false;
+  time_t cached_secs_ = 0;
+  size_t cached_max_size_ = 0;
+  std::string rendered_;
+  std::vector<size_t> rendered_ends_;
+  std::string scratch_;
+};
+
+} // namespace bpftrace::util
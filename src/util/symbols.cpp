@@ -16,6 +16,7 @@
 #include <unistd.h>
 #include <zlib.h>
 
+#include "scopeguard.h"
 #include "util/symbols.h"
 
 namespace bpftrace::util {
@@ -46,6 +47,72 @@ std::map<uintptr_t, elf_symbol, std::greater<>> get_symbol_table_for_elf(
   return symbol_table;
 }
 
+std::optional<elf_info> get_elf_info(const std::string &elf_file)
+{
+  if (elf_version(EV_CURRENT) == EV_NONE)
+    return std::nullopt;
+
+  int fd = open(elf_file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return std::nullopt;
+  SCOPE_EXIT
+  {
+    ::close(fd);
+  };
+
+  Elf *elf = elf_begin(fd, ELF_C_READ, nullptr);
+  if (elf == nullptr)
+    return std::nullopt;
+  SCOPE_EXIT
+  {
+    ::elf_end(elf);
+  };
+  if (elf_kind(elf) != ELF_K_ELF)
+    return std::nullopt;
+
+  elf_info info;
+  Elf_Scn *scn = nullptr;
+  while ((scn = elf_nextscn(elf, scn)) != nullptr) {
+    GElf_Shdr shdr;
+    if (!gelf_getshdr(scn, &shdr))
+      continue;
+
+    if (shdr.sh_type == SHT_SYMTAB || shdr.sh_type == SHT_DYNSYM) {
+      info.symbols_size += shdr.sh_size;
+      GElf_Shdr strtab;
+      Elf_Scn *strscn = elf_getscn(elf, shdr.sh_link);
+      if (strscn && gelf_getshdr(strscn, &strtab))
+        info.symbols_size += strtab.sh_size;
+      continue;
+    }
+
+    if (shdr.sh_type != SHT_NOTE || !info.build_id.empty())
+      continue;
+    Elf_Data *data = elf_getdata(scn, nullptr);
+    if (data == nullptr)
+      continue;
+    GElf_Nhdr nhdr;
+    size_t offset = 0;
+    size_t name_off;
+    size_t desc_off;
+    while ((offset = gelf_getnote(
+                data, offset, &nhdr, &name_off, &desc_off)) > 0) {
+      if (nhdr.n_type != NT_GNU_BUILD_ID || nhdr.n_namesz != 4 ||
+          memcmp(static_cast<char *>(data->d_buf) + name_off, "GNU", 4) != 0)
+        continue;
+      const auto *desc = static_cast<const uint8_t *>(data->d_buf) +
+                         desc_off;
+      static constexpr char hex[] = "0123456789abcdef";
+      for (size_t i = 0; i < nhdr.n_descsz; i++) {
+        info.build_id += hex[desc[i] >> 4];
+        info.build_id += hex[desc[i] & 0xf];
+      }
+      break;
+    }
+  }
+  return info;
+}
+
 bool symbol_has_module(const std::string &symbol)
 {
   return !symbol.empty() && symbol[symbol.size() - 1] == ']';
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <map>
+#include <optional>
 #include <string>
 
 namespace bpftrace::util {
@@ -62,6 +63,16 @@ struct elf_symbol {
 std::map<uintptr_t, elf_symbol, std::greater<>> get_symbol_table_for_elf(
     const std::string &elf_file);
 
+struct elf_info {
+  // Hex encoded GNU build id, empty if the file doesn't have one
+  std::string build_id;
+  // Size of the symbol tables and their string tables, which is roughly what
+  // it takes to keep the file's symbols in memory
+  uint64_t symbols_size = 0;
+};
+
+std::optional<elf_info> get_elf_info(const std::string &elf_file);
+
 bool symbol_has_cpp_mangled_signature(const std::string &sym_name);
 
 bool symbol_has_module(const std::string &symbol);
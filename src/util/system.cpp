@@ -1,9 +1,11 @@
 #include <algorithm>
 #include <array>
+#include <cinttypes>
 #include <climits>
 #include <filesystem>
 #include <fstream>
 #include <map>
+#include <sstream>
 #include <unordered_set>
 
 #include "log.h"
@@ -53,6 +55,31 @@ std::string get_proc_maps(pid_t pid)
   return get_proc_maps(std::to_string(pid));
 }
 
+std::optional<uint64_t> get_pid_start_time(pid_t pid)
+{
+  std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+  std::string stat;
+  if (!std::getline(file, stat))
+    return std::nullopt;
+
+  // The command name may contain spaces and parentheses, the fields after it
+  // start at the last ')'. The start time is the 20th of them.
+  auto comm_end = stat.rfind(')');
+  if (comm_end == std::string::npos)
+    return std::nullopt;
+  std::istringstream fields(stat.substr(comm_end + 1));
+  std::string field;
+  for (int i = 0; i < 20; i++)
+    fields >> field;
+  if (!fields)
+    return std::nullopt;
+  try {
+    return std::stoull(field);
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+}
+
 std::vector<int> get_pids_for_program(const std::string &program)
 {
   std::error_code ec;
@@ -108,6 +135,42 @@ std::string exec_system(const char *cmd)
   return result;
 }
 
+std::vector<exec_mapping> get_exec_mappings_for_pid(pid_t pid)
+{
+  std::vector<exec_mapping> mappings;
+  std::ifstream fs("/proc/" + std::to_string(pid) + "/maps");
+  if (!fs.is_open())
+    return mappings;
+
+  std::string line;
+  // Example mapping:
+  // 7fc8ee4fa000-7fc8ee4fb000 r-xp 00001000 00:1f 27168296 /usr/libc.so.6
+  while (std::getline(fs, line)) {
+    exec_mapping mapping;
+    char perms[5];
+    char dev[32];
+    int path_start = 0;
+    if (std::sscanf(line.c_str(),
+                    "%" SCNx64 "-%" SCNx64 " %4s %" SCNx64 " %31s %" SCNu64
+                    " %n",
+                    &mapping.start,
+                    &mapping.end,
+                    perms,
+                    &mapping.offset,
+                    dev,
+                    &mapping.inode,
+                    &path_start) != 6 ||
+        path_start == 0)
+      continue;
+    if (perms[2] != 'x')
+      continue;
+    mapping.dev = dev;
+    mapping.path = line.substr(path_start);
+    mappings.push_back(std::move(mapping));
+  }
+  return mappings;
+}
+
 std::vector<std::string> get_mapped_paths_for_pid(pid_t pid)
 {
   static std::map<pid_t, std::vector<std::string>> paths_cache;
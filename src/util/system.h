@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -10,8 +12,28 @@ std::string get_pid_exe(const std::string &pid);
 std::string get_proc_maps(const std::string &pid);
 std::string get_proc_maps(pid_t pid);
 
+// Start time of a process in clock ticks after boot, from /proc/<pid>/stat.
+// Together with the pid, it identifies a process across pid reuse. Returns
+// nothing if the process doesn't exist.
+std::optional<uint64_t> get_pid_start_time(pid_t pid);
+
 std::string exec_system(const char *cmd);
 
+struct exec_mapping {
+  uint64_t start;
+  uint64_t end;
+  uint64_t offset;
+  // "major:minor" of the device holding the file
+  std::string dev;
+  // 0 for anonymous mappings, e.g. JIT-ed code or [vdso]
+  uint64_t inode;
+  // Empty for anonymous mappings, or a pseudo-path like "[vdso]"
+  std::string path;
+};
+
+// Executable mappings of a process, in address order
+std::vector<exec_mapping> get_exec_mappings_for_pid(pid_t pid);
+
 std::vector<std::string> get_mapped_paths_for_pid(pid_t pid);
 std::vector<std::string> get_mapped_paths_for_running_pids();
 
@@ -0,0 +1,273 @@
+#include <sstream>
+
+#include "binary_reader.h"
+#include "bpfmap.h"
+#include "mocks.h"
+#include "output.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::binary_output {
+
+using binary::Encoder;
+using binary::Format;
+using binary::RecordType;
+using binary::TypeKind;
+
+static std::string decode(const std::string &data, Format format)
+{
+  std::istringstream in(data);
+  std::ostringstream out;
+  binary::Reader reader(in, out, format);
+  auto ok = reader.convert();
+  EXPECT_TRUE(bool(ok));
+  return out.str();
+}
+
+static std::string header()
+{
+  Encoder enc;
+  enc.u32(binary::VERSION);
+  return std::string(binary::MAGIC) + enc.data();
+}
+
+static std::string record(RecordType type, const Encoder &payload)
+{
+  Encoder enc;
+  enc.u8(static_cast<uint8_t>(type));
+  enc.u32(payload.data().size());
+  return enc.data() + payload.data();
+}
+
+// Whether the data is converted without error
+static bool converts(const std::string &data)
+{
+  std::istringstream in(data);
+  std::ostringstream out;
+  auto ok = binary::Reader(in, out, Format::json).convert();
+  if (ok)
+    return true;
+  llvm::consumeError(ok.takeError());
+  return false;
+}
+
+static MapInfo int_map_info()
+{
+  return MapInfo{
+    .key_type = CreateInt64(),
+    .value_type = CreateInt64(),
+    .detail = {},
+    .id = {},
+    .is_scalar = false,
+  };
+}
+
+static MapElements int_elements(
+    const std::vector<std::pair<int64_t, int64_t>> &pairs)
+{
+  MapElements elements(8, 8);
+  for (const auto &[key, value] : pairs) {
+    auto *k = reinterpret_cast<const uint8_t *>(&key);
+    auto *v = reinterpret_cast<const uint8_t *>(&value);
+    elements.push_back({ k, 8 }, { v, 8 });
+  }
+  return elements;
+}
+
+TEST(BinaryOutput, map_matches_json)
+{
+  MockBPFtrace bpftrace;
+  bpftrace.resources.maps_info["@mymap"] = int_map_info();
+  BpfMap map{ libbpf::BPF_MAP_TYPE_HASH, "@mymap", 8, 8, 1000 };
+  auto elements = int_elements({ { 1, 10 }, { -2, 20 }, { 3, -30 } });
+
+  std::stringstream json_out, binary_out, err;
+  JsonOutput json{ json_out, err };
+  BinaryOutput binary{ binary_out, err };
+  json.map(bpftrace, map, 2, 1, elements);
+  binary.map(bpftrace, map, 2, 1, elements);
+  // The schema is only written before the first print
+  json.map(bpftrace, map, 0, 10, elements);
+  binary.map(bpftrace, map, 0, 10, elements);
+
+  EXPECT_EQ(decode(binary_out.str(), Format::json), json_out.str());
+  EXPECT_EQ(decode(binary_out.str(), Format::text),
+            "@mymap[-2]: 20\n@mymap[3]: -30\n"
+            "@mymap[1]: 1\n@mymap[-2]: 2\n@mymap[3]: -3\n");
+  EXPECT_TRUE(err.str().empty());
+}
+
+TEST(BinaryOutput, lhist_matches_json)
+{
+  MockBPFtrace bpftrace;
+  bpftrace.resources.maps_info["@mymap"] = MapInfo{
+    .key_type = CreateInt64(),
+    .value_type = SizedType{ Type::lhist_t, 8 },
+    .detail = LinearHistogramArgs{ .min = 0, .max = 100, .step = 10 },
+    .id = {},
+    .is_scalar = true,
+  };
+  BpfMap map{ libbpf::BPF_MAP_TYPE_HASH, "@mymap", 8, 8, 1000 };
+
+  Histograms histograms;
+  auto &hist = histograms.get(std::vector<uint8_t>{ 0 });
+  for (uint32_t i = 0; i <= 11; i++)
+    hist.add(i, i + 1);
+
+  std::stringstream json_out, binary_out, err;
+  JsonOutput json{ json_out, err };
+  BinaryOutput binary{ binary_out, err };
+  json.map_hist(bpftrace, map, 0, 1, histograms);
+  binary.map_hist(bpftrace, map, 0, 1, histograms);
+
+  EXPECT_EQ(decode(binary_out.str(), Format::json), json_out.str());
+}
+
+TEST(BinaryOutput, messages_match_json)
+{
+  std::stringstream json_out, binary_out, err;
+  JsonOutput json{ json_out, err };
+  BinaryOutput binary{ binary_out, err };
+  for (Output *output : std::vector<Output *>{ &json, &binary }) {
+    output->attached_probes(2);
+    output->message(MessageType::printf, "hello \"world\"\n", false);
+    output->lost_events(10);
+  }
+
+  EXPECT_EQ(decode(binary_out.str(), Format::json), json_out.str());
+  EXPECT_EQ(decode(binary_out.str(), Format::text),
+            "Attaching 2 probes...\nhello \"world\"\nLost 10 events\n");
+}
+
+TEST(BinaryReader, tuple_keys)
+{
+  Encoder schema;
+  schema.u32(7);
+  schema.string("@m");
+  schema.string("map");
+  schema.u8(false);
+  schema.kind(TypeKind::tuple);
+  schema.u32(2);
+  schema.kind(TypeKind::sint);
+  schema.kind(TypeKind::string);
+  schema.kind(TypeKind::uint);
+
+  Encoder map;
+  map.u32(7);
+  map.u32(2);
+  for (int64_t i = 1; i <= 2; i++) {
+    map.i64(-i);
+    map.string(i == 1 ? "a\"b" : "c");
+    map.u64(i * 10);
+  }
+
+  auto data = header() + record(RecordType::schema, schema) +
+              record(RecordType::map, map);
+  EXPECT_EQ(decode(data, Format::text), "@m[-1, a\"b]: 10\n@m[-2, c]: 20\n");
+  EXPECT_EQ(decode(data, Format::json),
+            R"({"type": "map", "data": {"@m": {"-1,a\"b": 10, "-2,c": 20}}})"
+            "\n");
+}
+
+TEST(BinaryReader, skips_unknown_records)
+{
+  Encoder unknown;
+  unknown.u64(42);
+  Encoder lost;
+  lost.u64(3);
+
+  auto data = header() + record(static_cast<RecordType>(200), unknown) +
+              record(RecordType::lost_events, lost);
+  EXPECT_EQ(decode(data, Format::text), "Lost 3 events\n");
+}
+
+TEST(BinaryReader, invalid_input)
+{
+  EXPECT_FALSE(converts("not bpftrace output"));
+
+  Encoder version;
+  version.u32(binary::VERSION + 1);
+  EXPECT_FALSE(converts(std::string(binary::MAGIC) + version.data()));
+
+  // Truncated record
+  Encoder lost;
+  lost.u64(3);
+  auto data = header() + record(RecordType::lost_events, lost);
+  EXPECT_TRUE(converts(data));
+  EXPECT_FALSE(converts(data.substr(0, data.size() - 1)));
+
+  // Record shorter than its contents
+  Encoder short_lost;
+  short_lost.u32(3);
+  EXPECT_FALSE(
+      converts(header() + record(RecordType::lost_events, short_lost)));
+
+  // Map printed before its schema
+  Encoder map;
+  map.u32(0);
+  map.u32(0);
+  EXPECT_FALSE(converts(header() + record(RecordType::map, map)));
+}
+
+TEST(BinaryReader, bogus_sizes)
+{
+  // A record claiming to be 4 GiB is only read as far as the input goes
+  Encoder huge_record;
+  huge_record.u8(static_cast<uint8_t>(RecordType::lost_events));
+  huge_record.u32(UINT32_MAX);
+  huge_record.u64(3);
+  EXPECT_FALSE(converts(header() + huge_record.data()));
+
+  // Arrays with more elements than the record can hold, including elements
+  // which take no bytes at all
+  for (auto elem : { TypeKind::uint, TypeKind::none }) {
+    Encoder array;
+    array.kind(TypeKind::array);
+    array.u32(UINT32_MAX);
+    array.kind(elem);
+    array.u64(1);
+    EXPECT_FALSE(converts(header() + record(RecordType::value, array)));
+  }
+
+  // Types whose values can't fit in any record
+  Encoder nested;
+  nested.kind(TypeKind::array);
+  nested.u32(UINT32_MAX);
+  nested.kind(TypeKind::array);
+  nested.u32(UINT32_MAX);
+  nested.kind(TypeKind::uint);
+  EXPECT_FALSE(converts(header() + record(RecordType::value, nested)));
+
+  Encoder tuple;
+  tuple.kind(TypeKind::tuple);
+  tuple.u32(UINT32_MAX);
+  tuple.kind(TypeKind::none);
+  EXPECT_FALSE(converts(header() + record(RecordType::value, tuple)));
+
+  // Histograms with more buckets than the record holds
+  Encoder hist;
+  hist.kind(TypeKind::hist);
+  hist.u32(UINT32_MAX);
+  hist.i64(0);
+  hist.i64(1);
+  hist.u64(1);
+  EXPECT_FALSE(converts(header() + record(RecordType::value, hist)));
+
+  // Maps with more elements than the record holds
+  Encoder schema;
+  schema.u32(0);
+  schema.string("@m");
+  schema.string("map");
+  schema.u8(true);
+  schema.kind(TypeKind::none);
+  schema.kind(TypeKind::uint);
+  Encoder map;
+  map.u32(0);
+  map.u32(2);
+  map.u64(1);
+  auto data = header() + record(RecordType::schema, schema);
+  EXPECT_FALSE(converts(data + record(RecordType::map, map)));
+  map.u64(2);
+  EXPECT_TRUE(converts(data + record(RecordType::map, map)));
+}
+
+} // namespace bpftrace::test::binary_output
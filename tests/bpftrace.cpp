@@ -1,5 +1,7 @@
 #include <cstdint>
 #include <cstring>
+#include <filesystem>
+#include <map>
 
 #include "ast/attachpoint_parser.h"
 #include "ast/passes/codegen_llvm.h"
@@ -8,6 +10,7 @@
 #include "ast/passes/probe_analyser.h"
 #include "ast/passes/semantic_analyser.h"
 #include "bpftrace.h"
+#include "childhelper.h"
 #include "clang_parser.h"
 #include "driver.h"
 #include "mocks.h"
@@ -22,6 +25,7 @@ namespace bpftrace::test::bpftrace {
 
 using ::testing::ContainerEq;
 using ::testing::StrictMock;
+using ::testing::UnorderedElementsAreArray;
 
 static const int STRING_SIZE = 64;
 
@@ -1005,17 +1009,37 @@ std::pair<std::vector<uint8_t>, std::vector<uint8_t>> key_value_pair_int_str(
   return pair;
 }
 
+MapElements map_elements(
+    const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
+        &pairs)
+{
+  MapElements elements(pairs.front().first.size(),
+                       pairs.front().second.size());
+  for (const auto &[key, value] : pairs)
+    elements.push_back(key, value);
+  return elements;
+}
+
+std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> map_pairs(
+    const MapElements &elements)
+{
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> pairs;
+  for (const auto &[key, value] : elements)
+    pairs.emplace_back(std::vector<uint8_t>(key.begin(), key.end()),
+                       std::vector<uint8_t>(value.begin(), value.end()));
+  return pairs;
+}
+
 TEST(bpftrace, sort_by_key_int)
 {
   StrictMock<MockBPFtrace> bpftrace;
 
   SizedType key_arg = CreateUInt64();
-  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-      values_by_key = {
-        key_value_pair_int({ 2 }, 12),
-        key_value_pair_int({ 3 }, 11),
-        key_value_pair_int({ 1 }, 10),
-      };
+  auto values_by_key = map_elements({
+    key_value_pair_int({ 2 }, 12),
+    key_value_pair_int({ 3 }, 11),
+    key_value_pair_int({ 1 }, 10),
+  });
   StrictMock<MockBPFtrace>::sort_by_key(key_arg, values_by_key);
 
   std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
@@ -1025,7 +1049,7 @@ TEST(bpftrace, sort_by_key_int)
         key_value_pair_int({ 3 }, 11),
       };
 
-  EXPECT_THAT(values_by_key, ContainerEq(expected_values));
+  EXPECT_THAT(map_pairs(values_by_key), ContainerEq(expected_values));
 }
 
 TEST(bpftrace, sort_by_key_int_int)
@@ -1035,12 +1059,11 @@ TEST(bpftrace, sort_by_key_int_int)
   SizedType key = CreateTuple(
       Struct::CreateTuple({ CreateInt64(), CreateInt64(), CreateInt64() }));
 
-  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-      values_by_key = {
-        key_value_pair_int({ 5, 2, 1 }, 1), key_value_pair_int({ 5, 3, 1 }, 2),
-        key_value_pair_int({ 5, 1, 1 }, 3), key_value_pair_int({ 2, 2, 2 }, 4),
-        key_value_pair_int({ 2, 3, 2 }, 5), key_value_pair_int({ 2, 1, 2 }, 6),
-      };
+  auto values_by_key = map_elements({
+    key_value_pair_int({ 5, 2, 1 }, 1), key_value_pair_int({ 5, 3, 1 }, 2),
+    key_value_pair_int({ 5, 1, 1 }, 3), key_value_pair_int({ 2, 2, 2 }, 4),
+    key_value_pair_int({ 2, 3, 2 }, 5), key_value_pair_int({ 2, 1, 2 }, 6),
+  });
   StrictMock<MockBPFtrace>::sort_by_key(key, values_by_key);
 
   std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
@@ -1050,7 +1073,7 @@ TEST(bpftrace, sort_by_key_int_int)
         key_value_pair_int({ 5, 2, 1 }, 1), key_value_pair_int({ 5, 3, 1 }, 2),
       };
 
-  EXPECT_THAT(values_by_key, ContainerEq(expected_values));
+  EXPECT_THAT(map_pairs(values_by_key), ContainerEq(expected_values));
 }
 
 TEST(bpftrace, sort_by_key_str)
@@ -1058,13 +1081,12 @@ TEST(bpftrace, sort_by_key_str)
   StrictMock<MockBPFtrace> bpftrace;
 
   SizedType key_arg = CreateString(STRING_SIZE);
-  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-      values_by_key = {
-        key_value_pair_str({ "z" }, 1),
-        key_value_pair_str({ "a" }, 2),
-        key_value_pair_str({ "x" }, 3),
-        key_value_pair_str({ "d" }, 4),
-      };
+  auto values_by_key = map_elements({
+    key_value_pair_str({ "z" }, 1),
+    key_value_pair_str({ "a" }, 2),
+    key_value_pair_str({ "x" }, 3),
+    key_value_pair_str({ "d" }, 4),
+  });
   StrictMock<MockBPFtrace>::sort_by_key(key_arg, values_by_key);
 
   std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
@@ -1075,7 +1097,7 @@ TEST(bpftrace, sort_by_key_str)
         key_value_pair_str({ "z" }, 1),
       };
 
-  EXPECT_THAT(values_by_key, ContainerEq(expected_values));
+  EXPECT_THAT(map_pairs(values_by_key), ContainerEq(expected_values));
 }
 
 TEST(bpftrace, sort_by_key_str_str)
@@ -1087,15 +1109,14 @@ TEST(bpftrace, sort_by_key_str_str)
                             CreateString(STRING_SIZE),
                             CreateString(STRING_SIZE) }));
 
-  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-      values_by_key = {
-        key_value_pair_str({ "z", "a", "l" }, 1),
-        key_value_pair_str({ "a", "a", "m" }, 2),
-        key_value_pair_str({ "z", "c", "n" }, 3),
-        key_value_pair_str({ "a", "c", "o" }, 4),
-        key_value_pair_str({ "z", "b", "p" }, 5),
-        key_value_pair_str({ "a", "b", "q" }, 6),
-      };
+  auto values_by_key = map_elements({
+    key_value_pair_str({ "z", "a", "l" }, 1),
+    key_value_pair_str({ "a", "a", "m" }, 2),
+    key_value_pair_str({ "z", "c", "n" }, 3),
+    key_value_pair_str({ "a", "c", "o" }, 4),
+    key_value_pair_str({ "z", "b", "p" }, 5),
+    key_value_pair_str({ "a", "b", "q" }, 6),
+  });
   StrictMock<MockBPFtrace>::sort_by_key(key, values_by_key);
 
   std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
@@ -1108,7 +1129,7 @@ TEST(bpftrace, sort_by_key_str_str)
         key_value_pair_str({ "z", "c", "n" }, 3),
       };
 
-  EXPECT_THAT(values_by_key, ContainerEq(expected_values));
+  EXPECT_THAT(map_pairs(values_by_key), ContainerEq(expected_values));
 }
 
 TEST(bpftrace, sort_by_key_int_str)
@@ -1118,12 +1139,11 @@ TEST(bpftrace, sort_by_key_int_str)
   SizedType key = CreateTuple(
       Struct::CreateTuple({ CreateUInt64(), CreateString(STRING_SIZE) }));
 
-  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
-      values_by_key = {
-        key_value_pair_int_str(1, "b", 1), key_value_pair_int_str(2, "b", 2),
-        key_value_pair_int_str(3, "b", 3), key_value_pair_int_str(1, "a", 4),
-        key_value_pair_int_str(2, "a", 5), key_value_pair_int_str(3, "a", 6),
-      };
+  auto values_by_key = map_elements({
+    key_value_pair_int_str(1, "b", 1), key_value_pair_int_str(2, "b", 2),
+    key_value_pair_int_str(3, "b", 3), key_value_pair_int_str(1, "a", 4),
+    key_value_pair_int_str(2, "a", 5), key_value_pair_int_str(3, "a", 6),
+  });
   StrictMock<MockBPFtrace>::sort_by_key(key, values_by_key);
 
   std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
@@ -1133,7 +1153,107 @@ TEST(bpftrace, sort_by_key_int_str)
         key_value_pair_int_str(3, "a", 6), key_value_pair_int_str(3, "b", 3),
       };
 
-  EXPECT_THAT(values_by_key, ContainerEq(expected_values));
+  EXPECT_THAT(map_pairs(values_by_key), ContainerEq(expected_values));
+}
+
+TEST(bpftrace, sort_by_value)
+{
+  SizedType value_type = CreateInt64();
+  auto unsorted = std::vector{
+    key_value_pair_int({ 1 }, 5),  key_value_pair_int({ 2 }, -3),
+    key_value_pair_int({ 3 }, 5),  key_value_pair_int({ 4 }, -10),
+    key_value_pair_int({ 5 }, -3), key_value_pair_int({ 6 }, 7),
+    key_value_pair_int({ 7 }, 5),
+  };
+  // Equal values keep the order they were read in
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
+      expected_values = {
+        key_value_pair_int({ 4 }, -10), key_value_pair_int({ 2 }, -3),
+        key_value_pair_int({ 5 }, -3),  key_value_pair_int({ 1 }, 5),
+        key_value_pair_int({ 3 }, 5),   key_value_pair_int({ 7 }, 5),
+        key_value_pair_int({ 6 }, 7),
+      };
+
+  // No top, and a top larger than the map, both sort everything
+  for (uint32_t top : { 0, 7, 8, 100 }) {
+    auto values_by_key = map_elements(unsorted);
+    EXPECT_TRUE(StrictMock<MockBPFtrace>::sort_by_value(
+        value_type, top, 1, values_by_key));
+    EXPECT_THAT(map_pairs(values_by_key), ContainerEq(expected_values));
+  }
+}
+
+TEST(bpftrace, sort_by_value_top)
+{
+  SizedType value_type = CreateUInt64();
+  auto unsorted = std::vector{
+    key_value_pair_int({ 1 }, 5), key_value_pair_int({ 2 }, 3),
+    key_value_pair_int({ 3 }, 5), key_value_pair_int({ 4 }, 1),
+    key_value_pair_int({ 5 }, 3), key_value_pair_int({ 6 }, 7),
+    key_value_pair_int({ 7 }, 5),
+  };
+  auto expected_values = std::vector{
+    key_value_pair_int({ 4 }, 1), key_value_pair_int({ 2 }, 3),
+    key_value_pair_int({ 5 }, 3), key_value_pair_int({ 1 }, 5),
+    key_value_pair_int({ 3 }, 5), key_value_pair_int({ 7 }, 5),
+    key_value_pair_int({ 6 }, 7),
+  };
+
+  // The last `top` elements are the same as with a full sort, including
+  // which of the tied elements make the cut. The rest are there in any order.
+  for (uint32_t top = 1; top < expected_values.size(); top++) {
+    auto values_by_key = map_elements(unsorted);
+    EXPECT_TRUE(StrictMock<MockBPFtrace>::sort_by_value(
+        value_type, top, 1, values_by_key));
+
+    auto pairs = map_pairs(values_by_key);
+    auto split = pairs.size() - top;
+    auto expected_split = expected_values.begin() + split;
+    EXPECT_THAT(std::vector(pairs.begin() + split, pairs.end()),
+                ContainerEq(std::vector(expected_split, expected_values.end())))
+        << "top " << top;
+    EXPECT_THAT(std::vector(pairs.begin(), pairs.begin() + split),
+                UnorderedElementsAreArray(expected_values.begin(),
+                                          expected_split))
+        << "top " << top;
+  }
+}
+
+TEST(bpftrace, sort_by_value_per_cpu)
+{
+  // Per-CPU values are summed before sorting
+  SizedType value_type = CreateCount(false);
+  auto value = [](uint64_t cpu0, uint64_t cpu1) {
+    std::vector<uint8_t> data(2 * sizeof(uint64_t));
+    std::memcpy(data.data(), &cpu0, sizeof(cpu0));
+    std::memcpy(data.data() + sizeof(cpu0), &cpu1, sizeof(cpu1));
+    return data;
+  };
+  auto values_by_key = map_elements({
+    { key_value_pair_int({ 1 }, 0).first, value(1, 9) },
+    { key_value_pair_int({ 2 }, 0).first, value(8, 0) },
+    { key_value_pair_int({ 3 }, 0).first, value(0, 12) },
+  });
+  EXPECT_TRUE(StrictMock<MockBPFtrace>::sort_by_value(
+      value_type, 2, 2, values_by_key));
+
+  auto pairs = map_pairs(values_by_key);
+  ASSERT_EQ(pairs.size(), 3);
+  EXPECT_EQ(pairs[0].first, key_value_pair_int({ 2 }, 0).first);
+  EXPECT_EQ(pairs[1].first, key_value_pair_int({ 1 }, 0).first);
+  EXPECT_EQ(pairs[2].first, key_value_pair_int({ 3 }, 0).first);
+}
+
+TEST(bpftrace, sort_by_value_unsortable)
+{
+  auto values_by_key = map_elements({
+    key_value_pair_int({ 2 }, 1),
+    key_value_pair_int({ 1 }, 2),
+  });
+  auto before = map_pairs(values_by_key);
+  EXPECT_FALSE(StrictMock<MockBPFtrace>::sort_by_value(
+      CreateString(STRING_SIZE), 0, 1, values_by_key));
+  EXPECT_THAT(map_pairs(values_by_key), ContainerEq(before));
 }
 
 class bpftrace_btf : public test_btf {};
@@ -1306,4 +1426,145 @@ TEST(bpftrace, resolve_timestamp)
   EXPECT_EQ(bpftrace->resolve_timestamp(bootmode, 2, 15), "1736725827.000000");
 }
 
+// Serves stacks from a table instead of the BPF stack maps and records the
+// batches their frames are symbolicated in
+class StackBPFtrace : public MockBPFtrace {
+public:
+  bool lookup_stack(int64_t stackid,
+                    uint32_t nr_stack_frames,
+                    int32_t /*pid*/,
+                    StackType /*stack_type*/,
+                    std::vector<uint64_t> &stack_trace) override
+  {
+    lookups++;
+    auto stack = stacks.find(stackid);
+    if (stack == stacks.end())
+      return false;
+    stack_trace = stack->second;
+    stack_trace.resize(std::min<size_t>(nr_stack_frames, stack_trace.size()));
+    return true;
+  }
+
+  std::vector<std::vector<std::string>> resolve_stack_frames(
+      std::span<const uint64_t> addrs,
+      int32_t /*pid*/,
+      int32_t /*probe_id*/,
+      bool /*ustack*/,
+      StackType /*stack_type*/) override
+  {
+    batches.emplace_back(addrs.begin(), addrs.end());
+    std::vector<std::vector<std::string>> syms;
+    for (uint64_t addr : addrs)
+      syms.push_back({ "f" + std::to_string(addr) });
+    return syms;
+  }
+
+  std::map<int64_t, std::vector<uint64_t>> stacks;
+  std::vector<std::vector<uint64_t>> batches;
+  int lookups = 0;
+};
+
+// A kstack as stored in map keys and values: stack id and number of frames
+static std::vector<uint8_t> kstack(uint64_t stackid, uint64_t nr_stack_frames)
+{
+  std::vector<uint8_t> data(16);
+  std::memcpy(data.data(), &stackid, sizeof(stackid));
+  std::memcpy(data.data() + 8, &nr_stack_frames, sizeof(nr_stack_frames));
+  return data;
+}
+
+TEST(bpftrace, cache_stacks)
+{
+  StackBPFtrace bpftrace;
+  bpftrace.stacks = { { 1, { 10, 11 } }, { 2, { 20 } }, { 3, { 30, 31 } } };
+  auto type = CreateStack(true);
+  auto s1 = kstack(1, 2), s2 = kstack(2, 1), s3 = kstack(3, 2);
+  auto missing = kstack(4, 1);
+
+  // All frames of all stacks are symbolicated in one batch, each stack once
+  std::vector<std::span<const uint8_t>> elements = { s1, s2, missing, s1, s3 };
+  bpftrace.cache_stacks(type, elements);
+  EXPECT_EQ(bpftrace.lookups, 4);
+  EXPECT_THAT(bpftrace.batches,
+              ContainerEq(std::vector<std::vector<uint64_t>>{
+                  { 10, 11, 20, 30, 31 } }));
+
+  // Printing them from maps doesn't look them up again
+  EXPECT_EQ(bpftrace.get_stack(1, 2, -1, -1, false, type.stack_type, 8),
+            "\n        f10\n        f11\n");
+  EXPECT_EQ(bpftrace.get_stack(3, 2, -1, -1, false, type.stack_type, 8),
+            "\n        f30\n        f31\n");
+  EXPECT_EQ(bpftrace.lookups, 4);
+  EXPECT_EQ(bpftrace.batches.size(), 1);
+
+  // Cached stacks are skipped
+  bpftrace.cache_stacks(type, elements);
+  EXPECT_EQ(bpftrace.lookups, 5);
+  EXPECT_EQ(bpftrace.batches.size(), 1);
+}
+
+TEST(bpftrace, cache_stacks_bounded)
+{
+  StackBPFtrace bpftrace;
+  bpftrace.config_->stack_cache_size = 2;
+  bpftrace.stacks = { { 1, { 10 } }, { 2, { 20 } }, { 3, { 30 } } };
+  auto type = CreateStack(true);
+  auto s1 = kstack(1, 1), s2 = kstack(2, 1), s3 = kstack(3, 1);
+
+  // Stacks which don't fit into the cache would evict the others before
+  // they are printed, so they are left to be looked up when printed
+  std::vector<std::span<const uint8_t>> elements = { s1, s2, s3 };
+  bpftrace.cache_stacks(type, elements);
+  EXPECT_THAT(bpftrace.batches,
+              ContainerEq(std::vector<std::vector<uint64_t>>{ { 10, 20 } }));
+
+  // Stacks already in the cache count against its size
+  elements = { s2, s3 };
+  bpftrace.cache_stacks(type, elements);
+  EXPECT_THAT(bpftrace.batches,
+              ContainerEq(std::vector<std::vector<uint64_t>>{ { 10, 20 },
+                                                              { 30 } }));
+
+  // Without a cache, nothing is done ahead of printing
+  bpftrace.config_->stack_cache_size = 0;
+  bpftrace.batches.clear();
+  bpftrace.lookups = 0;
+  bpftrace.cache_stacks(type, elements);
+  EXPECT_EQ(bpftrace.lookups, 0);
+  EXPECT_TRUE(bpftrace.batches.empty());
+}
+
+TEST(bpftrace, cache_ustacks_exec)
+{
+  auto self = std::filesystem::read_symlink("/proc/self/exe");
+  auto child = getChild((self.parent_path() / "testprogs/wait10").string());
+  pid_t pid = child->pid();
+
+  StackBPFtrace bpftrace;
+  bpftrace.config_->user_symbol_cache_type = UserSymbolCacheType::per_pid;
+  bpftrace.stacks = { { 1, { 10 } } };
+  auto type = CreateStack(false);
+  auto get_stack = [&]() {
+    return bpftrace.get_stack(1, 1, pid, 0, true, type.stack_type, 8);
+  };
+
+  // Repeated stacks of a process are resolved once
+  get_stack();
+  get_stack();
+  EXPECT_EQ(bpftrace.lookups, 1);
+
+  // Until it runs another program, even if its stacks keep hitting the cache
+  child->run();
+  for (int i = 0; i < 500 && bpftrace.lookups == 1; i++) {
+    get_stack();
+    msleep(10);
+  }
+  EXPECT_EQ(bpftrace.lookups, 2);
+  get_stack();
+  EXPECT_EQ(bpftrace.lookups, 2);
+
+  child->terminate(true);
+  wait_for(child.get(), 1000);
+}
+
 } // namespace bpftrace::test::bpftrace
@@ -0,0 +1,18 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_clear_ringbuf_array)
+{
+  auto bpftrace = get_mock_bpftrace();
+  // One buffer whatever the number of CPUs, so the IR is the same everywhere
+  bpftrace->config_->ringbuf_cpus_per_buffer = 4096;
+
+  test(*bpftrace, "BEGIN { @x = 1; } kprobe:f { clear(@x); }", NAME);
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
@@ -0,0 +1,18 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_clear_ringbuf_wakeup)
+{
+  auto bpftrace = get_mock_bpftrace();
+  // Wake up the reader once every 8 events, or when a buffer fills up
+  bpftrace->config_->ringbuf_wakeup_batch = 8;
+
+  test(*bpftrace, "BEGIN { @x = 1; } kprobe:f { clear(@x); }", NAME);
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
@@ -0,0 +1,18 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_lhist_dense)
+{
+  auto bpftrace = get_mock_bpftrace();
+  bpftrace->config_->dense_hist = true;
+
+  // Four buckets, so the zeroed value fits on the stack
+  test(*bpftrace, "kprobe:f { @x = lhist(pid, 0, 100, 50) }", NAME);
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
@@ -0,0 +1,20 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_print_clear)
+{
+  auto bpftrace = get_mock_bpftrace();
+  bpftrace->config_->fuse_print_clear = true;
+
+  // A single print_clear event is sent, with the same layout as print
+  test(*bpftrace,
+       "BEGIN { @x = 1; } kprobe:f { print(@x); clear(@x); }",
+       NAME);
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
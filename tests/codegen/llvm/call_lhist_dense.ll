@@ -0,0 +1,195 @@
+; ModuleID = 'bpftrace'
+source_filename = "bpftrace"
+target datalayout = "e-m:e-p:64:64-i64:64-i128:128-n32:64-S128"
+target triple = "bpf-pc-linux"
+
+%"struct map_t" = type { ptr, ptr, ptr, ptr }
+%"struct map_t.0" = type { ptr, ptr }
+%"struct map_t.1" = type { ptr, ptr, ptr, ptr }
+
+@LICENSE = global [4 x i8] c"GPL\00", section "license", !dbg !0
+@AT_x = dso_local global %"struct map_t" zeroinitializer, section ".maps", !dbg !7
+@ringbuf = dso_local global %"struct map_t.0" zeroinitializer, section ".maps", !dbg !28
+@event_loss_counter = dso_local global %"struct map_t.1" zeroinitializer, section ".maps", !dbg !42
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64 %0, i64 %1) #0
+
+; Function Attrs: nounwind
+define i64 @kprobe_f_1(ptr %0) #0 section "s_kprobe_f_1" !dbg !59 {
+entry:
+  %initial_value = alloca [4 x i64], align 8
+  %"@x_key" = alloca [8 x i8], align 1
+  %get_pid_tgid = call i64 inttoptr (i64 14 to ptr)()
+  %1 = lshr i64 %get_pid_tgid, 32
+  %pid = trunc i64 %1 to i32
+  %2 = zext i32 %pid to i64
+  %linear = call i64 @linear(i64 %2, i64 0, i64 100, i64 50)
+  call void @llvm.lifetime.start.p0(i64 -1, ptr %"@x_key")
+  %3 = getelementptr [8 x i8], ptr %"@x_key", i64 0, i64 0
+  store i64 0, ptr %3, align 8
+  %4 = icmp ult i64 %linear, 4
+  br i1 %4, label %index_in_bounds, label %lookup_merge
+
+index_in_bounds:                                  ; preds = %entry
+  %lookup_elem = call ptr inttoptr (i64 1 to ptr)(ptr @AT_x, ptr %"@x_key")
+  %map_lookup_cond = icmp ne ptr %lookup_elem, null
+  br i1 %map_lookup_cond, label %lookup_success, label %lookup_failure
+
+lookup_success:                                   ; preds = %index_in_bounds
+  %5 = getelementptr [4 x i64], ptr %lookup_elem, i64 0, i64 %linear
+  %6 = load i64, ptr %5, align 8
+  %7 = add i64 %6, 1
+  store i64 %7, ptr %5, align 8
+  br label %lookup_merge
+
+lookup_failure:                                   ; preds = %index_in_bounds
+  call void @llvm.lifetime.start.p0(i64 -1, ptr %initial_value)
+  call void @llvm.memset.p0.i64(ptr align 1 %initial_value, i8 0, i64 32, i1 false)
+  %8 = getelementptr [4 x i64], ptr %initial_value, i64 0, i64 %linear
+  store i64 1, ptr %8, align 8
+  %update_elem = call i64 inttoptr (i64 2 to ptr)(ptr @AT_x, ptr %"@x_key", ptr %initial_value, i64 0)
+  call void @llvm.lifetime.end.p0(i64 -1, ptr %initial_value)
+  br label %lookup_merge
+
+lookup_merge:                                     ; preds = %lookup_failure, %lookup_success, %entry
+  call void @llvm.lifetime.end.p0(i64 -1, ptr %"@x_key")
+  ret i64 0
+}
+
+; Function Attrs: alwaysinline nounwind
+define internal i64 @linear(i64 %0, i64 %1, i64 %2, i64 %3) #1 section "helpers" {
+entry:
+  %4 = alloca i64, align 8
+  %5 = alloca i64, align 8
+  %6 = alloca i64, align 8
+  %7 = alloca i64, align 8
+  %8 = alloca i64, align 8
+  call void @llvm.lifetime.start.p0(i64 -1, ptr %8)
+  call void @llvm.lifetime.start.p0(i64 -1, ptr %7)
+  call void @llvm.lifetime.start.p0(i64 -1, ptr %6)
+  call void @llvm.lifetime.start.p0(i64 -1, ptr %5)
+  call void @llvm.lifetime.start.p0(i64 -1, ptr %4)
+  store i64 %0, ptr %8, align 8
+  store i64 %1, ptr %7, align 8
+  store i64 %2, ptr %6, align 8
+  store i64 %3, ptr %5, align 8
+  %9 = load i64, ptr %7, align 8
+  %10 = load i64, ptr %8, align 8
+  %11 = icmp slt i64 %10, %9
+  br i1 %11, label %lhist.lt_min, label %lhist.ge_min
+
+lhist.lt_min:                                     ; preds = %entry
+  ret i64 0
+
+lhist.ge_min:                                     ; preds = %entry
+  %12 = load i64, ptr %6, align 8
+  %13 = load i64, ptr %8, align 8
+  %14 = icmp sgt i64 %13, %12
+  br i1 %14, label %lhist.gt_max, label %lhist.le_max
+
+lhist.le_max:                                     ; preds = %lhist.ge_min
+  %15 = load i64, ptr %5, align 8
+  %16 = load i64, ptr %7, align 8
+  %17 = load i64, ptr %8, align 8
+  %18 = sub i64 %17, %16
+  %19 = udiv i64 %18, %15
+  %20 = add i64 %19, 1
+  store i64 %20, ptr %4, align 8
+  %21 = load i64, ptr %4, align 8
+  ret i64 %21
+
+lhist.gt_max:                                     ; preds = %lhist.ge_min
+  %22 = load i64, ptr %5, align 8
+  %23 = load i64, ptr %7, align 8
+  %24 = load i64, ptr %6, align 8
+  %25 = sub i64 %24, %23
+  %26 = udiv i64 %25, %22
+  %27 = add i64 %26, 1
+  store i64 %27, ptr %4, align 8
+  %28 = load i64, ptr %4, align 8
+  ret i64 %28
+}
+
+; Function Attrs: nocallback nofree nosync nounwind willreturn memory(argmem: readwrite)
+declare void @llvm.lifetime.start.p0(i64 immarg %0, ptr nocapture %1) #2
+
+; Function Attrs: nocallback nofree nounwind willreturn memory(argmem: write)
+declare void @llvm.memset.p0.i64(ptr nocapture writeonly %0, i8 %1, i64 %2, i1 immarg %3) #3
+
+; Function Attrs: nocallback nofree nosync nounwind willreturn memory(argmem: readwrite)
+declare void @llvm.lifetime.end.p0(i64 immarg %0, ptr nocapture %1) #2
+
+attributes #0 = { nounwind }
+attributes #1 = { alwaysinline nounwind }
+attributes #2 = { nocallback nofree nosync nounwind willreturn memory(argmem: readwrite) }
+attributes #3 = { nocallback nofree nounwind willreturn memory(argmem: write) }
+
+!llvm.dbg.cu = !{!55}
+!llvm.module.flags = !{!57, !58}
+
+!0 = !DIGlobalVariableExpression(var: !1, expr: !DIExpression())
+!1 = distinct !DIGlobalVariable(name: "LICENSE", linkageName: "global", scope: !2, file: !2, type: !3, isLocal: false, isDefinition: true)
+!2 = !DIFile(filename: "bpftrace.bpf.o", directory: ".")
+!3 = !DICompositeType(tag: DW_TAG_array_type, baseType: !4, size: 32, elements: !5)
+!4 = !DIBasicType(name: "int8", size: 8, encoding: DW_ATE_signed)
+!5 = !{!6}
+!6 = !DISubrange(count: 4, lowerBound: 0)
+!7 = !DIGlobalVariableExpression(var: !8, expr: !DIExpression())
+!8 = distinct !DIGlobalVariable(name: "AT_x", linkageName: "global", scope: !2, file: !2, type: !9, isLocal: false, isDefinition: true)
+!9 = !DICompositeType(tag: DW_TAG_structure_type, scope: !2, file: !2, size: 256, elements: !10)
+!10 = !{!11, !17, !22, !25}
+!11 = !DIDerivedType(tag: DW_TAG_member, name: "type", scope: !2, file: !2, baseType: !12, size: 64)
+!12 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !13, size: 64)
+!13 = !DICompositeType(tag: DW_TAG_array_type, baseType: !14, size: 160, elements: !15)
+!14 = !DIBasicType(name: "int", size: 32, encoding: DW_ATE_signed)
+!15 = !{!16}
+!16 = !DISubrange(count: 5, lowerBound: 0)
+!17 = !DIDerivedType(tag: DW_TAG_member, name: "max_entries", scope: !2, file: !2, baseType: !18, size: 64, offset: 64)
+!18 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !19, size: 64)
+!19 = !DICompositeType(tag: DW_TAG_array_type, baseType: !14, size: 32, elements: !20)
+!20 = !{!21}
+!21 = !DISubrange(count: 1, lowerBound: 0)
+!22 = !DIDerivedType(tag: DW_TAG_member, name: "key", scope: !2, file: !2, baseType: !23, size: 64, offset: 128)
+!23 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !24, size: 64)
+!24 = !DIBasicType(name: "int64", size: 64, encoding: DW_ATE_signed)
+!25 = !DIDerivedType(tag: DW_TAG_member, name: "value", scope: !2, file: !2, baseType: !26, size: 64, offset: 192)
+!26 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !27, size: 64)
+!27 = !DICompositeType(tag: DW_TAG_array_type, baseType: !24, size: 256, elements: !5)
+!28 = !DIGlobalVariableExpression(var: !29, expr: !DIExpression())
+!29 = distinct !DIGlobalVariable(name: "ringbuf", linkageName: "global", scope: !2, file: !2, type: !30, isLocal: false, isDefinition: true)
+!30 = !DICompositeType(tag: DW_TAG_structure_type, scope: !2, file: !2, size: 128, elements: !31)
+!31 = !{!32, !37}
+!32 = !DIDerivedType(tag: DW_TAG_member, name: "type", scope: !2, file: !2, baseType: !33, size: 64)
+!33 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !34, size: 64)
+!34 = !DICompositeType(tag: DW_TAG_array_type, baseType: !14, size: 864, elements: !35)
+!35 = !{!36}
+!36 = !DISubrange(count: 27, lowerBound: 0)
+!37 = !DIDerivedType(tag: DW_TAG_member, name: "max_entries", scope: !2, file: !2, baseType: !38, size: 64, offset: 64)
+!38 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !39, size: 64)
+!39 = !DICompositeType(tag: DW_TAG_array_type, baseType: !14, size: 8388608, elements: !40)
+!40 = !{!41}
+!41 = !DISubrange(count: 262144, lowerBound: 0)
+!42 = !DIGlobalVariableExpression(var: !43, expr: !DIExpression())
+!43 = distinct !DIGlobalVariable(name: "event_loss_counter", linkageName: "global", scope: !2, file: !2, type: !44, isLocal: false, isDefinition: true)
+!44 = !DICompositeType(tag: DW_TAG_structure_type, scope: !2, file: !2, size: 256, elements: !45)
+!45 = !{!46, !17, !51, !54}
+!46 = !DIDerivedType(tag: DW_TAG_member, name: "type", scope: !2, file: !2, baseType: !47, size: 64)
+!47 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !48, size: 64)
+!48 = !DICompositeType(tag: DW_TAG_array_type, baseType: !14, size: 64, elements: !49)
+!49 = !{!50}
+!50 = !DISubrange(count: 2, lowerBound: 0)
+!51 = !DIDerivedType(tag: DW_TAG_member, name: "key", scope: !2, file: !2, baseType: !52, size: 64, offset: 128)
+!52 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !53, size: 64)
+!53 = !DIBasicType(name: "int32", size: 32, encoding: DW_ATE_signed)
+!54 = !DIDerivedType(tag: DW_TAG_member, name: "value", scope: !2, file: !2, baseType: !23, size: 64, offset: 192)
+!55 = distinct !DICompileUnit(language: DW_LANG_C, file: !2, producer: "bpftrace", isOptimized: false, runtimeVersion: 0, emissionKind: LineTablesOnly, globals: !56)
+!56 = !{!0, !7, !28, !42}
+!57 = !{i32 2, !"Debug Info Version", i32 3}
+!58 = !{i32 7, !"uwtable", i32 0}
+!59 = distinct !DISubprogram(name: "kprobe_f_1", linkageName: "kprobe_f_1", scope: !2, file: !2, type: !60, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition, unit: !55, retainedNodes: !63)
+!60 = !DISubroutineType(types: !61)
+!61 = !{!24, !62}
+!62 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !4, size: 64)
+!63 = !{!64}
+!64 = !DILocalVariable(name: "ctx", arg: 1, scope: !59, file: !2, type: !62)
@@ -29,6 +29,17 @@ TEST(Config, set)
   EXPECT_FALSE(bool(config.set("log_size", "invalid")));
   EXPECT_EQ(config.log_size, 101);
 
+  // Check that bounded ints are range checked.
+  EXPECT_TRUE(bool(config.set("map_read_threads", "8")));
+  EXPECT_EQ(config.map_read_threads, 8);
+  EXPECT_FALSE(bool(config.set("map_read_threads", 1ULL << 32)));
+  EXPECT_FALSE(bool(config.set("map_read_threads", "100000")));
+  EXPECT_EQ(config.map_read_threads, 8);
+  EXPECT_TRUE(bool(config.set("ringbuf_max_latency_ms", "1")));
+  EXPECT_FALSE(bool(config.set("ringbuf_max_latency_ms", "0")));
+  EXPECT_FALSE(bool(config.set("ringbuf_max_latency_ms", 1ULL << 31)));
+  EXPECT_EQ(config.ringbuf_max_latency_ms, 1);
+
   // Check that string parsing works.
   EXPECT_TRUE(bool(config.set("str_trunc_trailer", "oh, no! we lost bytes!")));
   EXPECT_EQ(config.str_trunc_trailer, "oh, no! we lost bytes!");
@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "event_queue.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::event_queue {
+
+static std::string pop_string(EventQueue &queue)
+{
+  auto record = queue.front(0);
+  std::string s(reinterpret_cast<const char *>(record.data()), record.size());
+  queue.pop();
+  return s;
+}
+
+TEST(EventQueue, push_pop)
+{
+  EventQueue queue(64);
+  EXPECT_TRUE(queue.push("abc", 3));
+  EXPECT_TRUE(queue.push("defgh", 5));
+  EXPECT_EQ(queue.depth(), 2);
+
+  EXPECT_EQ(pop_string(queue), "abc");
+  EXPECT_EQ(pop_string(queue), "defgh");
+  EXPECT_EQ(queue.depth(), 0);
+  EXPECT_EQ(queue.high_water_mark(), 2);
+  EXPECT_TRUE(queue.front(0).empty());
+}
+
+TEST(EventQueue, records_are_aligned)
+{
+  EventQueue queue(64);
+  EXPECT_TRUE(queue.push("a", 1));
+  EXPECT_TRUE(queue.push("b", 1));
+  pop_string(queue);
+  auto record = queue.front(0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(record.data()) % sizeof(uint64_t), 0);
+}
+
+TEST(EventQueue, wrap_around)
+{
+  // Every record takes 24 bytes of the ring, so the third one needs to wrap
+  EventQueue queue(64);
+  for (int i = 0; i < 10; i++) {
+    std::string a = "0123456789a" + std::to_string(i);
+    std::string b = "0123456789b" + std::to_string(i);
+    EXPECT_TRUE(queue.push(a.data(), a.size()));
+    EXPECT_TRUE(queue.push(b.data(), b.size()));
+    EXPECT_EQ(pop_string(queue), a);
+    EXPECT_EQ(pop_string(queue), b);
+  }
+}
+
+TEST(EventQueue, too_large)
+{
+  EventQueue queue(64);
+  std::string s(64, 'x');
+  EXPECT_FALSE(queue.push(s.data(), s.size()));
+}
+
+TEST(EventQueue, large_record_after_offset)
+{
+  // The large record fits neither after the small one nor before it, so it
+  // can only be written once the consumer has caught up
+  EventQueue queue(64);
+  std::string small(24, 's');
+  std::string large(40, 'l');
+  std::thread producer([&] {
+    for (int i = 0; i < 10; i++) {
+      EXPECT_TRUE(queue.push(small.data(), small.size()));
+      EXPECT_TRUE(queue.push(large.data(), large.size()));
+    }
+  });
+
+  std::vector<std::string> records;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (records.size() < 20 && std::chrono::steady_clock::now() < deadline) {
+    auto record = queue.front(10);
+    if (record.empty())
+      continue;
+    records.emplace_back(reinterpret_cast<const char *>(record.data()),
+                         record.size());
+    queue.pop();
+  }
+  // Unblocks the producer should it be stuck
+  queue.close();
+  producer.join();
+
+  ASSERT_EQ(records.size(), 20);
+  for (size_t i = 0; i < records.size(); i += 2) {
+    EXPECT_EQ(records[i], small);
+    EXPECT_EQ(records[i + 1], large);
+  }
+}
+
+TEST(EventQueue, closed)
+{
+  EventQueue queue(64);
+  EXPECT_TRUE(queue.push("abc", 3));
+  queue.close();
+  EXPECT_FALSE(queue.push("def", 3));
+  EXPECT_EQ(pop_string(queue), "abc");
+  EXPECT_TRUE(queue.front(0).empty());
+}
+
+TEST(EventQueue, producer_consumer)
+{
+  constexpr uint64_t n = 100000;
+  EventQueue queue(256);
+
+  std::thread producer([&]() {
+    for (uint64_t i = 0; i < n; i++)
+      EXPECT_TRUE(queue.push(&i, sizeof(i)));
+    queue.wait_empty();
+    queue.close();
+  });
+
+  uint64_t expected = 0;
+  while (true) {
+    auto record = queue.front(10);
+    if (record.empty()) {
+      if (queue.closed())
+        break;
+      continue;
+    }
+    uint64_t v;
+    ASSERT_EQ(record.size(), sizeof(v));
+    std::memcpy(&v, record.data(), sizeof(v));
+    EXPECT_EQ(v, expected++);
+    queue.pop();
+  }
+  producer.join();
+
+  EXPECT_EQ(expected, n);
+  EXPECT_EQ(queue.depth(), 0);
+  EXPECT_LE(queue.high_water_mark(), 256 / 16);
+}
+
+} // namespace bpftrace::test::event_queue
@@ -0,0 +1,130 @@
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "format_string.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::format_string {
+
+using Args = std::vector<PrintableValue>;
+
+static PrintableValue sint(int64_t value)
+{
+  PrintableValue v;
+  v.set_sint(value);
+  return v;
+}
+
+static PrintableValue uint(uint64_t value)
+{
+  PrintableValue v;
+  v.set_uint(value);
+  return v;
+}
+
+static PrintableValue str(std::string_view value)
+{
+  PrintableValue v;
+  v.set_string(value);
+  return v;
+}
+
+static PrintableValue buf(const char *data, size_t size)
+{
+  PrintableValue v;
+  v.set_buffer(data, size);
+  return v;
+}
+
+TEST(FormatString, literal)
+{
+  FormatString fmt("hello world\n");
+  Args args;
+  EXPECT_EQ(fmt.format_str(args), "hello world\n");
+}
+
+TEST(FormatString, conversions)
+{
+  FormatString fmt("pid %d comm %s: %x!\n");
+  Args args{ uint(42), str("bash"), uint(255) };
+  EXPECT_EQ(fmt.format_str(args), "pid 42 comm bash: ff!\n");
+}
+
+TEST(FormatString, widths_and_length_modifiers)
+{
+  FormatString fmt("[%-5d][%5s][%hhu][%lld]");
+  Args args{ uint(7), str("ab"), uint(0x1ff), sint(-3) };
+  EXPECT_EQ(fmt.format_str(args), "[7    ][   ab][255][-3]");
+}
+
+TEST(FormatString, raw_buffers)
+{
+  char data[] = { 'a', 'b', '\x01' };
+  FormatString fmt("%r %rx %rh");
+  Args args{ buf(data, sizeof(data)),
+             buf(data, sizeof(data)),
+             buf(data, sizeof(data)) };
+  EXPECT_EQ(fmt.format_str(args), R"(ab\x01 \x61\x62\x01 61 62 01)");
+}
+
+TEST(FormatString, truncated_string)
+{
+  PrintableValue value;
+  value.set_string("abc", 4, "..");
+  FormatString fmt("%s");
+  EXPECT_EQ(fmt.format_str(Args{ value }), "abc..");
+}
+
+TEST(FormatString, long_conversion)
+{
+  std::string value(4000, 'x');
+  FormatString fmt("<%s>");
+  Args args{ str(value) };
+  EXPECT_EQ(fmt.format_str(args), "<" + value + ">");
+}
+
+TEST(FormatString, reuse)
+{
+  FormatString fmt("%s:%d");
+  Args first{ str(std::string(600, 'a')), uint(1) };
+  Args second{ str("b"), uint(2) };
+  EXPECT_EQ(fmt.format_str(first), std::string(600, 'a') + ":1");
+  EXPECT_EQ(fmt.format_str(second), "b:2");
+}
+
+TEST(FormatString, ostream)
+{
+  FormatString fmt("%s=%u");
+  Args args{ str("x"), uint(3) };
+  std::stringstream out;
+  fmt.format(out, args);
+  EXPECT_EQ(out.str(), "x=3");
+}
+
+// Microbenchmark of the per-event formatting cost. Disabled by default, run
+// it with:
+//   bpftrace_test --gtest_also_run_disabled_tests
+//     --gtest_filter='FormatString.DISABLED_benchmark'
+TEST(FormatString, DISABLED_benchmark)
+{
+  constexpr int iterations = 2'000'000;
+  FormatString fmt("%-16s pid %6d tid %6d lat %llu ns ret %x %r\n");
+  char data[] = { 'G', 'E', 'T', ' ', '/' };
+  Args args{ str("nginx"), uint(1234), uint(1240),
+             uint(87654321), uint(0), buf(data, sizeof(data)) };
+
+  size_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++)
+    total += fmt.format_str(args).size();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() -
+                                          start;
+
+  std::cout << "format_str: " << iterations / elapsed.count() << " events/s ("
+            << total << " bytes)" << std::endl;
+}
+
+} // namespace bpftrace::test::format_string
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "format_string.h"
+#include "gtest/gtest.h"
+
+// This test replaces the global allocation functions, so it is built as its
+// own executable rather than as part of bpftrace_test.
+//
+// Counts the heap allocations made by the current thread while enabled.
+static thread_local bool count_allocations = false;
+static thread_local size_t allocations = 0;
+
+static void *counted(void *ptr)
+{
+  if (!ptr)
+    throw std::bad_alloc();
+  if (count_allocations)
+    allocations++;
+  return ptr;
+}
+
+// The array and nothrow forms call these
+void *operator new(size_t size)
+{
+  return counted(std::malloc(size ? size : 1));
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+  auto align = static_cast<size_t>(alignment);
+  // aligned_alloc wants a multiple of the alignment
+  size = (std::max<size_t>(size, 1) + align - 1) & ~(align - 1);
+  return counted(std::aligned_alloc(align, size));
+}
+
+// Not inlined into callers, which GCC would otherwise warn about as freeing
+// memory from operator new
+[[gnu::noinline]] static void release(void *ptr)
+{
+  std::free(ptr);
+}
+
+void operator delete(void *ptr) noexcept
+{
+  release(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+  release(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+  release(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+  release(ptr);
+}
+
+namespace bpftrace::test::format_string_allocations {
+
+using Args = std::vector<PrintableValue>;
+
+TEST(FormatString, no_allocations)
+{
+  FormatString fmt("%-16s pid %6d tid %6d lat %llu ns ret %x %r %rh\n");
+  const char *comms[] = { "nginx", "sshd", "systemd-journal" };
+  char data[] = { 'G', 'E', 'T', ' ', '/' };
+  Args args(7);
+
+  auto run = [&]() {
+    size_t total = 0;
+    for (uint64_t i = 0; i < 1000; i++) {
+      args[0].set_string(comms[i % 3]);
+      args[1].set_uint(i);
+      args[2].set_uint(i * 7);
+      args[3].set_uint(i * 1'000'003);
+      args[4].set_uint(i % 2);
+      args[5].set_buffer(data, i % sizeof(data));
+      args[6].set_buffer(data, sizeof(data));
+      total += fmt.format_str(args).size();
+    }
+    return total;
+  };
+
+  // The first pass grows the reused strings, the second one must not
+  // allocate at all
+  auto expected = run();
+  allocations = 0;
+  count_allocations = true;
+  auto total = run();
+  count_allocations = false;
+
+  EXPECT_EQ(total, expected);
+  EXPECT_EQ(allocations, 0);
+}
+
+} // namespace bpftrace::test::format_string_allocations
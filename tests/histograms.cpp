@@ -0,0 +1,107 @@
+#include <vector>
+
+#include "histograms.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::histograms {
+
+using Key = std::vector<uint8_t>;
+
+TEST(histograms, add)
+{
+  Histograms histograms;
+  auto &hist = histograms.get(Key{ 1, 2 });
+  hist.add(7, 3);
+  hist.add(2, 1);
+  hist.add(0, 0);
+  hist.add(9, 1);
+  hist.add(7, 2);
+
+  EXPECT_EQ(&histograms.get(Key{ 1, 2 }), &hist);
+  EXPECT_EQ(histograms.size(), 1);
+  EXPECT_EQ(hist.key(), (Key{ 1, 2 }));
+  EXPECT_EQ(hist.total(), 7);
+  ASSERT_EQ(hist.buckets().size(), 3);
+  EXPECT_EQ(hist.buckets()[0].index, 2);
+  EXPECT_EQ(hist.buckets()[0].count, 1);
+  EXPECT_EQ(hist.buckets()[1].index, 7);
+  EXPECT_EQ(hist.buckets()[1].count, 5);
+  EXPECT_EQ(hist.buckets()[2].index, 9);
+  EXPECT_EQ(hist.buckets()[2].count, 1);
+
+  std::vector<uint64_t> values = { 5, 5, 5 };
+  hist.expand(values, 12);
+  EXPECT_EQ(values,
+            (std::vector<uint64_t>{ 0, 0, 1, 0, 0, 0, 0, 5, 0, 1, 0, 0 }));
+}
+
+TEST(histograms, empty_histogram)
+{
+  Histograms histograms;
+  auto &hist = histograms.get(Key{ 1 });
+  hist.add(3, 0);
+
+  EXPECT_EQ(histograms.size(), 1);
+  EXPECT_EQ(hist.total(), 0);
+  EXPECT_TRUE(hist.buckets().empty());
+}
+
+TEST(histograms, sort_by_total)
+{
+  Histograms histograms;
+  for (uint8_t i = 0; i < 100; i++)
+    histograms.get(Key{ i }).add(i % 10, (i * 37) % 50);
+
+  histograms.sort_by_total();
+  ASSERT_EQ(histograms.size(), 100);
+  const Histograms::Histogram *prev = nullptr;
+  for (const auto &hist : histograms) {
+    if (prev) {
+      EXPECT_LE(prev->total(), hist.total());
+      if (prev->total() == hist.total()) {
+        EXPECT_LT(prev->key(), hist.key());
+      }
+    }
+    prev = &hist;
+  }
+
+  // Lookups still work after sorting
+  EXPECT_EQ(histograms.get(Key{ 42 }).key(), Key{ 42 });
+  EXPECT_EQ(histograms.size(), 100);
+}
+
+TEST(histograms, sort_by_total_top)
+{
+  Histograms histograms;
+  for (uint8_t i = 0; i < 100; i++)
+    histograms.get(Key{ i }).add(0, 100 - i);
+
+  histograms.sort_by_total(3);
+  std::vector<uint64_t> top;
+  for (const auto &hist : histograms)
+    top.push_back(hist.total());
+  EXPECT_EQ(std::vector<uint64_t>(top.end() - 3, top.end()),
+            (std::vector<uint64_t>{ 98, 99, 100 }));
+  for (size_t i = 0; i < top.size() - 3; i++)
+    EXPECT_LT(top[i], 98);
+}
+
+TEST(histograms, erase_if)
+{
+  Histograms histograms;
+  for (uint8_t i = 0; i < 10; i++)
+    histograms.get(Key{ i }).add(0, i);
+
+  histograms.erase_if(
+      [](const Histograms::Histogram &hist) { return hist.total() % 2; });
+  EXPECT_EQ(histograms.size(), 5);
+  for (const auto &hist : histograms)
+    EXPECT_EQ(hist.total() % 2, 0);
+
+  // Lookups still work after erasing
+  EXPECT_EQ(histograms.get(Key{ 4 }).total(), 4);
+  EXPECT_EQ(histograms.get(Key{ 3 }).total(), 0);
+  EXPECT_EQ(histograms.size(), 6);
+}
+
+} // namespace bpftrace::test::histograms
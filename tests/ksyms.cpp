@@ -0,0 +1,33 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "ksyms.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::ksyms {
+
+TEST(ksyms, resolve_many)
+{
+  Config config;
+  Ksyms ksyms(config);
+
+  // Whatever the symbols are here (e.g. without access to kallsyms), the
+  // batch gives the same results as resolving one address at a time, in the
+  // order of the addresses, including repeated ones
+  std::vector<uint64_t> addrs = {
+    0xffffffff81000000, 0x1000, 0xffffffff81000010, 0xffffffff81000000
+  };
+  auto syms = ksyms.resolve_many(addrs, true, false, false);
+  ASSERT_EQ(syms.size(), addrs.size());
+  for (size_t i = 0; i < addrs.size(); i++) {
+    EXPECT_FALSE(syms[i].empty());
+    EXPECT_EQ(syms[i], ksyms.resolve(addrs[i], true, false, false));
+  }
+  EXPECT_EQ(syms[0], syms[3]);
+
+  EXPECT_TRUE(ksyms.resolve_many({}, true, false, false).empty());
+}
+
+} // namespace bpftrace::test::ksyms
@@ -0,0 +1,101 @@
+#include <vector>
+
+#include "map_delta.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::map_delta {
+
+using Bytes = std::vector<uint8_t>;
+
+TEST(map_delta, update)
+{
+  MapDelta delta;
+
+  delta.start();
+  EXPECT_TRUE(delta.update(Bytes{ 1 }, Bytes{ 10 }));
+  EXPECT_TRUE(delta.update(Bytes{ 2 }, Bytes{ 20 }));
+  delta.finish();
+  EXPECT_EQ(delta.size(), 2);
+
+  delta.start();
+  EXPECT_FALSE(delta.update(Bytes{ 1 }, Bytes{ 10 }));
+  EXPECT_TRUE(delta.update(Bytes{ 2 }, Bytes{ 21 }));
+  EXPECT_TRUE(delta.update(Bytes{ 3 }, Bytes{ 30 }));
+  delta.finish();
+
+  delta.start();
+  EXPECT_FALSE(delta.update(Bytes{ 1 }, Bytes{ 10 }));
+  EXPECT_FALSE(delta.update(Bytes{ 2 }, Bytes{ 21 }));
+  EXPECT_FALSE(delta.update(Bytes{ 3 }, Bytes{ 30 }));
+  delta.finish();
+}
+
+TEST(map_delta, deleted_keys)
+{
+  MapDelta delta;
+
+  delta.start();
+  EXPECT_TRUE(delta.update(Bytes{ 1 }, Bytes{ 10 }));
+  EXPECT_TRUE(delta.update(Bytes{ 2 }, Bytes{ 20 }));
+  delta.finish();
+
+  // Key 2 is deleted from the map...
+  delta.start();
+  EXPECT_FALSE(delta.update(Bytes{ 1 }, Bytes{ 10 }));
+  delta.finish();
+  EXPECT_EQ(delta.size(), 1);
+
+  // ...and comes back with the same value
+  delta.start();
+  EXPECT_FALSE(delta.update(Bytes{ 1 }, Bytes{ 10 }));
+  EXPECT_TRUE(delta.update(Bytes{ 2 }, Bytes{ 20 }));
+  delta.finish();
+}
+
+TEST(map_delta, fingerprint)
+{
+  // Short values are kept as they are
+  auto fp = MapDelta::fingerprint(Bytes{ 1, 2, 3 });
+  const auto *fp_bytes = reinterpret_cast<const uint8_t *>(fp.data());
+  EXPECT_EQ(Bytes(fp_bytes, fp_bytes + sizeof(fp)),
+            (Bytes{ 1, 2, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }));
+  Bytes value(16, 0xff);
+  EXPECT_EQ(MapDelta::fingerprint(value),
+            (MapDelta::Fingerprint{ UINT64_MAX, UINT64_MAX }));
+
+  // Longer ones are hashed, and any changed bit counts
+  Bytes long_value(64 * 8);
+  for (size_t i = 0; i < long_value.size(); i++)
+    long_value[i] = i;
+  auto long_fp = MapDelta::fingerprint(long_value);
+  EXPECT_EQ(MapDelta::fingerprint(long_value), long_fp);
+  for (size_t i = 0; i < long_value.size(); i += 7) {
+    Bytes changed = long_value;
+    changed[i] ^= 1 << (i % 8);
+    EXPECT_NE(MapDelta::fingerprint(changed), long_fp);
+  }
+  Bytes longer = long_value;
+  longer.push_back(0);
+  EXPECT_NE(MapDelta::fingerprint(longer), long_fp);
+}
+
+TEST(map_delta, long_values)
+{
+  MapDelta delta;
+  Bytes value(24);
+
+  delta.start();
+  EXPECT_TRUE(delta.update(Bytes{ 1 }, value));
+  delta.finish();
+
+  delta.start();
+  EXPECT_FALSE(delta.update(Bytes{ 1 }, value));
+  delta.finish();
+
+  value[23] = 1;
+  delta.start();
+  EXPECT_TRUE(delta.update(Bytes{ 1 }, value));
+  delta.finish();
+}
+
+} // namespace bpftrace::test::map_delta
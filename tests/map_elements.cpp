@@ -0,0 +1,71 @@
+#include <vector>
+
+#include "bpfmap.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::map_elements {
+
+static std::vector<uint8_t> bytes(std::span<const uint8_t> span)
+{
+  return { span.begin(), span.end() };
+}
+
+static std::vector<std::vector<uint8_t>> keys(const MapElements &elements)
+{
+  std::vector<std::vector<uint8_t>> result;
+  for (const auto &elem : elements)
+    result.push_back(bytes(elem.key));
+  return result;
+}
+
+TEST(map_elements, append)
+{
+  MapElements elements(2, 3);
+  EXPECT_TRUE(elements.empty());
+
+  // Keys and values come in separate arrays, as from a batch lookup
+  std::vector<uint8_t> batch_keys = { 1, 1, 2, 2 };
+  std::vector<uint8_t> batch_values = { 10, 11, 12, 20, 21, 22 };
+  elements.append(batch_keys.data(), batch_values.data(), 2);
+  elements.push_back(std::vector<uint8_t>{ 3, 3 },
+                     std::vector<uint8_t>{ 30, 31, 32 });
+
+  ASSERT_EQ(elements.size(), 3);
+  EXPECT_EQ(bytes(elements[0].key), std::vector<uint8_t>({ 1, 1 }));
+  EXPECT_EQ(bytes(elements[0].value), std::vector<uint8_t>({ 10, 11, 12 }));
+  EXPECT_EQ(bytes(elements[1].key), std::vector<uint8_t>({ 2, 2 }));
+  EXPECT_EQ(bytes(elements[1].value), std::vector<uint8_t>({ 20, 21, 22 }));
+  EXPECT_EQ(bytes(elements[2].key), std::vector<uint8_t>({ 3, 3 }));
+  EXPECT_EQ(bytes(elements[2].value), std::vector<uint8_t>({ 30, 31, 32 }));
+}
+
+TEST(map_elements, reorder)
+{
+  MapElements elements(1, 1);
+  for (uint8_t i = 0; i < 4; i++)
+    elements.push_back(std::vector<uint8_t>{ i },
+                       std::vector<uint8_t>{ static_cast<uint8_t>(i * 10) });
+
+  elements.reorder({ 3, 1, 2 });
+  EXPECT_EQ(keys(elements),
+            std::vector<std::vector<uint8_t>>({ { 3 }, { 1 }, { 2 } }));
+  EXPECT_EQ(bytes(elements[0].value), std::vector<uint8_t>({ 30 }));
+}
+
+TEST(map_elements, erase_if)
+{
+  MapElements elements(1, 1);
+  for (uint8_t i = 0; i < 5; i++)
+    elements.push_back(std::vector<uint8_t>{ i }, std::vector<uint8_t>{ i });
+
+  elements.erase_if(
+      [](const MapElements::Element &elem) { return elem.key[0] % 2; });
+  EXPECT_EQ(keys(elements),
+            std::vector<std::vector<uint8_t>>({ { 0 }, { 2 }, { 4 } }));
+
+  elements.erase_if([](const MapElements::Element &) { return true; });
+  EXPECT_TRUE(elements.empty());
+  EXPECT_EQ(elements.begin(), elements.end());
+}
+
+} // namespace bpftrace::test::map_elements
@@ -25,18 +25,12 @@ TEST(TextOutput, lhist_no_suffix)
   };
   BpfMap map{ libbpf::BPF_MAP_TYPE_HASH, "@mymap", 8, 8, 1000 };
 
-  std::map<std::vector<uint8_t>, std::vector<uint64_t>> values_by_key = {
-    {
-        { 0 },
-        { 0, 1, 1, 1, 1, 1, 1, 0 },
-    },
-  };
-
-  std::vector<std::pair<std::vector<uint8_t>, uint64_t>> total_counts_by_key = {
-    { { 0 }, 6 }
-  };
+  Histograms histograms;
+  auto &hist = histograms.get(std::vector<uint8_t>{ 0 });
+  for (uint32_t i = 1; i <= 6; i++)
+    hist.add(i, 1);
 
-  output.map_hist(bpftrace, map, 0, 0, values_by_key, total_counts_by_key);
+  output.map_hist(bpftrace, map, 0, 0, histograms);
 
   // The buckets for this test case have been specifically chosen: 640000 can
   // also be written as 625K, while the other bucket boundaries can not be
@@ -71,18 +65,12 @@ TEST(TextOutput, lhist_suffix)
   };
   BpfMap map{ libbpf::BPF_MAP_TYPE_HASH, "@mymap", 8, 8, 1000 };
 
-  std::map<std::vector<uint8_t>, std::vector<uint64_t>> values_by_key = {
-    {
-        { 0 },
-        { 0, 1, 1, 1, 1, 1, 0 },
-    },
-  };
-
-  std::vector<std::pair<std::vector<uint8_t>, uint64_t>> total_counts_by_key = {
-    { { 0 }, 5 }
-  };
+  Histograms histograms;
+  auto &hist = histograms.get(std::vector<uint8_t>{ 0 });
+  for (uint32_t i = 1; i <= 5; i++)
+    hist.add(i, 1);
 
-  output.map_hist(bpftrace, map, 0, 0, values_by_key, total_counts_by_key);
+  output.map_hist(bpftrace, map, 0, 0, histograms);
 
   EXPECT_EQ(R"(@mymap:
 [0, 1K)                1 |@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@|
@@ -0,0 +1,159 @@
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <ostream>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+#include "output_buffer.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::output_buffer {
+
+using namespace std::chrono_literals;
+
+class OutputBufferTest : public ::testing::Test {
+protected:
+  void SetUp() override
+  {
+    fd_ = memfd_create("output_buffer_test", MFD_CLOEXEC);
+    ASSERT_GE(fd_, 0);
+  }
+
+  void TearDown() override
+  {
+    close(fd_);
+  }
+
+  // Returns what was written since the last call
+  std::string read_new()
+  {
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    while ((n = pread(fd_, buf, sizeof(buf), read_offset_)) > 0) {
+      data.append(buf, n);
+      read_offset_ += n;
+    }
+    return data;
+  }
+
+  int fd_ = -1;
+  off_t read_offset_ = 0;
+};
+
+TEST_F(OutputBufferTest, holds_back_until_flush)
+{
+  OutputBuffer buf(fd_);
+  buf.set_flush_policy(1024 * 1024, 1h);
+  std::ostream out(&buf);
+
+  out << "first line" << std::endl;
+  out << "second line" << std::endl;
+  EXPECT_EQ(read_new(), "");
+  EXPECT_EQ(buf.buffered(), 23);
+
+  buf.flush();
+  EXPECT_EQ(read_new(), "first line\nsecond line\n");
+  EXPECT_EQ(buf.buffered(), 0);
+}
+
+TEST_F(OutputBufferTest, flushes_on_size)
+{
+  OutputBuffer buf(fd_);
+  buf.set_flush_policy(100 * 1024, 1h);
+  std::ostream out(&buf);
+
+  // Spans a few chunks before reaching the flush size
+  std::string line(999, 'x');
+  for (int i = 0; i < 200; i++)
+    out << line << "\n";
+
+  auto data = read_new();
+  EXPECT_GE(data.size(), 100 * 1024);
+  EXPECT_EQ(data.size() + buf.buffered(), 200 * 1000);
+
+  buf.flush();
+  data += read_new();
+  EXPECT_EQ(data.size(), 200 * 1000);
+  for (size_t i = 0; i < data.size(); i += 1000) {
+    EXPECT_EQ(data.substr(i, 999), line);
+    EXPECT_EQ(data[i + 999], '\n');
+  }
+}
+
+TEST_F(OutputBufferTest, flushes_on_interval)
+{
+  OutputBuffer buf(fd_);
+  buf.set_flush_policy(1024 * 1024, 10ms);
+  std::ostream out(&buf);
+
+  // The first flush after the interval writes everything out
+  buf.flush();
+  out << "a" << std::endl;
+  std::this_thread::sleep_for(20ms);
+  out << "b" << std::endl;
+  EXPECT_EQ(read_new(), "a\nb\n");
+
+  out << "c\n";
+  buf.flush_if_due();
+  EXPECT_EQ(read_new(), "");
+  std::this_thread::sleep_for(20ms);
+  buf.flush_if_due();
+  EXPECT_EQ(read_new(), "c\n");
+}
+
+TEST_F(OutputBufferTest, flushes_on_destruction)
+{
+  {
+    OutputBuffer buf(fd_);
+    buf.set_flush_policy(1024 * 1024, 1h);
+    std::ostream out(&buf);
+    out << "pending";
+  }
+  EXPECT_EQ(read_new(), "pending");
+}
+
+TEST_F(OutputBufferTest, closes_owned_fd)
+{
+  int fd = dup(fd_);
+  ASSERT_GE(fd, 0);
+  {
+    OutputBuffer buf(fd, true);
+    std::ostream out(&buf);
+    out << "owned";
+  }
+  EXPECT_EQ(read_new(), "owned");
+  EXPECT_EQ(fcntl(fd, F_GETFD), -1);
+}
+
+TEST_F(OutputBufferTest, flushes_while_written)
+{
+  std::string line(99, 'x');
+  {
+    OutputBuffer buf(fd_);
+    buf.set_flush_policy(1024 * 1024, 0ms);
+    // Like the output thread flushing while the main thread writes
+    std::atomic<bool> done = false;
+    std::thread flusher([&]() {
+      while (!done)
+        buf.flush_if_due();
+    });
+    std::ostream out(&buf);
+    for (int i = 0; i < 10000; i++)
+      out << line << "\n";
+    done = true;
+    flusher.join();
+  }
+
+  auto data = read_new();
+  ASSERT_EQ(data.size(), 10000 * 100);
+  for (size_t i = 0; i < data.size(); i += 100) {
+    EXPECT_EQ(data.substr(i, 99), line);
+    EXPECT_EQ(data[i + 99], '\n');
+  }
+}
+
+} // namespace bpftrace::test::output_buffer
@@ -0,0 +1,103 @@
+#ifdef HAVE_LIBPCAP
+
+#include <cstdint>
+#include <pcap/pcap.h>
+#include <string>
+#include <vector>
+
+#include "pcap_writer.h"
+#include "util/temp.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::pcap_writer {
+
+using util::TempFile;
+
+struct Packet {
+  uint64_t ns;
+  std::vector<uint8_t> data;
+};
+
+static std::vector<Packet> make_packets(size_t count, size_t max_size)
+{
+  std::vector<Packet> packets;
+  for (size_t i = 0; i < count; i++) {
+    Packet pkt{ .ns = i * 1'234'567'891ULL,
+                .data = std::vector<uint8_t>(1 + (i * 37) % max_size) };
+    for (size_t j = 0; j < pkt.data.size(); j++)
+      pkt.data[j] = static_cast<uint8_t>(i + j);
+    packets.push_back(std::move(pkt));
+  }
+  return packets;
+}
+
+static void write_packets(PCAPwriter &writer, std::vector<Packet> &packets)
+{
+  for (auto &pkt : packets)
+    EXPECT_TRUE(writer.write(pkt.ns, pkt.data.data(), pkt.data.size()));
+}
+
+static void expect_packets(const std::string &path,
+                           const std::vector<Packet> &expected)
+{
+  char errbuf[PCAP_ERRBUF_SIZE];
+  pcap_t *pd = pcap_open_offline(path.c_str(), errbuf);
+  ASSERT_NE(pd, nullptr) << errbuf;
+
+  size_t count = 0;
+  struct pcap_pkthdr *hdr;
+  const u_char *data;
+  while (pcap_next_ex(pd, &hdr, &data) == 1) {
+    if (count < expected.size()) {
+      const auto &pkt = expected[count];
+      EXPECT_EQ(hdr->caplen, pkt.data.size());
+      EXPECT_EQ(hdr->len, pkt.data.size());
+      EXPECT_EQ(static_cast<uint64_t>(hdr->ts.tv_sec), pkt.ns / 1'000'000'000);
+      EXPECT_EQ(static_cast<uint64_t>(hdr->ts.tv_usec),
+                pkt.ns % 1'000'000'000 / 1000);
+      EXPECT_EQ(std::vector<uint8_t>(data, data + hdr->caplen), pkt.data);
+    }
+    count++;
+  }
+  pcap_close(pd);
+  EXPECT_EQ(count, expected.size());
+}
+
+TEST(PCAPwriter, write_and_close)
+{
+  auto file = TempFile::create();
+  ASSERT_TRUE(bool(file));
+  auto path = file->path().string();
+  auto packets = make_packets(100, 1500);
+
+  PCAPwriter writer;
+  ASSERT_TRUE(writer.open(path));
+  write_packets(writer, packets);
+  // The destructor closes the writer again after bpftrace did
+  writer.close();
+  writer.close();
+  EXPECT_FALSE(writer.write(0, packets[0].data.data(), 1));
+
+  expect_packets(path, packets);
+}
+
+TEST(PCAPwriter, many_flushes)
+{
+  // Enough data for the flush thread to take several full buffers
+  auto file = TempFile::create();
+  ASSERT_TRUE(bool(file));
+  auto path = file->path().string();
+  auto packets = make_packets(5000, 9000);
+
+  {
+    PCAPwriter writer;
+    ASSERT_TRUE(writer.open(path));
+    write_packets(writer, packets);
+  }
+
+  expect_packets(path, packets);
+}
+
+} // namespace bpftrace::test::pcap_writer
+
+#endif // HAVE_LIBPCAP
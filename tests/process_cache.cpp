@@ -0,0 +1,77 @@
+#include <chrono>
+#include <filesystem>
+#include <unistd.h>
+
+#include "childhelper.h"
+#include "process_cache.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::process_cache {
+
+using namespace std::chrono_literals;
+
+static std::filesystem::path self_exe()
+{
+  std::error_code ec;
+  auto self = std::filesystem::read_symlink("/proc/self/exe", ec);
+  EXPECT_FALSE(ec);
+  return self;
+}
+
+TEST(process_cache, self)
+{
+  ProcessCache cache(16, 1h);
+  const auto &process = cache.get(getpid());
+  EXPECT_EQ(process.exe, self_exe().string());
+  EXPECT_NE(process.generation, 0);
+
+  auto generation = process.generation;
+  EXPECT_EQ(cache.get(getpid()).generation, generation);
+}
+
+TEST(process_cache, generation_is_not_rechecked)
+{
+  ProcessCache cache(16, 0ms);
+  auto generation = cache.generation(getpid());
+  EXPECT_NE(generation, 0);
+  EXPECT_EQ(cache.generation(getpid()), generation);
+  EXPECT_EQ(cache.get(getpid()).generation, generation);
+}
+
+TEST(process_cache, no_such_process)
+{
+  ProcessCache cache(16, 0ms);
+  EXPECT_EQ(cache.get(1 << 21).exe, "");
+  EXPECT_EQ(cache.get(1 << 21).generation, 0);
+}
+
+TEST(process_cache, exec_and_exit)
+{
+  auto wait10 = self_exe().parent_path() / "testprogs/wait10";
+  auto child = getChild(wait10.string());
+
+  ProcessCache cache(16, 0ms);
+  std::vector<pid_t> new_generations;
+  cache.on_new_generation(
+      [&](pid_t pid) { new_generations.push_back(pid); });
+
+  // Before the exec, the child still runs the test binary
+  auto before = cache.get(child->pid());
+  EXPECT_EQ(before.exe, self_exe().string());
+
+  child->run();
+  for (int i = 0; i < 100 && cache.get(child->pid()).exe != wait10; i++)
+    msleep(10);
+  auto after = cache.get(child->pid());
+  EXPECT_EQ(after.exe, wait10.string());
+  EXPECT_GT(after.generation, before.generation);
+  EXPECT_EQ(new_generations, std::vector<pid_t>{ child->pid() });
+
+  // The executable is remembered after the process is gone
+  child->terminate(true);
+  wait_for(child.get(), 1000);
+  EXPECT_EQ(cache.get(child->pid()).exe, wait10.string());
+  EXPECT_EQ(cache.get(child->pid()).generation, after.generation);
+}
+
+} // namespace bpftrace::test::process_cache
@@ -55,6 +55,33 @@ TEST(resource_analyser, multiple_lhist_bounds_in_single_map)
        false);
 }
 
+TEST(resource_analyser, dense_hist)
+{
+  auto bpftrace = get_mock_bpftrace();
+  bpftrace->config_->on_stack_limit = 0;
+  bpftrace->config_->dense_hist = true;
+  RequiredResources resources;
+  test(*bpftrace,
+       "BEGIN { @a[1] = hist(1, 2); @b = lhist(1, 0, 100, 10); }",
+       true,
+       &resources);
+
+  const auto &a = resources.maps_info.at("@a");
+  EXPECT_TRUE(a.dense_hist);
+  EXPECT_EQ(a.dense_hist_type(), CreateArray(249, CreateUInt64()));
+  const auto &b = resources.maps_info.at("@b");
+  EXPECT_TRUE(b.dense_hist);
+  EXPECT_EQ(b.dense_hist_type(), CreateArray(12, CreateUInt64()));
+  EXPECT_EQ(resources.max_write_map_value_size, 249 * 8);
+
+  // Only keys in use are allocated, scalar maps only have the one key
+  EXPECT_EQ(a.map_flags, BPF_F_NO_PREALLOC);
+  EXPECT_EQ(static_cast<uint64_t>(a.max_entries),
+            bpftrace->config_->max_map_keys);
+  EXPECT_EQ(b.map_flags, 0U);
+  EXPECT_EQ(b.max_entries, 1);
+}
+
 TEST(resource_analyser, printf_in_subprog)
 {
   test(R"(fn greet(): void { printf("Hello, world\n"); })", true);
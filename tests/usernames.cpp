@@ -0,0 +1,114 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+
+#include "usernames.h"
+#include "util/temp.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace::test::usernames {
+
+using namespace std::chrono_literals;
+using util::TempFile;
+
+class UsernamesTest : public ::testing::Test {
+protected:
+  void SetUp() override
+  {
+    auto f = TempFile::create();
+    ASSERT_TRUE(bool(f));
+    file_.emplace(std::move(*f));
+  }
+
+  void write(const std::string &contents)
+  {
+    std::ofstream out(path(), std::ios::trunc);
+    out << contents;
+  }
+
+  // Replaces the file the way passwd tools do, with a rename
+  void replace(const std::string &contents)
+  {
+    auto tmp = path() + ".new";
+    std::ofstream(tmp) << contents;
+    std::filesystem::rename(tmp, path());
+  }
+
+  std::string path()
+  {
+    return file_->path().string();
+  }
+
+  Config config_;
+  std::optional<TempFile> file_;
+};
+
+TEST_F(UsernamesTest, resolve)
+{
+  write("root:x:0:0:root:/root:/bin/bash\n"
+        "# comment\n"
+        "daemon:x:1:1::/:/usr/sbin/nologin\n"
+        "broken:x:abc:1::/:\n"
+        "short:x:2\n"
+        "dup:x:1:1::/:\n");
+
+  Usernames names(config_, path(), 1h);
+  EXPECT_EQ(names.resolve(0), "root");
+  EXPECT_EQ(names.resolve(1), "daemon");
+  EXPECT_EQ(names.resolve(2), "short");
+  EXPECT_EQ(names.resolve(3), "");
+  EXPECT_EQ(names.resolve(1ULL << 32), "");
+}
+
+TEST_F(UsernamesTest, reload_on_change)
+{
+  write("alice:x:1000:1000::/home/alice:/bin/sh\n");
+
+  Usernames names(config_, path(), 0ms);
+  EXPECT_EQ(names.resolve(1000), "alice");
+  EXPECT_EQ(names.resolve(1001), "");
+
+  replace("alice:x:1000:1000::/home/alice:/bin/sh\n"
+          "bob:x:1001:1001::/home/bob:/bin/sh\n");
+  EXPECT_EQ(names.resolve(1001), "bob");
+
+  write("carol:x:1000:1000::/home/carol:/bin/sh\n");
+  EXPECT_EQ(names.resolve(1000), "carol");
+  EXPECT_EQ(names.resolve(1001), "");
+}
+
+TEST_F(UsernamesTest, recheck_interval)
+{
+  write("alice:x:1000:1000::/home/alice:/bin/sh\n");
+
+  Usernames names(config_, path(), 1h);
+  EXPECT_EQ(names.resolve(1000), "alice");
+
+  // Not picked up until the interval has passed
+  replace("bob:x:1000:1000::/home/bob:/bin/sh\n");
+  EXPECT_EQ(names.resolve(1000), "alice");
+}
+
+TEST_F(UsernamesTest, missing_file)
+{
+  Usernames names(config_, path() + ".missing", 0ms);
+  EXPECT_EQ(names.resolve(0), "");
+}
+
+TEST_F(UsernamesTest, nss)
+{
+  write("alice:x:1000:1000::/home/alice:/bin/sh\n");
+
+  // Uids missing from the file are only looked up through NSS on request
+  Usernames names(config_, path(), 1h);
+  EXPECT_EQ(names.resolve(0), "");
+
+  config_.nss_usernames = true;
+  Usernames nss_names(config_, path(), 1h);
+  EXPECT_EQ(nss_names.resolve(1000), "alice");
+  EXPECT_EQ(nss_names.resolve(0), "root");
+}
+
+} // namespace bpftrace::test::usernames
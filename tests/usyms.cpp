@@ -0,0 +1,124 @@
+#include <csignal>
+#include <cstdint>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "config.h"
+#include "usyms.h"
+#include "gtest/gtest.h"
+
+// Symbols of the test binary itself to resolve
+extern "C" __attribute__((noinline)) int usyms_test_function1(int x)
+{
+  return x + 1;
+}
+
+extern "C" __attribute__((noinline)) int usyms_test_function2(int x)
+{
+  return x + 2;
+}
+
+namespace bpftrace::test::usyms {
+
+static uint64_t addr_of(int (*func)(int))
+{
+  return reinterpret_cast<uint64_t>(func);
+}
+
+TEST(usyms, resolve_many)
+{
+  Config config;
+  config.user_symbol_cache_type = UserSymbolCacheType::per_pid;
+  config.show_debug_info = false;
+  Usyms usyms(config);
+
+  std::vector<uint64_t> addrs = { addr_of(usyms_test_function1),
+                                  addr_of(usyms_test_function2),
+                                  addr_of(usyms_test_function1) + 1,
+                                  0x8 };
+  auto syms = usyms.resolve_many(
+      addrs, getpid(), "/proc/self/exe", false, false, false);
+  ASSERT_EQ(syms.size(), addrs.size());
+  EXPECT_EQ(syms[0], std::vector<std::string>{ "usyms_test_function1" });
+  EXPECT_EQ(syms[1], std::vector<std::string>{ "usyms_test_function2" });
+  EXPECT_EQ(syms[2], std::vector<std::string>{ "usyms_test_function1" });
+  EXPECT_EQ(syms[3], std::vector<std::string>{ "0x8" });
+
+  // The batch gives the same results as resolving one address at a time
+  for (size_t i = 0; i < addrs.size(); i++)
+    EXPECT_EQ(syms[i],
+              usyms.resolve(
+                  addrs[i], getpid(), "/proc/self/exe", false, false, false));
+
+  EXPECT_TRUE(
+      usyms.resolve_many({}, getpid(), "/proc/self/exe", false, false, false)
+          .empty());
+}
+
+static std::string resolve(Usyms &usyms, int32_t pid, int (*func)(int))
+{
+  auto syms = usyms.resolve(
+      addr_of(func), pid, "/proc/self/exe", false, false, false);
+  return syms.front();
+}
+
+TEST(usyms, cache_budget)
+{
+  // The symbol caches are those of bcc
+  Config config;
+  config.user_symbol_cache_type = UserSymbolCacheType::per_pid;
+  config.use_blazesym = false;
+
+  // Within the budget, the symbols stay cached
+  Usyms cached(config);
+  EXPECT_EQ(resolve(cached, getpid(), usyms_test_function1),
+            "usyms_test_function1");
+  EXPECT_GT(cached.cache_size(), 0);
+  EXPECT_EQ(cached.cache_evictions(), 0);
+
+  // Beyond it, they are evicted again, but only once they have been used
+  config.user_symbol_cache_bytes = 1;
+  Usyms evicted(config);
+  EXPECT_EQ(resolve(evicted, getpid(), usyms_test_function1),
+            "usyms_test_function1");
+  EXPECT_EQ(evicted.cache_size(), 0);
+  EXPECT_EQ(evicted.cache_evictions(), 1);
+  EXPECT_EQ(resolve(evicted, getpid(), usyms_test_function2),
+            "usyms_test_function2");
+  EXPECT_EQ(evicted.cache_evictions(), 2);
+}
+
+TEST(usyms, shared_layout)
+{
+  Config config;
+  config.user_symbol_cache_type = UserSymbolCacheType::per_pid;
+  config.use_blazesym = false;
+  Usyms usyms(config);
+
+  // A forked child has the same mappings as its parent
+  pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (child == 0) {
+    pause();
+    _exit(0);
+  }
+
+  EXPECT_EQ(resolve(usyms, getpid(), usyms_test_function1),
+            "usyms_test_function1");
+  size_t parent_size = usyms.cache_size();
+  EXPECT_EQ(resolve(usyms, child, usyms_test_function2),
+            "usyms_test_function2");
+  size_t both_size = usyms.cache_size();
+
+  kill(child, SIGKILL);
+  waitpid(child, nullptr, 0);
+
+  // The child got an entry of its own, but shares the parent's symbols, so
+  // they are only accounted for once
+  EXPECT_GT(both_size, parent_size);
+  EXPECT_LT(both_size - parent_size, parent_size / 2);
+}
+
+} // namespace bpftrace::test::usyms
@@ -1,8 +1,12 @@
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -10,9 +14,13 @@
 #include "util/bpf_names.h"
 #include "util/cgroup.h"
 #include "util/format.h"
+#include "util/kallsyms.h"
 #include "util/kernel.h"
+#include "util/lru_cache.h"
 #include "util/math.h"
 #include "util/paths.h"
+#include "util/stats.h"
+#include "util/strftime.h"
 #include "util/symbols.h"
 #include "util/system.h"
 #include "util/wildcard.h"
@@ -251,35 +259,374 @@ TEST(utils, get_cgroup_path_in_hierarchy)
   }
 
   const std::filesystem::path path(tmpdir);
-  const std::filesystem::path file_1 = path / "file1";
+  const std::filesystem::path dir_1 = path / "dir1";
   const std::filesystem::path subdir = path / "subdir";
-  const std::filesystem::path file_2 = subdir / "file2";
+  const std::filesystem::path dir_2 = subdir / "dir2";
 
-  // Make a few files in the directory to imitate cgroup files and get their
-  // inodes
-  if (!std::filesystem::create_directory(subdir)) {
-    throw std::runtime_error("creating subdirectory for tests failed");
+  // Make a few directories to imitate cgroups and get their inodes
+  if (!std::filesystem::create_directory(dir_1) ||
+      !std::filesystem::create_directory(subdir) ||
+      !std::filesystem::create_directory(dir_2)) {
+    throw std::runtime_error("creating subdirectories for tests failed");
   }
-  static_cast<std::ofstream &&>(std::ofstream(file_1) << "File 1 content")
+  static_cast<std::ofstream &&>(std::ofstream(path / "cgroup.procs") << "1\n")
       .close();
-  static_cast<std::ofstream &&>(std::ofstream(file_2) << "File 2 content")
-      .close();
-  struct stat file_1_st, file_2_st;
-  if (stat(file_1.c_str(), &file_1_st) < 0 ||
-      stat(file_2.c_str(), &file_2_st) < 0) {
-    throw std::runtime_error("stat on test files failed");
+  struct stat root_st, dir_1_st, dir_2_st;
+  if (stat(tmpdir.c_str(), &root_st) < 0 ||
+      stat(dir_1.c_str(), &dir_1_st) < 0 ||
+      stat(dir_2.c_str(), &dir_2_st) < 0) {
+    throw std::runtime_error("stat on test directories failed");
   }
 
-  // Look for both "cgroup files" by their inode twice (to test caching)
+  // Look for all "cgroups" by their inode twice (to test caching)
   for (int i = 0; i < 2; i++) {
-    EXPECT_EQ(get_cgroup_path_in_hierarchy(file_1_st.st_ino, tmpdir), "/file1");
-    EXPECT_EQ(get_cgroup_path_in_hierarchy(file_2_st.st_ino, tmpdir),
-              "/subdir/file2");
+    EXPECT_EQ(get_cgroup_path_in_hierarchy(root_st.st_ino, tmpdir), "/");
+    EXPECT_EQ(get_cgroup_path_in_hierarchy(dir_1_st.st_ino, tmpdir), "/dir1");
+    EXPECT_EQ(get_cgroup_path_in_hierarchy(dir_2_st.st_ino, tmpdir),
+              "/subdir/dir2");
+  }
+
+  EXPECT_GT(std::filesystem::remove_all(tmpdir), 0);
+}
+
+TEST(utils, cgroup_path_index)
+{
+  std::string tmpdir = "/tmp/bpftrace-test-utils-XXXXXX";
+
+  if (::mkdtemp(tmpdir.data()) == nullptr) {
+    throw std::runtime_error("creating temporary path for tests failed");
+  }
+
+  const std::filesystem::path path(tmpdir);
+  auto inode = [](const std::filesystem::path &p) -> uint64_t {
+    struct stat st;
+    if (stat(p.c_str(), &st) < 0)
+      throw std::runtime_error("stat on test directory failed");
+    return st.st_ino;
+  };
+
+  std::filesystem::create_directories(path / "a" / "b");
+  auto b = inode(path / "a" / "b");
+
+  // Read the events on every lookup
+  CgroupPathIndex index(tmpdir, 1 << 20, std::chrono::milliseconds(0));
+  EXPECT_EQ(index.find(b), "/a/b");
+  EXPECT_EQ(index.size(), 3);
+
+  // New cgroups are picked up incrementally, including their children
+  std::filesystem::create_directories(path / "c" / "d");
+  EXPECT_EQ(index.find(inode(path / "c" / "d")), "/c/d");
+  EXPECT_EQ(index.find(inode(path / "c")), "/c");
+  EXPECT_EQ(index.size(), 5);
+
+  // Removed cgroups are dropped
+  std::filesystem::remove(path / "a" / "b");
+  EXPECT_EQ(index.find(b), "");
+  EXPECT_EQ(index.size(), 4);
+
+  // Renames are handled too
+  auto c = inode(path / "c");
+  std::filesystem::rename(path / "c", path / "e");
+  EXPECT_EQ(index.find(c), "/e");
+  EXPECT_EQ(index.find(inode(path / "e" / "d")), "/e/d");
+
+  EXPECT_GT(std::filesystem::remove_all(tmpdir), 0);
+}
+
+TEST(utils, cgroup_path_index_recheck)
+{
+  std::string tmpdir = "/tmp/bpftrace-test-utils-XXXXXX";
+
+  if (::mkdtemp(tmpdir.data()) == nullptr) {
+    throw std::runtime_error("creating temporary path for tests failed");
+  }
+
+  const std::filesystem::path path(tmpdir);
+  auto inode = [](const std::filesystem::path &p) -> uint64_t {
+    struct stat st;
+    if (stat(p.c_str(), &st) < 0)
+      throw std::runtime_error("stat on test directory failed");
+    return st.st_ino;
+  };
+
+  std::filesystem::create_directories(path / "a");
+  auto a = inode(path / "a");
+
+  CgroupPathIndex index(tmpdir, 1 << 20, std::chrono::hours(1));
+  EXPECT_EQ(index.find(a), "/a");
+
+  // Hits don't read the events, so they don't see changes yet...
+  std::filesystem::create_directories(path / "b");
+  auto b = inode(path / "b");
+  std::filesystem::remove(path / "a");
+  EXPECT_EQ(index.find(a), "/a");
+  EXPECT_EQ(index.size(), 2);
+
+  // ...but misses do, which picks up new cgroups without walking the
+  // hierarchy, and the removal along with them
+  EXPECT_EQ(index.find(b), "/b");
+  EXPECT_EQ(index.find(a), "");
+  EXPECT_EQ(index.size(), 2);
+
+  EXPECT_GT(std::filesystem::remove_all(tmpdir), 0);
+}
+
+TEST(utils, cgroup_path_index_bounded)
+{
+  std::string tmpdir = "/tmp/bpftrace-test-utils-XXXXXX";
+
+  if (::mkdtemp(tmpdir.data()) == nullptr) {
+    throw std::runtime_error("creating temporary path for tests failed");
+  }
+
+  const std::filesystem::path path(tmpdir);
+  for (int i = 0; i < 4; i++)
+    std::filesystem::create_directory(path / std::to_string(i));
+
+  // Cgroups which didn't fit are still found by walking the hierarchy
+  CgroupPathIndex index(tmpdir, 2);
+  for (int i = 0; i < 4; i++) {
+    struct stat st;
+    ASSERT_EQ(stat((path / std::to_string(i)).c_str(), &st), 0);
+    EXPECT_EQ(index.find(st.st_ino), "/" + std::to_string(i));
   }
+  EXPECT_EQ(index.size(), 2);
 
   EXPECT_GT(std::filesystem::remove_all(tmpdir), 0);
 }
 
+TEST(utils, lru_cache)
+{
+  LruCache<int, std::string> cache(2);
+  EXPECT_EQ(cache.get(1), nullptr);
+
+  cache.put(1, "one");
+  cache.put(2, "two");
+  ASSERT_NE(cache.get(1), nullptr);
+  EXPECT_EQ(*cache.get(1), "one");
+
+  // 2 is the least recently used
+  cache.put(3, "three");
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.get(2), nullptr);
+  EXPECT_EQ(*cache.get(1), "one");
+  EXPECT_EQ(*cache.get(3), "three");
+
+  cache.put(3, "drei");
+  EXPECT_EQ(*cache.get(3), "drei");
+  EXPECT_EQ(cache.hits(), 5);
+  EXPECT_EQ(cache.misses(), 2);
+
+  cache.set_capacity(1);
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(cache.get(1), nullptr);
+  ASSERT_NE(cache.lru(), nullptr);
+  EXPECT_EQ(cache.lru()->first, 3);
+  cache.erase(1);
+  EXPECT_EQ(cache.size(), 1);
+  cache.pop_lru();
+  EXPECT_EQ(cache.lru(), nullptr);
+
+  // Disabled
+  cache.set_capacity(0);
+  cache.put(4, "four");
+  EXPECT_EQ(cache.get(4), nullptr);
+  EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(utils, kallsyms_table)
+{
+  std::istringstream kallsyms("0000000000000000 A fixed_percpu_data\n"
+                              "ffffffff81000000 T _stext\n"
+                              "ffffffff81000000 T _text\n"
+                              "ffffffff81001000 t do_one_initcall\n"
+                              "ffffffffc0002000 t mod_exit\t[mod]\n"
+                              "ffffffffc0001000 t mod_init\t[mod]\n"
+                              "garbage\n");
+  KallsymsTable table;
+  ASSERT_TRUE(table.load(kallsyms));
+  EXPECT_EQ(table.size(), 4);
+
+  EXPECT_FALSE(table.lookup(0).has_value());
+  EXPECT_FALSE(table.lookup(0xffffffff80ffffff).has_value());
+
+  // Of symbols at the same address, the first one wins
+  auto sym = table.lookup(0xffffffff81000000);
+  ASSERT_TRUE(sym.has_value());
+  EXPECT_EQ(sym->name, "_stext");
+  EXPECT_EQ(sym->offset, 0);
+
+  sym = table.lookup(0xffffffff81000fff);
+  ASSERT_TRUE(sym.has_value());
+  EXPECT_EQ(sym->name, "_stext");
+  EXPECT_EQ(sym->offset, 0xfff);
+
+  sym = table.lookup(0xffffffff81001010);
+  ASSERT_TRUE(sym.has_value());
+  EXPECT_EQ(sym->name, "do_one_initcall");
+  EXPECT_EQ(sym->offset, 0x10);
+
+  // Module symbols don't have to be listed in order
+  sym = table.lookup(0xffffffffc0001004);
+  ASSERT_TRUE(sym.has_value());
+  EXPECT_EQ(sym->name, "mod_init");
+  sym = table.lookup(0xffffffffc0002004);
+  ASSERT_TRUE(sym.has_value());
+  EXPECT_EQ(sym->name, "mod_exit");
+  EXPECT_EQ(sym->offset, 4);
+
+  // All addresses hidden by kptr_restrict
+  std::istringstream restricted("0000000000000000 T _stext\n"
+                                "0000000000000000 T _text\n");
+  EXPECT_FALSE(table.load(restricted));
+  EXPECT_TRUE(table.empty());
+  EXPECT_FALSE(table.lookup(0xffffffff81000000).has_value());
+}
+
+TEST(utils, per_cpu_reductions)
+{
+  std::mt19937_64 rng(42);
+  auto put = [](std::vector<uint8_t> &buf, size_t offset, uint64_t v) {
+    std::memcpy(buf.data() + offset, &v, sizeof(v));
+  };
+
+  for (auto isa : { detail::Isa::portable,
+                    detail::Isa::vec128,
+                    detail::Isa::avx2,
+                    detail::Isa::avx512 }) {
+    if (!detail::use_isa(isa))
+      continue;
+    // Odd sizes exercise the remainders of vectorized loops
+    for (int ncpus : { 0, 1, 3, 8, 17, 64, 255, 256, 1023 }) {
+      std::vector<uint8_t> sums(ncpus * 8);
+      std::vector<uint8_t> pairs(ncpus * 16);
+      std::vector<uint8_t> min_max(ncpus * 16);
+
+      uint64_t sum = 0, total = 0, count = 0;
+      bool any_set = false;
+      uint64_t umin = UINT64_MAX, umax = 0;
+      int64_t smin = INT64_MAX, smax = INT64_MIN;
+      for (int i = 0; i < ncpus; i++) {
+        uint64_t v = rng();
+        put(sums, i * 8, v);
+        sum += v;
+
+        uint64_t n = (rng() % 100) + 1;
+        put(pairs, i * 16, v);
+        put(pairs, (i * 16) + 8, n);
+        total += v;
+        count += n;
+
+        // Values of CPUs which never set one are ignored, even if not 0
+        bool is_set = rng() % 4 != 0;
+        put(min_max, i * 16, v);
+        put(min_max, (i * 16) + 8, is_set ? 1 : 0);
+        if (is_set) {
+          any_set = true;
+          umin = std::min(umin, v);
+          umax = std::max(umax, v);
+          smin = std::min(smin, static_cast<int64_t>(v));
+          smax = std::max(smax, static_cast<int64_t>(v));
+        }
+      }
+
+      EXPECT_EQ(reduce_value<uint64_t>(sums, ncpus), sum);
+      EXPECT_EQ(reduce_value<int64_t>(sums, ncpus), static_cast<int64_t>(sum));
+
+      EXPECT_EQ(min_max_value<uint64_t>(min_max, ncpus, false),
+                any_set ? umin : 0);
+      EXPECT_EQ(min_max_value<uint64_t>(min_max, ncpus, true),
+                any_set ? umax : 0);
+      EXPECT_EQ(min_max_value<int64_t>(min_max, ncpus, false),
+                any_set ? smin : 0);
+      EXPECT_EQ(min_max_value<int64_t>(min_max, ncpus, true),
+                any_set ? smax : 0);
+
+      if (ncpus == 0)
+        continue;
+      auto stats = stats_value<uint64_t>(pairs, ncpus);
+      EXPECT_EQ(stats.total, total);
+      EXPECT_EQ(stats.count, count);
+      EXPECT_EQ(stats.avg, total / count);
+      auto sstats = stats_value<int64_t>(pairs, ncpus);
+      EXPECT_EQ(sstats.total, static_cast<int64_t>(total));
+      EXPECT_EQ(sstats.avg,
+                static_cast<int64_t>(total) / static_cast<int64_t>(count));
+    }
+  }
+  detail::use_isa(detail::best_isa());
+}
+
+// Microbenchmark of the per-CPU reductions done for every printed key of a
+// per-CPU map. Disabled by default, run it with:
+//   bpftrace_test --gtest_also_run_disabled_tests
+//     --gtest_filter='utils.DISABLED_benchmark_per_cpu_reductions'
+TEST(utils, DISABLED_benchmark_per_cpu_reductions)
+{
+  constexpr int ncpus = 256;
+  constexpr int iterations = 1'000'000;
+  std::mt19937_64 rng(42);
+  std::vector<uint8_t> pairs(ncpus * 16);
+  for (int i = 0; i < ncpus; i++) {
+    uint64_t v = rng();
+    uint64_t is_set = rng() % 4 != 0;
+    std::memcpy(pairs.data() + (i * 16), &v, sizeof(v));
+    std::memcpy(pairs.data() + (i * 16) + 8, &is_set, sizeof(is_set));
+  }
+
+  auto bench = [&](const char *name, auto reduce) {
+    uint64_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+      total += reduce();
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "  " << name << ": " << elapsed.count() / iterations
+              << " ns/key (" << total << ")" << std::endl;
+  };
+
+  for (auto isa : { detail::Isa::portable,
+                    detail::Isa::vec128,
+                    detail::Isa::avx2,
+                    detail::Isa::avx512 }) {
+    if (!detail::use_isa(isa))
+      continue;
+    std::cout << "isa " << static_cast<int>(isa) << ", " << ncpus << " cpus"
+              << std::endl;
+    bench("sum", [&] { return reduce_value<uint64_t>(pairs, ncpus * 2); });
+    bench("max", [&] { return min_max_value<uint64_t>(pairs, ncpus, true); });
+    bench("avg", [&] { return avg_value<uint64_t>(pairs, ncpus); });
+  }
+  detail::use_isa(detail::best_isa());
+}
+
+TEST(utils, strftime_format)
+{
+  std::string out;
+
+  StrftimeFormat fmt("%s.%f [%f]");
+  EXPECT_TRUE(fmt.format(1000, 42, 64, out));
+  EXPECT_EQ(out, "1000.000042 [000042]");
+  // Same second, only the microseconds change
+  EXPECT_TRUE(fmt.format(1000, 999999, 64, out));
+  EXPECT_EQ(out, "1000.999999 [999999]");
+  EXPECT_TRUE(fmt.format(1001, 0, 64, out));
+  EXPECT_EQ(out, "1001.000000 [000000]");
+
+  StrftimeFormat escaped("%%f %%%f");
+  EXPECT_TRUE(escaped.format(0, 7, 64, out));
+  EXPECT_EQ(out, "%f %000007");
+
+  StrftimeFormat usecs_only("%f");
+  EXPECT_TRUE(usecs_only.format(0, 1, 64, out));
+  EXPECT_EQ(out, "000001");
+
+  // Too long for the buffer, or empty
+  EXPECT_FALSE(fmt.format(1001, 0, 8, out));
+  StrftimeFormat empty("");
+  EXPECT_FALSE(empty.format(0, 0, 64, out));
+}
+
 TEST(utils, parse_kconfig)
 {
   char path[] = "/tmp/configXXXXXX";
@@ -421,6 +768,48 @@ TEST(utils, get_pids_for_program)
   EXPECT_EQ(pids.size(), 0);
 }
 
+TEST(utils, get_exec_mappings_for_pid)
+{
+  auto self_exe = get_pid_exe(getpid());
+  auto mappings = get_exec_mappings_for_pid(getpid());
+  ASSERT_FALSE(mappings.empty());
+  EXPECT_THAT(mappings,
+              testing::Contains(testing::Field(&exec_mapping::path, self_exe)));
+  for (size_t i = 0; i < mappings.size(); i++) {
+    EXPECT_LT(mappings[i].start, mappings[i].end);
+    if (mappings[i].path.starts_with("/")) {
+      EXPECT_NE(mappings[i].inode, 0);
+    }
+    if (i > 0) {
+      EXPECT_LE(mappings[i - 1].end, mappings[i].start);
+    }
+  }
+
+  EXPECT_TRUE(get_exec_mappings_for_pid(-1).empty());
+}
+
+TEST(utils, get_pid_start_time)
+{
+  auto start_time = get_pid_start_time(getpid());
+  ASSERT_TRUE(start_time.has_value());
+  EXPECT_EQ(get_pid_start_time(getpid()), start_time);
+  // Started after us
+  EXPECT_GE(get_pid_start_time(getpid()), get_pid_start_time(1));
+
+  EXPECT_FALSE(get_pid_start_time(-1).has_value());
+}
+
+TEST(utils, get_elf_info)
+{
+  auto info = get_elf_info("/proc/self/exe");
+  ASSERT_TRUE(info.has_value());
+  EXPECT_GT(info->symbols_size, 0);
+  EXPECT_EQ(info->build_id.size() % 2, 0);
+
+  EXPECT_FALSE(get_elf_info("/doesnotexist").has_value());
+  EXPECT_FALSE(get_elf_info("/proc/self/maps").has_value());
+}
+
 TEST(utils, round_up_to_next_power_of_two)
 {
   // 2^31 = 2147483648 which is max power of 2 within uint32_t
@@ -435,4 +824,13 @@ TEST(utils, round_up_to_next_power_of_two)
   ASSERT_EQ(round_up_to_next_power_of_two(max_power_of_two), max_power_of_two);
 }
 
+TEST(utils, top_skip)
+{
+  EXPECT_EQ(top_skip(10, 0), 0);
+  EXPECT_EQ(top_skip(10, 3), 7);
+  EXPECT_EQ(top_skip(10, 10), 0);
+  EXPECT_EQ(top_skip(10, 11), 0);
+  EXPECT_EQ(top_skip(0, 3), 0);
+}
+
 } // namespace bpftrace::test::utils